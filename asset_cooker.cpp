@@ -0,0 +1,35 @@
+// Offline asset cooker. 
+// Decodes the given images once, builds their mip chains and writes 
+// everything into a .tepack archive, which the engine maps with openAssetPack.
+//
+// Usage: asset_cooker <output.tepack> <image> [<image> ...]
+// Each asset is named by the path it was given with, e.g. sample_assets/hero.png.
+
+#include "engine.h"
+
+int main(int argc, char** args) 
+{
+    if (argc < 3) {
+        std::cout << "usage: asset_cooker <output.tepack> <image> [<image> ...]" << std::endl;
+        return 1;
+    }
+
+    namespace pack = tiny_engine::detail::pack;
+    std::vector<pack::CookedTexture> textures;
+    for (int i = 2; i < argc; i++) {
+        pack::CookedTexture texture { args[i], {} };
+        if (!tiny_engine::detail::decodeImageFile(args[i], texture.image)) {
+            std::cout << "failed to decode " << args[i] << std::endl;
+            return 1;
+        }
+        std::cout << args[i] << ": " << texture.image.width << "x" << texture.image.height << std::endl;
+        textures.push_back(std::move(texture));
+    }
+
+    if (!pack::writeArchive(args[1], textures)) {
+        std::cout << "failed to write " << args[1] << std::endl;
+        return 1;
+    }
+    std::cout << "cooked " << textures.size() << " textures into " << args[1] << std::endl;
+    return 0;
+}
@@ -0,0 +1,106 @@
+// Benchmark of the skyline atlas packer: packs 10k sprites of random sizes onto 2048 and 4096 pages.
+// Prints the packing time, the page count and the packing efficiency,
+// which is the sprite area (without padding) divided by the area of all pages, 
+// and divided by the used area only, up to the highest rect on each page, 
+// which leaves out the free space of a last, partly filled page.
+// Every result is checked for overlaps and rects outside their page.
+//
+// Usage: atlas_benchmark
+
+#include "../engine.h"
+#include <random>
+
+using namespace tiny_engine;
+namespace atlas = tiny_engine::detail::atlas;
+
+struct SpriteSet 
+{
+    const char* name;
+    uint32_t minSize, maxSize;
+    // Fraction of sprites which are a long strip, e.g. UI bars, instead of roughly square.
+    float stripFraction;
+};
+
+static std::vector<atlas::Placement> randomSprites(const SpriteSet& set, uint32_t count)
+{
+    std::mt19937 random(7);
+    std::uniform_int_distribution<uint32_t> size(set.minSize, set.maxSize);
+    std::uniform_real_distribution<float> chance(0, 1);
+    std::vector<atlas::Placement> rects(count);
+    for (auto& rect : rects) 
+    {
+        rect.width = size(random);
+        rect.height = size(random);
+        if (chance(random) < set.stripFraction) rect.width = std::min(set.maxSize * 4, rect.width * 6);
+    }
+    return rects;
+}
+
+// Padded rects must stay on their page and must not overlap, checked on a coverage grid per page.
+static bool validPacking(const std::vector<atlas::Placement>& rects, uint32_t pageSize, uint32_t pageCount, uint32_t padding)
+{
+    std::vector<std::vector<uint8_t>> covered(pageCount, std::vector<uint8_t>((size_t) pageSize * pageSize));
+    for (const auto& rect : rects) 
+    {
+        if (rect.page >= pageCount || rect.x < padding || rect.y < padding ||
+            rect.x + rect.width + padding > pageSize || rect.y + rect.height + padding > pageSize) return false;
+        for (uint32_t y = rect.y - padding; y < rect.y + rect.height + padding; y++) 
+        {
+            for (uint32_t x = rect.x - padding; x < rect.x + rect.width + padding; x++) 
+            {
+                uint8_t& texel = covered[rect.page][(size_t) y * pageSize + x];
+                if (texel) return false;
+                texel = 1;
+            }
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    const uint32_t spriteCount = 10000;
+    const uint32_t padding = 1;
+    const SpriteSet sets[] = {
+        { "small 8-32", 8, 32, 0 },
+        { "mixed 8-128", 8, 128, 0 },
+        { "mixed with strips", 8, 96, 0.1f },
+    };
+
+    printf("%u sprites, %u texel padding\n", spriteCount, padding);
+    printf("%-20s %6s %10s %6s %11s %11s\n", "sprites", "page", "ms", "pages", "of pages", "of used");
+    for (const SpriteSet& set : sets) 
+    {
+        std::vector<atlas::Placement> sprites = randomSprites(set, spriteCount);
+        uint64_t spriteArea = 0;
+        for (const auto& rect : sprites) spriteArea += (uint64_t) rect.width * rect.height;
+
+        for (uint32_t pageSize : { 2048u, 4096u }) 
+        {
+            std::vector<atlas::Placement> rects;
+            uint32_t pageCount = 0;
+            double best = 1e30;
+            for (int run = 0; run < 5; run++) 
+            {
+                rects = sprites;
+                auto start = std::chrono::steady_clock::now();
+                pageCount = atlas::packRects(pageSize, pageSize, padding, rects);
+                best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+            if (pageCount == 0 || !validPacking(rects, pageSize, pageCount, padding)) 
+            {
+                printf("%-20s %6u packing failed\n", set.name, pageSize);
+                return 1;
+            }
+            std::vector<uint32_t> usedHeight(pageCount, 0);
+            for (const auto& rect : rects) usedHeight[rect.page] = std::max(usedHeight[rect.page], rect.y + rect.height + padding);
+            uint64_t usedArea = 0;
+            for (uint32_t height : usedHeight) usedArea += (uint64_t) height * pageSize;
+
+            double ofPages = (double) spriteArea / ((double) pageCount * pageSize * pageSize);
+            double ofUsed = (double) spriteArea / (double) usedArea;
+            printf("%-20s %6u %10.2f %6u %10.1f%% %10.1f%%\n", set.name, pageSize, best, pageCount, ofPages * 100, ofUsed * 100);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Benchmark of the broadphase in pairs per second, for sweep and prune and the spatial hash:
+// - pairs/s: 1k, 10k and 100k boxes of about unit size moving a little every update,
+//   spread so that about one in ten touches another,
+// - scaling: the update of 100k boxes inline (without initJobs) and with 2 and 4 threads.
+// Every update counts, including the incremental re-sort of sweep and prune.
+// On a machine with fewer cores the threaded rows measure the scheduling overhead instead.
+//
+// Usage: broadphase_benchmark
+
+#include "../engine.h"
+#include <cmath>
+#include <random>
+
+using namespace tiny_engine;
+
+// Boxes in structure-of-arrays form with a velocity each.
+struct Boxes 
+{
+    std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+    std::vector<float> velocityX, velocityY, velocityZ;
+
+    AabbArrays arrays() const 
+    {
+        return AabbArrays { minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data() };
+    }
+};
+
+static Boxes makeBoxes(uint32_t count)
+{
+    Boxes boxes;
+    std::mt19937 random(7);
+    // About 2.2 units of room per box along every axis.
+    float extent = std::cbrt((float) count) * 2.2f;
+    std::uniform_real_distribution<float> position(0, extent), size(0.5f, 1), velocity(-0.05f, 0.05f);
+    for (uint32_t i = 0; i < count; i++) 
+    {
+        float x = position(random), y = position(random), z = position(random), half = size(random) * 0.5f;
+        boxes.minX.push_back(x - half);
+        boxes.minY.push_back(y - half);
+        boxes.minZ.push_back(z - half);
+        boxes.maxX.push_back(x + half);
+        boxes.maxY.push_back(y + half);
+        boxes.maxZ.push_back(z + half);
+        boxes.velocityX.push_back(velocity(random));
+        boxes.velocityY.push_back(velocity(random));
+        boxes.velocityZ.push_back(velocity(random));
+    }
+    return boxes;
+}
+
+static void move(Boxes& boxes)
+{
+    for (size_t i = 0; i < boxes.minX.size(); i++) 
+    {
+        boxes.minX[i] += boxes.velocityX[i];
+        boxes.maxX[i] += boxes.velocityX[i];
+        boxes.minY[i] += boxes.velocityY[i];
+        boxes.maxY[i] += boxes.velocityY[i];
+        boxes.minZ[i] += boxes.velocityZ[i];
+        boxes.maxZ[i] += boxes.velocityZ[i];
+    }
+}
+
+struct Result 
+{
+    double milliseconds;
+    double pairsPerUpdate;
+};
+
+// Best of a few runs of updates, each after moving the boxes, in milliseconds per update.
+static Result measure(BroadphaseType type, uint32_t count)
+{
+    Boxes boxes = makeBoxes(count);
+    BroadphaseSettings settings;
+    settings.type = type;
+    settings.maxPairs = 1 << 22;
+    Broadphase broadphase = createBroadphase(settings);
+    // The first update sorts from scratch.
+    updateBroadphase(broadphase, boxes.arrays(), count);
+
+    const int updates = count >= 100000 ? 10 : 100;
+    Result best = { 1e30, 0 };
+    for (int run = 0; run < 5; run++) 
+    {
+        double milliseconds = 0;
+        uint64_t pairs = 0;
+        for (int i = 0; i < updates; i++) 
+        {
+            move(boxes);
+            auto start = std::chrono::steady_clock::now();
+            pairs += updateBroadphase(broadphase, boxes.arrays(), count);
+            milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        if (milliseconds / updates < best.milliseconds) best = { milliseconds / updates, (double) pairs / updates };
+    }
+    if (getBroadphaseStats(broadphase).droppedPairs) printf("pairs were dropped, raise maxPairs\n");
+    destroyBroadphase(broadphase);
+    return best;
+}
+
+static const char* typeName(BroadphaseType type)
+{
+    return type == BroadphaseType::SweepAndPrune ? "sweep and prune" : "spatial hash";
+}
+
+int main()
+{
+    const BroadphaseType types[] = { BroadphaseType::SweepAndPrune, BroadphaseType::SpatialHash };
+
+    printf("%-16s %8s %12s %12s %14s\n", "broadphase", "bodies", "ms/update", "pairs/update", "pairs/s");
+    for (BroadphaseType type : types) 
+    {
+        for (uint32_t count : { 1000u, 10000u, 100000u }) 
+        {
+            Result result = measure(type, count);
+            printf("%-16s %8u %12.3f %12.0f %14.0f\n", typeName(type), count, result.milliseconds,
+                   result.pairsPerUpdate, result.pairsPerUpdate * 1000 / result.milliseconds);
+        }
+    }
+
+    const uint32_t scalingCount = 100000;
+    printf("\nparallel update of %u bodies, hardware threads: %u\n", scalingCount,
+           std::max(1u, std::thread::hardware_concurrency()));
+    printf("%-16s %8s %12s %8s\n", "broadphase", "threads", "ms/update", "speedup");
+    for (BroadphaseType type : types) 
+    {
+        double inlineMilliseconds = 0;
+        for (uint32_t threads : { 1u, 2u, 4u }) 
+        {
+            // 1 thread is inline, without the job system running at all.
+            if (threads > 1) initJobs(threads - 1);
+            Result result = measure(type, scalingCount);
+            if (threads > 1) shutdownJobs();
+            if (threads == 1) inlineMilliseconds = result.milliseconds;
+            printf("%-16s %8u %12.3f %7.2fx\n", typeName(type), threads, result.milliseconds,
+                   inlineMilliseconds / result.milliseconds);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+// Benchmark of the graphics dispatch on the null backend, which does everything a real backend does
+// on the CPU (recording, sorting and batching the sprites) but never touches a GPU.
+// Prints nanoseconds per call of the public entry points, and for reference the std::string
+// comparison every call used to pay to find its backend.
+// build.bat builds it twice: with only the null backend, where the calls are direct,
+// and with the software backend as well, where they go through the backend's function table.
+//
+// Usage: dispatch_benchmark
+
+#include "../engine.h"
+
+using namespace tiny_engine;
+
+static const uint32_t spritesPerFrame = 10000;
+
+// Best of a few runs of frames, in nanoseconds per call.
+template<typename Frame>
+static double nanosecondsPerCall(uint64_t callsPerFrame, const Frame& frame)
+{
+    const int frames = 100;
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) 
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) frame();
+        double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, elapsed / ((double) frames * callsPerFrame));
+    }
+    return best;
+}
+
+int main()
+{
+#ifdef TE_SINGLE_BACKEND
+    printf("dispatch: direct calls, only the null backend compiled in\n");
+#else
+    printf("dispatch: through the backend function table\n");
+#endif
+    GraphicsContext* graphics = initGraphics("null", Window { 1280, 720, nullptr });
+    if (!graphics) 
+    {
+        std::cout << "no null backend" << std::endl;
+        return 1;
+    }
+    // Two textures, alternating, so the batches have something to sort.
+    namespace null = detail::null;
+    Texture textures[2] = { Texture { null::textureStorage.store(new null::NullTexture { 64, 64 }) },
+                            Texture { null::textureStorage.store(new null::NullTexture { 64, 64 }) } };
+
+    std::vector<float> xs(spritesPerFrame), ys(spritesPerFrame);
+    for (uint32_t i = 0; i < spritesPerFrame; i++) 
+    {
+        xs[i] = (float) (i % 1280);
+        ys[i] = (float) (i / 1280 * 16);
+    }
+
+    double bind = nanosecondsPerCall(spritesPerFrame, [&]() {
+        for (uint32_t i = 0; i < spritesPerFrame; i++) bindBackBuffer(graphics, 0, 0, 1280, 720);
+    });
+    double clear = nanosecondsPerCall(spritesPerFrame, [&]() {
+        for (uint32_t i = 0; i < spritesPerFrame; i++) clearBackBuffer(graphics, 0, 0, 0, 1);
+    });
+    double present = nanosecondsPerCall(1, [&]() { presentBackBuffer(graphics); });
+
+    // The draws include their share of the sorting and batching at the present.
+    double drawTextureCall = nanosecondsPerCall(spritesPerFrame, [&]() {
+        for (uint32_t i = 0; i < spritesPerFrame; i++) drawTexture(graphics, textures[i & 1], (int) xs[i], (int) ys[i]);
+        presentBackBuffer(graphics);
+    });
+    double drawSpriteCall = nanosecondsPerCall(spritesPerFrame, [&]() {
+        Sprite sprite;
+        for (uint32_t i = 0; i < spritesPerFrame; i++) 
+        {
+            sprite.texture = textures[i & 1];
+            sprite.x = xs[i];
+            sprite.y = ys[i];
+            drawSprite(graphics, sprite);
+        }
+        presentBackBuffer(graphics);
+    });
+    double drawSpritesCall = nanosecondsPerCall(spritesPerFrame, [&]() {
+        SpriteArrays arrays;
+        arrays.x = xs.data();
+        arrays.y = ys.data();
+        drawSprites(graphics, textures[0], arrays, spritesPerFrame / 2);
+        drawSprites(graphics, textures[1], arrays, spritesPerFrame / 2);
+        presentBackBuffer(graphics);
+    });
+
+    // What every call paid before the backend was resolved once in initGraphics.
+    // volatile, so the compiler neither knows the string nor drops the comparisons.
+    std::string api = "dx11";
+    volatile uint32_t matches = 0;
+    double stringCompare = nanosecondsPerCall(spritesPerFrame, [&]() {
+        for (uint32_t i = 0; i < spritesPerFrame; i++) 
+        {
+            const std::string* volatile current = &api;
+            if (*current == "dx11") matches = matches + 1;
+        }
+    });
+
+    printf("%-34s %8.2f ns\n", "bindBackBuffer", bind);
+    printf("%-34s %8.2f ns\n", "clearBackBuffer", clear);
+    printf("%-34s %8.2f ns\n", "presentBackBuffer (empty frame)", present);
+    printf("%-34s %8.2f ns per sprite\n", "drawTexture", drawTextureCall);
+    printf("%-34s %8.2f ns per sprite\n", "drawSprite", drawSpriteCall);
+    printf("%-34s %8.2f ns per sprite\n", "drawSprites", drawSpritesCall);
+    printf("%-34s %8.2f ns\n", "std::string compare (old dispatch)", stringCompare);
+
+    RenderStats stats = getRenderStats(graphics);
+    printf("last frame: %u draws submitted, %u draw calls\n", stats.drawsSubmitted, stats.drawCalls);
+    return 0;
+}
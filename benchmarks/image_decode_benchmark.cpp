@@ -0,0 +1,330 @@
+// Throughput benchmark of the built-in PNG and QOI decoders.
+// Decodes sample_assets/hero.png (a small sprite) and a 2048x2048 atlas tiled from it,
+// once as PNG and once as QOI, plus any image files given on the command line.
+// Prints the decoded RGBA megabytes per second and the time per image.
+// The atlas is encoded here, the PNG with Paeth filtered rows and fixed Huffman deflate.
+//
+// Usage (from the repository root): image_decode_benchmark [image files...]
+
+#include "../engine.h"
+#include <cstring>
+
+using namespace tiny_engine;
+
+// Best of a few runs, each decoding often enough to take a while.
+static double secondsPerDecode(const std::vector<uint8_t>& file, detail::DecodedImage& image, bool& ok) 
+{
+    ok = detail::decodeImage(file.data(), file.size(), image);
+    if (!ok) return 0;
+    size_t repeats = std::max<size_t>(1, 200000000 / image.pixels.size());
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) 
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < repeats; i++) detail::decodeImage(file.data(), file.size(), image);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, elapsed / repeats);
+    }
+    return best;
+}
+
+static void report(const char* name, const std::vector<uint8_t>& file) 
+{
+    detail::DecodedImage image;
+    bool ok;
+    double seconds = secondsPerDecode(file, image, ok);
+    if (!ok) 
+    {
+        printf("%-28s could not be decoded\n", name);
+        return;
+    }
+    printf("%-28s %5ux%-5u %9zu bytes %10.3f ms %8.1f MB/s\n", name, image.width, image.height,
+           file.size(), seconds * 1000, image.pixels.size() / seconds / 1e6);
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t v) 
+{
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back((uint8_t) (v >> shift));
+}
+
+// pixels are RGBA, top row first, as both formats store them.
+static std::vector<uint8_t> encodeQoi(uint32_t width, uint32_t height, const std::vector<uint32_t>& pixels) 
+{
+    std::vector<uint8_t> out = { 'q', 'o', 'i', 'f' };
+    put32(out, width);
+    put32(out, height);
+    out.push_back(4);
+    out.push_back(0);
+
+    uint32_t index[64] = {};
+    uint32_t previous = 0xff000000;
+    int run = 0;
+    for (size_t i = 0; i < pixels.size(); i++) 
+    {
+        uint32_t pixel = pixels[i];
+        if (pixel == previous) 
+        {
+            run++;
+            if (run == 62 || i + 1 == pixels.size()) 
+            {
+                out.push_back((uint8_t) (0xc0 | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) 
+        {
+            out.push_back((uint8_t) (0xc0 | (run - 1)));
+            run = 0;
+        }
+        uint8_t r = pixel & 0xff, g = (pixel >> 8) & 0xff, b = (pixel >> 16) & 0xff, a = pixel >> 24;
+        int slot = (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+        int dr = r - (previous & 0xff), dg = g - ((previous >> 8) & 0xff), db = b - ((previous >> 16) & 0xff);
+        if (index[slot] == pixel) 
+        {
+            out.push_back((uint8_t) slot);
+        }
+        else if (a == previous >> 24 && dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) 
+        {
+            out.push_back((uint8_t) (0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+        }
+        else 
+        {
+            out.insert(out.end(), { 0xff, r, g, b, a });
+        }
+        index[slot] = pixel;
+        previous = pixel;
+    }
+    out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+    return out;
+}
+
+// Writes deflate codes, least significant bit first.
+struct BitWriter 
+{
+    std::vector<uint8_t>& out;
+    uint32_t bits = 0;
+    int count = 0;
+
+    void put(uint32_t value, int length) 
+    {
+        bits |= value << count;
+        count += length;
+        while (count >= 8) 
+        {
+            out.push_back((uint8_t) bits);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    // Huffman codes are stored starting with their most significant bit.
+    void putCode(uint32_t code, int length) 
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+        put(reversed, length);
+    }
+
+    void flush() { if (count > 0) out.push_back((uint8_t) bits); bits = 0; count = 0; }
+};
+
+static void putLiteral(BitWriter& writer, uint32_t symbol) 
+{
+    if (symbol < 144) writer.putCode(0x30 + symbol, 8);
+    else if (symbol < 256) writer.putCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280) writer.putCode(symbol - 256, 7);
+    else writer.putCode(0xc0 + symbol - 280, 8);
+}
+
+// A single fixed Huffman block with greedy matching against the last position of each 3 byte hash.
+static std::vector<uint8_t> deflate(const std::vector<uint8_t>& data) 
+{
+    static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                             35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                             3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                               257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                               8193, 12289, 16385, 24577 };
+
+    std::vector<uint8_t> out = { 0x78, 0x01 };
+    BitWriter writer { out };
+    writer.put(1, 1);   // last block
+    writer.put(1, 2);   // fixed Huffman codes
+
+    std::vector<int64_t> lastPosition(1 << 15, -1);
+    size_t size = data.size();
+    for (size_t i = 0; i < size;) 
+    {
+        size_t length = 0, distance = 0;
+        if (i + 3 <= size) 
+        {
+            uint32_t hash = ((data[i] << 16 | data[i + 1] << 8 | data[i + 2]) * 2654435761u) >> 17;
+            int64_t candidate = lastPosition[hash];
+            lastPosition[hash] = (int64_t) i;
+            if (candidate >= 0 && i - candidate <= 32768) 
+            {
+                size_t maxLength = std::min<size_t>(258, size - i);
+                while (length < maxLength && data[candidate + length] == data[i + length]) length++;
+                distance = i - candidate;
+            }
+        }
+        if (length < 3) 
+        {
+            putLiteral(writer, data[i++]);
+            continue;
+        }
+
+        int code = 28;
+        while (lengthBase[code] > length) code--;
+        putLiteral(writer, 257 + code);
+        writer.put((uint32_t) (length - lengthBase[code]), lengthExtra[code]);
+        code = 29;
+        while (distanceBase[code] > distance) code--;
+        writer.putCode(code, 5);
+        writer.put((uint32_t) (distance - distanceBase[code]), code < 4 ? 0 : code / 2 - 1);
+        i += length;
+    }
+    putLiteral(writer, 256);
+    writer.flush();
+
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : data) 
+    {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(out, b << 16 | a);
+    return out;
+}
+
+static void putChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) 
+{
+    static uint32_t table[256];
+    if (table[1] == 0) 
+    {
+        for (uint32_t i = 0; i < 256; i++) 
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    put32(out, (uint32_t) data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    uint32_t crc = 0xffffffff;
+    for (size_t i = start; i < out.size(); i++) crc = table[(crc ^ out[i]) & 0xff] ^ (crc >> 8);
+    put32(out, crc ^ 0xffffffff);
+}
+
+static std::vector<uint8_t> encodePng(uint32_t width, uint32_t height, const std::vector<uint32_t>& pixels) 
+{
+    // Every row Paeth filtered, what encoders pick for most rows of photos and painted sprites.
+    size_t rowBytes = (size_t) width * 4;
+    std::vector<uint8_t> filtered;
+    filtered.reserve(height * (rowBytes + 1));
+    for (uint32_t y = 0; y < height; y++) 
+    {
+        const uint8_t* row = (const uint8_t*) &pixels[(size_t) y * width];
+        const uint8_t* prior = y > 0 ? row - rowBytes : nullptr;
+        filtered.push_back(4);
+        for (size_t i = 0; i < rowBytes; i++) 
+        {
+            int a = i >= 4 ? row[i - 4] : 0, b = prior ? prior[i] : 0, c = prior && i >= 4 ? prior[i - 4] : 0;
+            int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+            int predicted = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+            filtered.push_back((uint8_t) (row[i] - predicted));
+        }
+    }
+
+    std::vector<uint8_t> out = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    std::vector<uint8_t> header;
+    put32(header, width);
+    put32(header, height);
+    header.insert(header.end(), { 8, 6, 0, 0, 0 });
+    putChunk(out, "IHDR", header);
+    putChunk(out, "IDAT", deflate(filtered));
+    putChunk(out, "IEND", {});
+    return out;
+}
+
+int main(int argc, char** argv) 
+{
+    std::vector<uint8_t> heroFile;
+    detail::DecodedImage hero;
+    if (!detail::readFile("sample_assets/hero.png", heroFile) || !detail::decodeImage(heroFile.data(), heroFile.size(), hero)) 
+    {
+        std::cerr << "Could not load sample_assets/hero.png, run from the repository root." << std::endl;
+        return 1;
+    }
+
+    // The atlas tiles the sprite with a different tint per tile,
+    // so the encoders cannot just repeat the first copy.
+    const uint32_t atlasSize = 2048;
+    std::vector<uint32_t> atlas((size_t) atlasSize * atlasSize);
+    for (uint32_t y = 0; y < atlasSize; y++) 
+    {
+        for (uint32_t x = 0; x < atlasSize; x++) 
+        {
+            uint32_t tile = (y / hero.height) * (atlasSize / hero.width) + x / hero.width;
+            // Decoded images come bottom row first.
+            const uint8_t* p = &hero.pixels[((size_t) (hero.height - 1 - y % hero.height) * hero.width + x % hero.width) * 4];
+            uint32_t tint = tile * 2654435761u;
+            atlas[(size_t) y * atlasSize + x] = (uint8_t) (p[0] ^ (tint & 0x3f)) |
+                                                (uint8_t) (p[1] ^ ((tint >> 8) & 0x3f)) << 8 |
+                                                (uint8_t) (p[2] ^ ((tint >> 16) & 0x3f)) << 16 |
+                                                (uint32_t) p[3] << 24;
+        }
+    }
+    std::vector<uint32_t> heroTopFirst((size_t) hero.width * hero.height);
+    for (uint32_t y = 0; y < hero.height; y++) 
+    {
+        memcpy(&heroTopFirst[(size_t) y * hero.width], &hero.pixels[(size_t) (hero.height - 1 - y) * hero.width * 4], hero.width * 4);
+    }
+
+    std::vector<uint8_t> atlasPng = encodePng(atlasSize, atlasSize, atlas);
+    std::vector<uint8_t> atlasQoi = encodeQoi(atlasSize, atlasSize, atlas);
+
+    // Both encodings have to round trip, or the numbers mean nothing.
+    for (const auto* file : { &atlasPng, &atlasQoi }) 
+    {
+        detail::DecodedImage decoded;
+        bool same = detail::decodeImage(file->data(), file->size(), decoded) && decoded.width == atlasSize;
+        for (uint32_t y = 0; same && y < atlasSize; y++) 
+        {
+            same = memcmp(&decoded.pixels[(size_t) (atlasSize - 1 - y) * atlasSize * 4], &atlas[(size_t) y * atlasSize], atlasSize * 4) == 0;
+        }
+        if (!same) 
+        {
+            std::cerr << "The generated " << (file == &atlasPng ? "PNG" : "QOI") << " atlas does not decode to its pixels." << std::endl;
+            return 1;
+        }
+    }
+
+#if defined(TE_SIMD_SSE2)
+    printf("SIMD path: SSE2\n");
+#elif defined(TE_SIMD_NEON)
+    printf("SIMD path: NEON\n");
+#else
+    printf("SIMD path: scalar only\n");
+#endif
+    report("hero.png", heroFile);
+    report("hero.qoi", encodeQoi(hero.width, hero.height, heroTopFirst));
+    report("atlas.png (generated)", atlasPng);
+    report("atlas.qoi (generated)", atlasQoi);
+
+    for (int i = 1; i < argc; i++) 
+    {
+        std::vector<uint8_t> file;
+        if (!detail::readFile(argv[i], file)) 
+        {
+            printf("%-28s could not be read\n", argv[i]);
+            continue;
+        }
+        report(argv[i], file);
+    }
+    return 0;
+}
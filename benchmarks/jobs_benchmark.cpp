@@ -0,0 +1,156 @@
+// Benchmark suite of the job system, each run inline (without initJobs) and with 2, 4 and
+// all hardware threads:
+// - fib: recursive Fibonacci, every call above a cutoff runs its two halves as jobs and waits on them,
+//   the stress test of nested waits and work stealing.
+// - parallelFor: 1M items of light math in batches of 4096.
+// - fan-out/fan-in: 1000 tiny jobs on one counter plus a join job started with runJobAfter.
+// Prints milliseconds (best of 5), the speedup against inline and, for the small jobs, ns per job.
+// On a machine with fewer cores the threaded rows measure the scheduling overhead instead.
+//
+// Usage: jobs_benchmark
+
+#include "../engine.h"
+#include <cmath>
+
+using namespace tiny_engine;
+
+// Best of a few runs, in milliseconds.
+template<typename Body>
+static double bestOf(const Body& body)
+{
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) 
+    {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+// fib
+
+static const uint32_t fibN = 34;
+// Below this the calls are plain recursion, a job each would be far too small.
+static const uint32_t fibCutoff = 14;
+
+static uint64_t fibSerial(uint32_t n)
+{
+    return n < 2 ? n : fibSerial(n - 1) + fibSerial(n - 2);
+}
+
+struct FibJob 
+{
+    uint32_t n;
+    uint64_t result;
+};
+
+static void fibJob(void* data)
+{
+    FibJob* job = static_cast<FibJob*>(data);
+    if (job->n < fibCutoff) 
+    {
+        job->result = fibSerial(job->n);
+        return;
+    }
+    FibJob halves[2] = { { job->n - 1, 0 }, { job->n - 2, 0 } };
+    JobCounter counter;
+    runJob(fibJob, &halves[0], &counter);
+    runJob(fibJob, &halves[1], &counter);
+    waitForCounter(counter);
+    job->result = halves[0].result + halves[1].result;
+}
+
+static uint32_t fibJobCount(uint32_t n)
+{
+    return n < fibCutoff ? 0 : 2 + fibJobCount(n - 1) + fibJobCount(n - 2);
+}
+
+// parallelFor
+
+static const uint32_t itemCount = 1000000;
+static std::vector<float> items(itemCount), results(itemCount);
+
+static void parallelForItems()
+{
+    parallelFor(itemCount, 4096, [](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) results[i] = std::sqrt(items[i]) * 0.5f + std::sin(items[i]);
+    });
+}
+
+// fan-out/fan-in
+
+static const uint32_t fanOutJobs = 1000;
+static const uint32_t fanOutRounds = 100;
+static uint32_t fanOutValues[fanOutJobs];
+static uint64_t fanInSum = 0;
+
+static void fanOutJob(void* data)
+{
+    uint32_t* value = static_cast<uint32_t*>(data);
+    *value = *value * 1664525u + 1013904223u;
+}
+
+static void fanInJob(void*)
+{
+    for (uint32_t value : fanOutValues) fanInSum += value;
+}
+
+static void fanOutFanIn()
+{
+    for (uint32_t round = 0; round < fanOutRounds; round++) 
+    {
+        JobCounter fanOut, fanIn;
+        for (uint32_t& value : fanOutValues) runJob(fanOutJob, &value, &fanOut);
+        runJobAfter(fanOut, fanInJob, nullptr, &fanIn);
+        waitForCounter(fanIn);
+    }
+}
+
+int main()
+{
+    for (uint32_t i = 0; i < itemCount; i++) items[i] = (float) i * 0.001f;
+
+    uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> threadCounts = { 1, 2, 4 };
+    if (hardwareThreads > 4) threadCounts.push_back(hardwareThreads);
+
+    printf("hardware threads: %u\n", hardwareThreads);
+    printf("fib(%u), %u jobs; parallelFor over %u items; fan-out/fan-in of %u jobs, %u rounds\n",
+           fibN, fibJobCount(fibN), itemCount, fanOutJobs, fanOutRounds);
+    printf("%-8s %14s %14s %14s\n", "threads", "fib ms", "parallelFor ms", "fan-out ms");
+
+    double inlineFib = 0, inlineFor = 0, inlineFan = 0;
+    for (uint32_t threads : threadCounts) 
+    {
+        // 1 thread is inline, without the job system running at all.
+        if (threads > 1) initJobs(threads - 1);
+
+        uint64_t fibResult = 0;
+        double fib = bestOf([&]() {
+            FibJob root = { fibN, 0 };
+            fibJob(&root);
+            fibResult = root.result;
+        });
+        double forLoop = bestOf(parallelForItems);
+        double fan = bestOf(fanOutFanIn);
+        if (threads == 1) 
+        {
+            inlineFib = fib;
+            inlineFor = forLoop;
+            inlineFan = fan;
+        }
+        if (threads > 1) shutdownJobs();
+
+        if (fibResult != fibSerial(fibN)) 
+        {
+            printf("fib(%u) came out as %llu\n", fibN, (unsigned long long) fibResult);
+            return 1;
+        }
+        double nanosecondsPerJob = fan * 1e6 / ((double) fanOutRounds * (fanOutJobs + 1));
+        printf("%-8u %8.2f %4.1fx %8.2f %4.1fx %8.2f %4.1fx %5.0f ns/job\n", threads,
+               fib, inlineFib / fib, forLoop, inlineFor / forLoop, fan, inlineFan / fan, nanosecondsPerJob);
+    }
+    printf("checksum %llu\n", (unsigned long long) (fanInSum + (uint64_t) results[itemCount / 2]));
+    return 0;
+}
@@ -0,0 +1,123 @@
+// Loopback benchmark of the UDP transport: client transports send small timestamped messages
+// to one server transport, which echoes them back, for 3 seconds on the unreliable and then on
+// the reliable channel. Everything runs on one thread in ticks: every client sends, the server
+// receives, echoes and sends, every client receives.
+// Prints the packets per second through the server (per second of the whole run and per second
+// the server itself took), the socket calls, and the round trip percentiles, which include
+// the time the message waited for the other clients of the tick.
+// Needs nothing but 127.0.0.1.
+//
+// Usage: network_benchmark [clients] [batch size]   (default 64 and 64)
+
+#include "../engine.h"
+#include <cstring>
+
+using namespace tiny_engine;
+
+static const double runSeconds = 3;
+
+static double nowSeconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool run(uint32_t clientCount, uint32_t batchSize, uint32_t channel)
+{
+    TransportSettings serverSettings;
+    serverSettings.bind = netAddress("127.0.0.1", 0);
+    serverSettings.batchSize = batchSize;
+    serverSettings.maxConnections = clientCount;
+    serverSettings.packetCount = 8192;
+    std::optional<Transport> server = createTransport(serverSettings);
+    if (!server) return false;
+
+    TransportSettings clientSettings = serverSettings;
+    clientSettings.acceptConnections = false;
+    clientSettings.packetCount = 1024;
+    std::vector<Transport> clients;
+    std::vector<uint32_t> connections;
+    for (uint32_t i = 0; i < clientCount; i++) 
+    {
+        std::optional<Transport> client = createTransport(clientSettings);
+        if (!client) return false;
+        clients.push_back(*client);
+        connections.push_back(openConnection(*client, getTransportAddress(*server)));
+    }
+
+    std::vector<double> roundTrips;
+    roundTrips.reserve(1 << 22);
+    uint64_t refused = 0;
+    double serverSeconds = 0;
+    uint8_t message[32] = {};
+    NetEvent event;
+    double start = nowSeconds();
+    while (nowSeconds() - start < runSeconds) 
+    {
+        for (uint32_t i = 0; i < clientCount; i++) 
+        {
+            double sent = nowSeconds();
+            memcpy(message, &sent, sizeof(sent));
+            if (!sendMessage(clients[i], connections[i], channel, message, sizeof(message))) refused++;
+            sendPackets(clients[i]);
+        }
+
+        double serverStart = nowSeconds();
+        receivePackets(*server);
+        while (nextNetEvent(*server, event)) 
+        {
+            if (event.type != NetEventType::Message) continue;
+            if (!sendMessage(*server, event.connection, event.channel, event.data, event.size)) refused++;
+        }
+        sendPackets(*server);
+        serverSeconds += nowSeconds() - serverStart;
+
+        for (uint32_t i = 0; i < clientCount; i++) 
+        {
+            receivePackets(clients[i]);
+            while (nextNetEvent(clients[i], event)) 
+            {
+                if (event.type != NetEventType::Message) continue;
+                double sent;
+                memcpy(&sent, event.data, sizeof(sent));
+                roundTrips.push_back(nowSeconds() - sent);
+            }
+        }
+    }
+    double seconds = nowSeconds() - start;
+
+    TransportStats stats = getTransportStats(*server);
+    uint64_t packets = stats.packetsReceived + stats.packetsSent;
+    std::sort(roundTrips.begin(), roundTrips.end());
+    auto percentile = [&](double fraction) {
+        if (roundTrips.empty()) return 0.0;
+        return roundTrips[std::min(roundTrips.size() - 1, (size_t) (fraction * roundTrips.size()))] * 1e6;
+    };
+    printf("%s channel, %u clients, batches of %u\n", channel ? "reliable" : "unreliable", clientCount, batchSize);
+    printf("  server: %llu packets, %.0f packets/s, %.0f packets/s of server time, %llu receive and %llu send calls\n",
+           (unsigned long long) packets, packets / seconds, packets / serverSeconds,
+           (unsigned long long) stats.receiveCalls, (unsigned long long) stats.sendCalls);
+    printf("  round trip us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  (%zu messages)\n",
+           percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), percentile(1), roundTrips.size());
+    printf("  dropped %llu, pool exhausted %llu, messages refused %llu\n", (unsigned long long) stats.packetsDropped,
+           (unsigned long long) stats.poolExhausted, (unsigned long long) refused);
+
+    for (Transport client : clients) destroyTransport(client);
+    destroyTransport(*server);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t clientCount = argc > 1 ? (uint32_t) atoi(argv[1]) : 64;
+    uint32_t batchSize = argc > 2 ? (uint32_t) atoi(argv[2]) : 64;
+    // The default channels: 0 is unreliable, 1 reliable.
+    for (uint32_t channel : { 0u, 1u }) 
+    {
+        if (!run(clientCount, batchSize, channel)) 
+        {
+            std::cerr << "Could not open the loopback transports" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
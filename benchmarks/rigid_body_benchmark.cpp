@@ -0,0 +1,156 @@
+// Benchmark of the rigid body solver on two scenes at 60 steps per second:
+// - stacking: 10 x 10 towers of 10 boxes each on a static ground, which have to come to rest
+//   and stay up, the case warm starting is for,
+// - pile: boxes and spheres dropped from a grid into a walled pit, where they land on each other
+//   and form one big island of many contacts.
+// Prints the solver milliseconds per step (best of 5 runs, each the mean over the measured steps),
+// next to the whole step and its broadphase and narrowphase, and the contacts and islands of the last step.
+// Stacking also prints how far the top boxes sank, the towers stand if that is close to 0.
+//
+// Usage: rigid_body_benchmark
+
+#include "../engine.h"
+
+using namespace tiny_engine;
+
+static const float stepTime = 1 / 60.0f;
+// Steps before the measured ones, the pile is still falling during these.
+static const uint32_t settleSteps = 60;
+static const uint32_t measuredSteps = 240;
+
+static const uint32_t towerRows = 10;
+static const uint32_t towerHeight = 10;
+
+static void addGround(PhysicsWorld world)
+{
+    RigidBodyDesc ground;
+    ground.halfExtents = { 100, 0.5f, 100 };
+    ground.position = { 0, -0.5f, 0 };
+    ground.mass = 0;
+    addRigidBody(world, ground);
+}
+
+static void buildStacking(PhysicsWorld world)
+{
+    addGround(world);
+    for (uint32_t x = 0; x < towerRows; x++) 
+    {
+        for (uint32_t z = 0; z < towerRows; z++) 
+        {
+            for (uint32_t y = 0; y < towerHeight; y++) 
+            {
+                RigidBodyDesc box;
+                box.position = { x * 3.0f, 0.5f + y, z * 3.0f };
+                addRigidBody(world, box);
+            }
+        }
+    }
+}
+
+static void buildPile(PhysicsWorld world)
+{
+    addGround(world);
+    // Four walls around a 12 x 12 pit.
+    const float pit = 6;
+    for (int side = 0; side < 4; side++) 
+    {
+        RigidBodyDesc wall;
+        wall.mass = 0;
+        float offset = side & 1 ? pit + 0.5f : -pit - 0.5f;
+        wall.halfExtents = side < 2 ? Vec3 { 0.5f, 10, pit + 1 } : Vec3 { pit + 1, 10, 0.5f };
+        wall.position = side < 2 ? Vec3 { offset, 10, 0 } : Vec3 { 0, 10, offset };
+        addRigidBody(world, wall);
+    }
+    // 20 layers of 10 x 10, every other body a sphere, slightly turned and shifted so they tumble.
+    uint32_t index = 0;
+    for (uint32_t y = 0; y < 20; y++) 
+    {
+        for (uint32_t x = 0; x < 10; x++) 
+        {
+            for (uint32_t z = 0; z < 10; z++, index++) 
+            {
+                RigidBodyDesc body;
+                body.position = { -5.4f + x * 1.2f + (y & 1) * 0.3f, 1 + y * 1.2f, -5.4f + z * 1.2f };
+                if (index & 1) 
+                {
+                    body.shape = ShapeType::Sphere;
+                    body.halfExtents = { 0.5f, 0.5f, 0.5f };
+                }
+                else 
+                {
+                    body.rotation = quatFromAxisAngle(Vec3 { 1, 1, 0 }, 0.1f * (float) (index % 7));
+                }
+                addRigidBody(world, body);
+            }
+        }
+    }
+}
+
+struct SceneResult 
+{
+    PhysicsStats stats;
+    double solver;
+    double broadphase;
+    double narrowphase;
+    double step;
+    float sink;
+};
+
+// Builds the scene anew for every run and keeps the run with the fastest solver.
+template<typename Build>
+static SceneResult measure(const Build& build)
+{
+    SceneResult best = {};
+    best.solver = 1e30;
+    for (int run = 0; run < 5; run++) 
+    {
+        PhysicsWorld world = createPhysicsWorld(PhysicsSettings());
+        build(world);
+        for (uint32_t i = 0; i < settleSteps; i++) stepPhysics(world, stepTime);
+
+        SceneResult result = {};
+        for (uint32_t i = 0; i < measuredSteps; i++) 
+        {
+            stepPhysics(world, stepTime);
+            PhysicsStats stats = getPhysicsStats(world);
+            result.solver += stats.solverMilliseconds / measuredSteps;
+            result.broadphase += stats.broadphaseMilliseconds / measuredSteps;
+            result.narrowphase += stats.narrowphaseMilliseconds / measuredSteps;
+            result.step += stats.stepMilliseconds / measuredSteps;
+        }
+        result.stats = getPhysicsStats(world);
+
+        // Top boxes of the towers against where they started, only meaningful for stacking.
+        const Vec3* positions = getRigidBodyPositions(world);
+        for (uint32_t body = towerHeight; body < getRigidBodyCount(world); body += towerHeight) 
+        {
+            result.sink = std::max(result.sink, (0.5f + towerHeight - 1) - positions[body].y);
+        }
+        destroyPhysicsWorld(world);
+        if (result.solver < best.solver) best = result;
+    }
+    return best;
+}
+
+static void report(const char* name, const SceneResult& result)
+{
+    printf("%-10s %7u %9.3f %9.3f %9.3f %9.3f %9u %8u %7u\n", name, result.stats.bodyCount, result.solver,
+           result.step, result.broadphase, result.narrowphase, result.stats.contactCount,
+           result.stats.islandCount, result.stats.colorCount);
+}
+
+int main()
+{
+    printf("%u steps at 60 Hz after %u to settle, %u velocity iterations\n", measuredSteps, settleSteps,
+           PhysicsSettings().velocityIterations);
+    printf("%-10s %7s %9s %9s %9s %9s %9s %8s %7s\n", "scene", "bodies", "solver ms", "step ms", "broad ms",
+           "narrow ms", "contacts", "islands", "colors");
+
+    SceneResult stacking = measure(buildStacking);
+    report("stacking", stacking);
+    SceneResult pile = measure(buildPile);
+    report("pile", pile);
+
+    printf("stacking: top boxes sank by up to %.3f\n", stacking.sink);
+    return 0;
+}
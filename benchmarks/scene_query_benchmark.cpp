@@ -0,0 +1,106 @@
+// Benchmark of the scene queries in queries per second against the number of objects
+// (1k, 10k, 100k and 1M boxes of 0.2 to 2 units, about one per 4 x 4 x 4 units of space):
+// - rays: random origins and directions, 20 units long,
+// - camera rays: one per pixel of a 316 x 316 view through the whole scene, so neighbours
+//   take the same way down the tree,
+// - single rays: the random rays again, one raycastScene call each, so without the packets of 4,
+// - sweeps: boxes of 0.5 units moved 5 units,
+// - overlaps: boxes of 2 units.
+// 100k queries of each kind (best of 5), inline without initJobs. Also prints the tree height
+// and cost after a frame in which every tenth object moved.
+//
+// Usage: scene_query_benchmark
+
+#include "../engine.h"
+#include <cmath>
+#include <random>
+
+using namespace tiny_engine;
+
+static const uint32_t queryCount = 100000;
+
+// Best of a few runs of body, which runs queryCount queries, in queries per second.
+template<typename Body>
+static double queriesPerSecond(const Body& body)
+{
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) 
+    {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return queryCount / best;
+}
+
+int main()
+{
+    std::mt19937 random(5);
+    auto uniform = [&](float low, float high) { return std::uniform_real_distribution<float>(low, high)(random); };
+
+    printf("%-8s %7s %6s %12s %12s %12s %12s %12s %12s\n", "objects", "height", "cost", "build ms",
+           "rays/s", "camera/s", "single/s", "sweeps/s", "overlaps/s");
+    for (uint32_t objectCount : { 1000u, 10000u, 100000u, 1000000u }) 
+    {
+        float extent = std::cbrt((float) objectCount) * 4;
+        auto randomPoint = [&]() { return Vec3 { uniform(0, extent), uniform(0, extent), uniform(0, extent) }; };
+
+        SceneTree tree = createSceneTree(SceneTreeSettings());
+        std::vector<Aabb> boxes(objectCount);
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < objectCount; i++) 
+        {
+            Vec3 center = randomPoint();
+            Vec3 half = { uniform(0.1f, 1), uniform(0.1f, 1), uniform(0.1f, 1) };
+            boxes[i] = Aabb { center - half, center + half };
+            addSceneObject(tree, boxes[i]);
+        }
+        double build = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // One frame of motion. The objects of a new tree have the ids 0, 1, 2 and so on.
+        for (uint32_t i = 0; i < objectCount; i += 10) 
+        {
+            Vec3 offset = { uniform(-0.3f, 0.3f), uniform(-0.3f, 0.3f), uniform(-0.3f, 0.3f) };
+            boxes[i] = Aabb { boxes[i].min + offset, boxes[i].max + offset };
+            moveSceneObject(tree, i, boxes[i]);
+        }
+        updateSceneTree(tree);
+        SceneTreeStats stats = getSceneTreeStats(tree);
+
+        std::vector<Ray> rays(queryCount), cameraRays(queryCount);
+        std::vector<BoxSweep> sweeps(queryCount);
+        std::vector<Aabb> overlapBoxes(queryCount);
+        Vec3 eye = { extent / 2, extent / 2, -5 };
+        for (uint32_t i = 0; i < queryCount; i++) 
+        {
+            Vec3 origin = randomPoint();
+            Vec3 direction = normalize(Vec3 { uniform(-1, 1), uniform(-1, 1), uniform(-1, 1) });
+            rays[i] = Ray { origin, direction, 20 };
+            sweeps[i] = BoxSweep { Aabb { origin - Vec3 { 0.25f, 0.25f, 0.25f }, origin + Vec3 { 0.25f, 0.25f, 0.25f } },
+                                   direction * 5 };
+            Vec3 center = randomPoint();
+            overlapBoxes[i] = Aabb { center - Vec3 { 1, 1, 1 }, center + Vec3 { 1, 1, 1 } };
+            float pixelX = (float) (i % 316) / 316 - 0.5f, pixelY = (float) (i / 316) / 316 - 0.5f;
+            cameraRays[i] = Ray { eye, normalize(Vec3 { pixelX, pixelY, 1 }), 2 * extent };
+        }
+
+        std::vector<SceneHit> hits(queryCount);
+        std::vector<SceneOverlap> overlaps(4 * queryCount);
+        double raysPerSecond = queriesPerSecond([&]() { raycastScene(tree, rays.data(), hits.data(), queryCount); });
+        double cameraPerSecond = queriesPerSecond([&]() { raycastScene(tree, cameraRays.data(), hits.data(), queryCount); });
+        double singlePerSecond = queriesPerSecond([&]() {
+            for (uint32_t i = 0; i < queryCount; i++) raycastScene(tree, &rays[i], &hits[i], 1);
+        });
+        double sweepsPerSecond = queriesPerSecond([&]() { sweepScene(tree, sweeps.data(), hits.data(), queryCount); });
+        uint32_t overlapCount = 0;
+        double overlapsPerSecond = queriesPerSecond([&]() {
+            overlapCount = overlapScene(tree, overlapBoxes.data(), queryCount, overlaps.data(), (uint32_t) overlaps.size());
+        });
+        if (overlapCount > overlaps.size()) printf("only %zu of %u overlaps were written\n", overlaps.size(), overlapCount);
+
+        printf("%-8u %7u %6.1f %12.1f %12.0f %12.0f %12.0f %12.0f %12.0f\n", objectCount, stats.height, stats.cost,
+               build, raysPerSecond, cameraPerSecond, singlePerSecond, sweepsPerSecond, overlapsPerSecond);
+        destroySceneTree(tree);
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+// Benchmark of the text stages in glyphs per second:
+// - rasterize: building the glyph cache (outlines, coverage, atlas packing) for ASCII and Latin-1,
+// - layout: laying out a paragraph with advances and kerning, as on a run cache miss,
+// - cached run: looking up the layout of a string drawn every frame,
+// - drawText: the whole call on the null backend, including the sprites and their batching.
+// The repository ships no font, so it takes a TrueType file (glyf outlines), any will do, 
+// e.g. C:/Windows/Fonts/consola.ttf or /usr/share/fonts/truetype/dejavu/DejaVuSans.ttf.
+//
+// Usage: text_benchmark font.ttf
+
+#include "../engine.h"
+#include <cstring>
+
+using namespace tiny_engine;
+namespace text = tiny_engine::detail::text;
+
+static const char* paragraph =
+    "The quick brown fox jumps over the lazy dog. AVAST, Wolf! To: \"Tyrone\" (1234567890)\n"
+    "Sphinx of black quartz, judge my vow; pack my box with five dozen liquor jugs.\n"
+    "Fran\xc3\xa7ois fl\xc3\xa2ne \xc3\xa0 la caf\xc3\xa9t\xc3\xa9ria, \xc3\xbc" "ber gr\xc3\xbc" "ne Stra\xc3\x9f" "en.";
+
+// Best of a few runs of body, which handles glyphsPerRun glyphs, in glyphs per second.
+template<typename Body>
+static double glyphsPerSecond(double glyphsPerRun, const Body& body)
+{
+    // Enough repeats for a few milliseconds per run.
+    auto start = std::chrono::steady_clock::now();
+    body();
+    double once = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int repeats = (int) std::max(1.0, std::min(100000.0, 0.005 / std::max(once, 1e-9)));
+
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) 
+    {
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) body();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats);
+    }
+    return glyphsPerRun / best;
+}
+
+static void report(const char* name, double rate)
+{
+    printf("%-30s %12.0f glyphs/s %10.1f ns/glyph\n", name, rate, 1e9 / rate);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) 
+    {
+        printf("Usage: text_benchmark font.ttf\n");
+        return 1;
+    }
+    std::string fileName = argv[1];
+    std::vector<uint8_t> data;
+    text::TrueTypeFile font;
+    if (!detail::readFile(fileName, data) || !text::parseTrueType(data, font)) 
+    {
+        std::cerr << "Could not load the TrueType font " << fileName << std::endl;
+        return 1;
+    }
+    printf("%s\n", fileName.c_str());
+
+    // The glyphs createFontFromFile rasterizes.
+    std::vector<uint32_t> codePoints;
+    for (uint32_t c = 32; c < 127; c++) codePoints.push_back(c);
+    for (uint32_t c = 160; c < 256; c++) codePoints.push_back(c);
+
+    text::GlyphCache cache;
+    detail::DecodedImage page;
+    for (float pixelHeight : { 16.0f, 32.0f, 64.0f }) 
+    {
+        double rate = glyphsPerSecond((double) codePoints.size() + 1, [&]() {
+            cache.build(font, pixelHeight, codePoints, 2048, page);
+        });
+        char name[64];
+        snprintf(name, sizeof(name), "rasterize at %.0f px", pixelHeight);
+        report(name, rate);
+    }
+
+    // The rest at a typical UI size.
+    if (!cache.build(font, 20, codePoints, 2048, page)) 
+    {
+        std::cerr << "The glyphs do not fit onto one page" << std::endl;
+        return 1;
+    }
+    std::vector<text::PlacedGlyph> placed;
+    text::layoutText(cache, paragraph, strlen(paragraph), placed);
+    double glyphCount = (double) placed.size();
+
+    report("layout", glyphsPerSecond(glyphCount, [&]() {
+        placed.clear();
+        text::layoutText(cache, paragraph, strlen(paragraph), placed);
+    }));
+
+    text::RunCache runs;
+    std::string paragraphString = paragraph;
+    size_t shaped = 0;
+    report("cached run", glyphsPerSecond(glyphCount, [&]() {
+        shaped += runs.shape(cache, paragraphString).size();
+    }));
+
+    GraphicsContext* graphics = initGraphics("null", Window { 1280, 720, nullptr });
+    auto drawFont = graphics ? createFontFromFile(graphics, fileName, 20) : std::nullopt;
+    if (!drawFont) 
+    {
+        std::cerr << "Could not create the font on the null backend" << std::endl;
+        return 1;
+    }
+    // 100 strings a frame, so the present (sorting and batching the sprites) is part of it.
+    const int stringsPerFrame = 100;
+    report("drawText (null backend)", glyphsPerSecond(glyphCount * stringsPerFrame, [&]() {
+        for (int i = 0; i < stringsPerFrame; i++) drawText(graphics, *drawFont, paragraphString, 10, 700 - i * 7);
+        presentBackBuffer(graphics);
+    }));
+
+    printf("%.0f glyphs per paragraph, %zu shaped\n", glyphCount, shaped);
+    return 0;
+}
@@ -2,3 +2,116 @@ cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_WINDOWING /DTE_DX11 /nologo /Fobuild\ /F
 /EHsc /FS /Zi /MDd /Od sample.cpp ^
 /link ^
 /SUBSYSTEM:CONSOLE user32.lib gdi32.lib d3d11.lib dxguid.lib d3dcompiler.lib dsound.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/asset_cooker.exe ^
+/EHsc /FS /Zi /MDd /Od asset_cooker.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+build\asset_cooker.exe build\sample_assets.tepack sample_assets/hero.png
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/slot_map_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\slot_map_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_MATH /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/math_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\math_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/image_decode_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\image_decode_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/atlas_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\atlas_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/ring_buffer_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\ring_buffer_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_NULL_GRAPHICS /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/dispatch_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\dispatch_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_NULL_GRAPHICS /DTE_SOFTWARE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/dispatch_table_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\dispatch_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/jobs_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\jobs_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_NULL_GRAPHICS /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/text_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\text_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/sprite_pack_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\sprite_pack_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_PHYSICS /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/broadphase_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\broadphase_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_PHYSICS /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/rigid_body_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\rigid_body_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_PHYSICS /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/scene_query_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\scene_query_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_GAMEPLAY /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/ecs_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\ecs_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_NETWORK /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/network_benchmark.exe ^
+/EHsc /FS /Zi /MD /O2 benchmarks\network_benchmark.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib ws2_32.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_SOFTWARE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/software_golden_test.exe ^
+/EHsc /FS /Zi /MDd /Od tests\software_golden_test.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/ring_buffer_test.exe ^
+/EHsc /FS /Zi /MDd /Od tests\ring_buffer_test.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /DTE_NULL_GRAPHICS /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/batching_test.exe ^
+/EHsc /FS /Zi /MDd /Od tests\batching_test.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/texture_loader_test.exe ^
+/EHsc /FS /Zi /MDd /Od tests\texture_loader_test.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+cl /std:c++20 /DNOMINMAX /DUNICODE /nologo /Fobuild\ /Fd"build\obj.pdb" /Febuild/frame_pacer_test.exe ^
+/EHsc /FS /Zi /MDd /Od tests\frame_pacer_test.cpp ^
+/link ^
+/SUBSYSTEM:CONSOLE ole32.lib windowscodecs.lib
+
+build\software_golden_test.exe || exit /b 1
+build\ring_buffer_test.exe || exit /b 1
+build\batching_test.exe || exit /b 1
+build\texture_loader_test.exe || exit /b 1
+build\frame_pacer_test.exe || exit /b 1
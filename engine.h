@@ -3,41 +3,243 @@
 // TE_MATH etc.
 // TODO add better documentation here
 #pragma once
-#include <locale>
-#include <codecvt>
-#include <wincodec.h>
-#include <map>
-#include <comdef.h>
+
+#ifdef TE_EVERYTHING
+#ifndef TE_MATH
+#define TE_MATH
+#endif
+#ifndef TE_2D
+#define TE_2D
+#endif
+#ifndef TE_3D
+#define TE_3D
+#endif
+#ifndef TE_NETWORK
+#define TE_NETWORK
+#endif
+#ifndef TE_PHYSICS
+#define TE_PHYSICS
+#endif
+#ifndef TE_GAMEPLAY
+#define TE_GAMEPLAY
+#endif
+#ifndef TE_SOFTWARE
+#define TE_SOFTWARE
+#endif
+#ifndef TE_NULL_GRAPHICS
+#define TE_NULL_GRAPHICS
+#endif
+// The platform layers only exist on Windows.
+#ifdef _WIN32
+#ifndef TE_WINDOWING
+#define TE_WINDOWING
+#endif
+#ifndef TE_DX11
+#define TE_DX11
+#endif
+#endif
+#endif
+
+// The rigid bodies of the physics module use the math types.
+#if defined(TE_PHYSICS) && !defined(TE_MATH)
+#define TE_MATH
+#endif
+
+// The core (everything outside of TE_WINDOWING and TE_DX11) 
+// only needs the standard library and compiles on Linux as well.
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
 #include <cassert>
-#include <ppltasks.h>
 #include <vector>
 #include <iostream>
 #include <string>
-#include <dwrite.h>
-#include <d2d1.h>
+#include <optional>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <cstdio>
+#include <bit>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TE_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define TE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#if defined(__AVX2__)
+#define TE_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+#ifdef TE_NETWORK
+// Before anything includes windows.h, which would bring in the old winsock.h.
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mstcpip.h>
+#endif
+#include <locale>
+#include <codecvt>
+#include <wincodec.h>
+#include <comdef.h>
+#include <wrl/client.h>
+using Microsoft::WRL::ComPtr;
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef TE_NETWORK
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#endif
+#endif
+
+#ifdef TE_DX11
 #include <d3d11_1.h>
+#include <dxgi1_5.h>
 #include <d3dcompiler.h>
-#include <wrl/client.h>
 #include <DirectXMath.h>
-#include <optional>
-using Microsoft::WRL::ComPtr;
+#endif
 
 namespace tiny_engine {
 
+    /// A texture, or a sub-rectangle of one, e.g. a sprite on an atlas page. 
+    /// The uv rect (0/0 is the bottom left corner) defaults to the whole texture.
     struct Texture 
     {
         uint32_t id;
+        float uvLeft = 0;
+        float uvBottom = 0;
+        float uvRight = 1;
+        float uvTop = 1;
+    };
+
+    enum class EventType : uint8_t 
+    {
+        None,
+        Quit,
+        KeyDown,
+        KeyUp,
+        /// A character typed, as a unicode code point (after keyboard layout and modifiers).
+        TextInput,
+        MouseMove,
+        MouseButtonDown,
+        MouseButtonUp,
+        MouseWheel,
+        Resize,
+        FocusGained,
+        FocusLost
+    };
+
+    /// Platform independent key codes. 
+    /// Digits and letters use their (upper case) ASCII value.
+    enum class Key : uint16_t 
+    {
+        Unknown = 0,
+        Backspace = 8, Tab = 9, Enter = 13, Escape = 27, Space = 32,
+        Num0 = '0', Num1, Num2, Num3, Num4, Num5, Num6, Num7, Num8, Num9,
+        A = 'A', B, C, D, E, F, G, H, I, J, K, L, M, N, O, P, Q, R, S, T, U, V, W, X, Y, Z,
+        Left = 0x100, Right, Up, Down,
+        Insert, Delete, Home, End, PageUp, PageDown,
+        Shift, Control, Alt,
+        F1, F2, F3, F4, F5, F6, F7, F8, F9, F10, F11, F12
+    };
+
+    enum class MouseButton : uint8_t 
+    {
+        Left,
+        Right,
+        Middle,
+        X1,
+        X2
+    };
+
+    struct KeyEvent 
+    {
+        Key key;
+        uint16_t scanCode;
+        /// Generated by holding the key down.
+        bool repeat;
+    };
+
+    struct TextInputEvent 
+    {
+        uint32_t codePoint;
+    };
+
+    /// Positions are in client area pixels, 0/0 is the top left corner.
+    struct MouseMoveEvent 
+    {
+        int32_t x, y;
+    };
+
+    struct MouseButtonEvent 
+    {
+        MouseButton button;
+        int32_t x, y;
+    };
+
+    struct MouseWheelEvent 
+    {
+        /// In notches, positive is away from the user.
+        float delta;
+        int32_t x, y;
+    };
+
+    struct ResizeEvent 
+    {
+        int32_t width, height;
     };
 
+    /// One input or window event. Plain data, the member of the 
+    /// union which is valid depends on type.
     struct Event 
     {
-        std::string type;
+        EventType type;
+        /// When the event was received, in nanoseconds of eventClock(). 
+        /// eventClock() - timestamp is the latency so far.
+        uint64_t timestamp;
+        union 
+        {
+            KeyEvent key;
+            TextInputEvent text;
+            MouseMoveEvent mouseMove;
+            MouseButtonEvent mouseButton;
+            MouseWheelEvent mouseWheel;
+            ResizeEvent resize;
+        };
+    };
 
+    enum class GraphicsApi : uint8_t 
+    {
+        Null,
+        DX11,
+        Software
     };
 
+    namespace detail {
+        struct GraphicsBackend;
+    }
+
     struct GraphicsContext 
     {
-        std::string api;
+        GraphicsApi api;
+        /// The backend's entry points, resolved once by initGraphics.
+        const detail::GraphicsBackend* backend;
     };
 
   
@@ -51,421 +253,12035 @@ namespace tiny_engine {
 
     };
 
-    
+    /// Linear (bump) allocator for transient data. 
+    /// An allocation is a pointer increment, reset() frees everything at once. 
+    /// When the block runs full another one is chained on, reset() then replaces 
+    /// the blocks by a single one big enough for all of them. 
+    /// So after a few warm up frames, a frame does not touch the heap any more.
+    class FrameArena 
+    {
+        public:
+            /// No memory is taken until the first allocation.
+            explicit FrameArena(size_t initialCapacity = 256 * 1024);
+            ~FrameArena();
+            FrameArena(const FrameArena&) = delete;
+            FrameArena& operator=(const FrameArena&) = delete;
 
-    /// Creates a window with the client area having the desired dimension.
-    Window createWindow(int width, int height, bool fullscreen);
+            void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
 
-    /// Poll the window for messages. 
-    /// Necessary to have the window responsible, react to mouse movement, clicks,
-    /// is closable etc.
-    /// TODO return a list of frame events, including input events etc.
-    std::vector<Event> pollWindowMessages(Window window);
+            template<typename T>
+            T* allocateArray(size_t count) 
+            {
+                return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+            }
 
-    /// Holds the necessary data for a given 3D api. 
-    /// Filled by the engine, borrowed to the client, 
-    /// who passes it back on every api call. 
-    /// So the engine can always decide, which internal API 
-    /// calls to actually trigger. 
-    /// api: 
-    /// dx11
-    /// dx12
-    /// vulkan
-    /// opengl
-    GraphicsContext* initGraphics(const std::string& api, Window window);
+            /// Frees all allocations, no destructors are run.
+            void reset();
 
-    /// Clears the backbuffer to the given RGB color, 
-    /// and the depthbuffer to 1.
-    void clearBackBuffer(GraphicsContext* context, float r, float g, float b, float a);
+            size_t bytesUsed() const { return used; }
+            size_t capacity() const { return reserved; }
+            /// Allocations since the last reset.
+            uint32_t allocationCount() const { return allocations; }
+            /// Blocks taken from the heap since the arena was created.
+            uint32_t blockAllocationCount() const { return blockAllocations; }
 
-    /// 
-    /// Flips the backbuffer, presenting its contents to the main window.
-    void presentBackBuffer(GraphicsContext* context);
+        private:
+            // Blocks are chained through a header at their start.
+            struct BlockHeader 
+            {
+                BlockHeader* previous;
+                size_t size;
+            };
 
-    /// Binds the default (window) backbuffer. 
-    /// Must be done before any clear or draw operation.
-    void bindBackBuffer(GraphicsContext* context, int x, int y, int width, int height);
+            void addBlock(size_t minimumSize);
+            void freeBlocks();
+
+            BlockHeader* head = nullptr;
+            uint8_t* cursor = nullptr;
+            uint8_t* end = nullptr;
+            size_t initialCapacity;
+            size_t reserved = 0;
+            size_t used = 0;
+            uint32_t blockCount = 0;
+            uint32_t allocations = 0;
+            uint32_t blockAllocations = 0;
+    };
 
-    std::optional<Texture> createTextureFromFile(GraphicsContext* context, const std::string& fileName);
+    /// The arena of the current frame. 
+    /// There are two, presentBackBuffer swaps them and resets the older one, 
+    /// so an allocation stays valid until the end of the following frame 
+    /// (e.g. for data the GPU or a worker still reads while the next frame is built). 
+    /// Not thread safe, only for the thread running the frame loop.
+    FrameArena& frameArena();
+
+    /// Standard allocator on top of a frame arena, for containers which only live for a frame. 
+    /// Default constructed it uses the current frameArena(). 
+    /// Deallocation is a no-op, the memory comes back when the arena is reset.
+    template<typename T>
+    struct FrameAllocator 
+    {
+        using value_type = T;
 
-    void drawTexture(GraphicsContext* dx11Context, Texture t, int x, int y);
+        FrameArena* arena;
 
-    /// This is the private part of the API, 
-    /// should only be used internally. 
-    /// Call at your own risk, but better do not call at all!
-    namespace detail {
+        FrameAllocator() : arena(&frameArena()) {}
+        FrameAllocator(FrameArena& arena) : arena(&arena) {}
+        template<typename U>
+        FrameAllocator(const FrameAllocator<U>& other) : arena(other.arena) {}
 
-        template<typename T>
-        class ResourceStorage 
-        {
-            public:
-                uint32_t store(T* resource) 
-                {
-                    
-                    auto it = toIdStorage.find(resource);                        
-                    if (it != toIdStorage.end()) return it->second;
-                    uint32_t id = nextId++;
-                    storage[id] = resource;
-                    toIdStorage[resource] = id;
-                    return id;
+        T* allocate(size_t count) { return arena->allocateArray<T>(count); }
+        void deallocate(T*, size_t) {}
 
-                }
+        template<typename U>
+        bool operator==(const FrameAllocator<U>& other) const { return arena == other.arena; }
+        template<typename U>
+        bool operator!=(const FrameAllocator<U>& other) const { return arena != other.arena; }
+    };
 
-                T* get(uint32_t id)
-                {
-                    auto it = storage.find(id);
-                    return (it != storage.end()) ? it->second : nullptr;
-                }
+    template<typename T>
+    using FrameVector = std::vector<T, FrameAllocator<T>>;
 
-            private:
-                uint32_t nextId = 1; // 0 = invalid
-                std::map<uint32_t, T*> storage;
-                std::map<T*, uint32_t> toIdStorage;
+    /// What the last presented frame allocated.
+    struct FrameAllocationStats 
+    {
+        uint32_t arenaAllocations;
+        size_t arenaBytes;
+        /// Heap blocks the frame arenas had to take, 0 once they are warmed up.
+        uint32_t arenaBlockAllocations;
+        /// Every operator new of the frame, engine and game. 
+        /// Only counted if TE_TRACK_HEAP_ALLOCATIONS is defined, 0 otherwise.
+        uint64_t heapAllocations;
+    };
 
-        };
+    FrameAllocationStats getFrameAllocationStats();
 
-        namespace dx11 {
+    /// How well the draws of the last presented frame were batched. 
+    /// Counted on the CPU side, the null backend counts too, 
+    /// so batching can be tracked without a GPU.
+    struct RenderStats 
+    {
+        /// drawTexture calls.
+        uint32_t drawsSubmitted;
+        /// Draw calls which reached the backend after sorting and batching.
+        uint32_t drawCalls;
+        /// Draws of command lists dropped by culling, they are included in drawsSubmitted.
+        uint32_t drawsCulled;
+        /// Binds actually issued (shader, input layout, buffers, topology, texture, sampler).
+        uint32_t stateChanges;
+        /// Binds skipped because the state was already set.
+        uint32_t stateChangesSkipped;
+    };
 
-            struct InternalContext 
-            {
-                uint32_t spriteVertexShaderId;
-                uint32_t spritePixelShaderId;
-                uint32_t spriteShaderId;
-                uint32_t spriteShaderInputLayoutId;
-                uint32_t spriteVertexBufferId;
-                uint32_t spriteIndexBufferId;
-                uint32_t spriteSamplerId;
-                uint32_t quadModelId;
-                uint32_t objectTransformBufferId;
-                uint32_t cameraBufferId;
+    RenderStats getRenderStats(GraphicsContext* context);
+
+    // ------------------------------------------------------------------------
+    // Jobs
+    //
+    // A work stealing job system. Every job thread (the main thread, which calls initJobs, 
+    // and the workers) has its own deque: new jobs go to the bottom of the deque 
+    // of the thread creating them, idle threads steal from the top of the others. 
+    // Jobs are plain function pointers with a data pointer, scheduling one does not allocate. 
+    // Waiting on a counter runs other jobs meanwhile, so jobs can wait for jobs.
+    // Without initJobs every job runs inline on the calling thread.
+
+    /// Counts unfinished jobs: starting a job with the counter increments it, 
+    /// the job finishing decrements it. Must outlive the jobs using it.
+    struct JobCounter 
+    {
+        std::atomic<uint32_t> pending { 0 };
+    };
 
-                DirectX::XMMATRIX orthoProjectionMatrix;
+    using JobFunction = void (*)(void* data);
+
+    /// Starts the workers, workerCount 0 uses one less than there are hardware threads. 
+    /// The calling thread becomes the main thread of the job system.
+    void initJobs(uint32_t workerCount = 0);
+    /// Waits for the workers to finish their current job and joins them. 
+    /// Jobs still queued are not run.
+    void shutdownJobs();
+    /// Worker threads plus the main thread, 1 without initJobs.
+    uint32_t jobThreadCount();
+
+    /// Runs function(data) on any job thread.
+    void runJob(JobFunction function, void* data, JobCounter* counter = nullptr);
+    /// Like runJob, but the job only starts once dependency reached 0. 
+    /// Until then the thread which picked it up runs other jobs.
+    void runJobAfter(JobCounter& dependency, JobFunction function, void* data, JobCounter* counter = nullptr);
+    /// For jobs which must run on the main thread, e.g. because they use the graphics device. 
+    /// They run in runMainThreadJobs or while the main thread waits on a counter.
+    void runMainThreadJob(JobFunction function, void* data, JobCounter* counter = nullptr);
+    void runMainThreadJobs();
+
+    /// Runs other jobs until counter reached 0.
+    void waitForCounter(JobCounter& counter);
+
+    /// Calls body(context, begin, end) for consecutive batches of [0, count), 
+    /// spread over all job threads including the calling one. Returns when all are done.
+    void parallelFor(uint32_t count, uint32_t batchSize, 
+                     void (*body)(void* context, uint32_t begin, uint32_t end), void* context);
+
+    /// parallelFor with any callable body(begin, end).
+    template<typename Body>
+    void parallelFor(uint32_t count, uint32_t batchSize, const Body& body) 
+    {
+        parallelFor(count, batchSize, [](void* context, uint32_t begin, uint32_t end) {
+            (*static_cast<const Body*>(context))(begin, end);
+        }, (void*) &body);
+    }
 
-                HWND hwnd;
+    // ------------------------------------------------------------------------
+    // Profiling
+    //
+    // With TE_PROFILE defined, TE_PROFILE_SCOPE("name") times the rest of the enclosing block. 
+    // Every thread records into its own lock free buffer, the buffers are collected once 
+    // per frame in presentBackBuffer (or profileEndFrame for loops which do not present). 
+    // On dx11 the engine passes are also timed on the GPU with timestamp queries. 
+    // Without TE_PROFILE the macros are empty and none of this is compiled.
+
+#ifdef TE_PROFILE
+#define TE_PROFILE_CONCAT_INNER(a, b) a##b
+#define TE_PROFILE_CONCAT(a, b) TE_PROFILE_CONCAT_INNER(a, b)
+#define TE_PROFILE_SCOPE(name) tiny_engine::ProfileScope TE_PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define TE_PROFILE_THREAD(name) tiny_engine::setProfileThreadName(name)
+#else
+#define TE_PROFILE_SCOPE(name)
+#define TE_PROFILE_THREAD(name)
+#endif
 
-            };
+#ifdef TE_PROFILE
+    /// Times its lifetime, use it through TE_PROFILE_SCOPE. 
+    /// Only the name pointer is kept, so it must be a string literal (or live as long).
+    class ProfileScope 
+    {
+        public:
+            explicit ProfileScope(const char* name);
+            ~ProfileScope();
+            ProfileScope(const ProfileScope&) = delete;
+            ProfileScope& operator=(const ProfileScope&) = delete;
+
+        private:
+            const char* name;
+            uint64_t start;
+    };
 
-            struct ConstantBuffer 
-            {
+    /// Names the calling thread in captures, same lifetime rules as scope names.
+    void setProfileThreadName(const char* name);
 
-                ComPtr<ID3D11Buffer> buffer;
-            };
+    /// Frame times in buckets of bucketMilliseconds, the last bucket takes everything slower.
+    struct FrameTimeHistogram 
+    {
+        static constexpr uint32_t bucketCount = 100;
+        static constexpr double bucketMilliseconds = 0.5;
+
+        uint32_t buckets[bucketCount];
+        uint32_t frameCount;
+        double minMilliseconds;
+        double maxMilliseconds;
+        double totalMilliseconds;
+
+        /// The frame time fraction (0..1) of the frames stayed below, 
+        /// precise to a bucket, e.g. percentile(0.99).
+        double percentile(double fraction) const;
+    };
 
-            struct Model 
-            {
-                ComPtr<ID3D11Buffer> vertexBuffer;
-                ComPtr<ID3D11Buffer> indexBuffer;
-                size_t indexCount = 0;
-                uint32_t stride = 0;
-            };
+    FrameTimeHistogram getFrameTimeHistogram();
+    void resetFrameTimeHistogram();
 
-            struct Sampler  
-            {
-                ComPtr<ID3D11SamplerState> samplerState;
-            };
+    /// Starts keeping every scope of the following frames.
+    void beginProfileCapture();
+    /// Stops the capture and writes it as Chrome trace event JSON, 
+    /// which chrome://tracing, Perfetto and Speedscope open. 
+    /// Returns false if the file could not be written.
+    bool endProfileCapture(const std::string& fileName);
 
-            struct Camera
-            {
+    /// Ends a frame: collects the buffers of all threads and adds the frame time to the histogram.
+    void profileEndFrame();
+#endif
 
-                DirectX::XMFLOAT4X4 view;
-                DirectX::XMFLOAT4X4 projection;
-            };
+#ifdef TE_MATH
+    // ------------------------------------------------------------------------
+    // Math
+    //
+    // Matrices are row major and use the row vector convention (v * M), 
+    // the same as the engine shaders and DirectXMath: 
+    // the translation lives in the last row and 
+    // a * b applies a first, then b.
 
+    struct Vec2 
+    {
+        float x, y;
+    };
 
-            struct InputLayout
-            {
-                ComPtr<ID3D11InputLayout> inputLayout;
-            };
-            
-            struct DX11Texture {
-                ComPtr<ID3D11Texture2D> texture;
-                ComPtr<ID3D11RenderTargetView> rtv;
-                ComPtr<ID3D11ShaderResourceView> srv;
-            };
+    struct Vec3 
+    {
+        float x, y, z;
+    };
 
-            struct VertexShader 
-            {
-                ComPtr<ID3DBlob> blob;
-                ComPtr<ID3D11VertexShader> shader;
+    struct alignas(16) Vec4 
+    {
+        float x, y, z, w;
+    };
 
-            };
+    /// Rotation quaternion, w is the scalar part.
+    struct alignas(16) Quat 
+    {
+        float x, y, z, w;
+    };
 
-            struct PixelShader 
-            {
-                ComPtr<ID3DBlob> blob;
-                ComPtr<ID3D11PixelShader> shader;
-            };
+    struct alignas(16) Mat4 
+    {
+        float m[4][4];
+    };
 
-            struct ShaderProgram 
-            {
-                VertexShader* vs;
-                PixelShader* ps;
-            };
+    inline Vec2 operator+(Vec2 a, Vec2 b) { return { a.x + b.x, a.y + b.y }; }
+    inline Vec2 operator-(Vec2 a, Vec2 b) { return { a.x - b.x, a.y - b.y }; }
+    inline Vec2 operator*(Vec2 a, float s) { return { a.x * s, a.y * s }; }
+    inline float dot(Vec2 a, Vec2 b) { return a.x * b.x + a.y * b.y; }
+
+    inline Vec3 operator+(Vec3 a, Vec3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    inline Vec3 operator-(Vec3 a, Vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    inline Vec3 operator*(Vec3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+    inline float dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline Vec3 cross(Vec3 a, Vec3 b) 
+    { 
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; 
+    }
 
-            struct VertexAttributeDescription {
-                std::string semanticName;       
-                uint32_t attributeLocation;
-                int numberOfComponents;     
-                DXGI_FORMAT format;
-                int stride;
-                uint32_t offset;
+    inline Vec4 operator+(Vec4 a, Vec4 b) { return { a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w }; }
+    inline Vec4 operator-(Vec4 a, Vec4 b) { return { a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w }; }
+    inline Vec4 operator*(Vec4 a, float s) { return { a.x * s, a.y * s, a.z * s, a.w * s }; }
+    inline float dot(Vec4 a, Vec4 b) { return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w; }
+
+    inline float length(Vec2 v) { return std::sqrt(dot(v, v)); }
+    inline float length(Vec3 v) { return std::sqrt(dot(v, v)); }
+    inline float length(Vec4 v) { return std::sqrt(dot(v, v)); }
+    Vec2 normalize(Vec2 v);
+    Vec3 normalize(Vec3 v);
+    Vec4 normalize(Vec4 v);
+
+    Mat4 identityMatrix();
+    Mat4 translationMatrix(float x, float y, float z);
+    Mat4 scalingMatrix(float x, float y, float z);
+    Mat4 rotationMatrix(Quat q);
+    /// Scale, then rotate, then translate.
+    Mat4 composeTransform(Vec3 translation, Quat rotation, Vec3 scale);
+    /// Same projection as XMMatrixOrthographicLH.
+    Mat4 orthographicMatrixLH(float width, float height, float nearZ, float farZ);
+    /// Same projection as XMMatrixPerspectiveFovLH.
+    Mat4 perspectiveMatrixLH(float fovY, float aspect, float nearZ, float farZ);
+    Mat4 lookAtMatrixLH(Vec3 eye, Vec3 target, Vec3 up);
+    Mat4 transpose(const Mat4& m);
+    /// General inverse, returns the identity for singular matrices.
+    Mat4 inverse(const Mat4& m);
+    Mat4 operator*(const Mat4& a, const Mat4& b);
+    Vec4 operator*(Vec4 v, const Mat4& m);
+    /// v * m with w = 1, without the perspective divide.
+    Vec3 transformPoint(Vec3 v, const Mat4& m);
+    /// v * m with w = 0.
+    Vec3 transformDirection(Vec3 v, const Mat4& m);
+
+    Quat identityQuat();
+    Quat quatFromAxisAngle(Vec3 axis, float radians);
+    Quat normalize(Quat q);
+    Quat conjugate(Quat q);
+    /// Hamilton product, a * b rotates by b first, then by a.
+    Quat operator*(Quat a, Quat b);
+    Vec3 rotate(Quat q, Vec3 v);
+    Quat slerp(Quat a, Quat b, float t);
+
+    /// Batched kernel: transforms count points (w = 1) given in 
+    /// structure-of-arrays layout by one matrix. 
+    /// In and out arrays may be the same.
+    void transformPoints(const Mat4& m, const float* x, const float* y, const float* z, 
+                         float* outX, float* outY, float* outZ, size_t count);
+
+    /// Batched kernel: builds count transform matrices (scale, rotate, translate)
+    /// from translations, rotations and scales in structure-of-arrays layout.
+    void composeTransforms(const float* tx, const float* ty, const float* tz,
+                           const float* qx, const float* qy, const float* qz, const float* qw,
+                           const float* sx, const float* sy, const float* sz,
+                           Mat4* out, size_t count);
+#endif
 
-            };
+#ifdef TE_PHYSICS
+    // ------------------------------------------------------------------------
+    // Physics
+    //
+    // The broadphase finds the pairs of bodies whose axis aligned bounding boxes overlap. 
+    // The boxes are passed in structure-of-arrays form, a body is its index into the arrays. 
+    // Two algorithms: 
+    // Sweep and prune sorts the boxes along the axis they spread most over and keeps that order 
+    // from step to step, so re-sorting moving bodies is close to linear. The other two axes are 
+    // tested 4 boxes at a time with SIMD. 
+    // The spatial hash bins the boxes into a uniform grid, which suits bodies of about the same size. 
+    // The pair search is spread over the job threads (see initJobs). The pairs come out in the 
+    // same order for any number of threads.
+
+    enum class BroadphaseType 
+    {
+        SweepAndPrune,
+        SpatialHash
+    };
 
-            bool init(Window window);
-            void printDXGIError(HRESULT hr);
-            bool resizeSwapChain(HWND hwnd, int width, int height);
-            bool createDefaultDepthStencilBuffer(int width, int height);
-            void setViewport(int originX, int originY, int width, int height);
-            void clearBackBuffer(float r, float g, float b, float a);
-            void presentBackBuffer();
-            void bindBackBuffer(int x, int y, int width, int height);
-            void drawTexture(DX11Texture* texture, Sampler *sampler, ShaderProgram* shader,
-                                InputLayout* inputLayout, Model* quadModel,
-                                int x, int y);
-            void drawIndexed(uint32_t indexCount, uint32_t startIndex);
-            void bindInputLayout(dx11::InputLayout *inputLayout);
-            void bindVertexBuffer(ComPtr<ID3D11Buffer> vertexBuffer, uint32_t stride, uint32_t offset);
-            void bindIndexBuffer(ComPtr<ID3D11Buffer> indexBuffer, uint32_t offset);
-            void bindTexture(DX11Texture *texture, uint32_t slot,
-                             Sampler *sampler, uint32_t samplerSlot);
-            void bindShader(ShaderProgram* shader);
-            void uploadConstantBufferDataForVertexShader(ComPtr<ID3D11Buffer> buffer, void *data, 
-                                                        size_t size, uint32_t slot);
-            void uploadConstantBufferDataForPixelShader(ComPtr<ID3D11Buffer> buffer, void *data, 
-                                                        size_t size, uint32_t slot);
-            void copyConstantBufferData(ComPtr<ID3D11Buffer> buffer, void *data, size_t size);
+    struct BroadphaseSettings 
+    {
+        BroadphaseType type = BroadphaseType::SweepAndPrune;
+        /// Spatial hash cell size, at least the size of the bodies along every axis. 
+        /// Bodies bigger than a cell are tested against all other bodies.
+        float cellSize = 1;
+        /// Size of the pair buffer, which is allocated once. 
+        /// Pairs beyond it are dropped and counted in BroadphaseStats.
+        uint32_t maxPairs = 1 << 16;
+    };
 
-            VertexShader* createVertexShaderFromSource(const std::string& source);
-            PixelShader* createPixelShaderFromSource(const std::string& source);
-            ConstantBuffer* createConstantBuffer(size_t size);
-            DX11Texture *createTextureFromFile(const std::string &fileName);
-            InputLayout* createInputLayout(std::vector<dx11::VertexAttributeDescription> descs, 
-                                                dx11::ShaderProgram* shaderProgram);
+    struct Broadphase 
+    {
+        uint32_t id;
+    };
 
-            Sampler *createSampler(D3D11_TEXTURE_ADDRESS_MODE addressMode,
-                                   DirectX::XMVECTOR borderColor, D3D11_FILTER filter);
-            ComPtr<ID3D11Buffer> createVertexBuffer(const float *data, size_t size, D3D11_USAGE usage);
-            ComPtr<ID3D11Buffer> createIndexBuffer(const uint32_t *data, size_t size, D3D11_USAGE usage);
-            Model* createModelFromGeometry(const std::vector<float>& vertices,
-                                            const std::vector<uint32_t>& indices, 
+    /// Boxes of count bodies, body i is at index i of every array.
+    struct AabbArrays 
+    {
+        const float* minX;
+        const float* minY;
+        const float* minZ;
+        const float* maxX;
+        const float* maxY;
+        const float* maxZ;
+    };
+
+    /// Two bodies with overlapping boxes (touching counts), a < b.
+    struct BodyPair 
+    {
+        uint32_t a;
+        uint32_t b;
+    };
+
+    struct BroadphaseStats 
+    {
+        uint32_t bodyCount;
+        uint32_t pairCount;
+        /// Pairs which did not fit into maxPairs.
+        uint32_t droppedPairs;
+        /// Sweep and prune: moves of the incremental re-sort.
+        uint32_t sortMoves;
+        /// Sweep and prune: sorted from scratch (first update or a new sweep axis).
+        bool fullSort;
+        double milliseconds;
+    };
+
+    Broadphase createBroadphase(const BroadphaseSettings& settings);
+    void destroyBroadphase(Broadphase broadphase);
+    /// Finds the overlapping pairs among count bodies and returns how many there are. 
+    /// The number of bodies may change from update to update.
+    uint32_t updateBroadphase(Broadphase broadphase, const AabbArrays& boxes, uint32_t count);
+    /// The pairs of the last update, valid until the next one.
+    const BodyPair* getBroadphasePairs(Broadphase broadphase);
+    BroadphaseStats getBroadphaseStats(Broadphase broadphase);
+
+    // A physics world moves rigid boxes and spheres under gravity and resolves their contacts
+    // with a sequential impulse solver. Each step:
+    // integrate the velocities, find the pairs (broadphase above), build the contact manifolds,
+    // split the bodies into islands (groups which touch each other), solve the contacts
+    // and integrate the positions.
+    // The islands are solved in parallel. Within an island the contacts are colored so that no
+    // two contacts of one color share a body, 4 contacts of a color are solved at once with SIMD
+    // and the colors of big islands are spread over the threads as well.
+    // The impulses of the last step are the starting point of the next (warm starting),
+    // which lets stacks come to rest within few iterations.
+    // A step gives the same result for any number of threads.
+
+    enum class ShapeType
+    {
+        Sphere,
+        Box
+    };
+
+    struct RigidBodyDesc
+    {
+        ShapeType shape = ShapeType::Box;
+        /// Half the size of a box. A sphere uses x as its radius.
+        Vec3 halfExtents = { 0.5f, 0.5f, 0.5f };
+        Vec3 position = { 0, 0, 0 };
+        Quat rotation = { 0, 0, 0, 1 };
+        Vec3 linearVelocity = { 0, 0, 0 };
+        Vec3 angularVelocity = { 0, 0, 0 };
+        /// 0 makes the body static, it never moves.
+        float mass = 1;
+        float friction = 0.5f;
+        float restitution = 0;
+    };
+
+    struct PhysicsSettings
+    {
+        Vec3 gravity = { 0, -9.81f, 0 };
+        uint32_t velocityIterations = 8;
+        /// Fraction of the penetration which is pushed apart per step.
+        float penetrationCorrection = 0.2f;
+        /// Penetration which is left alone, so resting contacts do not jitter.
+        float allowedPenetration = 0.01f;
+        BroadphaseSettings broadphase;
+    };
+
+    struct PhysicsWorld
+    {
+        uint32_t id;
+    };
+
+    struct PhysicsStats
+    {
+        uint32_t bodyCount;
+        uint32_t manifoldCount;
+        uint32_t contactCount;
+        /// Contacts which started from the impulse of the last step.
+        uint32_t warmStartedContacts;
+        uint32_t islandCount;
+        /// SIMD batches of 4 contacts, and colors of the biggest island.
+        uint32_t batchCount;
+        uint32_t colorCount;
+        double broadphaseMilliseconds;
+        double narrowphaseMilliseconds;
+        double solverMilliseconds;
+        double stepMilliseconds;
+    };
+
+    PhysicsWorld createPhysicsWorld(const PhysicsSettings& settings);
+    void destroyPhysicsWorld(PhysicsWorld world);
+    /// Adds a body and returns its index. Bodies stay in the world until it is destroyed.
+    uint32_t addRigidBody(PhysicsWorld world, const RigidBodyDesc& desc);
+    void stepPhysics(PhysicsWorld world, float deltaTime);
+    uint32_t getRigidBodyCount(PhysicsWorld world);
+    /// Positions and rotations of all bodies, body i at index i. Valid until the next addRigidBody.
+    const Vec3* getRigidBodyPositions(PhysicsWorld world);
+    const Quat* getRigidBodyRotations(PhysicsWorld world);
+    void setRigidBodyTransform(PhysicsWorld world, uint32_t body, Vec3 position, Quat rotation);
+    void setRigidBodyVelocity(PhysicsWorld world, uint32_t body, Vec3 linear, Vec3 angular);
+    PhysicsStats getPhysicsStats(PhysicsWorld world);
+
+    // Scene queries find objects along rays, along moving boxes (sweeps) and inside boxes.
+    // The objects are boxes in a dynamic bounding volume tree, every node bounds its two children.
+    // An object sits in the tree with its box grown by a margin, so small moves do not touch the tree.
+    // updateSceneTree refits the nodes above the objects which moved out of their grown box and
+    // rotates nodes with their grandchildren where that makes them smaller, so the tree stays
+    // good without rebuilds.
+    // The batched queries take 4 queries at once down the tree with SIMD (one query per lane)
+    // and spread the packets over the job threads.
+
+    struct SceneTreeSettings
+    {
+        /// Objects sit in the tree with their box grown by this much on every side.
+        float margin = 0.1f;
+    };
+
+    struct SceneTree
+    {
+        uint32_t id;
+    };
+
+    struct Aabb
+    {
+        Vec3 min;
+        Vec3 max;
+    };
+
+    /// Hits along origin + direction * distance, for distance from 0 up to maxDistance.
+    struct Ray
+    {
+        Vec3 origin;
+        Vec3 direction;
+        float maxDistance;
+    };
+
+    /// A box moved by translation. Hits are at a distance from 0 to 1 along the translation.
+    struct BoxSweep
+    {
+        Aabb box;
+        Vec3 translation;
+    };
+
+    constexpr uint32_t noSceneObject = 0xffffffff;
+
+    /// The closest object hit, or noSceneObject.
+    struct SceneHit
+    {
+        uint32_t object;
+        float distance;
+    };
+
+    /// Query box query overlaps the box of object.
+    struct SceneOverlap
+    {
+        uint32_t query;
+        uint32_t object;
+    };
+
+    struct SceneTreeStats
+    {
+        uint32_t objectCount;
+        uint32_t nodeCount;
+        uint32_t height;
+        /// Surface area of all inner nodes over the area of the root, lower is faster to query.
+        float cost;
+        /// Work of the last updateSceneTree.
+        uint32_t movedObjects;
+        uint32_t refitNodes;
+        uint32_t rotations;
+        double milliseconds;
+    };
+
+    SceneTree createSceneTree(const SceneTreeSettings& settings);
+    void destroySceneTree(SceneTree tree);
+    /// Adds an object and returns its id. The ids of removed objects are reused.
+    uint32_t addSceneObject(SceneTree tree, const Aabb& box);
+    void removeSceneObject(SceneTree tree, uint32_t object);
+    /// Sets the box of an object. Queries see it only after the next updateSceneTree.
+    void moveSceneObject(SceneTree tree, uint32_t object, const Aabb& box);
+    void updateSceneTree(SceneTree tree);
+    /// The closest hit of every ray, hits[i] for rays[i].
+    void raycastScene(SceneTree tree, const Ray* rays, SceneHit* hits, uint32_t count);
+    /// The first object every box runs into, hits[i] for sweeps[i].
+    /// Objects the box overlaps at the start are hit at distance 0.
+    void sweepScene(SceneTree tree, const BoxSweep* sweeps, SceneHit* hits, uint32_t count);
+    /// The objects overlapping the boxes, ordered by query and object. Returns how many there are,
+    /// only the first maxOverlaps of them are written.
+    uint32_t overlapScene(SceneTree tree, const Aabb* boxes, uint32_t count,
+                          SceneOverlap* overlaps, uint32_t maxOverlaps);
+    SceneTreeStats getSceneTreeStats(SceneTree tree);
+#endif
+
+#ifdef TE_GAMEPLAY
+    // ------------------------------------------------------------------------
+    // Gameplay
+    //
+    // An entity component system. An entity is only an id, its data are components,
+    // plain structs registered once per world. Entities with the same set of components
+    // (an archetype) are stored together in chunks of 16KB, every component as its own array
+    // in the chunk, so a loop over some components of many entities reads just those, in order.
+    // Queries name the components they read and write. They find their archetypes once
+    // and pick up new archetypes as they appear.
+    // Adding and removing components moves an entity to another archetype, which must not
+    // happen while a query runs over it: systems record such changes into EntityCommands,
+    // which are played back once all systems are done.
+    // runSystems runs systems which do not write what another one reads or writes
+    // at the same time on the job threads.
+
+    constexpr uint32_t maxComponents = 64;
+    using ComponentId = uint32_t;
+    /// A set of components, bit i for the component with id i.
+    using ComponentMask = uint64_t;
+
+    inline ComponentMask componentMask(std::initializer_list<ComponentId> components)
+    {
+        ComponentMask mask = 0;
+        for (ComponentId component : components) mask |= ComponentMask(1) << component;
+        return mask;
+    }
+
+    struct GameWorld
+    {
+        uint32_t id;
+    };
+
+    /// The index of a destroyed entity is reused with the next generation,
+    /// so old copies of it no longer find the new entity.
+    struct Entity
+    {
+        uint32_t index;
+        uint32_t generation;
+    };
+
+    struct Query
+    {
+        uint32_t id;
+    };
+
+    struct EntityCommands
+    {
+        uint32_t id;
+    };
+
+    /// The entities of a query in one chunk, count of them with each component in its own array.
+    struct QueryChunk
+    {
+        uint32_t count;
+        const Entity* entities;
+        uint8_t* data;
+        /// Where the array of every component starts in data.
+        const uint32_t* columnOffsets;
+
+        template<typename T>
+        T* column(ComponentId component) const
+        {
+            return reinterpret_cast<T*>(data + columnOffsets[component]);
+        }
+    };
+
+    /// Called by runSystems with the commands of the system, which are played back after all systems ran.
+    using SystemFunction = void (*)(GameWorld world, EntityCommands commands, void* context);
+
+    struct SystemDesc
+    {
+        const char* name;
+        SystemFunction function;
+        void* context;
+        /// The components the system reads and writes, including those of its queries.
+        ComponentMask read;
+        ComponentMask write;
+    };
+
+    struct GameWorldStats
+    {
+        uint32_t entityCount;
+        uint32_t archetypeCount;
+        uint32_t chunkCount;
+        /// Groups of systems which run at the same time in runSystems.
+        uint32_t systemStages;
+        double systemMilliseconds;
+        double playbackMilliseconds;
+    };
+
+    GameWorld createGameWorld();
+    void destroyGameWorld(GameWorld world);
+    /// Registers a component of size bytes (up to 4KB, aligned to at most 16) and returns its id,
+    /// maxComponents once all are taken. Components are moved with memcpy and start zeroed.
+    ComponentId registerComponent(GameWorld world, uint32_t size, uint32_t alignment);
+
+    template<typename T>
+    ComponentId registerComponent(GameWorld world)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Components are moved with memcpy.");
+        return registerComponent(world, sizeof(T), alignof(T));
+    }
+
+    // Structural changes right away. Not while systems run, they use EntityCommands instead.
+    Entity createEntity(GameWorld world, ComponentMask components);
+    void destroyEntity(GameWorld world, Entity entity);
+    void addComponents(GameWorld world, Entity entity, ComponentMask components);
+    void removeComponents(GameWorld world, Entity entity, ComponentMask components);
+
+    bool isEntityAlive(GameWorld world, Entity entity);
+    /// nullptr if the entity is gone or does not have the component.
+    /// Valid until the next structural change.
+    void* getComponent(GameWorld world, Entity entity, ComponentId component);
+
+    template<typename T>
+    T* getComponent(GameWorld world, Entity entity, ComponentId component)
+    {
+        return static_cast<T*>(getComponent(world, entity, component));
+    }
+
+    /// The entities which have all components of read and write and none of exclude.
+    Query createQuery(GameWorld world, ComponentMask read, ComponentMask write, ComponentMask exclude = 0);
+    uint32_t getQueryEntityCount(GameWorld world, Query query);
+    /// The chunks of the query, valid until the next structural change.
+    /// The array belongs to the query, so a query must not be run by two threads at once.
+    const QueryChunk* getQueryChunks(GameWorld world, Query query, uint32_t& count);
+
+    /// Calls body(const QueryChunk&) for every chunk of the query.
+    template<typename Body>
+    void forEachChunk(GameWorld world, Query query, const Body& body)
+    {
+        uint32_t count;
+        const QueryChunk* chunks = getQueryChunks(world, query, count);
+        for (uint32_t i = 0; i < count; i++) body(chunks[i]);
+    }
+
+    /// forEachChunk with the chunks spread over the job threads.
+    template<typename Body>
+    void parallelForEachChunk(GameWorld world, Query query, const Body& body)
+    {
+        uint32_t count;
+        const QueryChunk* chunks = getQueryChunks(world, query, count);
+        parallelFor(count, 1, [chunks, &body](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++) body(chunks[i]);
+        });
+    }
+
+    // Deferred structural changes, recorded from any thread (one thread per EntityCommands)
+    // and applied in the order they were recorded by playbackEntityCommands.
+    EntityCommands createEntityCommands(GameWorld world);
+    void destroyEntityCommands(EntityCommands commands);
+    /// The entity is reserved right away, it is created with its components on playback.
+    Entity deferCreateEntity(EntityCommands commands, ComponentMask components);
+    void deferDestroyEntity(EntityCommands commands, Entity entity);
+    void deferAddComponents(EntityCommands commands, Entity entity, ComponentMask components);
+    void deferRemoveComponents(EntityCommands commands, Entity entity, ComponentMask components);
+    /// Sets a component on playback, after the changes recorded before. The value is copied now.
+    void deferSetComponent(EntityCommands commands, Entity entity, ComponentId component, const void* value);
+
+    void playbackEntityCommands(EntityCommands commands);
+
+    /// Systems run in runSystems. A system waits for the systems added before it which write
+    /// what it reads or writes, or read what it writes, the others run at the same time.
+    void addSystem(GameWorld world, const SystemDesc& desc);
+    /// Runs all systems, then plays back their commands in the order the systems were added.
+    void runSystems(GameWorld world);
+    GameWorldStats getGameWorldStats(GameWorld world);
+#endif
+
+#ifdef TE_NETWORK
+    // ------------------------------------------------------------------------
+    // Network
+    //
+    // A UDP transport for dedicated servers and their clients. One socket serves every
+    // connection. receivePackets and sendPackets move whole batches of datagrams per
+    // socket call (recvmmsg/sendmmsg on Linux), so a server core can serve many clients.
+    // Datagrams and queued messages live in a pool of fixed size packet buffers which is
+    // allocated once, nothing is allocated per packet.
+    // Every packet acks the packets which came from the other side, the newest one by its
+    // sequence and the 32 before it as a bitfield. Messages on reliable channels stay in
+    // their buffers until a packet carrying them is acked, and are sent again otherwise.
+    // They are delivered once and in order. Messages on unreliable channels are sent once
+    // and delivered as they come. Messages larger than a packet are split into fragments
+    // and joined again before they are delivered.
+    // There is no handshake or encryption, a connection is just the address of the other side.
+
+    constexpr uint32_t maxChannels = 8;
+    constexpr uint32_t noConnection = 0xffffffff;
+
+    /// IPv4 address and port, both in host byte order.
+    struct NetAddress
+    {
+        uint32_t ip;
+        uint16_t port;
+    };
+
+    /// Parses a dotted address like "127.0.0.1", 0.0.0.0 (any address) if it does not parse.
+    NetAddress netAddress(const char* ip, uint16_t port);
+
+    enum class ChannelType : uint8_t
+    {
+        Unreliable,
+        Reliable
+    };
+
+    struct TransportSettings
+    {
+        /// Where to receive, port 0 picks a free port (see getTransportAddress).
+        NetAddress bind = { 0, 0 };
+        uint32_t maxConnections = 64;
+        /// Packets from unknown addresses open a connection, for servers.
+        bool acceptConnections = true;
+        /// Packet buffers of the pool. Queued and unacked messages, received packets until the next
+        /// receivePackets and the packets of one batch take a buffer each. sendMessage leaves
+        /// 2 * batchSize of them for sending and receiving.
+        uint32_t packetCount = 4096;
+        /// Datagrams per socket call.
+        uint32_t batchSize = 64;
+        /// Both sides must use the same channels.
+        uint32_t channelCount = 2;
+        ChannelType channels[maxChannels] = { ChannelType::Unreliable, ChannelType::Reliable };
+        /// Larger messages are refused, at most 256KB. A connection allocates a buffer of this
+        /// size for a channel when the first fragmented message comes in on it.
+        uint32_t maxMessageSize = 64 * 1024;
+        /// Unacked reliable messages are sent again after this, or 1.5 round trips if that is longer.
+        double resendSeconds = 0.1;
+        /// Connections which receive nothing for this long are closed with a Disconnected event.
+        double timeoutSeconds = 5;
+        /// Drops this fraction of the outgoing packets, to test reliability.
+        float simulatedPacketLoss = 0;
+    };
+
+    struct Transport
+    {
+        uint32_t id;
+    };
+
+    enum class NetEventType
+    {
+        /// A packet from a new address opened the connection.
+        Connected,
+        /// The connection timed out, its index may be reused.
+        Disconnected,
+        Message
+    };
+
+    struct NetEvent
+    {
+        NetEventType type;
+        uint32_t connection;
+        uint32_t channel;
+        /// The message, valid until the next receivePackets.
+        const uint8_t* data;
+        uint32_t size;
+    };
+
+    struct TransportStats
+    {
+        uint64_t packetsSent;
+        uint64_t packetsReceived;
+        uint64_t bytesSent;
+        uint64_t bytesReceived;
+        /// Socket calls, far fewer than packets while the batches fill up.
+        uint64_t sendCalls;
+        uint64_t receiveCalls;
+        uint64_t messagesResent;
+        /// Packets dropped by simulatedPacketLoss or which the socket did not take.
+        uint64_t packetsDropped;
+        /// Received packets which were not ours, duplicates or too late to ack,
+        /// or came from an unknown address.
+        uint64_t packetsIgnored;
+        /// Times a packet buffer was needed and the pool was empty.
+        uint64_t poolExhausted;
+        uint32_t freePackets;
+        uint32_t connectionCount;
+    };
+
+    /// Opens and binds the socket, nothing if that fails.
+    std::optional<Transport> createTransport(const TransportSettings& settings);
+    void destroyTransport(Transport transport);
+    /// The address the socket is bound to, with the port picked for port 0.
+    NetAddress getTransportAddress(Transport transport);
+
+    /// The connection to this address, opened if there is none yet.
+    /// noConnection if all maxConnections are in use.
+    uint32_t openConnection(Transport transport, NetAddress address);
+    /// Drops the connection and its queued messages right away. The other side times out.
+    void closeConnection(Transport transport, uint32_t connection);
+    NetAddress getConnectionAddress(Transport transport, uint32_t connection);
+    /// Smoothed round trip time of the acked packets.
+    double getConnectionRoundTrip(Transport transport, uint32_t connection);
+
+    /// Copies the message into packet buffers, it goes out with the next sendPackets.
+    /// Returns false if the connection or channel does not exist, the message is too large,
+    /// the pool is empty or 256 reliable messages (fragments count each) of the channel are unacked.
+    bool sendMessage(Transport transport, uint32_t connection, uint32_t channel, const void* data, uint32_t size);
+    /// Packs the queued messages, due resends and pending acks into packets and sends them.
+    void sendPackets(Transport transport);
+    /// Receives everything waiting on the socket and queues the events, also times out connections.
+    void receivePackets(Transport transport);
+    /// Takes the oldest event of the last receivePackets, returns false if there is none.
+    bool nextNetEvent(Transport transport, NetEvent& event);
+    TransportStats getTransportStats(Transport transport);
+#endif
+
+    
+
+    /// Creates a window with the client area having the desired dimension.
+    Window createWindow(int width, int height, bool fullscreen);
+
+    /// Poll the window for messages. 
+    /// Necessary to have the window responsible, react to mouse movement, clicks,
+    /// is closable etc.
+    /// The resulting events are queued, drain them with nextEvent.
+    void pollWindowMessages(Window window);
+
+    /// Takes the oldest queued event, returns false if there is none. 
+    bool nextEvent(Event& event);
+
+    /// Queues an event as if it came from the window, e.g. for replays or headless runs. 
+    /// The timestamp is set if it is 0. 
+    /// Returns false if the queue is full, the event is dropped then.
+    bool pushEvent(Event event);
+
+    /// High resolution clock of the event timestamps, in nanoseconds.
+    uint64_t eventClock();
+
+    /// Holds the necessary data for a given 3D api. 
+    /// Filled by the engine, borrowed to the client, 
+    /// who passes it back on every api call. 
+    /// So the engine can always decide, which internal API 
+    /// calls to actually trigger. 
+    /// api: 
+    /// dx11
+    /// software (headless CPU rasterizer, needs TE_SOFTWARE)
+    /// null (renders nothing, to measure the engine side of every call, needs TE_NULL_GRAPHICS)
+    /// dx12
+    /// vulkan
+    /// opengl
+    GraphicsContext* initGraphics(const std::string& api, Window window);
+
+    /// Where compiled shaders are cached, "shader_cache" in the working directory by default. 
+    /// Set it before initGraphics, an empty directory turns the cache off. 
+    /// The cached bytecode does not depend on the machine, so the directory can be 
+    /// filled at build time (by running once) and shipped, then no launch compiles anything.
+    void setShaderCacheDirectory(const std::string& directory);
+
+    /// Shader cache use since start.
+    struct ShaderCacheStats 
+    {
+        uint32_t hits;
+        uint32_t misses;
+        /// Reading the cached bytecode.
+        double loadMilliseconds;
+        /// Compiling the misses.
+        double compileMilliseconds;
+    };
+
+    ShaderCacheStats getShaderCacheStats();
+
+    /// Clears the backbuffer to the given RGB color, 
+    /// and the depthbuffer to 1.
+    void clearBackBuffer(GraphicsContext* context, float r, float g, float b, float a);
+
+    /// 
+    /// Flips the backbuffer, presenting its contents to the main window.
+    void presentBackBuffer(GraphicsContext* context);
+
+    /// Binds the default (window) backbuffer. 
+    /// Must be done before any clear or draw operation.
+    void bindBackBuffer(GraphicsContext* context, int x, int y, int width, int height);
+
+    /// How presentBackBuffer presents and paces the frames.
+    struct PresentSettings 
+    {
+        /// 1 waits for the vertical blank (vsync), 0 presents right away.
+        uint32_t syncInterval = 1;
+        /// Back buffers of the dx11 flip model swap chain, 2 to 16.
+        uint32_t bufferCount = 2;
+        /// How many frames the CPU may queue ahead of the display on dx11, 1 to 16. 
+        /// presentBackBuffer waits on the swap chain until the queue has room, 
+        /// so the next frame starts (and reads its input) as late as possible.
+        uint32_t maxFrameLatency = 1;
+        /// With syncInterval 0 on dx11, present without waiting for the blank 
+        /// (tearing, for variable refresh rate displays), if the system supports it.
+        bool allowTearing = false;
+        /// presentBackBuffer holds the loop to this many frames per second, 
+        /// it sleeps and spins the last part for accuracy. 0 is no limit. Works on every backend.
+        double targetFrameRate = 0;
+    };
+
+    /// Applies the settings right away, call it between frames. 
+    /// A different bufferCount recreates the dx11 back buffers.
+    void setPresentSettings(GraphicsContext* context, const PresentSettings& settings);
+
+    PresentSettings getPresentSettings();
+
+    /// Where the time of the last frame went, in milliseconds.
+    struct FrameTiming 
+    {
+        /// From the start of the frame to presentBackBuffer: the game's CPU work.
+        double cpuTime;
+        /// Inside the backend present, e.g. the last sprite flush and the Present call.
+        double presentTime;
+        /// Waiting in the frame rate limiter.
+        double limiterWaitTime;
+        /// Waiting until the swap chain takes another frame (see maxFrameLatency).
+        double latencyWaitTime;
+        /// From the start of the frame to the start of the next one.
+        double frameTime;
+    };
+
+    /// The timing of the last presented frame.
+    FrameTiming getFrameTiming();
+
+    std::optional<Texture> createTextureFromFile(GraphicsContext* context, const std::string& fileName);
+
+    /// Draws the texture as a sprite centered at x/y. 
+    /// Sprites are sorted and batched by shader and texture and actually drawn on the next 
+    /// clearBackBuffer, bindBackBuffer, submitCommandLists or presentBackBuffer.
+    void drawTexture(GraphicsContext* dx11Context, Texture t, int x, int y);
+
+    /// A sprite with everything that can be set per sprite.
+    struct Sprite 
+    {
+        Texture texture;
+        /// Center of the sprite.
+        float x = 0, y = 0;
+        float width = 64, height = 64;
+        /// Counter clockwise around the center, in radians.
+        float rotation = 0;
+        /// Multiplied with the texture color, 0xAABBGGRR (red in the lowest byte).
+        uint32_t tint = 0xffffffff;
+        /// Higher layers are drawn over lower ones, text uses layer 1.
+        uint8_t layer = 0;
+    };
+
+    /// Like drawTexture, batched the same way. 
+    /// The software backend ignores rotation and tint.
+    void drawSprite(GraphicsContext* context, const Sprite& sprite);
+
+    /// Many sprites of one texture as structure of arrays, e.g. straight from a particle system. 
+    /// x and y are required, the other arrays may be null and then use the defaults of Sprite.
+    struct SpriteArrays 
+    {
+        const float* x = nullptr;
+        const float* y = nullptr;
+        const float* width = nullptr;
+        const float* height = nullptr;
+        const float* rotation = nullptr;
+        const uint32_t* tint = nullptr;
+    };
+
+    /// Draws count sprites of the texture from the arrays, 
+    /// packed into the batch with SIMD instead of one drawSprite call each.
+    void drawSprites(GraphicsContext* context, Texture texture, const SpriteArrays& sprites, 
+                     uint32_t count, uint8_t layer = 0);
+
+    /// Releases the texture. 
+    /// Its id becomes invalid, later draws with it are ignored.
+    void destroyTexture(GraphicsContext* context, Texture t);
+
+    /// Draws recorded by one thread, to spread the per object work of a frame 
+    /// (culling, sorting, on dx11 also recording the device commands into 
+    /// a deferred context) across worker threads. 
+    /// create, destroy and submit only on the main thread. 
+    /// begin, drawTexture and close may run on any thread, one thread per list at a time. 
+    /// While lists are recorded the main thread must not rebind the back buffer 
+    /// or create and destroy textures.
+    struct CommandList 
+    {
+        uint32_t id;
+    };
+
+    CommandList createCommandList(GraphicsContext* context);
+    void destroyCommandList(GraphicsContext* context, CommandList list);
+
+    /// Starts recording, anything recorded before is dropped. 
+    /// The list culls against the view of the currently bound back buffer.
+    void beginCommandList(GraphicsContext* context, CommandList list);
+
+    /// Like drawTexture, but into the list. 
+    /// Sprites which are completely outside the view are culled right here.
+    void drawTexture(CommandList list, Texture t, int x, int y);
+
+    /// Ends recording. On dx11 the sorted draws are recorded into a D3D11 command list here, 
+    /// so most of the draw cost stays on the recording thread.
+    void closeCommandList(GraphicsContext* context, CommandList list);
+
+    /// Draws closed lists after everything drawn directly so far, in array order. 
+    /// The result only depends on the order of the array, 
+    /// never on which thread finished recording first. 
+    /// The lists can be begun again afterwards.
+    void submitCommandLists(GraphicsContext* context, const CommandList* lists, uint32_t count);
+
+    /// Images packed into shared atlas pages. 
+    /// Each entry of textures is a page plus the sub-rect of one image, 
+    /// so sprites using different images of the same page are drawn in one call.
+    struct TextureAtlas 
+    {
+        std::vector<Texture> pages;
+        std::vector<Texture> textures;
+    };
+
+    /// Loads the images and packs them into as few pages of pageSize x pageSize texels as possible.
+    /// textures[i] is the image of fileNames[i]. 
+    /// Fails if an image cannot be loaded or is bigger than a page. 
+    /// Release the atlas by destroying its pages.
+    std::optional<TextureAtlas> createTextureAtlas(GraphicsContext* context, 
+                                                   const std::vector<std::string>& fileNames, 
+                                                   uint32_t pageSize = 2048);
+
+    /// A TrueType font, rasterized at one size.
+    struct Font 
+    {
+        uint32_t id;
+    };
+
+    /// Loads a TrueType font (.ttf with glyf outlines) and rasterizes printable ASCII and Latin-1 
+    /// at pixelHeight (ascender to descender) onto one atlas page. 
+    /// Other characters are drawn as the font's missing glyph.
+    std::optional<Font> createFontFromFile(GraphicsContext* context, const std::string& fileName, 
+                                           float pixelHeight);
+
+    void destroyFont(GraphicsContext* context, Font font);
+
+    /// Draws UTF-8 text in white, starting at x/y on the baseline of its first line, 
+    /// '\n' starts a new line below. The glyphs are sprites of the font's atlas page, 
+    /// drawn above the drawTexture sprites, so all text of one font takes one draw call. 
+    /// The layout of each string is cached, redrawing a string every frame only costs the sprites.
+    void drawText(GraphicsContext* context, Font font, const std::string& text, int x, int y);
+
+    /// A memory mapped archive of cooked assets (see asset_cooker.cpp).
+    struct AssetPack 
+    {
+        uint32_t id;
+    };
+
+    /// Maps the archive into memory. Nothing is read up front, 
+    /// the OS pages the data in as textures are created from it.
+    std::optional<AssetPack> openAssetPack(const std::string& fileName);
+
+    /// Unmaps the archive. 
+    /// Textures created from it must be destroyed first, 
+    /// the software backend samples them straight from the mapping.
+    void closeAssetPack(AssetPack pack);
+
+    /// Creates the texture (with its mip chain) from a cooked asset, 
+    /// name is the path the asset was cooked from, e.g. "sample_assets/hero.png".
+    std::optional<Texture> createTextureFromPack(GraphicsContext* context, AssetPack pack, 
+                                                 const std::string& name);
+
+    /// Refers to a texture which is loaded in the background.
+    struct TextureLoadHandle 
+    {
+        uint32_t id;
+    };
+
+    enum class TextureLoadState 
+    {
+        Pending,
+        Ready,
+        Failed
+    };
+
+    /// Limits how many decoded textures are turned into 
+    /// actual (GPU) textures per frame. 
+    /// At least one texture is finalized per frame, even if it is 
+    /// bigger than maxBytesPerFrame.
+    struct TextureUploadBudget 
+    {
+        uint32_t maxTexturesPerFrame = 4;
+        size_t maxBytesPerFrame = 16 * 1024 * 1024;
+    };
+
+    /// Timings of the background texture loads, all in milliseconds.
+    /// Latency is measured from the request to the texture being ready.
+    struct TextureLoadStats 
+    {
+        uint32_t requested = 0;
+        uint32_t completed = 0;
+        uint32_t failed = 0;
+        double lastLatency = 0;
+        double averageLatency = 0;
+        double maxLatency = 0;
+        double averageDecodeTime = 0;
+        double averageUploadTime = 0;
+    };
+
+    /// Starts loading the texture and returns immediately. 
+    /// The file is decoded on worker threads, the texture itself is created 
+    /// during presentBackBuffer, within the upload budget.
+    TextureLoadHandle createTextureFromFileAsync(GraphicsContext* context, const std::string& fileName);
+
+    TextureLoadState getTextureLoadState(GraphicsContext* context, TextureLoadHandle handle);
+
+    /// The loaded texture, or std::nullopt while it is pending or if it failed. 
+    /// Once the load is done, ready or failed, this releases the handle: call it once the state 
+    /// is no longer Pending, also for failed loads. Afterwards the handle reports Failed.
+    std::optional<Texture> getLoadedTexture(GraphicsContext* context, TextureLoadHandle handle);
+
+    void setTextureUploadBudget(GraphicsContext* context, TextureUploadBudget budget);
+
+    TextureLoadStats getTextureLoadStats(GraphicsContext* context);
+
+    /// This is the private part of the API, 
+    /// should only be used internally. 
+    /// Call at your own risk, but better do not call at all!
+    namespace detail {
+
+#ifdef TE_MATH
+        namespace math {
+
+            /// Plain scalar versions of the batched kernels. 
+            /// Used for the remainders of the SIMD loops and 
+            /// as the reference to measure the SIMD paths against.
+            void transformPointsScalar(const Mat4& m, const float* x, const float* y, const float* z, 
+                                       float* outX, float* outY, float* outZ, size_t count);
+            void composeTransformsScalar(const float* tx, const float* ty, const float* tz,
+                                         const float* qx, const float* qy, const float* qz, const float* qw,
+                                         const float* sx, const float* sy, const float* sz,
+                                         Mat4* out, size_t count);
+        }
+#endif
+
+        /// Dense storage of T objects, addressed by 32 bit handles. 
+        /// A handle packs the slot index (low 24 bits) and the generation 
+        /// of that slot (high 8 bits). Erasing bumps the generation, 
+        /// so stale handles are detected (until the generation wraps after 255 reuses).
+        /// get, insert and erase are O(1), the objects stay contiguous 
+        /// and can be iterated without holes via begin()/end().
+        /// The handle 0 is never handed out and always invalid.
+        template<typename T>
+        class SlotMap 
+        {
+            public:
+                static constexpr uint32_t indexBits = 24;
+                static constexpr uint32_t indexMask = (1u << indexBits) - 1;
+                static constexpr uint32_t maxSize = indexMask;
+
+                uint32_t insert(T value) 
+                {
+                    uint32_t slotIndex;
+                    if (freeHead != endOfFreeList) 
+                    {
+                        slotIndex = freeHead;
+                        freeHead = slots[slotIndex].denseIndex;
+                    }
+                    else 
+                    {
+                        assert(slots.size() < maxSize);
+                        slotIndex = (uint32_t) slots.size();
+                        slots.push_back(Slot { 0, 1 });
+                    }
+
+                    Slot& slot = slots[slotIndex];
+                    slot.denseIndex = (uint32_t) values.size();
+                    values.push_back(std::move(value));
+                    denseToSlot.push_back(slotIndex);
+                    return (slot.generation << indexBits) | slotIndex;
+                }
+
+                /// Removes the object, the last object is moved into its place.
+                /// Returns false for unknown or stale handles.
+                bool erase(uint32_t handle) 
+                {
+                    if (!contains(handle)) return false;
+                    uint32_t slotIndex = handle & indexMask;
+                    Slot& slot = slots[slotIndex];
+
+                    uint32_t last = (uint32_t) values.size() - 1;
+                    if (slot.denseIndex != last) 
+                    {
+                        values[slot.denseIndex] = std::move(values[last]);
+                        denseToSlot[slot.denseIndex] = denseToSlot[last];
+                        slots[denseToSlot[last]].denseIndex = slot.denseIndex;
+                    }
+                    values.pop_back();
+                    denseToSlot.pop_back();
+
+                    // Generation 0 is skipped, so no handle ever becomes 0.
+                    slot.generation = (slot.generation + 1) & 0xff;
+                    if (slot.generation == 0) slot.generation = 1;
+                    slot.denseIndex = freeHead;
+                    freeHead = slotIndex;
+                    return true;
+                }
+
+                bool contains(uint32_t handle) const 
+                {
+                    uint32_t slotIndex = handle & indexMask;
+                    if (slotIndex >= slots.size()) return false;
+                    const Slot& slot = slots[slotIndex];
+                    return slot.generation == (handle >> indexBits) && 
+                           slot.denseIndex < values.size() && 
+                           denseToSlot[slot.denseIndex] == slotIndex;
+                }
+
+                T* get(uint32_t handle) 
+                {
+                    return contains(handle) ? &values[slots[handle & indexMask].denseIndex] : nullptr;
+                }
+
+                const T* get(uint32_t handle) const 
+                {
+                    return contains(handle) ? &values[slots[handle & indexMask].denseIndex] : nullptr;
+                }
+
+                /// The handle of the object at the given position of the dense array.
+                uint32_t handleAt(size_t denseIndex) const 
+                {
+                    uint32_t slotIndex = denseToSlot[denseIndex];
+                    return (slots[slotIndex].generation << indexBits) | slotIndex;
+                }
+
+                void reserve(size_t count) 
+                {
+                    values.reserve(count);
+                    denseToSlot.reserve(count);
+                    slots.reserve(count);
+                }
+
+                size_t size() const { return values.size(); }
+                bool empty() const { return values.empty(); }
+                T* begin() { return values.data(); }
+                T* end() { return values.data() + values.size(); }
+                const T* begin() const { return values.data(); }
+                const T* end() const { return values.data() + values.size(); }
+
+            private:
+                static constexpr uint32_t endOfFreeList = 0xffffffff;
+
+                // For free slots denseIndex links to the next free slot.
+                struct Slot 
+                {
+                    uint32_t denseIndex;
+                    uint32_t generation;
+                };
+
+                std::vector<T> values;
+                std::vector<uint32_t> denseToSlot;
+                std::vector<Slot> slots;
+                uint32_t freeHead = endOfFreeList;
+        };
+
+        /// Holds the resources of a backend (textures, shaders, buffers...).
+        /// The ids handed out here are what the client gets to see, e.g. in Texture.
+        template<typename T>
+        class ResourceStorage 
+        {
+            public:
+                uint32_t store(T* resource) 
+                {
+                    return slots.insert(resource);
+                }
+
+                T* get(uint32_t id)
+                {
+                    auto resource = slots.get(id);
+                    return resource ? *resource : nullptr;
+                }
+
+                /// Removes the resource from the storage and hands it back, 
+                /// so the caller can destroy it. 
+                /// Returns nullptr for unknown or already released ids.
+                T* release(uint32_t id) 
+                {
+                    T* resource = get(id);
+                    if (resource) slots.erase(id);
+                    return resource;
+                }
+
+            private:
+                SlotMap<T*> slots;
+
+        };
+
+        /// Fixed capacity single producer, single consumer ring buffer. 
+        /// push and pop never allocate and are safe to call from 
+        /// one producer thread and one consumer thread at the same time.
+        /// Capacity must be a power of two.
+        template<typename T, uint32_t Capacity>
+        class RingBuffer 
+        {
+            public:
+                static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+                static constexpr uint32_t capacity = Capacity;
+
+                /// Returns false (and counts a dropped item) if the buffer is full.
+                bool push(const T& item) 
+                {
+                    uint32_t tail = writeIndex.load(std::memory_order_relaxed);
+                    if (tail - readIndex.load(std::memory_order_acquire) == Capacity) 
+                    {
+                        dropped.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                    items[tail & (Capacity - 1)] = item;
+                    writeIndex.store(tail + 1, std::memory_order_release);
+                    return true;
+                }
+
+                bool pop(T& item) 
+                {
+                    uint32_t head = readIndex.load(std::memory_order_relaxed);
+                    if (head == writeIndex.load(std::memory_order_acquire)) return false;
+                    item = items[head & (Capacity - 1)];
+                    readIndex.store(head + 1, std::memory_order_release);
+                    return true;
+                }
+
+                uint32_t size() const 
+                {
+                    return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+                }
+
+                bool empty() const { return size() == 0; }
+                uint32_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+            private:
+                T items[Capacity];
+                // Free running, wrap around at 2^32 which is a multiple of Capacity. 
+                // On separate cache lines, so producer and consumer do not fight over one.
+                alignas(64) std::atomic<uint32_t> readIndex { 0 };
+                alignas(64) std::atomic<uint32_t> writeIndex { 0 };
+                std::atomic<uint32_t> dropped { 0 };
+        };
+
+        /// The events of all windows, filled by the window procedure, drained by nextEvent.
+        RingBuffer<Event, 1024> eventQueue;
+
+#ifdef TE_PROFILE
+        namespace profiler {
+
+            struct ScopeEvent 
+            {
+                const char* name;
+                uint64_t start;
+                uint64_t end;
+            };
+
+            /// The scopes of one thread, pushed by that thread, drained by profileEndFrame.
+            struct ThreadBuffer 
+            {
+                RingBuffer<ScopeEvent, 8192> events;
+                uint32_t threadId;
+                const char* name = nullptr;
+            };
+
+            struct CapturedEvent 
+            {
+                const char* name;
+                uint64_t start;
+                uint64_t end;
+                uint32_t threadId;
+            };
+
+            /// The buffer of the calling thread, registered on first use.
+            ThreadBuffer& threadBuffer();
+            /// Empties the buffers of all threads, into the capture if one is running.
+            void collectThreadBuffers();
+            void writeJsonString(FILE* file, const char* text);
+
+            thread_local ThreadBuffer* currentThreadBuffer = nullptr;
+            /// Never shrinks, the buffer of a finished thread stays around.
+            std::vector<ThreadBuffer*> threadBuffers;
+            std::mutex threadBuffersMutex;
+
+            FrameTimeHistogram histogram = {};
+            uint64_t lastFrameEnd = 0;
+
+            bool capturing = false;
+            uint64_t captureStart = 0;
+            std::vector<CapturedEvent> capturedEvents;
+
+            /// GPU timings appear as this thread in captures.
+            constexpr uint32_t gpuThreadId = 0xffff;
+        }
+#endif
+
+        class TextureLoader;
+        struct CommandListData;
+        struct SpriteDraw;
+
+        /// The entry points of one graphics backend. 
+        /// initGraphics resolves the api name to one of these tables once, 
+        /// the public functions call through it without checking the api again.
+        struct GraphicsBackend 
+        {
+            GraphicsApi api;
+            void (*clearBackBuffer)(float r, float g, float b, float a);
+            void (*presentBackBuffer)();
+            void (*bindBackBuffer)(int x, int y, int width, int height);
+            void (*drawTexture)(Texture t, int x, int y);
+            /// Records ready made sprites, e.g. the glyphs of drawText.
+            void (*drawSprites)(const SpriteDraw* draws, uint32_t count);
+            /// Creates and stores a texture from RGBA8 data, mipCount levels in the asset pack layout. 
+            /// Returns the texture id, 0 on failure. 
+            /// If pixelsOutliveTexture the backend may keep pointing into the pixels instead of copying them.
+            uint32_t (*createTexture)(uint32_t width, uint32_t height, uint32_t mipCount, 
+                                      const uint8_t* pixels, bool pixelsOutliveTexture);
+            void (*destroyTexture)(uint32_t id);
+            /// The background texture loader of the backend, created on first use.
+            TextureLoader* (*textureLoader)();
+            /// The render stats of the last presented frame.
+            RenderStats (*renderStats)();
+            /// Applies the backend part of the present settings (swap chain, vsync).
+            void (*applyPresentSettings)(const PresentSettings& settings);
+            /// Blocks until the backend takes the next frame, 
+            /// null for backends which never have to wait.
+            void (*waitForFrameLatency)();
+            /// The backend part of the command lists. 
+            /// begin and close run on the recording thread, submit and destroy on the main thread.
+            void (*beginCommandList)(CommandListData& list);
+            void (*closeCommandList)(CommandListData& list);
+            void (*submitCommandList)(CommandListData& list);
+            void (*destroyCommandList)(CommandListData& list);
+        };
+
+        /// The double buffered frame arenas, see frameArena().
+        FrameArena frameArenas[2];
+        uint32_t currentFrameArena = 0;
+        FrameAllocationStats frameAllocationStats = {};
+        uint32_t blockAllocationsAtFrameStart = 0;
+
+        /// Counted by the replaced global operator new with TE_TRACK_HEAP_ALLOCATIONS.
+        std::atomic<uint64_t> heapAllocationCount { 0 };
+        uint64_t heapAllocationsAtFrameStart = 0;
+
+        /// Swaps and resets the frame arenas and records the frame's allocation stats.
+        void endFrameAllocations();
+
+        /// The time source of the frame pacer, in nanoseconds, and how it sleeps. 
+        /// A fake clock lets the pacing be tested without waiting in real time.
+        struct PacingClock 
+        {
+            uint64_t (*now)(void* user);
+            void (*sleep)(void* user, uint64_t nanoseconds);
+            void* user;
+        };
+
+        /// eventClock(), sleeping on a high resolution timer where the platform has one.
+        PacingClock systemPacingClock();
+
+        /// Measures where the time of each frame goes and holds the loop to a target rate. 
+        /// Platform neutral, presentBackBuffer drives it: beginPresent and endPresent around 
+        /// the backend's present, then waitForNextFrame.
+        class FramePacer 
+        {
+            public:
+                explicit FramePacer(PacingClock clock = systemPacingClock());
+                /// 0 turns the limiter off.
+                void setTargetFrameRate(double framesPerSecond);
+                void beginPresent();
+                void endPresent();
+                /// Sleeps until shortly before the next frame is due and spins the rest, 
+                /// then calls latencyWait (if not null) and starts the next frame. 
+                /// Due times advance by whole periods, so the average rate is exact. 
+                /// A frame which is more than a period late restarts the schedule 
+                /// instead of being caught up with a burst of short frames.
+                void waitForNextFrame(void (*latencyWait)());
+                FrameTiming lastFrame() const { return timing; }
+                /// How long before the due time sleeping stops. It follows the worst 
+                /// oversleep seen (and slowly relaxes again), so the spin stays short.
+                uint64_t spinMargin() const { return margin; }
+
+            private:
+                PacingClock clock;
+                uint64_t period = 0;
+                /// Valid once scheduled, any clock value (0 too) is a valid time.
+                bool scheduled = false;
+                uint64_t nextFrameDue = 0;
+                bool frameStarted = false;
+                uint64_t frameStart = 0;
+                uint64_t presentStart = 0;
+                uint64_t presentEnd = 0;
+                uint64_t margin = 1000000;
+                FrameTiming timing = {};
+        };
+
+        FramePacer framePacer;
+        PresentSettings presentSettings;
+
+        /// A decoded image in straight (not premultiplied) RGBA8. 
+        /// Rows are flipped vertically, the bottom row comes first, 
+        /// which is the order the backends upload textures in.
+        struct DecodedImage 
+        {
+            uint32_t width = 0;
+            uint32_t height = 0;
+            std::vector<uint8_t> pixels;
+        };
+
+        /// The decoders reject images with more pixels than this (256 MB of RGBA) 
+        /// before allocating anything, the sizes come straight from the file headers.
+        constexpr uint64_t maxImagePixels = 8192 * 8192;
+
+        /// The decoders keep their scratch buffers per thread for the next image, 
+        /// except for buffers which grew past this: one huge image must not pin its memory 
+        /// to the thread (every loader worker) for good.
+        constexpr size_t maxKeptScratchBytes = 4 * 1024 * 1024;
+
+        /// Frees the buffer at the end of the scope if it grew past maxKeptScratchBytes.
+        template<typename T>
+        struct ScratchTrim 
+        {
+            std::vector<T>& buffer;
+
+            ~ScratchTrim() 
+            {
+                if (buffer.capacity() * sizeof(T) > maxKeptScratchBytes) std::vector<T>().swap(buffer);
+            }
+        };
+
+        namespace wic {
+
+            /// Decodes any image format the Windows Imaging Component knows about.
+            bool decodeImageFile(const std::string& fileName, DecodedImage& image);
+        }
+
+        /// Decodes an image file with the best decoder available on this platform:
+        /// the built-in PNG/QOI decoders, WIC for everything else on Windows.
+        bool decodeImageFile(const std::string& fileName, DecodedImage& image);
+
+        /// Decodes PNG or QOI data into image (which is resized to fit).
+        bool decodeImage(const uint8_t* data, size_t size, DecodedImage& image);
+
+        bool readFile(const std::string& fileName, std::vector<uint8_t>& contents);
+
+        namespace zlib {
+
+            /// Inflates a zlib stream into out, which must have room for outSize bytes.
+            /// Fails if the stream is corrupt or does not decode to exactly outSize bytes.
+            bool inflate(const uint8_t* data, size_t size, uint8_t* out, size_t outSize);
+        }
+
+        /// Built-in PNG decoder. 
+        /// Supports all color types and bit depths, palettes, tRNS and Adam7 interlacing.
+        /// 16 bit channels are reduced to 8 bit. 
+        namespace png {
+
+            bool isPNG(const uint8_t* data, size_t size);
+            bool readSize(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height);
+
+            /// Decodes into out (height rows of rowPitch bytes each, e.g. an upload staging buffer), 
+            /// as straight RGBA8 with the bottom row first. 
+            /// Unfiltering, the RGBA conversion and the flip all happen in one pass over the rows.
+            bool decode(const uint8_t* data, size_t size, uint8_t* out, size_t rowPitch);
+
+            /// Reverses the PNG filter of one row in place. 
+            /// prior is the previous (already unfiltered) row, all zeros for the first one.
+            void unfilterRow(uint8_t filter, uint8_t* row, const uint8_t* prior, size_t rowBytes, uint32_t bytesPerPixel);
+        }
+
+        /// Decoder for the "Quite OK Image" format, which decodes many times faster than PNG.
+        namespace qoi {
+
+            bool isQOI(const uint8_t* data, size_t size);
+            bool readSize(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height);
+
+            /// Same output as png::decode: straight RGBA8, bottom row first.
+            bool decode(const uint8_t* data, size_t size, uint8_t* out, size_t rowPitch);
+        }
+
+        /// Packed asset archives (.tepack). They are written offline by the 
+        /// asset cooker (asset_cooker.cpp) and memory mapped at runtime, 
+        /// so loading a texture costs no decoding and no extra copies.
+        ///
+        /// Layout, all little endian: 
+        ///   FileHeader
+        ///   payloads, each 16 byte aligned
+        ///   TocEntry[entryCount], sorted by nameHash
+        ///   the asset names, referenced by the toc entries
+        ///
+        /// A texture payload is the final texture data: RGBA8 with the bottom row first, 
+        /// followed by the rest of its mip chain down to 1x1, each level 16 byte aligned.
+        namespace pack {
+
+            constexpr char magic[4] = { 'T', 'E', 'P', 'K' };
+            constexpr uint32_t version = 1;
+            constexpr uint32_t payloadAlignment = 16;
+
+            enum class PixelFormat : uint32_t 
+            {
+                RGBA8 = 0
+            };
+
+            struct FileHeader 
+            {
+                char magic[4];
+                uint32_t version;
+                uint32_t entryCount;
+                uint32_t reserved;
+                uint64_t tocOffset;
+                uint64_t namesOffset;
+            };
+
+            struct TocEntry 
+            {
+                uint64_t nameHash;
+                uint64_t dataOffset;
+                uint64_t dataSize;
+                uint32_t nameOffset;
+                uint32_t nameLength;
+                uint32_t width;
+                uint32_t height;
+                uint32_t mipCount;
+                PixelFormat format;
+            };
+
+            /// Asset names are case insensitive and use '/' as separator, 
+            /// "Sprites\\Hero.png" and "sprites/hero.png" are the same asset.
+            std::string normalizeName(const std::string& name);
+            /// 64 bit FNV-1a of the normalized name.
+            uint64_t hashName(const std::string& name);
+
+            /// Number of levels of a full mip chain down to 1x1.
+            uint32_t mipCount(uint32_t width, uint32_t height);
+            /// Offset of a mip level from the start of the texture payload.
+            uint64_t mipOffset(uint32_t width, uint32_t height, uint32_t level);
+
+            /// Appends the full mip chain of the image (RGBA8) to payload, 
+            /// in the payload layout described above. Levels are 2x2 box filtered.
+            void buildMipChain(const DecodedImage& image, std::vector<uint8_t>& payload);
+
+            /// Read only memory mapping of a whole file.
+            class MappedFile 
+            {
+                public:
+                    MappedFile() = default;
+                    ~MappedFile();
+                    MappedFile(const MappedFile&) = delete;
+                    MappedFile& operator=(const MappedFile&) = delete;
+
+                    bool open(const std::string& fileName);
+                    void close();
+                    const uint8_t* data() const { return view; }
+                    size_t size() const { return length; }
+
+                private:
+                    const uint8_t* view = nullptr;
+                    size_t length = 0;
+#ifdef _WIN32
+                    HANDLE file = INVALID_HANDLE_VALUE;
+                    HANDLE mapping = nullptr;
+#endif
+            };
+
+            /// An opened archive. 
+            /// Lookups are a binary search over the hashes of the table of contents, 
+            /// the data is read straight from the mapping.
+            class Archive 
+            {
+                public:
+                    bool open(const std::string& fileName);
+                    const TocEntry* find(const std::string& name) const;
+                    const uint8_t* payload(const TocEntry& entry) const { return file.data() + entry.dataOffset; }
+                    uint32_t entryCount() const { return count; }
+
+                private:
+                    MappedFile file;
+                    const TocEntry* toc = nullptr;
+                    const char* names = nullptr;
+                    uint32_t count = 0;
+            };
+
+            struct CookedTexture 
+            {
+                std::string name;
+                DecodedImage image;
+            };
+
+            /// Builds the mip chains and writes the archive, used by the cooker.
+            bool writeArchive(const std::string& fileName, const std::vector<CookedTexture>& textures);
+
+            ResourceStorage<Archive> archiveStorage;
+        }
+
+        /// Compiled shader bytecode on disk, so a shader is compiled once and not on every launch. 
+        /// One file per shader in the cache directory, named by its key in hex (.cso): 
+        ///   FileHeader
+        ///   the bytecode
+        namespace shadercache {
+
+            constexpr char magic[4] = { 'T', 'E', 'S', 'C' };
+            constexpr uint32_t version = 1;
+
+            struct FileHeader 
+            {
+                char magic[4];
+                uint32_t version;
+                uint64_t key;
+                uint64_t size;
+                /// FNV-1a of the bytecode, a truncated or damaged file is a miss.
+                uint64_t checksum;
+            };
+
+            struct Define 
+            {
+                std::string name;
+                std::string value;
+            };
+
+            /// 64 bit FNV-1a over everything which changes the bytecode: 
+            /// source, defines, target profile, compile flags and compiler version.
+            uint64_t shaderKey(const std::string& source, const std::vector<Define>& defines, 
+                               const std::string& profile, uint32_t flags, uint32_t compilerVersion);
+            std::string fileName(const std::string& directory, uint64_t key);
+            /// False if there is no file for the key or it does not check out.
+            bool load(const std::string& directory, uint64_t key, std::vector<uint8_t>& bytecode);
+            /// Writes a temporary file and renames it into place, 
+            /// so processes sharing the directory never read a half written file.
+            bool store(const std::string& directory, uint64_t key, const void* bytecode, size_t size);
+
+            std::string directory = "shader_cache";
+            ShaderCacheStats stats = {};
+        }
+
+        /// One sprite in the batch instance stream, 48 bytes. 
+        /// Matches the per instance part of the sprite input layout: 
+        /// INSTANCE_RECT, INSTANCE_UV, INSTANCE_ROTATION_DEPTH (float4, float4, float2), 
+        /// INSTANCE_TINT (R8G8B8A8_UNORM) and INSTANCE_LAYER (uint). 
+        /// The vertex shader expands the unit quad model by it.
+        struct SpriteInstance 
+        {
+            float x, y, width, height;
+            float uvLeft, uvBottom, uvRight, uvTop;
+            float rotation, depth;
+            uint32_t tint;
+            uint32_t layer;
+        };
+
+        /// A run of instances in the batch instance stream which all use 
+        /// the same shader and texture, so it can be drawn with a single call.
+        struct SpriteBatchRange 
+        {
+            uint32_t shaderId;
+            uint32_t textureId;
+            uint32_t firstInstance;
+            uint32_t instanceCount;
+        };
+
+        /// One recorded sprite draw. 
+        /// shaderId 0 means the default sprite shader of the backend.
+        struct SpriteDraw 
+        {
+            uint32_t textureId;
+            uint32_t shaderId;
+            uint8_t layer;
+            float x, y, width, height, depth;
+            float uvLeft, uvBottom, uvRight, uvTop;
+            float rotation = 0;
+            uint32_t tint = 0xffffffff;
+        };
+
+        /// Depth of the sprites from drawTexture, drawSprite and drawSprites.
+        constexpr float spriteDepth = 0.2f;
+
+        /// What gets sorted: the key and the index of the draw it belongs to.
+        struct SortPacket 
+        {
+            uint64_t key;
+            uint32_t index;
+        };
+
+        /// Sort key of a draw, sorted ascending. From the high bits down: 
+        /// layer (8 bits), shader (16 bits), texture (24 bits), inverted depth (16 bits). 
+        /// So layers are drawn in order, inside a layer draws with the same state 
+        /// end up next to each other, and those go back to front (depth 1 is far).
+        /// Shader and texture contribute the slot index part of their ids. 
+        /// Texture slots always fit, shader slots as long as fewer than 65536 shaders exist at once. 
+        /// Beyond that two shaders can share key bits, which only costs batching: 
+        /// the draw ranges still split on the full ids.
+        uint64_t makeSortKey(uint8_t layer, uint32_t shaderId, uint32_t textureId, float depth);
+
+        /// Stable LSD radix sort of the packets by key, 8 bits per pass. 
+        /// Passes over a byte which is the same in all keys are skipped, 
+        /// so a frame which e.g. only uses one layer and shader needs only a few passes. 
+        /// scratch must have room for count packets.
+        void radixSort(SortPacket* packets, SortPacket* scratch, size_t count);
+
+        /// Remembers which state is bound on the device, so binding it again can be skipped. 
+        /// Backend independent, the backends ask before each bind and 
+        /// only talk to the device if change() says the value is new.
+        class StateCache 
+        {
+            public:
+                enum Slot 
+                {
+                    Shader,
+                    InputLayout,
+                    VertexBuffer,
+                    IndexBuffer,
+                    Topology,
+                    Texture,
+                    Sampler,
+                    SlotCount
+                };
+
+                StateCache() { invalidate(); }
+
+                /// Records value as bound in slot. 
+                /// Returns false if it already was, then the bind can be skipped.
+                bool change(Slot slot, uint32_t value) 
+                {
+                    if (bound[slot] == value) 
+                    {
+                        skippedCount++;
+                        return false;
+                    }
+                    bound[slot] = value;
+                    changeCount++;
+                    return true;
+                }
+
+                /// Forgets what is bound, e.g. after someone else used the device 
+                /// or the object behind an id was recreated.
+                void invalidate(Slot slot) { bound[slot] = unknown; }
+                void invalidate() { for (auto& value : bound) value = unknown; }
+
+                uint32_t changes() const { return changeCount; }
+                uint32_t skipped() const { return skippedCount; }
+                void resetCounters() { changeCount = skippedCount = 0; }
+
+            private:
+                static constexpr uint32_t unknown = 0xffffffff;
+                uint32_t bound[SlotCount];
+                uint32_t changeCount = 0;
+                uint32_t skippedCount = 0;
+        };
+
+        /// Closes the render stats of a frame: adds the counters of the cache, 
+        /// publishes frame as last and starts a new frame. 
+        /// The cache is invalidated, the device state is not trusted across a present.
+        void endFrameRenderStats(RenderStats& frame, RenderStats& last, StateCache& cache);
+
+        /// Packs rectangles into texture atlas pages, CPU only.
+        namespace atlas {
+
+            struct Rect 
+            {
+                uint32_t x, y, width, height;
+            };
+
+            /// Skyline bottom-left packer for one page. 
+            /// The skyline is the upper outline of everything placed so far, 
+            /// a new rect goes where its top edge ends up lowest.
+            class SkylinePacker 
+            {
+                public:
+                    SkylinePacker(uint32_t width, uint32_t height);
+                    void reset();
+                    /// Returns false if there is no room left for the rect.
+                    bool insert(uint32_t width, uint32_t height, Rect& placed);
+                    /// Fraction of the page covered by the placed rects.
+                    float occupancy() const;
+
+                private:
+                    struct Segment 
+                    {
+                        uint32_t x, y, width;
+                    };
+
+                    // The y the rect would be placed at on top of segment index, false if it does not fit.
+                    bool fit(size_t index, uint32_t width, uint32_t height, uint32_t& y) const;
+
+                    std::vector<Segment> skyline;
+                    uint32_t pageWidth;
+                    uint32_t pageHeight;
+                    uint64_t usedArea = 0;
+            };
+
+            /// A rect to pack (width, height) and where it went (page, x, y).
+            struct Placement 
+            {
+                uint32_t width, height;
+                uint32_t page, x, y;
+            };
+
+            /// Packs the rects onto as few pages as possible, tallest first, 
+            /// each rect is tried on every open page before a new one is started. 
+            /// padding texels are kept free around every rect, 
+            /// x/y are the position of the rect itself (inside its padding).
+            /// Returns the number of pages, 0 if a rect is bigger than a page.
+            uint32_t packRects(uint32_t pageWidth, uint32_t pageHeight, uint32_t padding, 
+                               std::vector<Placement>& rects);
+
+            /// Copies the image onto the page at x/y and repeats its edge texels into the padding around it, 
+            /// so filtering at the sprite edges does not pick up the neighbours.
+            void blitWithPadding(uint8_t* page, uint32_t pageWidth, uint32_t pageHeight, 
+                                 const DecodedImage& image, uint32_t x, uint32_t y, uint32_t padding);
+        }
+
+        /// Packs count sprites from the arrays into out (structure of arrays to array of structures), 
+        /// 4 at a time with SSE2 or NEON. All get the texture, layer and the default sprite depth.
+        void packSprites(const SpriteArrays& sprites, uint32_t count, const Texture& texture, 
+                         uint8_t layer, SpriteDraw* out);
+        /// Plain scalar version, for the remainder of the SIMD loop and to measure it against.
+        void packSpritesScalar(const SpriteArrays& sprites, uint32_t begin, uint32_t end, 
+                               const Texture& texture, uint8_t layer, SpriteDraw* out);
+        /// Reused by drawSprites for the packed sprites.
+        std::vector<SpriteDraw> spritePackBuffer;
+
+        /// Records the sprite draws of a frame (between bindBackBuffer and presentBackBuffer).
+        /// build() radix sorts them by their sort key, gathers them into one instance stream 
+        /// and one draw range per run of the same shader and texture. 
+        /// Platform neutral: the backends only upload and draw the result.
+        class SpriteBatch 
+        {
+            public:
+                void add(const SpriteDraw& draw);
+                void add(const SpriteDraw* draws, uint32_t count);
+                /// Appends the draws of other behind the own ones. 
+                /// Draws with equal sort keys keep this order in build().
+                void append(const SpriteBatch& other);
+                void build();
+                void clear();
+                bool empty() const { return draws.empty(); }
+                size_t size() const { return draws.size(); }
+                const std::vector<SpriteInstance>& instances() const { return instanceStream; }
+                const std::vector<SpriteBatchRange>& ranges() const { return drawRanges; }
+
+            private:
+                std::vector<SpriteDraw> draws;
+                std::vector<SortPacket> packets;
+                std::vector<SortPacket> sortScratch;
+                std::vector<SpriteInstance> instanceStream;
+                std::vector<SpriteBatchRange> drawRanges;
+        };
+
+        /// A command list: the draws recorded by its thread, 
+        /// plus what the backend keeps per list (the deferred context on dx11).
+        struct CommandListData 
+        {
+            SpriteBatch batch;
+            /// Sprites outside this rect (view coordinates) are culled while recording.
+            float cullLeft, cullBottom, cullRight, cullTop;
+            /// Counted while recording, added to the frame stats on submit.
+            RenderStats stats = {};
+            StateCache stateCache;
+            bool recording = false;
+            bool closed = false;
+            /// Owned by the backend, released by its destroyCommandList.
+            void* backendData = nullptr;
+        };
+
+        /// All command lists, of whichever backend. 
+        /// Only the main thread adds and removes lists, recording threads only look them up.
+        ResourceStorage<CommandListData> commandListStorage;
+
+        /// Fonts: TrueType parsing, glyph rasterization and text layout, CPU only. 
+        /// The backends only ever see the atlas page (a texture) and sprite draws.
+        namespace text {
+
+            /// A TrueType font file (glyf outlines) and the offsets of the tables used here. 
+            /// All reads are bounds checked, a broken file gives empty glyphs but never reads outside data.
+            struct TrueTypeFile 
+            {
+                std::vector<uint8_t> data;
+                /// The unicode subtable of the cmap.
+                uint32_t cmap = 0;
+                uint32_t glyf = 0;
+                uint32_t loca = 0;
+                uint32_t hmtx = 0;
+                uint32_t kern = 0;
+                uint32_t glyphCount = 0;
+                uint32_t horizontalMetricCount = 0;
+                bool longLocaOffsets = false;
+                float unitsPerEm = 0;
+                float ascender = 0;
+                float descender = 0;
+                float lineGap = 0;
+            };
+
+            /// Fails if a table needed for drawing (cmap, glyf, loca, head, hhea, hmtx, maxp) is missing.
+            bool parseTrueType(std::vector<uint8_t> data, TrueTypeFile& font);
+
+            /// The glyph of the code point from the unicode cmap (format 4 or 12), 
+            /// 0 (the missing glyph) if the font has none.
+            uint32_t glyphIndex(const TrueTypeFile& font, uint32_t codePoint);
+
+            /// Advance width in font units.
+            float glyphAdvance(const TrueTypeFile& font, uint32_t glyph);
+
+            /// The format 0 'kern' table entry of the pair in font units, 0 if there is none.
+            float glyphKerning(const TrueTypeFile& font, uint32_t left, uint32_t right);
+
+            struct Edge 
+            {
+                float x0, y0, x1, y1;
+            };
+
+            /// The outline of the glyph as closed polygons, composite glyphs resolved and 
+            /// curves flattened. Font units times scale, y up like in the font.
+            void glyphOutline(const TrueTypeFile& font, uint32_t glyph, float scale, std::vector<Edge>& edges);
+
+            /// Writes the exact area coverage (0-255, non-zero winding) of the closed outline 
+            /// into width x height values, rows top first. 
+            /// The edges are in pixels with y pointing down and must lie inside the bitmap. 
+            /// accumulation is scratch memory, resized as needed.
+            void rasterizeEdges(const Edge* edges, size_t count, uint32_t width, uint32_t height, 
+                                std::vector<float>& accumulation, uint8_t* coverage);
+
+            /// A rasterized glyph and where it is on the atlas page.
+            struct Glyph 
+            {
+                uint32_t codePoint;
+                /// The glyph index in the font, kerning pairs refer to it.
+                uint32_t fontGlyph;
+                float advance;
+                /// The bitmap's bottom left corner relative to the pen position on the baseline, in pixels.
+                float left, bottom;
+                float width, height;
+                float uvLeft, uvBottom, uvRight, uvTop;
+            };
+
+            /// A glyph of laid out text: the glyph's index in the cache and 
+            /// the bottom left corner of its bitmap relative to the text origin.
+            struct PlacedGlyph 
+            {
+                uint32_t glyph;
+                float x, y;
+            };
+
+            /// The glyphs of a font at one pixel size, all rasterized up front onto one atlas page.
+            class GlyphCache 
+            {
+                public:
+                    /// Rasterizes the glyphs of codePoints plus the missing glyph and packs them 
+                    /// onto the smallest square power of two page up to maxPageSize. 
+                    /// page gets RGBA8 texels, white with the coverage as alpha, bottom row first. 
+                    /// Fails if the glyphs do not fit.
+                    bool build(const TrueTypeFile& font, float pixelHeight, const std::vector<uint32_t>& codePoints, 
+                               uint32_t maxPageSize, DecodedImage& page);
+                    /// Index of the glyph of the code point, 0 (the missing glyph) if it was not built.
+                    uint32_t find(uint32_t codePoint) const;
+                    const Glyph& glyph(uint32_t index) const { return glyphs[index]; }
+                    size_t size() const { return glyphs.size(); }
+                    /// Kerning between two glyphs of the cache, in pixels.
+                    float kerning(uint32_t left, uint32_t right) const;
+                    float lineHeight() const { return lineAdvance; }
+
+                private:
+                    struct KerningPair 
+                    {
+                        /// Font glyph of the left one in the high 16 bits, the right one in the low ones.
+                        uint32_t pair;
+                        float amount;
+                    };
+
+                    // 0 is the missing glyph, the others are sorted by code point.
+                    std::vector<Glyph> glyphs;
+                    // Latin-1 goes through a table, everything else is a binary search.
+                    uint32_t latinGlyphs[256] = {};
+                    std::vector<KerningPair> kerningPairs;
+                    float lineAdvance = 0;
+            };
+
+            /// Lays out UTF-8 text from the origin on the baseline, with advances and kerning. 
+            /// '\n' starts a new line lineHeight() further down. Glyphs are snapped to whole pixels. 
+            /// Appends one placed glyph per character with a bitmap, so blanks cost nothing to draw.
+            void layoutText(const GlyphCache& cache, const char* text, size_t length, 
+                            std::vector<PlacedGlyph>& placed);
+
+            /// Remembers the layout of recently drawn strings, so text which is drawn 
+            /// every frame is laid out once. The runs are allocated up front and looked up 
+            /// by the FNV-1a hash of the string in sets of runsPerSet. A miss lays the string 
+            /// out into the least recently used run of its set, reusing the memory of its 
+            /// string and glyphs, so text which changes every frame does not allocate 
+            /// once the runs have grown to fit it.
+            class RunCache 
+            {
+                public:
+                    static constexpr size_t runsPerSet = 4;
+
+                    /// capacity is rounded up to whole sets.
+                    explicit RunCache(size_t capacity = 256);
+                    const std::vector<PlacedGlyph>& shape(const GlyphCache& cache, const std::string& text);
+                    /// Forgets all layouts, keeps the memory.
+                    void clear();
+                    uint64_t hits() const { return hitCount; }
+                    uint64_t misses() const { return missCount; }
+
+                private:
+                    struct Run 
+                    {
+                        uint64_t hash = 0;
+                        /// 0 for a free run.
+                        uint64_t lastUse = 0;
+                        std::string text;
+                        std::vector<PlacedGlyph> glyphs;
+                    };
+
+                    std::vector<Run> runs;
+                    uint64_t useCount = 0;
+                    uint64_t hitCount = 0;
+                    uint64_t missCount = 0;
+            };
+        }
+
+        /// A font: its glyph atlas and the layouts drawn with it.
+        struct FontData 
+        {
+            text::GlyphCache glyphs;
+            text::RunCache runs;
+            uint32_t pageTextureId = 0;
+            /// Reused for the sprites of each drawText.
+            std::vector<SpriteDraw> draws;
+        };
+
+        ResourceStorage<FontData> fontStorage;
+
+        namespace jobs {
+
+            struct JobThread;
+
+            struct Job 
+            {
+                JobFunction function;
+                void* data;
+                JobCounter* counter;
+                /// Waited for before the job runs, see runJobAfter.
+                JobCounter* dependency;
+                /// Next job in a free list.
+                Job* next;
+                /// Where the job goes back to when it is done.
+                JobThread* owner;
+            };
+
+            /// Chase-Lev work stealing deque of fixed capacity. 
+            /// The owning thread pushes and pops at the bottom (LIFO, good for the cache), 
+            /// any thread steals from the top (FIFO, the oldest and usually biggest work). 
+            /// Lock free, only a pop racing a steal for the last job needs a CAS.
+            class JobDeque 
+            {
+                public:
+                    static constexpr int64_t capacity = 4096;
+
+                    /// Owner only. False if the deque is full.
+                    bool push(Job* job);
+                    /// Owner only.
+                    Job* pop();
+                    /// Any thread. nullptr if empty or another thread won the race.
+                    Job* steal();
+
+                private:
+                    // On separate cache lines, the owner writes bottom, thieves write top.
+                    alignas(64) std::atomic<int64_t> top { 0 };
+                    alignas(64) std::atomic<int64_t> bottom { 0 };
+                    std::atomic<Job*> buffer[capacity];
+            };
+
+            /// What each job thread owns.
+            struct JobThread 
+            {
+                JobDeque deque;
+                /// Jobs ready for reuse, only touched by the owning thread.
+                Job* freeJobs = nullptr;
+                /// Jobs finished by other threads, pushed lock free, 
+                /// taken over all at once when freeJobs runs empty.
+                std::atomic<Job*> finishedJobs { nullptr };
+                /// Jobs are allocated in blocks which are never given back, 
+                /// so after warming up scheduling does not allocate.
+                std::vector<std::unique_ptr<Job[]>> jobBlocks;
+                std::thread thread;
+            };
+
+            constexpr uint32_t noThread = 0xffffffff;
+
+            Job* allocateJob(JobFunction function, void* data, JobCounter* counter);
+            /// Takes a job from the free lists of thread, which must be the calling one.
+            Job* takeFreeJob(JobThread& thread);
+            /// Queues the job on the deque of the calling thread.
+            void schedule(Job* job);
+            /// Own deque first, then main thread jobs (main thread only), then stealing.
+            Job* findJob(uint32_t threadIndex);
+            void execute(Job* job);
+            void workerLoop(uint32_t threadIndex);
+
+            /// Index 0 is the main thread, the workers follow.
+            std::vector<std::unique_ptr<JobThread>> threads;
+            /// Index of the calling thread in threads, noThread outside the job system.
+            thread_local uint32_t threadIndex = noThread;
+            /// Threads outside the job system queue here, under externalMutex. 
+            /// Job threads only steal from it.
+            std::unique_ptr<JobThread> external;
+            std::mutex externalMutex;
+            std::mutex mainThreadMutex;
+            std::vector<Job*> mainThreadJobs;
+            /// Size of mainThreadJobs, to check without taking the lock.
+            std::atomic<uint32_t> mainThreadJobCount { 0 };
+
+            /// Jobs in any deque, idle workers sleep while it is 0.
+            std::atomic<int64_t> queuedJobs { 0 };
+            std::atomic<uint32_t> sleepingWorkers { 0 };
+            std::atomic<bool> running { false };
+            std::mutex sleepMutex;
+            std::condition_variable wakeUp;
+
+            // The workers must be joined before the globals above go away.
+            struct ShutdownAtExit 
+            {
+                ~ShutdownAtExit() { shutdownJobs(); }
+            };
+            ShutdownAtExit shutdownAtExit;
+        }
+
+        /// A small pool of persistent worker threads, for blocking work like file IO 
+        /// which should not hold up the job threads. 
+        /// Submitted tasks run on whichever worker is free. 
+        /// parallelFor lets the calling thread help out and 
+        /// returns when all items are done.
+        class WorkerPool 
+        {
+            public:
+                /// threadCount 0 uses one worker less than there are hardware threads.
+                explicit WorkerPool(uint32_t threadCount = 0);
+                ~WorkerPool();
+                WorkerPool(const WorkerPool&) = delete;
+                WorkerPool& operator=(const WorkerPool&) = delete;
+
+                void submit(std::function<void()> task);
+                void parallelFor(uint32_t count, const std::function<void(uint32_t)>& body);
+                uint32_t threadCount() const { return (uint32_t) threads.size(); }
+
+            private:
+                void workerLoop();
+
+                std::vector<std::thread> threads;
+                // Ring buffer of pending tasks, it only grows, 
+                // so steady state submits do not allocate.
+                std::vector<std::function<void()>> tasks;
+                size_t firstTask = 0;
+                size_t taskCount = 0;
+                std::mutex mutex;
+                std::condition_variable wakeUp;
+                bool shuttingDown = false;
+        };
+
+        /// Loads textures in the background. 
+        /// Files are decoded on a worker pool, the decoded images are handed to 
+        /// the upload sink on the thread calling processUploads, 
+        /// a limited amount per call. 
+        /// The sink creates the actual texture and returns its id, 0 on failure. 
+        /// Nothing here depends on a graphics api, a CPU-only sink works just as well.
+        class TextureLoader 
+        {
+            public:
+                using DecodeFunction = std::function<bool(const std::string&, DecodedImage&)>;
+                using UploadSink = std::function<uint32_t(const DecodedImage&)>;
+
+                TextureLoader(DecodeFunction decode, UploadSink upload, uint32_t threadCount = 0);
+
+                /// Queues the file for decoding, returns the request handle.
+                uint32_t request(const std::string& fileName);
+
+                /// Uploads decoded images within the upload budget. 
+                /// Returns the number of finalized requests.
+                uint32_t processUploads();
+
+                void setUploadBudget(const TextureUploadBudget& budget) { uploadBudget = budget; }
+
+                TextureLoadState state(uint32_t requestHandle) const;
+
+                /// The texture id of a ready request, 0 otherwise.
+                uint32_t textureId(uint32_t requestHandle) const;
+
+                /// Forgets a ready or failed request, its handle is invalid afterwards. 
+                /// Returns false for pending requests, which are kept, and unknown handles.
+                bool release(uint32_t requestHandle);
+
+                const TextureLoadStats& stats() const { return loadStats; }
+
+            private:
+                using Clock = std::chrono::steady_clock;
+
+                struct Request 
+                {
+                    TextureLoadState state;
+                    uint32_t textureId;
+                    Clock::time_point start;
+                };
+
+                // Written by the workers, consumed by processUploads.
+                struct Decoded 
+                {
+                    uint32_t requestHandle;
+                    bool succeeded;
+                    double decodeMilliseconds;
+                    DecodedImage image;
+                };
+
+                void finish(uint32_t requestHandle, bool succeeded, uint32_t textureId);
+
+                DecodeFunction decode;
+                UploadSink upload;
+                TextureUploadBudget uploadBudget;
+                SlotMap<Request> requests;
+                std::mutex decodedMutex;
+                std::deque<Decoded> decoded;
+                TextureLoadStats loadStats;
+                double totalDecodeTime = 0;
+                double totalUploadTime = 0;
+                double totalLatency = 0;
+                uint32_t uploads = 0;
+
+                // Last, so the workers are joined before anything they use is gone.
+                WorkerPool workers;
+        };
+
+#ifdef TE_PHYSICS
+        namespace physics {
+
+            /// Bodies (sweep and prune) or hash buckets (spatial hash) per chunk of the parallel 
+            /// pair search. Each chunk writes its own pairs, they are joined in chunk order.
+            constexpr uint32_t pairSearchChunkSize = 1024;
+
+            struct SortEntry 
+            {
+                float key;
+                uint32_t body;
+            };
+
+            /// A body in the spatial hash, in the cell of its min corner.
+            struct HashEntry 
+            {
+                int32_t cellX, cellY, cellZ;
+                uint32_t body;
+            };
+
+            /// A broadphase with everything it keeps from update to update. 
+            /// All buffers only grow, once warmed up an update does not allocate.
+            struct BroadphaseData 
+            {
+                BroadphaseSettings settings;
+                std::vector<BodyPair> pairs;
+                uint32_t pairCount = 0;
+                BroadphaseStats stats = {};
+                std::vector<std::vector<BodyPair>> chunkPairs;
+
+                // Sweep and prune: the order along the sweep axis from the last update, 
+                // and the boxes gathered in that order (sweep axis first). 
+                // The gathered arrays have 4 padding boxes which overlap nothing, for the 4 wide loads.
+                int axis = -1;
+                std::vector<SortEntry> order;
+                std::vector<float> sortedMin[3];
+                std::vector<float> sortedMax[3];
+                std::vector<uint32_t> sortedBody;
+
+                // Spatial hash: the entries grouped by bucket, bucket i is 
+                // hashSorted[bucketStart[i]] up to hashSorted[bucketStart[i + 1]].
+                std::vector<HashEntry> hashEntries;
+                std::vector<HashEntry> hashSorted;
+                std::vector<uint32_t> bucketStart;
+                std::vector<uint32_t> largeBodies;
+                std::vector<uint8_t> isLarge;
+            };
+
+            /// Variance of the box centers along x, y and z (scaled by 4, the centers are not halved).
+            void axisSpread(const AabbArrays& boxes, uint32_t count, float spread[3]);
+            /// Insertion sort by (key, body), cheap for the nearly sorted order of the last update. 
+            /// Gives up after maxMoves moves and returns false, the order is then only partly sorted.
+            bool resortIncremental(std::vector<SortEntry>& order, uint32_t maxMoves, uint32_t& moves);
+            /// Pairs of the sorted boxes [begin, end) with the boxes after them, 4 at a time with SIMD.
+            void sweepRange(const BroadphaseData& data, uint32_t begin, uint32_t end, std::vector<BodyPair>& out);
+            /// Plain scalar sweep, for the SIMD remainder and to measure it against.
+            void sweepRangeScalar(const BroadphaseData& data, uint32_t begin, uint32_t end, 
+                                  std::vector<BodyPair>& out);
+            void sweepAndPrune(BroadphaseData& data, const AabbArrays& boxes, uint32_t count);
+            void spatialHash(BroadphaseData& data, const AabbArrays& boxes, uint32_t count);
+
+            ResourceStorage<BroadphaseData> broadphaseStorage;
+
+            /// Contacts are made up to this far apart, so bodies slow down before they touch
+            /// instead of tunneling into each other in one step.
+            constexpr float speculativeDistance = 0.02f;
+            /// A new contact point takes over the impulses of an old one at most this far away.
+            constexpr float warmStartDistance = 0.05f;
+            /// The incident face is clipped this far outside the sides of the reference face,
+            /// so the corners of equal faces on top of each other do not come and go.
+            constexpr float clipTolerance = 0.005f;
+            /// Broadphase pairs per chunk of the parallel narrowphase.
+            constexpr uint32_t narrowphaseChunkSize = 256;
+            /// Islands with more contacts solve the batches of each color in parallel.
+            constexpr uint32_t parallelIslandContacts = 1024;
+            /// Color of the contacts whose bodies already have all other colors,
+            /// they go one per batch and are solved in order.
+            constexpr uint32_t overflowColor = 63;
+            /// Contacts approaching faster than this bounce off with the restitution of the bodies.
+            constexpr float restitutionVelocity = 1.0f;
+            /// No body or contact, e.g. in the empty lanes of a batch.
+            constexpr uint32_t noIndex = 0xffffffff;
+
+            struct Mat3
+            {
+                float m[3][3];
+            };
+
+            struct ContactPoint
+            {
+                /// The point relative to body a, in its local frame. Matches the point up with
+                /// the one of the last step, as long as the bodies did not slide apart.
+                Vec3 localA;
+                Vec3 position;
+                /// Positive when the bodies overlap.
+                float depth;
+                float normalImpulse;
+                float tangentImpulse[2];
+            };
+
+            /// Up to 4 contact points of a pair of bodies, the normal points from a to b.
+            struct Manifold
+            {
+                uint32_t a;
+                uint32_t b;
+                Vec3 normal;
+                uint32_t pointCount;
+                ContactPoint points[4];
+            };
+
+            /// 4 contacts in structure-of-arrays form, a lane per contact.
+            /// The rows are the normal and the two friction directions.
+            /// Empty lanes have no bodies and no mass, they never move anything.
+            struct alignas(16) ContactBatch
+            {
+                uint32_t bodyA[4];
+                uint32_t bodyB[4];
+                float inverseMassA[4];
+                float inverseMassB[4];
+                // [row][x, y, z][lane]
+                float direction[3][3][4];
+                float angularA[3][3][4];
+                float angularB[3][3][4];
+                // The world inverse inertia times angularA/angularB.
+                float inertiaA[3][3][4];
+                float inertiaB[3][3][4];
+                float mass[3][4];
+                float impulse[3][4];
+                /// Normal velocity the contact pushes towards:
+                /// positive to separate overlapping bodies, negative to let a gap close.
+                float velocityTarget[4];
+                float friction[4];
+                /// Manifold index * 4 + point, noIndex for an empty lane.
+                uint32_t contact[4];
+                uint32_t color;
+            };
+
+            /// Bodies which touch each other, directly or through others. Static bodies do not connect.
+            struct Island
+            {
+                uint32_t firstManifold;
+                uint32_t manifoldCount;
+                uint32_t firstContact;
+                uint32_t contactCount;
+                uint32_t firstBatch;
+                uint32_t batchCount;
+                uint32_t colorCount;
+            };
+
+            /// A physics world. All buffers only grow, once warmed up a step does not allocate.
+            struct WorldData
+            {
+                PhysicsSettings settings;
+                Broadphase broadphase;
+                PhysicsStats stats = {};
+
+                // The bodies, in structure-of-arrays form.
+                std::vector<Vec3> position;
+                std::vector<Quat> rotation;
+                std::vector<Vec3> linearVelocity;
+                std::vector<Vec3> angularVelocity;
+                std::vector<ShapeType> shape;
+                std::vector<Vec3> halfExtents;
+                std::vector<float> inverseMass;
+                /// Diagonal of the inverse inertia in the local frame.
+                std::vector<Vec3> inverseInertia;
+                std::vector<Mat3> inverseInertiaWorld;
+                std::vector<float> friction;
+                std::vector<float> restitution;
+                std::vector<float> boxMin[3];
+                std::vector<float> boxMax[3];
+
+                // The manifolds of this step, per narrowphase chunk and joined in chunk order,
+                // and the ones of the last step sorted by (a, b) for warm starting.
+                std::vector<std::vector<Manifold>> chunkManifolds;
+                std::vector<uint32_t> chunkWarmStarted;
+                std::vector<Manifold> manifolds;
+                std::vector<Manifold> cachedManifolds;
+
+                // Islands: a union find over the bodies, the manifolds grouped by island
+                // and their contacts (manifold index * 4 + point) grouped by color within the island.
+                std::vector<uint32_t> parent;
+                std::vector<uint32_t> islandOf;
+                std::vector<uint32_t> manifoldIsland;
+                std::vector<Island> islands;
+                std::vector<uint32_t> islandManifolds;
+                std::vector<uint32_t> contacts;
+                std::vector<uint8_t> contactColor;
+                std::vector<uint64_t> bodyColors;
+                std::vector<ContactBatch> batches;
+            };
+
+            /// A box with its axes in world space.
+            struct OrientedBox
+            {
+                Vec3 center;
+                Vec3 axis[3];
+                float half[3];
+            };
+
+            OrientedBox orientedBox(const WorldData& world, uint32_t body);
+            // The shape pair tests write up to 4 points (position and depth) and return how many.
+            // The normal points from the first shape to the second.
+            uint32_t collideSpheres(Vec3 centerA, float radiusA, Vec3 centerB, float radiusB, 
+                                    Vec3& normal, ContactPoint* points);
+            uint32_t collideSphereBox(Vec3 center, float radius, const OrientedBox& box, 
+                                      Vec3& normal, ContactPoint* points);
+            /// Separating axis test, then the incident face clipped against the reference face.
+            uint32_t collideBoxes(const OrientedBox& a, const OrientedBox& b, Vec3& normal, ContactPoint* points);
+            /// Picks the 4 of count points which hold the bodies best: the deepest one and 
+            /// the ones spanning the largest area with it.
+            uint32_t reduceContacts(const ContactPoint* candidates, uint32_t count, Vec3 normal, 
+                                    ContactPoint* points);
+            /// Contact manifold of two bodies, false if they are further apart than speculativeDistance.
+            bool collide(const WorldData& world, uint32_t a, uint32_t b, Manifold& manifold);
+            /// The manifolds of the pairs, warm started from the cached ones of the last step.
+            void findContacts(WorldData& world, const BodyPair* pairs, uint32_t pairCount);
+            void buildIslands(WorldData& world);
+            /// Colors the contacts of an island and counts its batches.
+            void colorIsland(WorldData& world, Island& island);
+            /// Fills the batches of an island by color and applies the impulses of the last step.
+            void prepareIsland(WorldData& world, const Island& island, float deltaTime);
+            void fillBatch(const WorldData& world, ContactBatch& batch, const uint32_t* contacts, 
+                           uint32_t laneCount, uint32_t color, float deltaTime);
+            void warmStartBatch(WorldData& world, const ContactBatch& batch);
+            /// One iteration over 4 contacts, with SIMD. Lanes of a batch never share a moving body.
+            void solveBatch(WorldData& world, ContactBatch& batch);
+            /// The same one contact at a time, to measure the SIMD version against.
+            void solveBatchScalar(WorldData& world, ContactBatch& batch);
+            void solveIslands(WorldData& world, float deltaTime);
+
+            ResourceStorage<WorldData> worldStorage;
+
+            /// Queries per chunk of the parallel scene queries, a multiple of 4.
+            constexpr uint32_t sceneQueryChunkSize = 64;
+
+            /// A leaf holds one object (children[0] is noIndex), an inner node two children.
+            struct SceneNode
+            {
+                Aabb box;
+                uint32_t parent;
+                uint32_t children[2];
+                uint32_t object;
+                /// Longest way down to a leaf, 0 for leaves.
+                uint32_t height;
+            };
+
+            /// A node to search for the sibling of a new leaf. inheritedCost is how much the nodes
+            /// above it grow, bound the least any pairing below it can cost.
+            struct SiblingCandidate
+            {
+                float bound;
+                float inheritedCost;
+                uint32_t node;
+            };
+
+            struct SceneTreeData
+            {
+                SceneTreeSettings settings;
+                std::vector<SceneNode> nodes;
+                std::vector<uint32_t> freeNodes;
+                uint32_t root = noIndex;
+                // Per object id: its exact box and its leaf (noIndex for free ids).
+                std::vector<Aabb> objectBox;
+                std::vector<uint32_t> objectNode;
+                std::vector<uint32_t> freeObjects;
+                std::vector<uint32_t> movedObjects;
+                std::vector<uint8_t> objectMoved;
+                // Nodes to refit in updateSceneTree, marked with the update they were added in,
+                // and sorted by height into refitOrder (a counting sort over heightStart).
+                std::vector<uint32_t> refitNodes;
+                std::vector<uint32_t> refitOrder;
+                std::vector<uint32_t> heightStart;
+                std::vector<uint32_t> nodeMark;
+                uint32_t updateCount = 0;
+                uint32_t objectCount = 0;
+                SceneTreeStats stats = {};
+                std::vector<SiblingCandidate> siblingCandidates;
+                std::vector<std::vector<SceneOverlap>> chunkOverlaps;
+            };
+
+            uint32_t allocateSceneNode(SceneTreeData& tree);
+            void insertSceneLeaf(SceneTreeData& tree, uint32_t leaf);
+            void removeSceneLeaf(SceneTreeData& tree, uint32_t leaf);
+            /// Fits the box and height of an inner node to its children.
+            void refitSceneNode(SceneTreeData& tree, uint32_t node);
+            /// Swaps a child of node with a grandchild on the other side if that shrinks the
+            /// child it goes into. Returns whether it did.
+            bool rotateSceneNode(SceneTreeData& tree, uint32_t node);
+            /// Refits and rotates from node up to the root.
+            void refitSceneAncestors(SceneTreeData& tree, uint32_t node);
+            /// Closest hits of up to 4 boxes moving from center along direction for distances
+            /// [0, maxDistance], the box of every node grown by the extents. Rays have extents 0.
+            void castScenePacket(const SceneTreeData& tree, const Vec3* centers, const Vec3* extents,
+                                 const Vec3* directions, const float* maxDistances, uint32_t laneCount,
+                                 SceneHit* hits, std::vector<uint32_t>& stack);
+            void overlapScenePacket(const SceneTreeData& tree, const Aabb* boxes, uint32_t firstQuery,
+                                    uint32_t laneCount, std::vector<SceneOverlap>& out,
+                                    std::vector<uint32_t>& stack);
+
+            ResourceStorage<SceneTreeData> sceneTreeStorage;
+        }
+#endif
+
+#ifdef TE_GAMEPLAY
+        namespace gameplay {
+
+            constexpr uint32_t chunkBytes = 16 * 1024;
+            constexpr uint32_t maxComponentSize = 4 * 1024;
+            /// The component arrays in a chunk start at multiples of this, so they can be loaded with SIMD.
+            constexpr uint32_t columnAlignment = 16;
+            constexpr uint32_t noColumn = 0xffffffff;
+            constexpr uint32_t noIndex = 0xffffffff;
+
+            struct ComponentInfo
+            {
+                uint32_t size;
+                uint32_t alignment;
+            };
+
+            struct Chunk
+            {
+                /// chunkBytes, the entities first, then the array of every component.
+                uint8_t* memory;
+                uint32_t count;
+            };
+
+            /// All entities with one set of components. The chunks are full except the last.
+            struct Archetype
+            {
+                ComponentMask components;
+                /// Entities per chunk. Chunks are chunkBytes, unless one entity does not fit into that.
+                uint32_t capacity;
+                uint32_t chunkSize;
+                uint32_t columnOffsets[maxComponents];
+                std::vector<Chunk> chunks;
+                uint32_t entityCount = 0;
+            };
+
+            /// Where an entity is, archetype is noIndex while its index is free or only reserved.
+            struct EntitySlot
+            {
+                uint32_t generation;
+                uint32_t archetype;
+                uint32_t chunk;
+                uint32_t row;
+            };
+
+            struct QueryData
+            {
+                ComponentMask required;
+                ComponentMask exclude;
+                std::vector<uint32_t> archetypes;
+                std::vector<QueryChunk> chunks;
+            };
+
+            enum class CommandType : uint8_t
+            {
+                Create,
+                Destroy,
+                Add,
+                Remove,
+                Set
+            };
+
+            struct Command
+            {
+                CommandType type;
+                Entity entity;
+                ComponentMask components;
+                /// Set: the component and where its value is in CommandsData::values.
+                ComponentId component;
+                uint32_t valueOffset;
+            };
+
+            struct CommandsData
+            {
+                uint32_t world;
+                std::vector<Command> commands;
+                std::vector<uint8_t> values;
+            };
+
+            struct SystemData
+            {
+                SystemDesc desc;
+                EntityCommands commands;
+                uint32_t stage;
+                GameWorld world;
+            };
+
+            struct GameWorldData
+            {
+                ComponentInfo components[maxComponents];
+                uint32_t componentCount = 0;
+                ComponentMask registered = 0;
+                // Behind pointers, QueryChunk points at the column offsets of the archetypes.
+                std::vector<std::unique_ptr<Archetype>> archetypes;
+                std::unordered_map<ComponentMask, uint32_t> archetypeOf;
+                std::vector<uint8_t*> spareChunks;
+                std::vector<EntitySlot> entities;
+                std::vector<uint32_t> freeEntities;
+                /// Indices handed out so far, reserved ones may not have a slot yet.
+                uint32_t nextEntity = 0;
+                uint32_t entityCount = 0;
+                std::mutex entityMutex;
+                std::vector<QueryData> queries;
+                std::vector<SystemData> systems;
+                uint32_t stageCount = 0;
+                GameWorldStats stats = {};
+            };
+
+            /// The archetype with exactly these components, created with its layout if there is none yet.
+            uint32_t findArchetype(GameWorldData& world, ComponentMask components);
+            /// A free or new entity index, under the entity mutex so commands can reserve from any thread.
+            Entity reserveEntity(GameWorldData& world);
+            /// Appends the entity to the archetype with zeroed components.
+            void placeEntity(GameWorldData& world, uint32_t index, uint32_t archetype);
+            /// Takes the entity out of its archetype, the last entity of the archetype fills the gap.
+            void unplaceEntity(GameWorldData& world, uint32_t index);
+            /// Moves the entity to another archetype, keeping the components both have.
+            void moveEntity(GameWorldData& world, uint32_t index, uint32_t archetype);
+            bool isAlive(const GameWorldData& world, Entity entity);
+            void freeEntity(GameWorldData& world, Entity entity);
+            void playback(GameWorldData& world, CommandsData& commands);
+
+            ResourceStorage<GameWorldData> gameWorldStorage;
+            ResourceStorage<CommandsData> commandsStorage;
+        }
+#endif
+
+#ifdef TE_NETWORK
+        namespace network {
+
+            /// Datagrams stay below the usual internet MTU.
+            constexpr uint32_t packetBytes = 1200;
+            /// Larger messages are split into fragments of this size.
+            constexpr uint32_t fragmentBytes = 1024;
+            constexpr uint32_t maxFragments = 256;
+            constexpr uint16_t protocolId = 0x7e01;
+            /// Protocol id, flags, sequence, ack and ack bits.
+            constexpr uint32_t packetHeaderBytes = 11;
+            /// Channel and flags, size, then the sequence or message id and the fragment index and count if needed.
+            constexpr uint32_t messageHeaderBytes = 7;
+            constexpr uint8_t hasAcks = 1;
+            constexpr uint8_t fragmented = 0x80;
+            /// Unacked reliable messages per channel, and how far ahead of the next
+            /// delivery a received one may be.
+            constexpr uint32_t reliableWindow = 256;
+            constexpr uint32_t sentPacketHistory = 256;
+            constexpr uint32_t maxReliablePerPacket = 32;
+            constexpr uint32_t noPacket = 0xffffffff;
+            constexpr uint32_t noOffset = 0xffffffff;
+            constexpr int socketBufferBytes = 4 * 1024 * 1024;
+            /// An empty packet goes out after this long without any, so the other side does not time out.
+            constexpr double keepAliveSeconds = 0.5;
+
+            static_assert(packetHeaderBytes + messageHeaderBytes + fragmentBytes <= packetBytes);
+
+#ifdef _WIN32
+            using NativeSocket = SOCKET;
+#else
+            using NativeSocket = int;
+#endif
+
+            /// A message or fragment in a packet buffer. Sent and received messages use the same slots.
+            struct QueuedMessage
+            {
+                /// The pool buffer, noPacket while the slot is empty.
+                uint32_t packet = noPacket;
+                uint16_t size;
+                /// Reliable: the message sequence. Unreliable: the id shared by the fragments of a message.
+                uint16_t sequence;
+                uint8_t fragment;
+                /// 0 for messages which are not split.
+                uint8_t lastFragment;
+                bool sent;
+                double sentTime;
+            };
+
+            struct ChannelState
+            {
+                ChannelType type;
+                uint16_t nextSequence = 0;
+                uint16_t oldestUnacked = 0;
+                /// Reliable: the unacked messages, by sequence % reliableWindow.
+                QueuedMessage window[reliableWindow];
+                /// Unreliable: the messages for the next sendPackets.
+                std::vector<QueuedMessage> queue;
+
+                /// Reliable: the next sequence to deliver and the messages which came in before it.
+                uint16_t nextDelivery = 0;
+                QueuedMessage received[reliableWindow];
+
+                /// The fragments joined so far, maxMessageSize once the channel gets a fragmented message.
+                std::vector<uint8_t> assembly;
+                bool assembling = false;
+                uint16_t assemblyId;
+                uint8_t assemblyLast;
+                uint32_t assemblySize;
+                uint32_t fragmentsReceived;
+                bool fragmentReceived[maxFragments];
+            };
+
+            /// The reliable messages which went out in a packet, acked with it.
+            struct SentPacket
+            {
+                bool pending;
+                uint16_t sequence;
+                double time;
+                uint32_t reliableCount;
+                uint8_t channels[maxReliablePerPacket];
+                uint16_t messages[maxReliablePerPacket];
+            };
+
+            struct ConnectionData
+            {
+                bool active;
+                NetAddress address;
+                double lastReceived;
+                double lastSent;
+                double roundTrip;
+                uint16_t nextPacket;
+                /// The newest packet from the other side, and bit i for the packet i + 1 before it.
+                uint16_t remoteSequence;
+                uint32_t remoteAcks;
+                bool receivedAny;
+                /// A packet with messages came in which no packet acked yet.
+                bool ackPending;
+                SentPacket sent[sentPacketHistory];
+                std::vector<ChannelState> channels;
+            };
+
+            /// Assembled messages are copied to TransportData::eventBytes, which may still grow,
+            /// so their data is set by nextNetEvent.
+            struct PendingEvent
+            {
+                NetEvent event;
+                uint32_t assembledOffset;
+            };
+
+            struct TransportData
+            {
+                TransportSettings settings;
+                NativeSocket socket;
+                NetAddress address;
+                /// packetCount buffers of packetBytes.
+                std::vector<uint8_t> packetMemory;
+                std::vector<uint32_t> freePackets;
+                /// Allocated when first opened, kept for the next connection at that index.
+                std::vector<std::unique_ptr<ConnectionData>> connections;
+                std::unordered_map<uint64_t, uint32_t> connectionOf;
+                std::vector<PendingEvent> events;
+                uint32_t nextEvent = 0;
+                std::vector<uint8_t> eventBytes;
+                /// Buffers which events point into, freed by the next receivePackets.
+                std::vector<uint32_t> heldPackets;
+                /// The datagrams of the batch being received or sent.
+                std::vector<uint32_t> batchPackets;
+                std::vector<uint32_t> batchSizes;
+                std::vector<NetAddress> batchAddresses;
+#ifndef _WIN32
+                std::vector<mmsghdr> headers;
+                std::vector<iovec> vectors;
+                std::vector<sockaddr_in> socketAddresses;
+#endif
+                uint32_t random = 0x9e3779b9;
+                TransportStats stats = {};
+            };
+
+            uint8_t* packetData(TransportData& transport, uint32_t packet);
+            /// A buffer from the pool, noPacket (counted in the stats) if it is empty.
+            uint32_t takePacket(TransportData& transport);
+            void releasePacket(TransportData& transport, uint32_t packet);
+            /// Receives into the taken buffers of batchPackets, sets their sizes and addresses
+            /// and returns how many arrived.
+            uint32_t receiveBatch(TransportData& transport);
+            /// Sends the packets of the batch and gives their buffers back.
+            void sendBatch(TransportData& transport);
+            /// Frees the buffers of the connection and makes its index free.
+            void resetConnection(TransportData& transport, uint32_t connection);
+            /// Handles the acks and messages of a packet. Returns true if an event points into it.
+            bool processPacket(TransportData& transport, uint32_t connection, const uint8_t* data, uint32_t size, double now);
+            /// Packs what the connection has to send into packets of the batch.
+            void writePackets(TransportData& transport, uint32_t connection, double now);
+
+            ResourceStorage<TransportData> transportStorage;
+        }
+#endif
+
+#ifdef TE_DX11
+        namespace dx11 {
+
+            struct InternalContext 
+            {
+                uint32_t spriteVertexShaderId;
+                uint32_t spritePixelShaderId;
+                uint32_t spriteShaderId;
+                uint32_t spriteShaderInputLayoutId;
+                uint32_t spriteVertexBufferId;
+                uint32_t spriteIndexBufferId;
+                uint32_t spriteSamplerId;
+                uint32_t quadModelId;
+                uint32_t spriteBatchModelId;
+                uint32_t objectTransformBufferId;
+                uint32_t cameraBufferId;
+
+                DirectX::XMMATRIX orthoProjectionMatrix;
+                // Size of the orthographic 2D view, centered on 0/0.
+                float viewWidth;
+                float viewHeight;
+
+                HWND hwnd;
+
+            };
+
+            struct ConstantBuffer 
+            {
+
+                ComPtr<ID3D11Buffer> buffer;
+            };
+
+            struct Model 
+            {
+                ComPtr<ID3D11Buffer> vertexBuffer;
+                ComPtr<ID3D11Buffer> indexBuffer;
+                size_t indexCount = 0;
+                uint32_t stride = 0;
+            };
+
+            /// The dx11 part of a command list: a deferred context with its own 
+            /// sprite batch buffers, and the commands recorded into it on close.
+            struct DeferredCommandList 
+            {
+                ComPtr<ID3D11DeviceContext> context;
+                ComPtr<ID3D11CommandList> commands;
+                Model batchModel = { nullptr, nullptr, 0, sizeof(SpriteInstance) };
+                D3D11_VIEWPORT viewport;
+            };
+
+            struct Sampler  
+            {
+                ComPtr<ID3D11SamplerState> samplerState;
+            };
+
+            struct Camera
+            {
+
+                DirectX::XMFLOAT4X4 view;
+                DirectX::XMFLOAT4X4 projection;
+            };
+
+
+            struct InputLayout
+            {
+                ComPtr<ID3D11InputLayout> inputLayout;
+            };
+            
+            struct DX11Texture {
+                ComPtr<ID3D11Texture2D> texture;
+                ComPtr<ID3D11RenderTargetView> rtv;
+                ComPtr<ID3D11ShaderResourceView> srv;
+            };
+
+            struct VertexShader 
+            {
+                ComPtr<ID3DBlob> blob;
+                ComPtr<ID3D11VertexShader> shader;
+
+            };
+
+            struct PixelShader 
+            {
+                ComPtr<ID3DBlob> blob;
+                ComPtr<ID3D11PixelShader> shader;
+            };
+
+            struct ShaderProgram 
+            {
+                VertexShader* vs;
+                PixelShader* ps;
+            };
+
+            struct VertexAttributeDescription {
+                std::string semanticName;       
+                uint32_t attributeLocation;
+                int numberOfComponents;     
+                DXGI_FORMAT format;
+                int stride;
+                uint32_t offset;
+                /// Advances once per instance instead of once per vertex.
+                bool perInstance = false;
+
+            };
+
+            bool init(Window window);
+            void printDXGIError(HRESULT hr);
+            bool resizeSwapChain(HWND hwnd, int width, int height);
+            /// Takes over vsync, tearing and the frame latency right away, 
+            /// a different buffer count resizes the swap chain buffers.
+            void applyPresentSettings(const PresentSettings& settings);
+            /// Blocks on the swap chain's frame latency object until it takes another frame.
+            void waitForFrameLatency();
+            bool createDefaultDepthStencilBuffer(int width, int height);
+            void setViewport(int originX, int originY, int width, int height);
+            void clearBackBuffer(float r, float g, float b, float a);
+            void presentBackBuffer();
+            void bindBackBuffer(int x, int y, int width, int height);
+            /// Draws the batch through context, shader id 0 in a range is the default sprite shader. 
+            /// Every range is one DrawIndexedInstanced of the quad model over its instances. 
+            /// Only state which differs from what cache remembers is bound.
+            void flushSpriteBatch(SpriteBatch& batch, ID3D11DeviceContext* context, 
+                                StateCache& cache, RenderStats& stats, Sampler *sampler, 
+                                InputLayout* inputLayout, Model* batchModel);
+            /// Records the draws of a closed list into its deferred context, 
+            /// called on the recording thread.
+            bool recordCommandList(CommandListData& list);
+            /// Grows the instance buffer of the batch model to at least instanceCount sprites.
+            bool reserveSpriteBatchModel(Model* batchModel, uint32_t instanceCount);
+            void drawIndexed(uint32_t indexCount, uint32_t startIndex);
+            void bindTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+            void bindInputLayout(dx11::InputLayout *inputLayout);
+            void bindVertexBuffer(ComPtr<ID3D11Buffer> vertexBuffer, uint32_t stride, uint32_t offset);
+            void bindIndexBuffer(ComPtr<ID3D11Buffer> indexBuffer, uint32_t offset);
+            void bindTexture(DX11Texture *texture, uint32_t slot,
+                             Sampler *sampler, uint32_t samplerSlot);
+            void bindShader(ShaderProgram* shader);
+            void uploadConstantBufferDataForVertexShader(ComPtr<ID3D11Buffer> buffer, void *data, 
+                                                        size_t size, uint32_t slot);
+            void uploadConstantBufferDataForPixelShader(ComPtr<ID3D11Buffer> buffer, void *data, 
+                                                        size_t size, uint32_t slot);
+            void copyConstantBufferData(ComPtr<ID3D11Buffer> buffer, void *data, size_t size);
+
+            /// Bytecode of the shader from the shader cache, or compiled with D3DCompile 
+            /// and stored in the cache on a miss. nullptr if it does not compile.
+            ComPtr<ID3DBlob> compileShader(const std::string& source, 
+                                           const std::vector<shadercache::Define>& defines, const char* profile);
+            VertexShader* createVertexShaderFromSource(const std::string& source, 
+                                                       const std::vector<shadercache::Define>& defines = {});
+            PixelShader* createPixelShaderFromSource(const std::string& source, 
+                                                     const std::vector<shadercache::Define>& defines = {});
+            ConstantBuffer* createConstantBuffer(size_t size);
+            DX11Texture *createTextureFromPixels(uint32_t width, uint32_t height, const uint8_t* rgbaPixels);
+            /// mipData holds mipCount RGBA8 levels in the asset pack payload layout.
+            DX11Texture *createTextureFromMipChain(uint32_t width, uint32_t height, uint32_t mipCount, 
+                                                   const uint8_t* mipData);
+            InputLayout* createInputLayout(std::vector<dx11::VertexAttributeDescription> descs, 
+                                                dx11::ShaderProgram* shaderProgram);
+
+            Sampler *createSampler(D3D11_TEXTURE_ADDRESS_MODE addressMode,
+                                   DirectX::XMVECTOR borderColor, D3D11_FILTER filter);
+            ComPtr<ID3D11Buffer> createVertexBuffer(const float *data, size_t size, D3D11_USAGE usage);
+            ComPtr<ID3D11Buffer> createIndexBuffer(const uint32_t *data, size_t size, D3D11_USAGE usage);
+            Model* createModelFromGeometry(const std::vector<float>& vertices,
+                                            const std::vector<uint32_t>& indices, 
                                             D3D11_USAGE bufferUsage, 
                                             uint32_t stride);
 
-            
+            
+
+            std::string getSpriteVertexShaderSource();
+            std::string getSpritePixelShaderSource();
+
+            ComPtr<ID3D11Device> dx11Device;
+            ComPtr<ID3D11DeviceContext> dx11Context;
+            ComPtr<ID3D11Debug> dx11Debug;
+            ComPtr<IDXGISwapChain> dx11SwapChain;
+            ComPtr<IDXGISwapChain2> dx11SwapChain2;
+            /// Signaled whenever the swap chain can take another frame.
+            HANDLE frameLatencyWaitable = nullptr;
+            /// The flags the swap chain was created with, ResizeBuffers must pass the same.
+            UINT swapChainFlags = 0;
+            bool tearingSupported = false;
+            PresentSettings presentSettings;
+            ComPtr<ID3D11Texture2D> dx11BackBuffer;
+            ComPtr<ID3D11Texture2D> dx11DepthStencilBuffer;
+            ComPtr<ID3D11DepthStencilView> dx11DepthStencilView;
+            ComPtr<ID3D11RenderTargetView> dx11rtv;
+            ComPtr<ID3D11DepthStencilState> dx11DepthStencilState;
+            ComPtr<ID3D11RasterizerState> dx11RasterState;
+            ComPtr<ID3D11SamplerState> dx11SamplerState;
+            ComPtr<ID3D11BlendState> dx11BlendState;
+
+            ResourceStorage<DX11Texture> textureStorage;
+            ResourceStorage<ShaderProgram> shaderProgramStorage;
+            ResourceStorage<VertexShader> vertexShaderStorage;
+            ResourceStorage<PixelShader> pixelShaderStorage;
+            ResourceStorage<Sampler> samplerStorage;
+            ResourceStorage<Model> modelStorage;
+            ResourceStorage<ConstantBuffer> constantBufferStorage;
+            ResourceStorage<InputLayout> inputLayoutStorage;
+
+            SpriteBatch spriteBatch;
+            StateCache stateCache;
+            RenderStats frameRenderStats = {};
+            RenderStats renderStats = {};
+            TextureLoader* textureLoader = nullptr;
+            // The viewport last set on the immediate context, for the deferred ones.
+            D3D11_VIEWPORT currentViewport = {};
+
+#ifdef TE_PROFILE
+            /// The timestamp queries of one frame. They are read back a few frames later, 
+            /// so the CPU never waits on the GPU for them.
+            struct GpuTimingFrame 
+            {
+                static constexpr uint32_t maxScopes = 32;
+                ComPtr<ID3D11Query> disjoint;
+                ComPtr<ID3D11Query> begin[maxScopes];
+                ComPtr<ID3D11Query> end[maxScopes];
+                const char* names[maxScopes];
+                uint32_t scopeCount = 0;
+                /// eventClock() when the frame began, the first GPU scope is placed there.
+                uint64_t cpuStart = 0;
+                bool pending = false;
+            };
+
+            /// Times the GPU work issued on the immediate context during its lifetime, 
+            /// use it through TE_PROFILE_GPU_SCOPE.
+            class GpuProfileScope 
+            {
+                public:
+                    explicit GpuProfileScope(const char* name);
+                    ~GpuProfileScope();
+
+                private:
+                    uint32_t scope;
+            };
+
+            /// Called after present: closes the frame of queries and reads back older frames.
+            void endGpuTimingFrame();
+            void readGpuTimings();
+
+            constexpr uint32_t gpuTimingLatency = 4;
+            GpuTimingFrame gpuTimingFrames[gpuTimingLatency];
+            uint32_t currentGpuTimingFrame = 0;
+            bool gpuTimingFrameOpen = false;
+#define TE_PROFILE_GPU_SCOPE(name) tiny_engine::detail::dx11::GpuProfileScope TE_PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#else
+#define TE_PROFILE_GPU_SCOPE(name)
+#endif
+
+
+
+        }
+#endif
+
+#ifdef TE_NULL_GRAPHICS
+        /// Backend which renders nothing. 
+        /// Shows what every call costs on the engine side (dispatch, bookkeeping), 
+        /// e.g. for benchmarks on machines without a GPU.
+        namespace null {
+
+            struct NullTexture 
+            {
+                uint32_t width;
+                uint32_t height;
+            };
+
+            struct CallCounts 
+            {
+                uint64_t clears;
+                uint64_t presents;
+                uint64_t binds;
+                uint64_t draws;
+            };
+
+            /// Sorts and batches the recorded draws like a real backend would 
+            /// and counts the draw calls and binds it would issue.
+            void flushSpriteBatch();
+
+            CallCounts callCounts = {};
+            ResourceStorage<NullTexture> textureStorage;
+            SpriteBatch spriteBatch;
+            StateCache stateCache;
+            RenderStats frameRenderStats = {};
+            RenderStats renderStats = {};
+            TextureLoader* textureLoader = nullptr;
+        }
+#endif
+
+        /// Headless CPU rasterizer backend. 
+        /// Renders into an in-memory RGBA framebuffer, 
+        /// the screen is split into tiles which are rasterized in parallel on the job threads 
+        /// (once the game called initJobs).
+        /// There is no depth buffer, sprites are composited in batch order.
+        namespace software {
+
+            /// CPU side texture, RGBA8 with the bottom row first, like the dx11 upload data.
+            /// texels points either into pixels or, for textures from an asset pack, 
+            /// straight into the mapped archive.
+            struct SoftwareTexture 
+            {
+                uint32_t width;
+                uint32_t height;
+                const uint32_t* texels;
+                std::vector<uint32_t> pixels;
+            };
+
+            /// The backbuffer, RGBA8 (r in the lowest byte), top row first.
+            struct Framebuffer 
+            {
+                uint32_t width = 0;
+                uint32_t height = 0;
+                std::vector<uint32_t> pixels;
+            };
+
+            struct InternalContext 
+            {
+                // Size of the orthographic 2D view, centered on 0/0 as in dx11.
+                float viewWidth;
+                float viewHeight;
+
+                int viewportX;
+                int viewportY;
+                int viewportWidth;
+                int viewportHeight;
+            };
+
+            /// Cost of the last presented frame.
+            struct FrameStats 
+            {
+                uint32_t spriteCount;
+                uint32_t flushCount;
+                double rasterMilliseconds;
+            };
+
+            /// A sprite quad transformed to pixel coordinates.
+            struct ScreenQuad 
+            {
+                float left, top, right, bottom;
+                float uLeft, vTop, uRight, vBottom;
+                SoftwareTexture* texture;
+            };
+
+            constexpr int tileSize = 64;
+
+            bool init(Window window);
+            void clearBackBuffer(float r, float g, float b, float a);
+            void bindBackBuffer(int x, int y, int width, int height);
+            void presentBackBuffer();
+            void flushSpriteBatch(SpriteBatch& batch);
+            void rasterizeTile(uint32_t tileIndex);
+            SoftwareTexture* createTextureFromPixels(uint32_t width, uint32_t height, const uint8_t* rgbaPixels);
+            /// Wraps the pixels without copying them, they must outlive the texture.
+            SoftwareTexture* createTextureView(uint32_t width, uint32_t height, const uint8_t* rgbaPixels);
+
+            /// Alpha blends count source pixels over the destination: 
+            /// rgb = src * srcAlpha + dst * (1 - srcAlpha), alpha = srcAlpha.
+            void blendSpan(uint32_t* dst, const uint32_t* src, int count);
+
+            /// The rendered image, e.g. for golden image comparisons.
+            const Framebuffer& getFramebuffer();
+            const FrameStats& getFrameStats();
+
+            InternalContext internalContext = {};
+            Framebuffer framebuffer;
+            FrameStats frameStats = {};
+            FrameStats currentFrameStats = {};
+            ResourceStorage<SoftwareTexture> textureStorage;
+            SpriteBatch spriteBatch;
+            StateCache stateCache;
+            RenderStats frameRenderStats = {};
+            RenderStats renderStats = {};
+            TextureLoader* textureLoader = nullptr;
+
+            // Per flush scratch data, kept alive to avoid reallocations.
+            std::vector<ScreenQuad> screenQuads;
+            std::vector<std::vector<uint32_t>> tileQuads;
+            uint32_t tilesX = 0;
+            uint32_t tilesY = 0;
+        }
+
+        
+    }
+
+}
+
+
+
+// ----------------------------------------------------------------------------
+// Public API implementation
+
+#ifdef TE_DX11
+namespace dx11 = tiny_engine::detail::dx11;
+
+// Singleton of our dx11 internal context, holding resource ids etc.
+static dx11::InternalContext dx11InternalContext =  {};
+#endif
+
+#ifdef TE_SOFTWARE
+namespace software = tiny_engine::detail::software;
+#endif
+
+#ifdef TE_NULL_GRAPHICS
+namespace null = tiny_engine::detail::null;
+#endif
+
+#ifdef TE_DX11
+// Draws all sprites collected since the last flush. 
+// Called before anything which must happen after these sprites, 
+// e.g. clearing, rebinding the backbuffer or presenting.
+static void flushDX11SpriteBatch()
+{
+    if (dx11::spriteBatch.empty()) return;
+    TE_PROFILE_SCOPE("dx11 sprite flush");
+    TE_PROFILE_GPU_SCOPE("sprites");
+    auto sampler = dx11::samplerStorage.get(dx11InternalContext.spriteSamplerId);
+    auto inputLayout = dx11::inputLayoutStorage.get(dx11InternalContext.spriteShaderInputLayoutId);
+    auto model = dx11::modelStorage.get(dx11InternalContext.spriteBatchModelId);
+    dx11::flushSpriteBatch(dx11::spriteBatch, dx11::dx11Context.Get(), dx11::stateCache, 
+                           dx11::frameRenderStats, sampler, inputLayout, model);
+}
+#endif
+
+// ----------------------------------------------------------------------------
+// Backend dispatch
+//
+// Every backend is a table of functions, initGraphics picks one 
+// and the public functions below just call through it.
+
+#if defined(TE_DX11) || defined(TE_SOFTWARE) || defined(TE_NULL_GRAPHICS)
+// Moves what a command list counted while recording into the frame stats.
+static void addCommandListStats(tiny_engine::RenderStats& frame, tiny_engine::detail::CommandListData& list)
+{
+    frame.drawsSubmitted += list.stats.drawsSubmitted;
+    frame.drawsCulled += list.stats.drawsCulled;
+    frame.drawCalls += list.stats.drawCalls;
+    frame.stateChanges += list.stateCache.changes();
+    frame.stateChangesSkipped += list.stateCache.skipped();
+    list.stats = {};
+    list.stateCache.resetCounters();
+}
+
+// Culls command list sprites against a view of the given size centered on 0/0.
+static void setCommandListView(tiny_engine::detail::CommandListData& list, float viewWidth, float viewHeight)
+{
+    list.cullLeft = -viewWidth * 0.5f;
+    list.cullRight = viewWidth * 0.5f;
+    list.cullBottom = -viewHeight * 0.5f;
+    list.cullTop = viewHeight * 0.5f;
+}
+#endif
+
+#ifdef TE_DX11
+static void dx11ClearBackBuffer(float r, float g, float b, float a)
+{
+    flushDX11SpriteBatch();
+    TE_PROFILE_GPU_SCOPE("clear");
+    dx11::clearBackBuffer(r, g, b, a);
+}
+
+static void dx11PresentBackBuffer()
+{
+    flushDX11SpriteBatch();
+    {
+        TE_PROFILE_SCOPE("dx11 present");
+        dx11::presentBackBuffer();
+    }
+#ifdef TE_PROFILE
+    dx11::endGpuTimingFrame();
+#endif
+    tiny_engine::detail::endFrameRenderStats(dx11::frameRenderStats, dx11::renderStats, dx11::stateCache);
+    if (dx11::textureLoader) dx11::textureLoader->processUploads();
+}
+
+static void dx11BindBackBuffer(int x, int y, int width, int height)
+{
+    flushDX11SpriteBatch();
+    dx11::bindBackBuffer(x, y, width, height);
+}
+
+static void dx11DrawTexture(tiny_engine::Texture t, int x, int y)
+{
+    // Sprites are only recorded here, they are sorted by their sort key 
+    // and drawn in as few draw calls as possible on the next flush.
+    // Scale up to actual image size -> TODO
+    dx11::spriteBatch.add({ t.id, 0, 0, (float) x, (float) y, 64, 64, tiny_engine::detail::spriteDepth, 
+                            t.uvLeft, t.uvBottom, t.uvRight, t.uvTop });
+    dx11::frameRenderStats.drawsSubmitted++;
+}
+
+static void dx11DrawSprites(const tiny_engine::detail::SpriteDraw* draws, uint32_t count)
+{
+    dx11::spriteBatch.add(draws, count);
+    dx11::frameRenderStats.drawsSubmitted += count;
+}
+
+static uint32_t dx11CreateTexture(uint32_t width, uint32_t height, uint32_t mipCount, 
+                                  const uint8_t* pixels, bool)
+{
+    auto texture = dx11::createTextureFromMipChain(width, height, mipCount, pixels);
+    return texture ? dx11::textureStorage.store(texture) : 0;
+}
+
+static void dx11DestroyTexture(uint32_t id)
+{
+    // Pending sprites of this texture are drawn first.
+    flushDX11SpriteBatch();
+    delete dx11::textureStorage.release(id);
+}
+
+static tiny_engine::detail::TextureLoader* dx11TextureLoader()
+{
+    namespace ted = tiny_engine::detail;
+    if (!dx11::textureLoader) 
+    {
+        dx11::textureLoader = new ted::TextureLoader(ted::decodeImageFile, 
+            [](const ted::DecodedImage& image) -> uint32_t {
+                return dx11CreateTexture(image.width, image.height, 1, image.pixels.data(), false);
+            });
+    }
+    return dx11::textureLoader;
+}
+
+static tiny_engine::RenderStats dx11RenderStats()
+{
+    return dx11::renderStats;
+}
+
+static void dx11ApplyPresentSettings(const tiny_engine::PresentSettings& settings)
+{
+    flushDX11SpriteBatch();
+    dx11::applyPresentSettings(settings);
+}
+
+static void dx11WaitForFrameLatency()
+{
+    dx11::waitForFrameLatency();
+}
+
+static void dx11BeginCommandList(tiny_engine::detail::CommandListData& list)
+{
+    if (!list.backendData) list.backendData = new dx11::DeferredCommandList();
+    auto deferred = static_cast<dx11::DeferredCommandList*>(list.backendData);
+    deferred->commands.Reset();
+    deferred->viewport = dx11::currentViewport;
+    setCommandListView(list, dx11InternalContext.viewWidth, dx11InternalContext.viewHeight);
+}
+
+static void dx11CloseCommandList(tiny_engine::detail::CommandListData& list)
+{
+    // Sorting, batching and the device calls all happen on the recording thread.
+    if (!dx11::recordCommandList(list)) list.batch.clear();
+}
+
+static void dx11SubmitCommandList(tiny_engine::detail::CommandListData& list)
+{
+    addCommandListStats(dx11::frameRenderStats, list);
+    auto deferred = static_cast<dx11::DeferredCommandList*>(list.backendData);
+    if (!deferred || !deferred->commands) return;
+    // What was drawn directly so far comes first.
+    flushDX11SpriteBatch();
+    TE_PROFILE_GPU_SCOPE("command list");
+    // TRUE restores the immediate context state afterwards, so its state cache stays valid.
+    dx11::dx11Context->ExecuteCommandList(deferred->commands.Get(), TRUE);
+    deferred->commands.Reset();
+}
+
+static void dx11DestroyCommandList(tiny_engine::detail::CommandListData& list)
+{
+    delete static_cast<dx11::DeferredCommandList*>(list.backendData);
+    list.backendData = nullptr;
+}
+
+static constexpr tiny_engine::detail::GraphicsBackend dx11Backend = {
+    tiny_engine::GraphicsApi::DX11, 
+    dx11ClearBackBuffer, dx11PresentBackBuffer, dx11BindBackBuffer, dx11DrawTexture, dx11DrawSprites, 
+    dx11CreateTexture, dx11DestroyTexture, dx11TextureLoader, dx11RenderStats, 
+    dx11ApplyPresentSettings, dx11WaitForFrameLatency, 
+    dx11BeginCommandList, dx11CloseCommandList, dx11SubmitCommandList, dx11DestroyCommandList
+};
+#endif
+
+#ifdef TE_SOFTWARE
+static void softwareClearBackBuffer(float r, float g, float b, float a)
+{
+    software::flushSpriteBatch(software::spriteBatch);
+    software::clearBackBuffer(r, g, b, a);
+}
+
+static void softwarePresentBackBuffer()
+{
+    software::flushSpriteBatch(software::spriteBatch);
+    software::presentBackBuffer();
+    tiny_engine::detail::endFrameRenderStats(software::frameRenderStats, software::renderStats, software::stateCache);
+    if (software::textureLoader) software::textureLoader->processUploads();
+}
+
+static void softwareBindBackBuffer(int x, int y, int width, int height)
+{
+    software::flushSpriteBatch(software::spriteBatch);
+    software::bindBackBuffer(x, y, width, height);
+}
+
+static void softwareDrawTexture(tiny_engine::Texture t, int x, int y)
+{
+    software::spriteBatch.add({ t.id, 0, 0, (float) x, (float) y, 64, 64, tiny_engine::detail::spriteDepth, 
+                                t.uvLeft, t.uvBottom, t.uvRight, t.uvTop });
+    software::frameRenderStats.drawsSubmitted++;
+}
+
+static void softwareDrawSprites(const tiny_engine::detail::SpriteDraw* draws, uint32_t count)
+{
+    software::spriteBatch.add(draws, count);
+    software::frameRenderStats.drawsSubmitted += count;
+}
+
+static uint32_t softwareCreateTexture(uint32_t width, uint32_t height, uint32_t, 
+                                      const uint8_t* pixels, bool pixelsOutliveTexture)
+{
+    // No mip mapping in the software rasterizer, only the top level is used.
+    auto texture = pixelsOutliveTexture ? software::createTextureView(width, height, pixels) 
+                                        : software::createTextureFromPixels(width, height, pixels);
+    return software::textureStorage.store(texture);
+}
+
+static void softwareDestroyTexture(uint32_t id)
+{
+    software::flushSpriteBatch(software::spriteBatch);
+    delete software::textureStorage.release(id);
+}
+
+static tiny_engine::detail::TextureLoader* softwareTextureLoader()
+{
+    namespace ted = tiny_engine::detail;
+    if (!software::textureLoader) 
+    {
+        software::textureLoader = new ted::TextureLoader(ted::decodeImageFile, 
+            [](const ted::DecodedImage& image) -> uint32_t {
+                return softwareCreateTexture(image.width, image.height, 1, image.pixels.data(), false);
+            });
+    }
+    return software::textureLoader;
+}
+
+static tiny_engine::RenderStats softwareRenderStats()
+{
+    return software::renderStats;
+}
+
+static void softwareApplyPresentSettings(const tiny_engine::PresentSettings&)
+{
+    // The framebuffer is never shown, there is no swap chain to configure.
+}
+
+static void softwareBeginCommandList(tiny_engine::detail::CommandListData& list)
+{
+    setCommandListView(list, software::internalContext.viewWidth, software::internalContext.viewHeight);
+}
+
+static void softwareCloseCommandList(tiny_engine::detail::CommandListData&)
+{
+}
+
+static void softwareSubmitCommandList(tiny_engine::detail::CommandListData& list)
+{
+    addCommandListStats(software::frameRenderStats, list);
+    // Pending direct draws first, then the list on its own, like the dx11 backend orders them.
+    software::flushSpriteBatch(software::spriteBatch);
+    software::spriteBatch.append(list.batch);
+    software::flushSpriteBatch(software::spriteBatch);
+    list.batch.clear();
+}
+
+static void softwareDestroyCommandList(tiny_engine::detail::CommandListData&)
+{
+}
+
+static constexpr tiny_engine::detail::GraphicsBackend softwareBackend = {
+    tiny_engine::GraphicsApi::Software, 
+    softwareClearBackBuffer, softwarePresentBackBuffer, softwareBindBackBuffer, softwareDrawTexture, softwareDrawSprites, 
+    softwareCreateTexture, softwareDestroyTexture, softwareTextureLoader, softwareRenderStats, 
+    softwareApplyPresentSettings, nullptr, 
+    softwareBeginCommandList, softwareCloseCommandList, softwareSubmitCommandList, softwareDestroyCommandList
+};
+#endif
+
+#ifdef TE_NULL_GRAPHICS
+static void nullClearBackBuffer(float, float, float, float)
+{
+    null::flushSpriteBatch();
+    null::callCounts.clears++;
+}
+
+static void nullPresentBackBuffer()
+{
+    null::flushSpriteBatch();
+    null::callCounts.presents++;
+    tiny_engine::detail::endFrameRenderStats(null::frameRenderStats, null::renderStats, null::stateCache);
+    if (null::textureLoader) null::textureLoader->processUploads();
+}
+
+static void nullBindBackBuffer(int, int, int, int)
+{
+    null::flushSpriteBatch();
+    null::callCounts.binds++;
+}
+
+static void nullDrawTexture(tiny_engine::Texture t, int x, int y)
+{
+    null::spriteBatch.add({ t.id, 0, 0, (float) x, (float) y, 64, 64, tiny_engine::detail::spriteDepth, 
+                            t.uvLeft, t.uvBottom, t.uvRight, t.uvTop });
+    null::frameRenderStats.drawsSubmitted++;
+    null::callCounts.draws++;
+}
+
+static void nullDrawSprites(const tiny_engine::detail::SpriteDraw* draws, uint32_t count)
+{
+    null::spriteBatch.add(draws, count);
+    null::frameRenderStats.drawsSubmitted += count;
+    null::callCounts.draws += count;
+}
+
+static uint32_t nullCreateTexture(uint32_t width, uint32_t height, uint32_t, const uint8_t*, bool)
+{
+    return null::textureStorage.store(new null::NullTexture { width, height });
+}
+
+static void nullDestroyTexture(uint32_t id)
+{
+    null::flushSpriteBatch();
+    delete null::textureStorage.release(id);
+}
+
+static tiny_engine::detail::TextureLoader* nullTextureLoader()
+{
+    namespace ted = tiny_engine::detail;
+    if (!null::textureLoader) 
+    {
+        null::textureLoader = new ted::TextureLoader(ted::decodeImageFile, 
+            [](const ted::DecodedImage& image) -> uint32_t {
+                return nullCreateTexture(image.width, image.height, 1, nullptr, false);
+            });
+    }
+    return null::textureLoader;
+}
+
+static tiny_engine::RenderStats nullRenderStats()
+{
+    return null::renderStats;
+}
+
+static void nullApplyPresentSettings(const tiny_engine::PresentSettings&)
+{
+}
+
+static void nullBeginCommandList(tiny_engine::detail::CommandListData& list)
+{
+    // There is no view, nothing is culled.
+    setCommandListView(list, INFINITY, INFINITY);
+}
+
+static void nullCloseCommandList(tiny_engine::detail::CommandListData&)
+{
+}
+
+static void nullSubmitCommandList(tiny_engine::detail::CommandListData& list)
+{
+    addCommandListStats(null::frameRenderStats, list);
+    null::flushSpriteBatch();
+    null::spriteBatch.append(list.batch);
+    null::flushSpriteBatch();
+    list.batch.clear();
+}
+
+static void nullDestroyCommandList(tiny_engine::detail::CommandListData&)
+{
+}
+
+static constexpr tiny_engine::detail::GraphicsBackend nullBackend = {
+    tiny_engine::GraphicsApi::Null, 
+    nullClearBackBuffer, nullPresentBackBuffer, nullBindBackBuffer, nullDrawTexture, nullDrawSprites, 
+    nullCreateTexture, nullDestroyTexture, nullTextureLoader, nullRenderStats, 
+    nullApplyPresentSettings, nullptr, 
+    nullBeginCommandList, nullCloseCommandList, nullSubmitCommandList, nullDestroyCommandList
+};
+#endif
+
+// With exactly one backend compiled in its table is known at compile time, 
+// the calls through it become direct calls which the compiler can inline.
+#if defined(TE_DX11) && !defined(TE_SOFTWARE) && !defined(TE_NULL_GRAPHICS)
+#define TE_SINGLE_BACKEND dx11Backend
+#elif defined(TE_SOFTWARE) && !defined(TE_DX11) && !defined(TE_NULL_GRAPHICS)
+#define TE_SINGLE_BACKEND softwareBackend
+#elif defined(TE_NULL_GRAPHICS) && !defined(TE_DX11) && !defined(TE_SOFTWARE)
+#define TE_SINGLE_BACKEND nullBackend
+#endif
+
+static inline const tiny_engine::detail::GraphicsBackend& backendOf(tiny_engine::GraphicsContext* context)
+{
+#ifdef TE_SINGLE_BACKEND
+    (void) context;
+    return TE_SINGLE_BACKEND;
+#else
+    return *context->backend;
+#endif
+}
+
+tiny_engine::GraphicsContext* tiny_engine::initGraphics(const std::string& api, 
+                                            tiny_engine::Window window) 
+{
+    // Without any backend compiled in, neither is used.
+    (void) api;
+    (void) window;
+
+    namespace ted = tiny_engine::detail;
+#ifdef TE_SOFTWARE
+    if (api == "software") 
+    {
+        if (!software::init(window)) return nullptr;
+        return new tiny_engine::GraphicsContext { GraphicsApi::Software, &softwareBackend };
+    }
+#endif
+#ifdef TE_NULL_GRAPHICS
+    if (api == "null") 
+    {
+        return new tiny_engine::GraphicsContext { GraphicsApi::Null, &nullBackend };
+    }
+#endif
+#ifdef TE_DX11
+    if (api != "dx11") return nullptr;
+
+    if (tiny_engine::detail::dx11::init(window)) 
+    {
+
+        dx11InternalContext.hwnd = (HWND) window.nativeWindowHandle;
+
+        auto dx11Context = new tiny_engine::GraphicsContext { GraphicsApi::DX11, &dx11Backend };
+
+        // Next we create all secondary default resources we
+        // need to implement all api functions. 
+        // In particular we need:
+        // Shaders to render sprites and 3d models.
+        // 3d models may be animated and have light and shadow. 
+        // Sprites currently are unlit. 
+        // We need default input layouts for both sprites and 3d models,
+        // VertexBuffers for sprites etc.
+        auto spriteVertexShader = dx11::createVertexShaderFromSource(
+                dx11::getSpriteVertexShaderSource());
+        auto spritePixelShader = dx11::createPixelShaderFromSource(
+                dx11::getSpritePixelShaderSource());
+        auto spriteShaderProgram = new dx11::ShaderProgram {spriteVertexShader, spritePixelShader};
+        auto spriteVertexShaderId = dx11::vertexShaderStorage.store(spriteVertexShader);
+        auto spritePixelShaderId = dx11::pixelShaderStorage.store(spritePixelShader);
+        auto spriteShaderProgramId = dx11::shaderProgramStorage.store(spriteShaderProgram);
+        dx11InternalContext.spriteVertexShaderId = spriteVertexShaderId;
+        dx11InternalContext.spritePixelShaderId = spritePixelShaderId;
+        dx11InternalContext.spriteShaderId = spriteShaderProgramId;
+
+        auto defaultSampler = dx11::createSampler(D3D11_TEXTURE_ADDRESS_WRAP, DirectX::XMVECTOR{1, 1,1,1}, 
+                                                        D3D11_FILTER_MIN_MAG_MIP_LINEAR );
+        auto defaultSamplerId = dx11::samplerStorage.store(defaultSampler);
+        dx11InternalContext.spriteSamplerId = defaultSamplerId;
+
+        // Slot 0 is the unit quad model, slot 1 the sprite batch instances (see SpriteInstance).
+        using tiny_engine::detail::SpriteInstance;
+        std::vector<dx11::VertexAttributeDescription> spriteAttributes =  {
+                            {"POSITION", 0, 3, DXGI_FORMAT_R32G32B32_FLOAT, sizeof(float) * 5, 0}, 
+                            {"TEXCOORD", 0, 2, DXGI_FORMAT_R32G32_FLOAT, sizeof(float) * 5, sizeof(float) * 3},
+                            {"INSTANCE_RECT", 1, 4, DXGI_FORMAT_R32G32B32A32_FLOAT, sizeof(SpriteInstance), 
+                                offsetof(SpriteInstance, x), true},
+                            {"INSTANCE_UV", 1, 4, DXGI_FORMAT_R32G32B32A32_FLOAT, sizeof(SpriteInstance), 
+                                offsetof(SpriteInstance, uvLeft), true},
+                            {"INSTANCE_ROTATION_DEPTH", 1, 2, DXGI_FORMAT_R32G32_FLOAT, sizeof(SpriteInstance), 
+                                offsetof(SpriteInstance, rotation), true},
+                            {"INSTANCE_TINT", 1, 4, DXGI_FORMAT_R8G8B8A8_UNORM, sizeof(SpriteInstance), 
+                                offsetof(SpriteInstance, tint), true},
+                            {"INSTANCE_LAYER", 1, 1, DXGI_FORMAT_R32_UINT, sizeof(SpriteInstance), 
+                                offsetof(SpriteInstance, layer), true}
+                        };
+        auto spriteInputLayout = dx11::createInputLayout(spriteAttributes, spriteShaderProgram);
+        auto spriteInputLayoutId = dx11::inputLayoutStorage.store(spriteInputLayout);
+        dx11InternalContext.spriteShaderInputLayoutId = spriteInputLayoutId;
+
+        // Creating the quad model for all sprites:
+        std::vector<float> quadVertices = {
+            -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,
+            0.5f, -0.5f, 0.0f, 1.0f, 0.0f,
+            -0.5f,  0.5f, 0.0f, 0.0f, 1.0f,
+            0.5, 0.5, 0.0f, 1.0f, 1.0f
+
+        };
+
+
+        std::vector<uint32_t> quadIndices = {
+            // 0,1, 2,
+            // 2, 1, 3
+
+                2,1,0, 
+                3,1,2
+
+        };
+        auto quadModel = dx11::createModelFromGeometry(quadVertices, 
+                                                        quadIndices, 
+                                                        D3D11_USAGE_DEFAULT, 5  * sizeof(float));
+        dx11InternalContext.quadModelId = dx11::modelStorage.store(quadModel);
+
+        // The sprite batch model only has a dynamic instance buffer (the indices come from the quad model), 
+        // it grows with the number of sprites per frame.
+        auto spriteBatchModel = new dx11::Model { nullptr, nullptr, 0, sizeof(SpriteInstance) };
+        dx11::reserveSpriteBatchModel(spriteBatchModel, 1024);
+        dx11InternalContext.spriteBatchModelId = dx11::modelStorage.store(spriteBatchModel);
+
+        // Create a constant buffer to hold the worldmatrix for object transformations:
+        auto objectTransformBuffer = dx11::createConstantBuffer(sizeof(DirectX::XMMATRIX));
+        dx11InternalContext.objectTransformBufferId = dx11::constantBufferStorage.store(objectTransformBuffer);
+
+        // Default camera buffer setup, 
+        // this will hold the view/projection matrices in every shader.
+        auto cameraBuffer = dx11::createConstantBuffer(sizeof(DirectX::XMMATRIX) * 2);
+        dx11InternalContext.cameraBufferId = dx11::constantBufferStorage.store(cameraBuffer);
+
+        // Setup a default projection and viewmatrix for our 2D rendering:
+        float viewWidth  = window.width;
+        float viewHeight = window.height;
+        float nearZ = 0.1f;
+        float farZ  = 100.0f;
+
+        auto ortho = DirectX::XMMatrixOrthographicLH(viewWidth, viewHeight, nearZ, farZ);
+        dx11InternalContext.orthoProjectionMatrix = ortho;
+        dx11InternalContext.viewWidth = viewWidth;
+        dx11InternalContext.viewHeight = viewHeight;
+        
+        DirectX::XMFLOAT4X4 orthoData;
+        DirectX::XMStoreFloat4x4(&orthoData, ortho);
+        DirectX::XMFLOAT4X4 viewData;
+        DirectX::XMStoreFloat4x4(&viewData, DirectX::XMMatrixIdentity());
+        dx11::Camera cam = { viewData, orthoData };
+        dx11::uploadConstantBufferDataForVertexShader(cameraBuffer->buffer, &cam, sizeof(dx11::Camera), 1);
+        
+        return dx11Context;
+    }
+    else 
+    {
+
+        return nullptr;
+    }
+#else
+    return nullptr;
+#endif
+
+}
+
+
+
+void tiny_engine::drawTexture(GraphicsContext* context, Texture t, int x, int y)
+{
+    backendOf(context).drawTexture(t, x, y);
+}
+
+void tiny_engine::drawSprite(GraphicsContext* context, const Sprite& sprite)
+{
+    const Texture& t = sprite.texture;
+    detail::SpriteDraw draw = { t.id, 0, sprite.layer, sprite.x, sprite.y, sprite.width, sprite.height, 
+                                detail::spriteDepth, t.uvLeft, t.uvBottom, t.uvRight, t.uvTop, 
+                                sprite.rotation, sprite.tint };
+    backendOf(context).drawSprites(&draw, 1);
+}
+
+void tiny_engine::drawSprites(GraphicsContext* context, Texture texture, const SpriteArrays& sprites, 
+                              uint32_t count, uint8_t layer)
+{
+    if (count == 0 || !sprites.x || !sprites.y) return;
+    auto& packed = detail::spritePackBuffer;
+    packed.resize(count);
+    detail::packSprites(sprites, count, texture, layer, packed.data());
+    backendOf(context).drawSprites(packed.data(), count);
+}
+
+void tiny_engine::clearBackBuffer(GraphicsContext* context, float r, float g, 
+                                                        float b, float a)
+{
+    backendOf(context).clearBackBuffer(r, g, b, a);
+}
+
+void tiny_engine::presentBackBuffer(GraphicsContext* context)
+{
+    const auto& backend = backendOf(context);
+    detail::framePacer.beginPresent();
+    backend.presentBackBuffer();
+    detail::framePacer.endPresent();
+    tiny_engine::detail::endFrameAllocations();
+#ifdef TE_PROFILE
+    profileEndFrame();
+#endif
+    detail::framePacer.waitForNextFrame(backend.waitForFrameLatency);
+}
+
+void tiny_engine::setPresentSettings(GraphicsContext* context, const PresentSettings& settings)
+{
+    detail::presentSettings = settings;
+    detail::framePacer.setTargetFrameRate(settings.targetFrameRate);
+    backendOf(context).applyPresentSettings(settings);
+}
+
+tiny_engine::PresentSettings tiny_engine::getPresentSettings()
+{
+    return detail::presentSettings;
+}
+
+tiny_engine::FrameTiming tiny_engine::getFrameTiming()
+{
+    return detail::framePacer.lastFrame();
+}
+
+void tiny_engine::setShaderCacheDirectory(const std::string& directory)
+{
+    detail::shadercache::directory = directory;
+}
+
+tiny_engine::ShaderCacheStats tiny_engine::getShaderCacheStats()
+{
+    return detail::shadercache::stats;
+}
+
+void tiny_engine::bindBackBuffer(GraphicsContext* context, int x, int y, 
+                                                int width, int height) 
+{
+    backendOf(context).bindBackBuffer(x, y, width, height);
+}
+
+
+std::optional<tiny_engine::Texture> tiny_engine::createTextureFromFile(GraphicsContext* context, 
+                                                    const std::string& fileName)
+{
+    detail::DecodedImage image;
+    if (!detail::decodeImageFile(fileName, image)) return std::nullopt;
+    uint32_t id = backendOf(context).createTexture(image.width, image.height, 1, image.pixels.data(), false);
+    if (id == 0) return std::nullopt;
+    return Texture { id };
+}
+
+void tiny_engine::destroyTexture(GraphicsContext* context, Texture t)
+{
+    backendOf(context).destroyTexture(t.id);
+}
+
+std::optional<tiny_engine::TextureAtlas> tiny_engine::createTextureAtlas(GraphicsContext* context, 
+                                                    const std::vector<std::string>& fileNames, 
+                                                    uint32_t pageSize)
+{
+    namespace atlas = tiny_engine::detail::atlas;
+    // One texel of padding, filled with the edge texels, against bleeding with linear filtering.
+    constexpr uint32_t padding = 1;
+
+    std::vector<detail::DecodedImage> images(fileNames.size());
+    std::vector<atlas::Placement> rects(fileNames.size());
+    for (size_t i = 0; i < fileNames.size(); i++) 
+    {
+        if (!detail::decodeImageFile(fileNames[i], images[i])) return std::nullopt;
+        rects[i] = atlas::Placement { images[i].width, images[i].height, 0, 0, 0 };
+    }
+
+    uint32_t pageCount = atlas::packRects(pageSize, pageSize, padding, rects);
+    if (pageCount == 0 && !rects.empty()) return std::nullopt;
+
+    TextureAtlas result;
+    std::vector<uint8_t> pagePixels((size_t) pageSize * pageSize * 4);
+    for (uint32_t page = 0; page < pageCount; page++) 
+    {
+        std::fill(pagePixels.begin(), pagePixels.end(), 0);
+        for (size_t i = 0; i < rects.size(); i++) 
+        {
+            if (rects[i].page != page) continue;
+            atlas::blitWithPadding(pagePixels.data(), pageSize, pageSize, images[i], rects[i].x, rects[i].y, padding);
+        }
+
+        uint32_t id = backendOf(context).createTexture(pageSize, pageSize, 1, pagePixels.data(), false);
+        if (id == 0) 
+        {
+            for (auto& created : result.pages) destroyTexture(context, created);
+            return std::nullopt;
+        }
+        result.pages.push_back(Texture { id });
+    }
+
+    // Page rows are stored bottom first like every texture, so y maps directly to v.
+    for (const auto& rect : rects) 
+    {
+        float scale = 1.0f / pageSize;
+        result.textures.push_back(Texture { result.pages[rect.page].id, 
+                                            rect.x * scale, rect.y * scale, 
+                                            (rect.x + rect.width) * scale, (rect.y + rect.height) * scale });
+    }
+    return result;
+}
+
+std::optional<tiny_engine::Font> tiny_engine::createFontFromFile(GraphicsContext* context, 
+                                                    const std::string& fileName, float pixelHeight)
+{
+    std::vector<uint8_t> contents;
+    detail::text::TrueTypeFile file;
+    if (!detail::readFile(fileName, contents) || !detail::text::parseTrueType(std::move(contents), file)) 
+    {
+        return std::nullopt;
+    }
+
+    std::vector<uint32_t> codePoints;
+    for (uint32_t c = 32; c < 127; c++) codePoints.push_back(c);
+    for (uint32_t c = 160; c < 256; c++) codePoints.push_back(c);
+
+    auto font = new detail::FontData();
+    detail::DecodedImage page;
+    if (!font->glyphs.build(file, pixelHeight, codePoints, 2048, page)) 
+    {
+        delete font;
+        return std::nullopt;
+    }
+    font->pageTextureId = backendOf(context).createTexture(page.width, page.height, 1, page.pixels.data(), false);
+    if (font->pageTextureId == 0) 
+    {
+        delete font;
+        return std::nullopt;
+    }
+    return Font { detail::fontStorage.store(font) };
+}
+
+void tiny_engine::destroyFont(GraphicsContext* context, Font font)
+{
+    auto data = detail::fontStorage.release(font.id);
+    if (!data) return;
+    backendOf(context).destroyTexture(data->pageTextureId);
+    delete data;
+}
+
+void tiny_engine::drawText(GraphicsContext* context, Font font, const std::string& text, int x, int y)
+{
+    auto data = detail::fontStorage.get(font.id);
+    if (!data) return;
+    const auto& placed = data->runs.shape(data->glyphs, text);
+
+    // One layer above the sprites, so text is blended over them, and in front of them for the depth test.
+    constexpr uint8_t textLayer = 1;
+    constexpr float textDepth = 0.15f;
+    data->draws.clear();
+    for (const auto& p : placed) 
+    {
+        const auto& glyph = data->glyphs.glyph(p.glyph);
+        data->draws.push_back({ data->pageTextureId, 0, textLayer, 
+                                x + p.x + glyph.width * 0.5f, y + p.y + glyph.height * 0.5f, 
+                                glyph.width, glyph.height, textDepth, 
+                                glyph.uvLeft, glyph.uvBottom, glyph.uvRight, glyph.uvTop });
+    }
+    if (!data->draws.empty()) backendOf(context).drawSprites(data->draws.data(), (uint32_t) data->draws.size());
+}
+
+// The background texture loader of the context's backend, created on first use.
+static tiny_engine::detail::TextureLoader* textureLoaderFor(tiny_engine::GraphicsContext* context)
+{
+    return backendOf(context).textureLoader();
+}
+
+tiny_engine::TextureLoadHandle tiny_engine::createTextureFromFileAsync(GraphicsContext* context, 
+                                                        const std::string& fileName)
+{
+    auto loader = textureLoaderFor(context);
+    return TextureLoadHandle { loader ? loader->request(fileName) : 0 };
+}
+
+tiny_engine::TextureLoadState tiny_engine::getTextureLoadState(GraphicsContext* context, 
+                                                        TextureLoadHandle handle)
+{
+    auto loader = textureLoaderFor(context);
+    return loader ? loader->state(handle.id) : TextureLoadState::Failed;
+}
+
+std::optional<tiny_engine::Texture> tiny_engine::getLoadedTexture(GraphicsContext* context, 
+                                                        TextureLoadHandle handle)
+{
+    auto loader = textureLoaderFor(context);
+    if (!loader) return std::nullopt;
+    TextureLoadState state = loader->state(handle.id);
+    if (state == TextureLoadState::Pending) return std::nullopt;
+    // Done either way, so the request is released, otherwise every load would keep a slot.
+    uint32_t textureId = loader->textureId(handle.id);
+    loader->release(handle.id);
+    if (state == TextureLoadState::Failed) return std::nullopt;
+    return Texture { textureId };
+}
+
+void tiny_engine::setTextureUploadBudget(GraphicsContext* context, TextureUploadBudget budget)
+{
+    auto loader = textureLoaderFor(context);
+    if (loader) loader->setUploadBudget(budget);
+}
+
+tiny_engine::TextureLoadStats tiny_engine::getTextureLoadStats(GraphicsContext* context)
+{
+    auto loader = textureLoaderFor(context);
+    return loader ? loader->stats() : TextureLoadStats {};
+}
+
+std::optional<tiny_engine::AssetPack> tiny_engine::openAssetPack(const std::string& fileName)
+{
+    auto archive = new detail::pack::Archive();
+    if (!archive->open(fileName)) 
+    {
+        delete archive;
+        return std::nullopt;
+    }
+    return AssetPack { detail::pack::archiveStorage.store(archive) };
+}
+
+void tiny_engine::closeAssetPack(AssetPack pack)
+{
+    delete detail::pack::archiveStorage.release(pack.id);
+}
+
+std::optional<tiny_engine::Texture> tiny_engine::createTextureFromPack(GraphicsContext* context, 
+                                                    AssetPack pack, const std::string& name)
+{
+    auto archive = detail::pack::archiveStorage.get(pack.id);
+    if (!archive) return std::nullopt;
+    auto entry = archive->find(name);
+    if (!entry) return std::nullopt;
+
+    // The mapping stays alive until closeAssetPack, the textures may point into it.
+    uint32_t id = backendOf(context).createTexture(entry->width, entry->height, entry->mipCount, 
+                                                   archive->payload(*entry), true);
+    if (id == 0) return std::nullopt;
+    return Texture { id };
+}
+
+// ----------------------------------------------------------------------------
+// Sprite batching
+//
+
+uint64_t tiny_engine::detail::makeSortKey(uint8_t layer, uint32_t shaderId, uint32_t textureId, float depth)
+{
+    // Far sprites get the small keys, so they are drawn first.
+    float clamped = std::min(std::max(depth, 0.0f), 1.0f);
+    uint64_t inverseDepth = (uint64_t) ((1.0f - clamped) * 0xffff);
+    uint64_t shaderSlot = shaderId & 0xffff;
+    uint64_t textureSlot = textureId & SlotMap<int>::indexMask;
+    return ((uint64_t) layer << 56) | (shaderSlot << 40) | (textureSlot << 16) | inverseDepth;
+}
+
+void tiny_engine::detail::radixSort(SortPacket* packets, SortPacket* scratch, size_t count)
+{
+    if (count < 2) return;
+
+    // Short lists are faster with a plain (stable) insertion sort.
+    if (count <= 32) 
+    {
+        for (size_t i = 1; i < count; i++) 
+        {
+            SortPacket packet = packets[i];
+            size_t j = i;
+            for (; j > 0 && packets[j - 1].key > packet.key; j--) packets[j] = packets[j - 1];
+            packets[j] = packet;
+        }
+        return;
+    }
+
+    // The histograms of all 8 bytes in one pass over the keys.
+    uint32_t histograms[8][256] = {};
+    for (size_t i = 0; i < count; i++) 
+    {
+        uint64_t key = packets[i].key;
+        for (int b = 0; b < 8; b++) histograms[b][(key >> (b * 8)) & 0xff]++;
+    }
+
+    SortPacket* from = packets;
+    SortPacket* to = scratch;
+    uint64_t firstKey = packets[0].key;
+    for (int b = 0; b < 8; b++) 
+    {
+        uint32_t* histogram = histograms[b];
+        uint32_t shift = b * 8;
+        // All keys share this byte, the pass would not move anything.
+        if (histogram[(firstKey >> shift) & 0xff] == count) continue;
+
+        uint32_t offset = 0;
+        for (int i = 0; i < 256; i++) 
+        {
+            uint32_t bucketSize = histogram[i];
+            histogram[i] = offset;
+            offset += bucketSize;
+        }
+        for (size_t i = 0; i < count; i++) 
+        {
+            to[histogram[(from[i].key >> shift) & 0xff]++] = from[i];
+        }
+        std::swap(from, to);
+    }
+
+    if (from != packets) memcpy(packets, from, count * sizeof(SortPacket));
+}
+
+void tiny_engine::detail::SpriteBatch::add(const SpriteDraw& draw)
+{
+    packets.push_back(SortPacket { makeSortKey(draw.layer, draw.shaderId, draw.textureId, draw.depth), 
+                                   (uint32_t) draws.size() });
+    draws.push_back(draw);
+}
+
+void tiny_engine::detail::SpriteBatch::add(const SpriteDraw* newDraws, uint32_t count)
+{
+    uint32_t offset = (uint32_t) draws.size();
+    draws.insert(draws.end(), newDraws, newDraws + count);
+    packets.resize(offset + count);
+    SortPacket* packet = packets.data() + offset;
+    for (uint32_t i = 0; i < count; i++) 
+    {
+        const SpriteDraw& draw = newDraws[i];
+        packet[i] = SortPacket { makeSortKey(draw.layer, draw.shaderId, draw.textureId, draw.depth), offset + i };
+    }
+}
+
+void tiny_engine::detail::SpriteBatch::append(const SpriteBatch& other)
+{
+    uint32_t offset = (uint32_t) draws.size();
+    draws.insert(draws.end(), other.draws.begin(), other.draws.end());
+    // The keys are recomputed, other may already have sorted its packets.
+    for (uint32_t i = 0; i < other.draws.size(); i++) 
+    {
+        const SpriteDraw& draw = other.draws[i];
+        packets.push_back(SortPacket { makeSortKey(draw.layer, draw.shaderId, draw.textureId, draw.depth), 
+                                       offset + i });
+    }
+}
+
+void tiny_engine::detail::SpriteBatch::clear()
+{
+    // Only the sizes are reset, the capacity is kept for the next frame.
+    draws.clear();
+    packets.clear();
+    instanceStream.clear();
+    drawRanges.clear();
+}
+
+void tiny_engine::detail::SpriteBatch::build()
+{
+    TE_PROFILE_SCOPE("SpriteBatch::build");
+    // Draws with equal keys keep their submission order, the sort is stable.
+    sortScratch.resize(packets.size());
+    radixSort(packets.data(), sortScratch.data(), packets.size());
+
+    instanceStream.resize(draws.size());
+    drawRanges.clear();
+
+    SpriteInstance* instance = instanceStream.data();
+    for (uint32_t i = 0; i < packets.size(); i++) 
+    {
+        const SpriteDraw& d = draws[packets[i].index];
+        instance[i] = SpriteInstance { d.x, d.y, d.width, d.height, 
+                                       d.uvLeft, d.uvBottom, d.uvRight, d.uvTop, 
+                                       d.rotation, d.depth, d.tint, d.layer };
+
+        if (drawRanges.empty() || drawRanges.back().textureId != d.textureId || 
+            drawRanges.back().shaderId != d.shaderId) 
+        {
+            drawRanges.push_back(SpriteBatchRange { d.shaderId, d.textureId, i, 0 });
+        }
+        drawRanges.back().instanceCount++;
+    }
+}
+
+void tiny_engine::detail::packSpritesScalar(const SpriteArrays& sprites, uint32_t begin, uint32_t end, 
+                                            const Texture& texture, uint8_t layer, SpriteDraw* out)
+{
+    for (uint32_t i = begin; i < end; i++) 
+    {
+        SpriteDraw& d = out[i];
+        d = SpriteDraw { texture.id, 0, layer, sprites.x[i], sprites.y[i], 
+                         sprites.width ? sprites.width[i] : 64, sprites.height ? sprites.height[i] : 64, 
+                         spriteDepth, texture.uvLeft, texture.uvBottom, texture.uvRight, texture.uvTop };
+        if (sprites.rotation) d.rotation = sprites.rotation[i];
+        if (sprites.tint) d.tint = sprites.tint[i];
+    }
+}
+
+void tiny_engine::detail::packSprites(const SpriteArrays& sprites, uint32_t count, const Texture& texture, 
+                                      uint8_t layer, SpriteDraw* out)
+{
+    TE_PROFILE_SCOPE("packSprites");
+    // x, y, width and height are next to each other in a draw, 
+    // so 4 sprites are transposed into them with 4 stores.
+    static_assert(offsetof(SpriteDraw, height) == offsetof(SpriteDraw, x) + 3 * sizeof(float), 
+                  "SpriteDraw x, y, width and height must be contiguous");
+    // Everything else is the same for all sprites (or a plain copy per sprite).
+    SpriteDraw shared = { texture.id, 0, layer, 0, 0, 0, 0, spriteDepth, 
+                          texture.uvLeft, texture.uvBottom, texture.uvRight, texture.uvTop };
+    uint32_t i = 0;
+#if defined(TE_SIMD_SSE2)
+    const __m128 defaultSize = _mm_set1_ps(64);
+    for (; i + 4 <= count; i += 4) 
+    {
+        __m128 x = _mm_loadu_ps(sprites.x + i);
+        __m128 y = _mm_loadu_ps(sprites.y + i);
+        __m128 width = sprites.width ? _mm_loadu_ps(sprites.width + i) : defaultSize;
+        __m128 height = sprites.height ? _mm_loadu_ps(sprites.height + i) : defaultSize;
+        _MM_TRANSPOSE4_PS(x, y, width, height);
+        SpriteDraw* d = out + i;
+        d[0] = shared; d[1] = shared; d[2] = shared; d[3] = shared;
+        _mm_storeu_ps(&d[0].x, x);
+        _mm_storeu_ps(&d[1].x, y);
+        _mm_storeu_ps(&d[2].x, width);
+        _mm_storeu_ps(&d[3].x, height);
+        if (sprites.rotation) {
+            d[0].rotation = sprites.rotation[i];     d[1].rotation = sprites.rotation[i + 1];
+            d[2].rotation = sprites.rotation[i + 2]; d[3].rotation = sprites.rotation[i + 3];
+        }
+        if (sprites.tint) {
+            d[0].tint = sprites.tint[i];     d[1].tint = sprites.tint[i + 1];
+            d[2].tint = sprites.tint[i + 2]; d[3].tint = sprites.tint[i + 3];
+        }
+    }
+#elif defined(TE_SIMD_NEON)
+    const float32x4_t defaultSize = vdupq_n_f32(64);
+    for (; i + 4 <= count; i += 4) 
+    {
+        float32x4x4_t columns = { { vld1q_f32(sprites.x + i), vld1q_f32(sprites.y + i), 
+                                    sprites.width ? vld1q_f32(sprites.width + i) : defaultSize, 
+                                    sprites.height ? vld1q_f32(sprites.height + i) : defaultSize } };
+        SpriteDraw* d = out + i;
+        d[0] = shared; d[1] = shared; d[2] = shared; d[3] = shared;
+        vst4q_lane_f32(&d[0].x, columns, 0);
+        vst4q_lane_f32(&d[1].x, columns, 1);
+        vst4q_lane_f32(&d[2].x, columns, 2);
+        vst4q_lane_f32(&d[3].x, columns, 3);
+        if (sprites.rotation) {
+            d[0].rotation = sprites.rotation[i];     d[1].rotation = sprites.rotation[i + 1];
+            d[2].rotation = sprites.rotation[i + 2]; d[3].rotation = sprites.rotation[i + 3];
+        }
+        if (sprites.tint) {
+            d[0].tint = sprites.tint[i];     d[1].tint = sprites.tint[i + 1];
+            d[2].tint = sprites.tint[i + 2]; d[3].tint = sprites.tint[i + 3];
+        }
+    }
+#else
+    (void) shared;
+#endif
+    packSpritesScalar(sprites, i, count, texture, layer, out);
+}
+
+// ----------------------------------------------------------------------------
+// Texture atlas packing
+//
+
+tiny_engine::detail::atlas::SkylinePacker::SkylinePacker(uint32_t width, uint32_t height)
+    : pageWidth(width), pageHeight(height)
+{
+    reset();
+}
+
+void tiny_engine::detail::atlas::SkylinePacker::reset()
+{
+    skyline.clear();
+    skyline.push_back(Segment { 0, 0, pageWidth });
+    usedArea = 0;
+}
+
+bool tiny_engine::detail::atlas::SkylinePacker::fit(size_t index, uint32_t width, uint32_t height, 
+                                                    uint32_t& y) const
+{
+    if (skyline[index].x + width > pageWidth) return false;
+    // The rect rests on the highest segment below it.
+    y = 0;
+    uint32_t remaining = width;
+    for (size_t i = index; remaining > 0; i++) 
+    {
+        y = std::max(y, skyline[i].y);
+        if (y + height > pageHeight) return false;
+        remaining -= std::min(remaining, skyline[i].width);
+    }
+    return true;
+}
+
+bool tiny_engine::detail::atlas::SkylinePacker::insert(uint32_t width, uint32_t height, Rect& placed)
+{
+    if (width == 0 || height == 0) 
+    {
+        placed = Rect { 0, 0, width, height };
+        return true;
+    }
+
+    // Lowest top edge wins, ties go to the narrower segment (less wasted space next to it).
+    size_t bestIndex = skyline.size();
+    uint32_t bestTop = UINT32_MAX;
+    uint32_t bestWidth = UINT32_MAX;
+    uint32_t bestY = 0;
+    for (size_t i = 0; i < skyline.size(); i++) 
+    {
+        uint32_t y;
+        if (!fit(i, width, height, y)) continue;
+        if (y + height < bestTop || (y + height == bestTop && skyline[i].width < bestWidth)) 
+        {
+            bestIndex = i;
+            bestTop = y + height;
+            bestWidth = skyline[i].width;
+            bestY = y;
+        }
+    }
+    if (bestIndex == skyline.size()) return false;
+
+    placed = Rect { skyline[bestIndex].x, bestY, width, height };
+    usedArea += (uint64_t) width * height;
+
+    // The new segment replaces everything it covers, 
+    // a partly covered segment is cut to the remaining part.
+    Segment segment { placed.x, bestTop, width };
+    skyline.insert(skyline.begin() + bestIndex, segment);
+    uint32_t right = segment.x + segment.width;
+    size_t i = bestIndex + 1;
+    while (i < skyline.size() && skyline[i].x < right) 
+    {
+        uint32_t segmentRight = skyline[i].x + skyline[i].width;
+        if (segmentRight <= right) 
+        {
+            skyline.erase(skyline.begin() + i);
+            continue;
+        }
+        skyline[i].width = segmentRight - right;
+        skyline[i].x = right;
+        break;
+    }
+
+    // Merge neighbours of the same height, keeps the skyline short.
+    for (size_t j = 0; j + 1 < skyline.size();) 
+    {
+        if (skyline[j].y == skyline[j + 1].y) 
+        {
+            skyline[j].width += skyline[j + 1].width;
+            skyline.erase(skyline.begin() + j + 1);
+        }
+        else 
+        {
+            j++;
+        }
+    }
+    return true;
+}
+
+float tiny_engine::detail::atlas::SkylinePacker::occupancy() const
+{
+    return (float) ((double) usedArea / ((double) pageWidth * pageHeight));
+}
+
+uint32_t tiny_engine::detail::atlas::packRects(uint32_t pageWidth, uint32_t pageHeight, uint32_t padding, 
+                                               std::vector<Placement>& rects)
+{
+    std::vector<uint32_t> order(rects.size());
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        if (rects[a].height != rects[b].height) return rects[a].height > rects[b].height;
+        if (rects[a].width != rects[b].width) return rects[a].width > rects[b].width;
+        return a < b;
+    });
+
+    std::vector<SkylinePacker> pages;
+    for (uint32_t index : order) 
+    {
+        Placement& rect = rects[index];
+        uint32_t paddedWidth = rect.width + padding * 2;
+        uint32_t paddedHeight = rect.height + padding * 2;
+        if (paddedWidth > pageWidth || paddedHeight > pageHeight) return 0;
+
+        Rect placed;
+        uint32_t page = 0;
+        while (page < pages.size() && !pages[page].insert(paddedWidth, paddedHeight, placed)) page++;
+        if (page == pages.size()) 
+        {
+            pages.emplace_back(pageWidth, pageHeight);
+            pages.back().insert(paddedWidth, paddedHeight, placed);
+        }
+        rect.page = page;
+        rect.x = placed.x + padding;
+        rect.y = placed.y + padding;
+    }
+    return (uint32_t) pages.size();
+}
+
+void tiny_engine::detail::atlas::blitWithPadding(uint8_t* page, uint32_t pageWidth, uint32_t pageHeight, 
+                                                 const DecodedImage& image, uint32_t x, uint32_t y, 
+                                                 uint32_t padding)
+{
+    if (image.width == 0 || image.height == 0) return;
+    const uint32_t* src = (const uint32_t*) image.pixels.data();
+    uint32_t* dst = (uint32_t*) page;
+
+    int top = (int) (y + image.height + padding);
+    for (int py = (int) y - (int) padding; py < top; py++) 
+    {
+        if (py < 0 || py >= (int) pageHeight) continue;
+        uint32_t sy = (uint32_t) std::clamp(py - (int) y, 0, (int) image.height - 1);
+        const uint32_t* srcRow = src + (size_t) sy * image.width;
+        uint32_t* dstRow = dst + (size_t) py * pageWidth;
+
+        memcpy(dstRow + x, srcRow, image.width * 4);
+        for (uint32_t p = 1; p <= padding; p++) 
+        {
+            if (x >= p) dstRow[x - p] = srcRow[0];
+            if (x + image.width - 1 + p < pageWidth) dstRow[x + image.width - 1 + p] = srcRow[image.width - 1];
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Text
+//
+
+// Big endian reads from the font file, 0 outside of it.
+static uint8_t ttfU8(const tiny_engine::detail::text::TrueTypeFile& font, size_t offset)
+{
+    return offset < font.data.size() ? font.data[offset] : 0;
+}
+
+static uint16_t ttfU16(const tiny_engine::detail::text::TrueTypeFile& font, size_t offset)
+{
+    if (offset + 2 > font.data.size()) return 0;
+    return (uint16_t) (font.data[offset] << 8 | font.data[offset + 1]);
+}
+
+static int16_t ttfI16(const tiny_engine::detail::text::TrueTypeFile& font, size_t offset)
+{
+    return (int16_t) ttfU16(font, offset);
+}
+
+static uint32_t ttfU32(const tiny_engine::detail::text::TrueTypeFile& font, size_t offset)
+{
+    if (offset + 4 > font.data.size()) return 0;
+    return (uint32_t) font.data[offset] << 24 | (uint32_t) font.data[offset + 1] << 16 | 
+           (uint32_t) font.data[offset + 2] << 8 | font.data[offset + 3];
+}
+
+// 2.14 fixed point, the scale factors of composite glyphs.
+static float ttfF2Dot14(const tiny_engine::detail::text::TrueTypeFile& font, size_t offset)
+{
+    return ttfI16(font, offset) / 16384.0f;
+}
+
+static constexpr uint32_t ttfTag(const char* tag)
+{
+    return (uint32_t) (uint8_t) tag[0] << 24 | (uint32_t) (uint8_t) tag[1] << 16 | 
+           (uint32_t) (uint8_t) tag[2] << 8 | (uint8_t) tag[3];
+}
+
+bool tiny_engine::detail::text::parseTrueType(std::vector<uint8_t> data, TrueTypeFile& font)
+{
+    font = TrueTypeFile();
+    font.data = std::move(data);
+
+    // Plain TrueType only, no collections and no CFF outlines.
+    uint32_t version = ttfU32(font, 0);
+    if (version != 0x00010000 && version != ttfTag("true")) return false;
+
+    uint32_t head = 0, hhea = 0, maxp = 0, cmap = 0;
+    uint16_t tableCount = ttfU16(font, 4);
+    for (uint32_t i = 0; i < tableCount; i++) 
+    {
+        size_t record = 12 + (size_t) i * 16;
+        uint32_t tag = ttfU32(font, record);
+        uint32_t offset = ttfU32(font, record + 8);
+        uint32_t length = ttfU32(font, record + 12);
+        if ((uint64_t) offset + length > font.data.size()) continue;
+
+        if (tag == ttfTag("head")) head = offset;
+        else if (tag == ttfTag("hhea")) hhea = offset;
+        else if (tag == ttfTag("maxp")) maxp = offset;
+        else if (tag == ttfTag("cmap")) cmap = offset;
+        else if (tag == ttfTag("glyf")) font.glyf = offset;
+        else if (tag == ttfTag("loca")) font.loca = offset;
+        else if (tag == ttfTag("hmtx")) font.hmtx = offset;
+        else if (tag == ttfTag("kern")) font.kern = offset;
+    }
+    if (!head || !hhea || !maxp || !cmap || !font.glyf || !font.loca || !font.hmtx) return false;
+
+    font.unitsPerEm = ttfU16(font, head + 18);
+    font.longLocaOffsets = ttfI16(font, head + 50) != 0;
+    font.glyphCount = ttfU16(font, maxp + 4);
+    font.ascender = ttfI16(font, hhea + 4);
+    font.descender = ttfI16(font, hhea + 6);
+    font.lineGap = ttfI16(font, hhea + 8);
+    font.horizontalMetricCount = ttfU16(font, hhea + 34);
+
+    // A unicode subtable, the full repertoire (format 12) if there is one.
+    uint16_t subtableCount = ttfU16(font, cmap + 2);
+    for (uint32_t i = 0; i < subtableCount; i++) 
+    {
+        size_t record = cmap + 4 + (size_t) i * 8;
+        uint16_t platform = ttfU16(font, record);
+        uint16_t encoding = ttfU16(font, record + 2);
+        uint32_t subtable = cmap + ttfU32(font, record + 4);
+        uint16_t format = ttfU16(font, subtable);
+        bool unicode = platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10));
+        if (!unicode || (format != 4 && format != 12)) continue;
+        if (!font.cmap || format == 12) font.cmap = subtable;
+    }
+
+    return font.cmap && font.unitsPerEm > 0 && font.glyphCount > 0 && font.horizontalMetricCount > 0;
+}
+
+uint32_t tiny_engine::detail::text::glyphIndex(const TrueTypeFile& font, uint32_t codePoint)
+{
+    uint32_t table = font.cmap;
+    uint32_t glyph = 0;
+    uint16_t format = ttfU16(font, table);
+    if (format == 4 && codePoint <= 0xffff) 
+    {
+        uint32_t segmentCount = ttfU16(font, table + 6) / 2;
+        size_t endCodes = table + 14;
+        size_t startCodes = endCodes + segmentCount * 2 + 2;
+        size_t deltas = startCodes + segmentCount * 2;
+        size_t rangeOffsets = deltas + segmentCount * 2;
+
+        // The first segment which ends at or after the code point.
+        uint32_t low = 0, high = segmentCount;
+        while (low < high) 
+        {
+            uint32_t middle = (low + high) / 2;
+            if (ttfU16(font, endCodes + middle * 2) < codePoint) low = middle + 1;
+            else high = middle;
+        }
+        if (low == segmentCount) return 0;
+        uint16_t start = ttfU16(font, startCodes + low * 2);
+        if (codePoint < start) return 0;
+
+        uint16_t delta = ttfU16(font, deltas + low * 2);
+        uint16_t rangeOffset = ttfU16(font, rangeOffsets + low * 2);
+        if (rangeOffset == 0) 
+        {
+            glyph = (codePoint + delta) & 0xffff;
+        }
+        else 
+        {
+            // The offset is relative to its own position in the rangeOffsets array.
+            glyph = ttfU16(font, rangeOffsets + low * 2 + rangeOffset + (codePoint - start) * 2);
+            if (glyph) glyph = (glyph + delta) & 0xffff;
+        }
+    }
+    else if (format == 12) 
+    {
+        uint32_t groupCount = ttfU32(font, table + 12);
+        uint32_t low = 0, high = groupCount;
+        while (low < high) 
+        {
+            uint32_t middle = (low + high) / 2;
+            size_t group = table + 16 + (size_t) middle * 12;
+            if (ttfU32(font, group + 4) < codePoint) low = middle + 1;
+            else high = middle;
+        }
+        if (low == groupCount) return 0;
+        size_t group = table + 16 + (size_t) low * 12;
+        uint32_t start = ttfU32(font, group);
+        if (codePoint < start) return 0;
+        glyph = ttfU32(font, group + 8) + (codePoint - start);
+    }
+    return glyph < font.glyphCount ? glyph : 0;
+}
+
+float tiny_engine::detail::text::glyphAdvance(const TrueTypeFile& font, uint32_t glyph)
+{
+    // Glyphs after the last long metric share its advance.
+    uint32_t metric = std::min(glyph, font.horizontalMetricCount - 1);
+    return ttfU16(font, font.hmtx + (size_t) metric * 4);
+}
+
+float tiny_engine::detail::text::glyphKerning(const TrueTypeFile& font, uint32_t left, uint32_t right)
+{
+    // Only the Microsoft version of the table, its first horizontal format 0 subtable.
+    if (!font.kern || ttfU16(font, font.kern) != 0) return 0;
+    uint16_t subtableCount = ttfU16(font, font.kern + 2);
+    size_t subtable = font.kern + 4;
+    for (uint32_t i = 0; i < subtableCount; i++) 
+    {
+        uint16_t length = ttfU16(font, subtable + 2);
+        uint16_t coverage = ttfU16(font, subtable + 4);
+        if ((coverage >> 8) == 0 && (coverage & 0x1) && !(coverage & 0x4)) 
+        {
+            uint32_t key = left << 16 | right;
+            uint32_t low = 0, high = ttfU16(font, subtable + 6);
+            while (low < high) 
+            {
+                uint32_t middle = (low + high) / 2;
+                size_t pair = subtable + 14 + (size_t) middle * 6;
+                uint32_t pairKey = ttfU32(font, pair);
+                if (pairKey == key) return ttfI16(font, pair + 4);
+                if (pairKey < key) low = middle + 1;
+                else high = middle;
+            }
+            return 0;
+        }
+        if (length == 0) break;
+        subtable += length;
+    }
+    return 0;
+}
+
+// Flattens the quadratic curve p0-p1-p2 into edges, finer the more it bends.
+static void flattenQuadratic(float x0, float y0, float x1, float y1, float x2, float y2, 
+                             std::vector<tiny_engine::detail::text::Edge>& edges)
+{
+    float deviationX = x0 - 2 * x1 + x2;
+    float deviationY = y0 - 2 * y1 + y2;
+    float deviation = deviationX * deviationX + deviationY * deviationY;
+    int segments = 1 + (int) std::sqrt(std::sqrt(3 * deviation));
+    float previousX = x0, previousY = y0;
+    for (int i = 1; i <= segments; i++) 
+    {
+        float t = (float) i / segments;
+        float u = 1 - t;
+        float x = u * u * x0 + 2 * u * t * x1 + t * t * x2;
+        float y = u * u * y0 + 2 * u * t * y1 + t * t * y2;
+        edges.push_back({ previousX, previousY, x, y });
+        previousX = x;
+        previousY = y;
+    }
+}
+
+// transform maps glyph to output space: x' = t0 x + t2 y + t4, y' = t1 x + t3 y + t5.
+static void appendGlyphOutline(const tiny_engine::detail::text::TrueTypeFile& font, uint32_t glyph, 
+                               const float transform[6], int depth, 
+                               std::vector<tiny_engine::detail::text::Edge>& edges)
+{
+    if (depth > 8 || glyph >= font.glyphCount) return;
+    size_t start, end;
+    if (font.longLocaOffsets) 
+    {
+        start = ttfU32(font, font.loca + (size_t) glyph * 4);
+        end = ttfU32(font, font.loca + (size_t) glyph * 4 + 4);
+    }
+    else 
+    {
+        start = (size_t) ttfU16(font, font.loca + (size_t) glyph * 2) * 2;
+        end = (size_t) ttfU16(font, font.loca + (size_t) glyph * 2 + 2) * 2;
+    }
+    start += font.glyf;
+    end += font.glyf;
+    // Empty glyphs (blanks) have no data at all.
+    if (end <= start || end > font.data.size()) return;
+
+    int16_t contourCount = ttfI16(font, start);
+    if (contourCount < 0) 
+    {
+        // A composite: the outlines of other glyphs, each with its own transform.
+        size_t p = start + 10;
+        for (;;) 
+        {
+            uint16_t flags = ttfU16(font, p);
+            uint16_t component = ttfU16(font, p + 2);
+            p += 4;
+            float dx, dy;
+            if (flags & 0x1) 
+            {
+                dx = ttfI16(font, p);
+                dy = ttfI16(font, p + 2);
+                p += 4;
+            }
+            else 
+            {
+                dx = (int8_t) ttfU8(font, p);
+                dy = (int8_t) ttfU8(font, p + 1);
+                p += 2;
+            }
+            // Components aligned by point numbers instead of offsets are rare, they stay unmoved.
+            if (!(flags & 0x2)) dx = dy = 0;
+
+            float a = 1, b = 0, c = 0, d = 1;
+            if (flags & 0x8) 
+            {
+                a = d = ttfF2Dot14(font, p);
+                p += 2;
+            }
+            else if (flags & 0x40) 
+            {
+                a = ttfF2Dot14(font, p);
+                d = ttfF2Dot14(font, p + 2);
+                p += 4;
+            }
+            else if (flags & 0x80) 
+            {
+                a = ttfF2Dot14(font, p);
+                b = ttfF2Dot14(font, p + 2);
+                c = ttfF2Dot14(font, p + 4);
+                d = ttfF2Dot14(font, p + 6);
+                p += 8;
+            }
+
+            const float* t = transform;
+            float combined[6] = { t[0] * a + t[2] * b, t[1] * a + t[3] * b, 
+                                  t[0] * c + t[2] * d, t[1] * c + t[3] * d, 
+                                  t[0] * dx + t[2] * dy + t[4], t[1] * dx + t[3] * dy + t[5] };
+            appendGlyphOutline(font, component, combined, depth + 1, edges);
+            if (!(flags & 0x20)) break;
+        }
+        return;
+    }
+
+    size_t endPoints = start + 10;
+    uint32_t pointCount = contourCount ? ttfU16(font, endPoints + (contourCount - 1) * 2) + 1 : 0;
+    size_t p = endPoints + contourCount * 2;
+    p += 2 + ttfU16(font, p);
+
+    // Flags (with repeat counts), then the x and then the y deltas.
+    struct Point 
+    {
+        float x, y;
+        bool onCurve;
+    };
+    std::vector<Point> points(pointCount);
+    std::vector<uint8_t> flags(pointCount);
+    for (uint32_t i = 0; i < pointCount;) 
+    {
+        uint8_t flag = ttfU8(font, p++);
+        flags[i++] = flag;
+        if (flag & 0x8) 
+        {
+            uint8_t repeat = ttfU8(font, p++);
+            while (repeat-- && i < pointCount) flags[i++] = flag;
+        }
+    }
+    int value = 0;
+    for (uint32_t i = 0; i < pointCount; i++) 
+    {
+        if (flags[i] & 0x2) value += (flags[i] & 0x10) ? ttfU8(font, p++) : -ttfU8(font, p++);
+        else if (!(flags[i] & 0x10)) { value += ttfI16(font, p); p += 2; }
+        points[i].x = (float) value;
+        points[i].onCurve = flags[i] & 0x1;
+    }
+    value = 0;
+    for (uint32_t i = 0; i < pointCount; i++) 
+    {
+        if (flags[i] & 0x4) value += (flags[i] & 0x20) ? ttfU8(font, p++) : -ttfU8(font, p++);
+        else if (!(flags[i] & 0x20)) { value += ttfI16(font, p); p += 2; }
+        points[i].y = (float) value;
+    }
+    for (auto& point : points) 
+    {
+        float x = point.x, y = point.y;
+        point.x = transform[0] * x + transform[2] * y + transform[4];
+        point.y = transform[1] * x + transform[3] * y + transform[5];
+    }
+
+    uint32_t first = 0;
+    for (int contour = 0; contour < contourCount; contour++) 
+    {
+        uint32_t last = ttfU16(font, endPoints + contour * 2);
+        if (last < first || last >= pointCount) break;
+
+        // Start on a point on the curve, or halfway between two control points. 
+        // Two control points in a row have an implied point on the curve between them.
+        const Point& firstPoint = points[first];
+        const Point& lastPoint = points[last];
+        float startX, startY;
+        uint32_t next = first;
+        if (firstPoint.onCurve) 
+        {
+            startX = firstPoint.x;
+            startY = firstPoint.y;
+            next = first + 1;
+        }
+        else if (lastPoint.onCurve) 
+        {
+            startX = lastPoint.x;
+            startY = lastPoint.y;
+        }
+        else 
+        {
+            startX = (firstPoint.x + lastPoint.x) * 0.5f;
+            startY = (firstPoint.y + lastPoint.y) * 0.5f;
+        }
+
+        float penX = startX, penY = startY;
+        float controlX = 0, controlY = 0;
+        bool hasControl = false;
+        for (uint32_t i = next; i <= last; i++) 
+        {
+            const Point& point = points[i];
+            if (point.onCurve) 
+            {
+                if (hasControl) flattenQuadratic(penX, penY, controlX, controlY, point.x, point.y, edges);
+                else edges.push_back({ penX, penY, point.x, point.y });
+                penX = point.x;
+                penY = point.y;
+                hasControl = false;
+            }
+            else 
+            {
+                if (hasControl) 
+                {
+                    float middleX = (controlX + point.x) * 0.5f;
+                    float middleY = (controlY + point.y) * 0.5f;
+                    flattenQuadratic(penX, penY, controlX, controlY, middleX, middleY, edges);
+                    penX = middleX;
+                    penY = middleY;
+                }
+                controlX = point.x;
+                controlY = point.y;
+                hasControl = true;
+            }
+        }
+        if (hasControl) flattenQuadratic(penX, penY, controlX, controlY, startX, startY, edges);
+        else edges.push_back({ penX, penY, startX, startY });
+        first = last + 1;
+    }
+}
+
+void tiny_engine::detail::text::glyphOutline(const TrueTypeFile& font, uint32_t glyph, float scale, 
+                                             std::vector<Edge>& edges)
+{
+    edges.clear();
+    float transform[6] = { scale, 0, 0, scale, 0, 0 };
+    appendGlyphOutline(font, glyph, transform, 0, edges);
+}
+
+void tiny_engine::detail::text::rasterizeEdges(const Edge* edges, size_t count, uint32_t width, uint32_t height, 
+                                               std::vector<float>& accumulation, uint8_t* coverage)
+{
+    // Every edge adds the signed area it covers to the right of it into the cells it crosses, 
+    // a running sum over each row then gives the coverage. The sum is never reset between rows, 
+    // what spills past the end of a row cancels out before the next one starts.
+    size_t cellCount = (size_t) width * height;
+    accumulation.assign(cellCount + 2, 0.0f);
+    float* cells = accumulation.data();
+    for (size_t i = 0; i < count; i++) 
+    {
+        float x0 = std::clamp(edges[i].x0, 0.0f, (float) width);
+        float y0 = std::clamp(edges[i].y0, 0.0f, (float) height);
+        float x1 = std::clamp(edges[i].x1, 0.0f, (float) width);
+        float y1 = std::clamp(edges[i].y1, 0.0f, (float) height);
+        if (y0 == y1) continue;
+        float direction = 1;
+        if (y0 > y1) 
+        {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+            direction = -1;
+        }
+
+        float dxdy = (x1 - x0) / (y1 - y0);
+        float x = x0;
+        int lastRow = std::min((int) std::ceil(y1), (int) height);
+        for (int row = (int) y0; row < lastRow; row++) 
+        {
+            float* line = cells + (size_t) row * width;
+            float dy = std::min((float) row + 1, y1) - std::max((float) row, y0);
+            float xNext = x + dxdy * dy;
+            float d = dy * direction;
+            float left = std::min(x, xNext);
+            float right = std::max(x, xNext);
+            float leftFloor = std::floor(left);
+            int leftCell = (int) leftFloor;
+            int rightCell = (int) std::ceil(right);
+            if (rightCell <= leftCell + 1) 
+            {
+                // Within one cell: it gets the part right of the edge, the next cell the rest.
+                float middle = 0.5f * (x + xNext) - leftFloor;
+                line[leftCell] += d - d * middle;
+                line[leftCell + 1] += d * middle;
+            }
+            else 
+            {
+                // Across several cells: a triangle in the first and the last, trapezoids between.
+                float step = 1.0f / (right - left);
+                float leftFraction = left - leftFloor;
+                float firstArea = 0.5f * step * (1 - leftFraction) * (1 - leftFraction);
+                float rightFraction = right - (float) rightCell + 1;
+                float lastArea = 0.5f * step * rightFraction * rightFraction;
+                line[leftCell] += d * firstArea;
+                if (rightCell == leftCell + 2) 
+                {
+                    line[leftCell + 1] += d * (1 - firstArea - lastArea);
+                }
+                else 
+                {
+                    float secondArea = step * (1.5f - leftFraction);
+                    line[leftCell + 1] += d * (secondArea - firstArea);
+                    for (int cell = leftCell + 2; cell < rightCell - 1; cell++) line[cell] += d * step;
+                    float beforeLast = secondArea + (rightCell - leftCell - 3) * step;
+                    line[rightCell - 1] += d * (1 - beforeLast - lastArea);
+                }
+                line[rightCell] += d * lastArea;
+            }
+            x = xNext;
+        }
+    }
+
+    float sum = 0;
+    for (size_t i = 0; i < cellCount; i++) 
+    {
+        sum += cells[i];
+        coverage[i] = (uint8_t) (std::min(std::fabs(sum), 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+bool tiny_engine::detail::text::GlyphCache::build(const TrueTypeFile& font, float pixelHeight, 
+                                                  const std::vector<uint32_t>& codePoints, 
+                                                  uint32_t maxPageSize, DecodedImage& page)
+{
+    namespace atlas = tiny_engine::detail::atlas;
+    glyphs.clear();
+    kerningPairs.clear();
+    std::fill(std::begin(latinGlyphs), std::end(latinGlyphs), 0);
+    float fontHeight = font.ascender - font.descender;
+    if (fontHeight <= 0 || pixelHeight <= 0) return false;
+    float scale = pixelHeight / fontHeight;
+    lineAdvance = std::round((fontHeight + font.lineGap) * scale);
+
+    std::vector<uint32_t> sorted = codePoints;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    glyphs.push_back(Glyph {});
+    for (uint32_t codePoint : sorted) 
+    {
+        if (codePoint == 0) continue;
+        Glyph glyph = {};
+        glyph.codePoint = codePoint;
+        glyph.fontGlyph = glyphIndex(font, codePoint);
+        glyphs.push_back(glyph);
+    }
+
+    std::vector<DecodedImage> bitmaps(glyphs.size());
+    std::vector<atlas::Placement> rects;
+    std::vector<uint32_t> rectGlyphs;
+    std::vector<Edge> edges;
+    std::vector<float> accumulation;
+    std::vector<uint8_t> coverage;
+    for (uint32_t i = 0; i < glyphs.size(); i++) 
+    {
+        Glyph& glyph = glyphs[i];
+        if (glyph.codePoint < 256) latinGlyphs[glyph.codePoint] = i;
+        glyph.advance = glyphAdvance(font, glyph.fontGlyph) * scale;
+        glyphOutline(font, glyph.fontGlyph, scale, edges);
+        if (edges.empty()) continue;
+
+        // The bitmap covers the outline on whole pixels.
+        float minX = edges[0].x0, maxX = minX, minY = edges[0].y0, maxY = minY;
+        for (const auto& edge : edges) 
+        {
+            minX = std::min({ minX, edge.x0, edge.x1 });
+            maxX = std::max({ maxX, edge.x0, edge.x1 });
+            minY = std::min({ minY, edge.y0, edge.y1 });
+            maxY = std::max({ maxY, edge.y0, edge.y1 });
+        }
+        glyph.left = std::floor(minX);
+        glyph.bottom = std::floor(minY);
+        float top = std::ceil(maxY);
+        uint32_t width = (uint32_t) (std::ceil(maxX) - glyph.left);
+        uint32_t height = (uint32_t) (top - glyph.bottom);
+        if (width == 0 || height == 0) continue;
+        if (width + 2 > maxPageSize || height + 2 > maxPageSize) return false;
+        glyph.width = (float) width;
+        glyph.height = (float) height;
+
+        for (auto& edge : edges) 
+        {
+            edge = { edge.x0 - glyph.left, top - edge.y0, edge.x1 - glyph.left, top - edge.y1 };
+        }
+        coverage.resize((size_t) width * height);
+        rasterizeEdges(edges.data(), edges.size(), width, height, accumulation, coverage.data());
+
+        // White with the coverage as alpha, flipped to bottom row first.
+        DecodedImage& bitmap = bitmaps[i];
+        bitmap.width = width;
+        bitmap.height = height;
+        bitmap.pixels.resize((size_t) width * height * 4);
+        for (uint32_t row = 0; row < height; row++) 
+        {
+            const uint8_t* src = coverage.data() + (size_t) (height - 1 - row) * width;
+            uint8_t* dst = bitmap.pixels.data() + (size_t) row * width * 4;
+            for (uint32_t x = 0; x < width; x++) 
+            {
+                dst[x * 4 + 0] = 255;
+                dst[x * 4 + 1] = 255;
+                dst[x * 4 + 2] = 255;
+                dst[x * 4 + 3] = src[x];
+            }
+        }
+        rects.push_back(atlas::Placement { width, height, 0, 0, 0 });
+        rectGlyphs.push_back(i);
+    }
+
+    // The smallest page all glyphs fit onto.
+    uint32_t pageSize = 64;
+    for (;;) 
+    {
+        std::vector<atlas::Placement> placed = rects;
+        if (placed.empty() || atlas::packRects(pageSize, pageSize, 1, placed) == 1) 
+        {
+            rects = std::move(placed);
+            break;
+        }
+        if (pageSize >= maxPageSize) return false;
+        pageSize *= 2;
+    }
+
+    // Transparent white, so filtering at the glyph edges does not darken them.
+    page.width = pageSize;
+    page.height = pageSize;
+    page.pixels.resize((size_t) pageSize * pageSize * 4);
+    uint32_t* texels = (uint32_t*) page.pixels.data();
+    uint32_t transparentWhite;
+    const uint8_t white[4] = { 255, 255, 255, 0 };
+    memcpy(&transparentWhite, white, 4);
+    std::fill(texels, texels + (size_t) pageSize * pageSize, transparentWhite);
+
+    float texel = 1.0f / pageSize;
+    for (size_t i = 0; i < rects.size(); i++) 
+    {
+        const auto& rect = rects[i];
+        Glyph& glyph = glyphs[rectGlyphs[i]];
+        atlas::blitWithPadding(page.pixels.data(), pageSize, pageSize, bitmaps[rectGlyphs[i]], rect.x, rect.y, 1);
+        glyph.uvLeft = rect.x * texel;
+        glyph.uvBottom = rect.y * texel;
+        glyph.uvRight = (rect.x + rect.width) * texel;
+        glyph.uvTop = (rect.y + rect.height) * texel;
+    }
+
+    // Only the pairs between glyphs of the cache are kept.
+    if (font.kern) 
+    {
+        for (const auto& left : glyphs) 
+        {
+            for (const auto& right : glyphs) 
+            {
+                float amount = glyphKerning(font, left.fontGlyph, right.fontGlyph) * scale;
+                if (amount != 0) kerningPairs.push_back({ left.fontGlyph << 16 | right.fontGlyph, amount });
+            }
+        }
+        std::sort(kerningPairs.begin(), kerningPairs.end(), 
+                  [](const KerningPair& a, const KerningPair& b) { return a.pair < b.pair; });
+        kerningPairs.erase(std::unique(kerningPairs.begin(), kerningPairs.end(), 
+                  [](const KerningPair& a, const KerningPair& b) { return a.pair == b.pair; }), kerningPairs.end());
+    }
+    return true;
+}
+
+uint32_t tiny_engine::detail::text::GlyphCache::find(uint32_t codePoint) const
+{
+    if (codePoint < 256) return latinGlyphs[codePoint];
+    if (glyphs.size() < 2) return 0;
+    auto found = std::lower_bound(glyphs.begin() + 1, glyphs.end(), codePoint, 
+                                  [](const Glyph& glyph, uint32_t c) { return glyph.codePoint < c; });
+    if (found == glyphs.end() || found->codePoint != codePoint) return 0;
+    return (uint32_t) (found - glyphs.begin());
+}
+
+float tiny_engine::detail::text::GlyphCache::kerning(uint32_t left, uint32_t right) const
+{
+    if (kerningPairs.empty()) return 0;
+    uint32_t pair = glyphs[left].fontGlyph << 16 | glyphs[right].fontGlyph;
+    auto found = std::lower_bound(kerningPairs.begin(), kerningPairs.end(), pair, 
+                                  [](const KerningPair& p, uint32_t key) { return p.pair < key; });
+    return (found != kerningPairs.end() && found->pair == pair) ? found->amount : 0;
+}
+
+// Decodes one code point and advances text, broken sequences give U+FFFD.
+static uint32_t decodeUtf8(const uint8_t*& text, const uint8_t* end)
+{
+    uint32_t c = *text++;
+    if (c < 0x80) return c;
+    int extra = c >= 0xf8 ? -1 : c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : -1;
+    if (extra < 0) return 0xfffd;
+    c &= 0x3f >> extra;
+    for (int i = 0; i < extra; i++) 
+    {
+        if (text == end || (*text & 0xc0) != 0x80) return 0xfffd;
+        c = c << 6 | (*text++ & 0x3f);
+    }
+    return c;
+}
+
+void tiny_engine::detail::text::layoutText(const GlyphCache& cache, const char* text, size_t length, 
+                                           std::vector<PlacedGlyph>& placed)
+{
+    if (cache.size() == 0) return;
+    const uint8_t* p = (const uint8_t*) text;
+    const uint8_t* end = p + length;
+    float penX = 0, penY = 0;
+    uint32_t previous = 0;
+    bool hasPrevious = false;
+    while (p < end) 
+    {
+        uint32_t codePoint = decodeUtf8(p, end);
+        if (codePoint == '\n') 
+        {
+            penX = 0;
+            penY -= cache.lineHeight();
+            hasPrevious = false;
+            continue;
+        }
+        if (codePoint == '\r') continue;
+
+        uint32_t index = cache.find(codePoint);
+        const Glyph& glyph = cache.glyph(index);
+        if (hasPrevious) penX += cache.kerning(previous, index);
+        if (glyph.width > 0) placed.push_back({ index, std::round(penX) + glyph.left, penY + glyph.bottom });
+        penX += glyph.advance;
+        previous = index;
+        hasPrevious = true;
+    }
+}
+
+tiny_engine::detail::text::RunCache::RunCache(size_t capacity)
+    : runs(std::max<size_t>(1, (capacity + runsPerSet - 1) / runsPerSet) * runsPerSet)
+{
+    // Room for a typical HUD line in every run, so the first frames do not allocate either.
+    for (Run& run : runs) 
+    {
+        run.text.reserve(32);
+        run.glyphs.reserve(32);
+    }
+}
+
+void tiny_engine::detail::text::RunCache::clear()
+{
+    for (Run& run : runs) run.lastUse = 0;
+}
+
+const std::vector<tiny_engine::detail::text::PlacedGlyph>& 
+tiny_engine::detail::text::RunCache::shape(const GlyphCache& cache, const std::string& text)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : text) 
+    {
+        hash ^= (uint8_t) c;
+        hash *= 1099511628211ull;
+    }
+
+    size_t first = (size_t) (hash % (runs.size() / runsPerSet)) * runsPerSet;
+    Run* oldest = &runs[first];
+    for (size_t i = first; i < first + runsPerSet; i++) 
+    {
+        Run& run = runs[i];
+        if (run.lastUse != 0 && run.hash == hash && run.text == text) 
+        {
+            run.lastUse = ++useCount;
+            hitCount++;
+            return run.glyphs;
+        }
+        if (run.lastUse < oldest->lastUse) oldest = &run;
+    }
+    missCount++;
+
+    // Free runs have lastUse 0, so they are taken before any run is replaced.
+    Run& run = *oldest;
+    run.hash = hash;
+    run.lastUse = ++useCount;
+    run.text.assign(text);
+    run.glyphs.clear();
+    layoutText(cache, text.data(), text.size(), run.glyphs);
+    return run.glyphs;
+}
+
+// ----------------------------------------------------------------------------
+// Worker pool
+//
+
+tiny_engine::detail::WorkerPool::WorkerPool(uint32_t threadCount)
+{
+    if (threadCount == 0) 
+    {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+    for (uint32_t i = 0; i < threadCount; i++) 
+    {
+        threads.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+tiny_engine::detail::WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shuttingDown = true;
+    }
+    wakeUp.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+void tiny_engine::detail::WorkerPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (taskCount == tasks.size()) 
+        {
+            // Full, unroll the ring into a bigger one.
+            std::vector<std::function<void()>> grown(std::max<size_t>(16, tasks.size() * 2));
+            for (size_t i = 0; i < taskCount; i++) grown[i] = std::move(tasks[(firstTask + i) % tasks.size()]);
+            tasks = std::move(grown);
+            firstTask = 0;
+        }
+        tasks[(firstTask + taskCount) % tasks.size()] = std::move(task);
+        taskCount++;
+    }
+    wakeUp.notify_one();
+}
+
+void tiny_engine::detail::WorkerPool::workerLoop()
+{
+    while (true) 
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeUp.wait(lock, [this]() { return shuttingDown || taskCount > 0; });
+            if (taskCount == 0) return;
+            task = std::move(tasks[firstTask]);
+            firstTask = (firstTask + 1) % tasks.size();
+            taskCount--;
+        }
+        task();
+    }
+}
+
+void tiny_engine::detail::WorkerPool::parallelFor(uint32_t count, 
+                                    const std::function<void(uint32_t)>& body)
+{
+    if (count == 0) return;
+
+    // Lives on this stack, so the call waits for every helper task to finish, 
+    // even ones which only get picked up after all items are done. 
+    // The tasks then only capture a pointer and std::function does not allocate.
+    struct State 
+    {
+        std::atomic<uint32_t> nextItem { 0 };
+        uint32_t count;
+        uint32_t finishedHelpers = 0;
+        const std::function<void(uint32_t)>* body;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    State state;
+    state.count = count;
+    state.body = &body;
+
+    auto runItems = [](State* state) 
+    {
+        for (uint32_t i = state->nextItem++; i < state->count; i = state->nextItem++) 
+        {
+            (*state->body)(i);
+        }
+    };
+
+    uint32_t helpers = std::min<uint32_t>(threadCount(), count - 1);
+    for (uint32_t i = 0; i < helpers; i++) 
+    {
+        submit([statePointer = &state, runItems]() {
+            runItems(statePointer);
+            std::lock_guard<std::mutex> lock(statePointer->mutex);
+            statePointer->finishedHelpers++;
+            statePointer->finished.notify_all();
+        });
+    }
+    runItems(&state);
+
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.finished.wait(lock, [&]() { return state.finishedHelpers == helpers; });
+}
+
+// ----------------------------------------------------------------------------
+// Jobs
+//
+
+bool tiny_engine::detail::jobs::JobDeque::push(Job* job)
+{
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= capacity) return false;
+    buffer[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+    // Publishes the job and its contents to the thieves.
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+tiny_engine::detail::jobs::Job* tiny_engine::detail::jobs::JobDeque::pop()
+{
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b) 
+    {
+        // Empty.
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Job* job = buffer[b & (capacity - 1)].load(std::memory_order_relaxed);
+    if (t == b) 
+    {
+        // The last job, a thief may be taking it right now.
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            job = nullptr;
+        }
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+tiny_engine::detail::jobs::Job* tiny_engine::detail::jobs::JobDeque::steal()
+{
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+
+    Job* job = buffer[t & (capacity - 1)].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return job;
+}
+
+tiny_engine::detail::jobs::Job* tiny_engine::detail::jobs::allocateJob(JobFunction function, void* data, 
+                                                                        JobCounter* counter)
+{
+    if (counter) counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+    Job* job;
+    if (threadIndex != noThread) 
+    {
+        job = takeFreeJob(*threads[threadIndex]);
+    }
+    else 
+    {
+        std::lock_guard<std::mutex> lock(externalMutex);
+        job = takeFreeJob(*external);
+    }
+    job->function = function;
+    job->data = data;
+    job->counter = counter;
+    job->dependency = nullptr;
+    job->next = nullptr;
+    return job;
+}
+
+tiny_engine::detail::jobs::Job* tiny_engine::detail::jobs::takeFreeJob(JobThread& thread)
+{
+    if (!thread.freeJobs) thread.freeJobs = thread.finishedJobs.exchange(nullptr, std::memory_order_acquire);
+    if (!thread.freeJobs) 
+    {
+        const size_t blockSize = 256;
+        Job* block = new Job[blockSize];
+        thread.jobBlocks.emplace_back(block);
+        for (size_t i = 0; i < blockSize; i++) 
+        {
+            block[i].owner = &thread;
+            block[i].next = i + 1 < blockSize ? &block[i + 1] : nullptr;
+        }
+        thread.freeJobs = block;
+    }
+    Job* job = thread.freeJobs;
+    thread.freeJobs = job->next;
+    return job;
+}
+
+void tiny_engine::detail::jobs::schedule(Job* job)
+{
+    bool queued;
+    if (threadIndex != noThread) 
+    {
+        queued = threads[threadIndex]->deque.push(job);
+    }
+    else 
+    {
+        std::lock_guard<std::mutex> lock(externalMutex);
+        queued = external->deque.push(job);
+    }
+    if (!queued) 
+    {
+        // Full, no room to defer it.
+        execute(job);
+        return;
+    }
+
+    queuedJobs.fetch_add(1);
+    if (sleepingWorkers.load() > 0) 
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wakeUp.notify_one();
+    }
+}
+
+tiny_engine::detail::jobs::Job* tiny_engine::detail::jobs::findJob(uint32_t index)
+{
+    if (index == 0 && mainThreadJobCount.load(std::memory_order_relaxed) > 0) 
+    {
+        std::lock_guard<std::mutex> lock(mainThreadMutex);
+        if (!mainThreadJobs.empty()) 
+        {
+            Job* job = mainThreadJobs.back();
+            mainThreadJobs.pop_back();
+            mainThreadJobCount = (uint32_t) mainThreadJobs.size();
+            return job;
+        }
+    }
+
+    Job* job = threads[index]->deque.pop();
+    // Steal starting at the next thread, so the thieves spread over the victims.
+    uint32_t count = (uint32_t) threads.size();
+    for (uint32_t i = 1; !job && i < count; i++) 
+    {
+        job = threads[(index + i) % count]->deque.steal();
+    }
+    if (!job) job = external->deque.steal();
+
+    if (job) queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+    return job;
+}
+
+void tiny_engine::detail::jobs::execute(Job* job)
+{
+    if (job->dependency) tiny_engine::waitForCounter(*job->dependency);
+    job->function(job->data);
+    JobCounter* counter = job->counter;
+
+    // Back to the thread which allocated it.
+    JobThread* owner = job->owner;
+    job->next = owner->finishedJobs.load(std::memory_order_relaxed);
+    while (!owner->finishedJobs.compare_exchange_weak(job->next, job, 
+                                                       std::memory_order_release, std::memory_order_relaxed)) 
+    {
+    }
+
+    // Last, a waiter may destroy the counter as soon as it reaches 0.
+    if (counter) counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void tiny_engine::detail::jobs::workerLoop(uint32_t index)
+{
+    threadIndex = index;
+    TE_PROFILE_THREAD("job worker");
+    while (running.load(std::memory_order_relaxed)) 
+    {
+        Job* job = findJob(index);
+        if (job) 
+        {
+            execute(job);
+            continue;
+        }
+
+        // Nothing queued: spin a little, new work often follows right away, then sleep.
+        for (int i = 0; i < 64 && queuedJobs.load(std::memory_order_relaxed) <= 0; i++) 
+        {
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers.fetch_add(1);
+        wakeUp.wait(lock, []() { return queuedJobs.load() > 0 || !running.load(); });
+        sleepingWorkers.fetch_sub(1);
+    }
+}
+
+void tiny_engine::initJobs(uint32_t workerCount)
+{
+    namespace jobs = detail::jobs;
+    if (jobs::running) return;
+    if (workerCount == 0) 
+    {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    if (!jobs::external) jobs::external = std::make_unique<jobs::JobThread>();
+    jobs::running = true;
+    jobs::threadIndex = 0;
+    jobs::threads.clear();
+    for (uint32_t i = 0; i <= workerCount; i++) jobs::threads.push_back(std::make_unique<jobs::JobThread>());
+    for (uint32_t i = 1; i <= workerCount; i++) 
+    {
+        jobs::threads[i]->thread = std::thread(jobs::workerLoop, i);
+    }
+}
+
+void tiny_engine::shutdownJobs()
+{
+    namespace jobs = detail::jobs;
+    if (!jobs::running) return;
+    {
+        std::lock_guard<std::mutex> lock(jobs::sleepMutex);
+        jobs::running = false;
+    }
+    jobs::wakeUp.notify_all();
+    for (size_t i = 1; i < jobs::threads.size(); i++) jobs::threads[i]->thread.join();
+    jobs::threads.clear();
+    jobs::mainThreadJobs.clear();
+    jobs::mainThreadJobCount = 0;
+    jobs::queuedJobs = 0;
+    jobs::threadIndex = jobs::noThread;
+}
+
+uint32_t tiny_engine::jobThreadCount()
+{
+    return std::max<uint32_t>(1, (uint32_t) detail::jobs::threads.size());
+}
+
+void tiny_engine::runJob(JobFunction function, void* data, JobCounter* counter)
+{
+    namespace jobs = detail::jobs;
+    if (!jobs::running) 
+    {
+        function(data);
+        return;
+    }
+    jobs::schedule(jobs::allocateJob(function, data, counter));
+}
+
+void tiny_engine::runJobAfter(JobCounter& dependency, JobFunction function, void* data, JobCounter* counter)
+{
+    namespace jobs = detail::jobs;
+    if (!jobs::running) 
+    {
+        // Inline, every job before this one already ran.
+        function(data);
+        return;
+    }
+
+    jobs::Job* job = jobs::allocateJob(function, data, counter);
+    job->dependency = &dependency;
+    jobs::schedule(job);
+}
+
+void tiny_engine::runMainThreadJob(JobFunction function, void* data, JobCounter* counter)
+{
+    namespace jobs = detail::jobs;
+    if (!jobs::running || jobs::threadIndex == 0) 
+    {
+        function(data);
+        return;
+    }
+    jobs::Job* job = jobs::allocateJob(function, data, counter);
+    std::lock_guard<std::mutex> lock(jobs::mainThreadMutex);
+    jobs::mainThreadJobs.push_back(job);
+    jobs::mainThreadJobCount = (uint32_t) jobs::mainThreadJobs.size();
+}
+
+void tiny_engine::runMainThreadJobs()
+{
+    namespace jobs = detail::jobs;
+    while (true) 
+    {
+        jobs::Job* job = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(jobs::mainThreadMutex);
+            if (jobs::mainThreadJobs.empty()) return;
+            job = jobs::mainThreadJobs.back();
+            jobs::mainThreadJobs.pop_back();
+            jobs::mainThreadJobCount = (uint32_t) jobs::mainThreadJobs.size();
+        }
+        jobs::execute(job);
+    }
+}
+
+void tiny_engine::waitForCounter(JobCounter& counter)
+{
+    namespace jobs = detail::jobs;
+    uint32_t index = jobs::threadIndex;
+    while (counter.pending.load(std::memory_order_acquire) != 0) 
+    {
+        jobs::Job* job = index != jobs::noThread ? jobs::findJob(index) : nullptr;
+        if (job) jobs::execute(job);
+        else std::this_thread::yield();
+    }
+}
+
+void tiny_engine::parallelFor(uint32_t count, uint32_t batchSize, 
+                              void (*body)(void* context, uint32_t begin, uint32_t end), void* context)
+{
+    if (count == 0) return;
+    batchSize = std::max<uint32_t>(batchSize, 1);
+    uint32_t batches = (count + batchSize - 1) / batchSize;
+
+    // Instead of one job per batch, one job per thread which takes batches until none are left, 
+    // so uneven batches balance out and scheduling costs stay independent of count.
+    struct State 
+    {
+        std::atomic<uint32_t> nextBatch { 0 };
+        uint32_t count;
+        uint32_t batchSize;
+        uint32_t batches;
+        void (*body)(void*, uint32_t, uint32_t);
+        void* context;
+    };
+    State state;
+    state.count = count;
+    state.batchSize = batchSize;
+    state.batches = batches;
+    state.body = body;
+    state.context = context;
+
+    auto runBatches = [](void* data) 
+    {
+        auto state = static_cast<State*>(data);
+        for (uint32_t batch = state->nextBatch++; batch < state->batches; batch = state->nextBatch++) 
+        {
+            uint32_t begin = batch * state->batchSize;
+            state->body(state->context, begin, std::min(begin + state->batchSize, state->count));
+        }
+    };
+
+    JobCounter counter;
+    uint32_t helpers = std::min(jobThreadCount() - 1, batches - 1);
+    for (uint32_t i = 0; i < helpers; i++) runJob(runBatches, &state, &counter);
+    runBatches(&state);
+    waitForCounter(counter);
+}
+
+// ----------------------------------------------------------------------------
+// Profiling
+//
+#ifdef TE_PROFILE
+
+tiny_engine::detail::profiler::ThreadBuffer& tiny_engine::detail::profiler::threadBuffer()
+{
+    if (!currentThreadBuffer) 
+    {
+        currentThreadBuffer = new ThreadBuffer();
+        std::lock_guard<std::mutex> lock(threadBuffersMutex);
+        currentThreadBuffer->threadId = (uint32_t) threadBuffers.size();
+        threadBuffers.push_back(currentThreadBuffer);
+    }
+    return *currentThreadBuffer;
+}
+
+tiny_engine::ProfileScope::ProfileScope(const char* name) 
+    : name(name), start(eventClock())
+{
+}
+
+tiny_engine::ProfileScope::~ProfileScope()
+{
+    // A full buffer drops the scope, RingBuffer counts it.
+    detail::profiler::threadBuffer().events.push({ name, start, eventClock() });
+}
+
+void tiny_engine::setProfileThreadName(const char* name)
+{
+    detail::profiler::threadBuffer().name = name;
+}
+
+double tiny_engine::FrameTimeHistogram::percentile(double fraction) const
+{
+    if (frameCount == 0) return 0;
+    uint32_t target = (uint32_t) std::ceil(fraction * frameCount);
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < bucketCount - 1; i++) 
+    {
+        seen += buckets[i];
+        if (seen >= target) return (i + 1) * bucketMilliseconds;
+    }
+    return maxMilliseconds;
+}
+
+tiny_engine::FrameTimeHistogram tiny_engine::getFrameTimeHistogram()
+{
+    return detail::profiler::histogram;
+}
+
+void tiny_engine::resetFrameTimeHistogram()
+{
+    detail::profiler::histogram = {};
+}
+
+void tiny_engine::beginProfileCapture()
+{
+    namespace profiler = detail::profiler;
+    profiler::capturedEvents.clear();
+    profiler::captureStart = eventClock();
+    profiler::capturing = true;
+}
+
+void tiny_engine::profileEndFrame()
+{
+    namespace profiler = detail::profiler;
+    uint64_t now = eventClock();
+    uint32_t threadId = profiler::threadBuffer().threadId;
+
+    if (profiler::lastFrameEnd != 0) 
+    {
+        auto& histogram = profiler::histogram;
+        double milliseconds = (now - profiler::lastFrameEnd) / 1e6;
+        uint32_t bucket = (uint32_t) (milliseconds / FrameTimeHistogram::bucketMilliseconds);
+        histogram.buckets[std::min(bucket, FrameTimeHistogram::bucketCount - 1)]++;
+        histogram.minMilliseconds = histogram.frameCount ? std::min(histogram.minMilliseconds, milliseconds) : milliseconds;
+        histogram.maxMilliseconds = std::max(histogram.maxMilliseconds, milliseconds);
+        histogram.totalMilliseconds += milliseconds;
+        histogram.frameCount++;
+
+        if (profiler::capturing && profiler::lastFrameEnd >= profiler::captureStart) 
+        {
+            profiler::capturedEvents.push_back({ "frame", profiler::lastFrameEnd, now, threadId });
+        }
+    }
+    profiler::lastFrameEnd = now;
+
+    // Drained every frame, captured or not, so the buffers never run full.
+    profiler::collectThreadBuffers();
+}
+
+void tiny_engine::detail::profiler::collectThreadBuffers()
+{
+    std::lock_guard<std::mutex> lock(threadBuffersMutex);
+    for (auto buffer : threadBuffers) 
+    {
+        ScopeEvent event;
+        while (buffer->events.pop(event)) 
+        {
+            if (capturing && event.start >= captureStart) 
+            {
+                capturedEvents.push_back({ event.name, event.start, event.end, buffer->threadId });
+            }
+        }
+    }
+}
+
+void tiny_engine::detail::profiler::writeJsonString(FILE* file, const char* text)
+{
+    fputc('"', file);
+    for (const char* c = text; *c; c++) 
+    {
+        if (*c == '"' || *c == '\\') fputc('\\', file);
+        if ((unsigned char) *c >= 0x20) fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+bool tiny_engine::endProfileCapture(const std::string& fileName)
+{
+    namespace profiler = detail::profiler;
+    profiler::collectThreadBuffers();
+    profiler::capturing = false;
+
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (!file) return false;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    auto writeThreadName = [&](uint32_t threadId, const char* name) 
+    {
+        fprintf(file, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":", 
+                first ? "" : ",\n", threadId);
+        profiler::writeJsonString(file, name);
+        fprintf(file, "}}");
+        first = false;
+    };
+    {
+        std::lock_guard<std::mutex> lock(profiler::threadBuffersMutex);
+        for (auto buffer : profiler::threadBuffers) 
+        {
+            char fallbackName[32];
+            snprintf(fallbackName, sizeof(fallbackName), "thread %u", buffer->threadId);
+            writeThreadName(buffer->threadId, buffer->name ? buffer->name : fallbackName);
+        }
+    }
+    writeThreadName(profiler::gpuThreadId, "GPU");
+
+    // Complete events, timestamps in microseconds since the capture started.
+    for (const auto& event : profiler::capturedEvents) 
+    {
+        fprintf(file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":", 
+                event.threadId, (event.start - profiler::captureStart) / 1000.0, 
+                (event.end - event.start) / 1000.0);
+        profiler::writeJsonString(file, event.name);
+        fputc('}', file);
+    }
+    fprintf(file, "\n]}\n");
+    profiler::capturedEvents.clear();
+    return fclose(file) == 0;
+}
+#endif
+
+// ----------------------------------------------------------------------------
+// Frame arena
+//
+
+tiny_engine::FrameArena::FrameArena(size_t initialCapacity)
+    : initialCapacity(initialCapacity)
+{
+}
+
+tiny_engine::FrameArena::~FrameArena()
+{
+    freeBlocks();
+}
+
+void tiny_engine::FrameArena::addBlock(size_t minimumSize)
+{
+    // Blocks grow geometrically, so a frame needs only a few of them.
+    size_t size = std::max({ minimumSize + sizeof(BlockHeader), initialCapacity, reserved });
+    auto block = (BlockHeader*) ::operator new(size);
+    block->previous = head;
+    block->size = size;
+    head = block;
+    cursor = (uint8_t*) (block + 1);
+    end = (uint8_t*) block + size;
+    reserved += size;
+    blockCount++;
+    blockAllocations++;
+}
+
+void tiny_engine::FrameArena::freeBlocks()
+{
+    while (head) 
+    {
+        BlockHeader* previous = head->previous;
+        ::operator delete(head);
+        head = previous;
+    }
+    cursor = end = nullptr;
+    reserved = 0;
+    blockCount = 0;
+}
+
+void* tiny_engine::FrameArena::allocate(size_t size, size_t alignment)
+{
+    auto aligned = (uint8_t*) (((uintptr_t) cursor + alignment - 1) & ~(uintptr_t) (alignment - 1));
+    if (!head || aligned + size > end) 
+    {
+        addBlock(size + alignment);
+        aligned = (uint8_t*) (((uintptr_t) cursor + alignment - 1) & ~(uintptr_t) (alignment - 1));
+    }
+    used += size;
+    allocations++;
+    cursor = aligned + size;
+    return aligned;
+}
+
+void tiny_engine::FrameArena::reset()
+{
+    // Several blocks mean the last use did not fit, 
+    // replace them by one which holds everything next time.
+    if (blockCount > 1) 
+    {
+        size_t total = reserved;
+        freeBlocks();
+        addBlock(total);
+    }
+    if (head) cursor = (uint8_t*) (head + 1);
+    used = 0;
+    allocations = 0;
+}
+
+tiny_engine::FrameArena& tiny_engine::frameArena()
+{
+    return detail::frameArenas[detail::currentFrameArena];
+}
+
+tiny_engine::FrameAllocationStats tiny_engine::getFrameAllocationStats()
+{
+    return detail::frameAllocationStats;
+}
+
+tiny_engine::RenderStats tiny_engine::getRenderStats(GraphicsContext* context)
+{
+    return backendOf(context).renderStats();
+}
+
+tiny_engine::CommandList tiny_engine::createCommandList(GraphicsContext*)
+{
+    return CommandList { detail::commandListStorage.store(new detail::CommandListData()) };
+}
+
+void tiny_engine::destroyCommandList(GraphicsContext* context, CommandList list)
+{
+    auto data = detail::commandListStorage.release(list.id);
+    if (!data) return;
+    backendOf(context).destroyCommandList(*data);
+    delete data;
+}
+
+void tiny_engine::beginCommandList(GraphicsContext* context, CommandList list)
+{
+    auto data = detail::commandListStorage.get(list.id);
+    if (!data) return;
+    data->batch.clear();
+    data->stats = {};
+    data->stateCache.resetCounters();
+    data->recording = true;
+    data->closed = false;
+    backendOf(context).beginCommandList(*data);
+}
+
+void tiny_engine::drawTexture(CommandList list, Texture t, int x, int y)
+{
+    auto data = detail::commandListStorage.get(list.id);
+    if (!data || !data->recording) return;
+    data->stats.drawsSubmitted++;
+
+    // The same 64x64 quad drawTexture draws.
+    float halfSize = 32;
+    if (x + halfSize < data->cullLeft || x - halfSize > data->cullRight || 
+        y + halfSize < data->cullBottom || y - halfSize > data->cullTop) 
+    {
+        data->stats.drawsCulled++;
+        return;
+    }
+    data->batch.add({ t.id, 0, 0, (float) x, (float) y, 64, 64, detail::spriteDepth, 
+                      t.uvLeft, t.uvBottom, t.uvRight, t.uvTop });
+}
+
+void tiny_engine::closeCommandList(GraphicsContext* context, CommandList list)
+{
+    auto data = detail::commandListStorage.get(list.id);
+    if (!data || !data->recording) return;
+    data->recording = false;
+    data->closed = true;
+    backendOf(context).closeCommandList(*data);
+}
+
+void tiny_engine::submitCommandLists(GraphicsContext* context, const CommandList* lists, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) 
+    {
+        auto data = detail::commandListStorage.get(lists[i].id);
+        if (!data || !data->closed) continue;
+        backendOf(context).submitCommandList(*data);
+        data->closed = false;
+    }
+}
+
+void tiny_engine::detail::endFrameRenderStats(RenderStats& frame, RenderStats& last, StateCache& cache)
+{
+    frame.stateChanges += cache.changes();
+    frame.stateChangesSkipped += cache.skipped();
+    last = frame;
+    frame = {};
+    cache.resetCounters();
+    cache.invalidate();
+}
+
+void tiny_engine::detail::endFrameAllocations()
+{
+    FrameArena& current = frameArenas[currentFrameArena];
+    uint32_t blockAllocations = frameArenas[0].blockAllocationCount() + frameArenas[1].blockAllocationCount();
+    uint64_t heapAllocations = heapAllocationCount.load(std::memory_order_relaxed);
+
+    frameAllocationStats.arenaAllocations = current.allocationCount();
+    frameAllocationStats.arenaBytes = current.bytesUsed();
+    frameAllocationStats.arenaBlockAllocations = blockAllocations - blockAllocationsAtFrameStart;
+    frameAllocationStats.heapAllocations = heapAllocations - heapAllocationsAtFrameStart;
+
+    // The older arena is recycled for the next frame.
+    currentFrameArena ^= 1;
+    frameArenas[currentFrameArena].reset();
+
+    blockAllocationsAtFrameStart = frameArenas[0].blockAllocationCount() + frameArenas[1].blockAllocationCount();
+    heapAllocationsAtFrameStart = heapAllocationCount.load(std::memory_order_relaxed);
+}
+
+#ifdef TE_TRACK_HEAP_ALLOCATIONS
+// Replaces the global operator new, to count every heap allocation of the program.
+// Needs engine.h to be included in exactly one translation unit, as usual.
+// The aligned versions, used e.g. for the gameplay chunks, are replaced and counted as well. 
+// On Windows their memory comes from _aligned_malloc, which free can not release.
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC sees the malloc in operator new and the free in operator delete and warns about mixing them.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new(size_t size)
+{
+    tiny_engine::detail::heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    tiny_engine::detail::heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    size_t align = (size_t) alignment;
+#ifdef _WIN32
+    void* memory = _aligned_malloc(size ? size : 1, align);
+#else
+    // aligned_alloc wants the size to be a multiple of the alignment.
+    void* memory = aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align);
+#endif
+    if (memory) return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+void operator delete[](void* memory, std::align_val_t alignment) noexcept
+{
+    operator delete(memory, alignment);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(memory, alignment);
+}
+
+void operator delete[](void* memory, size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(memory, alignment);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+// ----------------------------------------------------------------------------
+// Frame pacing
+//
+
+static uint64_t systemPacingNow(void*)
+{
+    return tiny_engine::eventClock();
+}
+
+static void systemPacingSleep(void*, uint64_t nanoseconds)
+{
+#if defined(_WIN32) && defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+    // Sleep only wakes up on the next scheduler tick (up to 15.6 ms later), 
+    // the high resolution timer (Windows 10 1803 upwards) within a fraction of a millisecond.
+    static thread_local HANDLE timer = CreateWaitableTimerExW(nullptr, nullptr, 
+                                            CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (timer) 
+    {
+        // Relative due time, in 100 ns units.
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -(LONGLONG) (nanoseconds / 100);
+        if (SetWaitableTimerEx(timer, &dueTime, 0, nullptr, nullptr, nullptr, 0)) 
+        {
+            WaitForSingleObject(timer, INFINITE);
+            return;
+        }
+    }
+#endif
+    std::this_thread::sleep_for(std::chrono::nanoseconds(nanoseconds));
+}
+
+tiny_engine::detail::PacingClock tiny_engine::detail::systemPacingClock()
+{
+    return PacingClock { systemPacingNow, systemPacingSleep, nullptr };
+}
+
+tiny_engine::detail::FramePacer::FramePacer(PacingClock clock) : clock(clock)
+{
+}
+
+void tiny_engine::detail::FramePacer::setTargetFrameRate(double framesPerSecond)
+{
+    period = framesPerSecond > 0 ? (uint64_t) (1e9 / framesPerSecond) : 0;
+    scheduled = false;
+}
+
+void tiny_engine::detail::FramePacer::beginPresent()
+{
+    presentStart = clock.now(clock.user);
+    // The first frame starts with its first present.
+    if (!frameStarted) 
+    {
+        frameStart = presentStart;
+        frameStarted = true;
+    }
+}
+
+void tiny_engine::detail::FramePacer::endPresent()
+{
+    presentEnd = clock.now(clock.user);
+}
+
+void tiny_engine::detail::FramePacer::waitForNextFrame(void (*latencyWait)())
+{
+    TE_PROFILE_SCOPE("frame pacing");
+    constexpr uint64_t minMargin = 50000;
+    constexpr uint64_t maxMargin = 16000000;
+
+    uint64_t limiterStart = clock.now(clock.user);
+    uint64_t now = limiterStart;
+    if (period > 0) 
+    {
+        if (!scheduled || now > nextFrameDue + period) 
+        {
+            nextFrameDue = now;
+            scheduled = true;
+        }
+        else 
+        {
+            if (nextFrameDue > now + margin) 
+            {
+                uint64_t requested = nextFrameDue - now - margin;
+                clock.sleep(clock.user, requested);
+                uint64_t woken = clock.now(clock.user);
+                uint64_t overslept = woken > now + requested ? woken - (now + requested) : 0;
+                // Up right away with some headroom, down slowly.
+                uint64_t wanted = overslept + overslept / 4;
+                margin = wanted > margin ? wanted : margin - (margin - wanted) / 16;
+                margin = std::clamp(margin, minMargin, maxMargin);
+                now = woken;
+            }
+            while (now < nextFrameDue) now = clock.now(clock.user);
+        }
+        nextFrameDue += period;
+    }
+
+    uint64_t latencyWaitStart = now;
+    if (latencyWait) 
+    {
+        latencyWait();
+        now = clock.now(clock.user);
+    }
+
+    constexpr double toMilliseconds = 1e-6;
+    timing.cpuTime = (presentStart - frameStart) * toMilliseconds;
+    timing.presentTime = (presentEnd - presentStart) * toMilliseconds;
+    timing.limiterWaitTime = (latencyWaitStart - limiterStart) * toMilliseconds;
+    timing.latencyWaitTime = (now - latencyWaitStart) * toMilliseconds;
+    timing.frameTime = (now - frameStart) * toMilliseconds;
+    frameStart = now;
+    frameStarted = true;
+}
+
+// ----------------------------------------------------------------------------
+// Events
+//
+
+uint64_t tiny_engine::eventClock()
+{
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool tiny_engine::nextEvent(Event& event)
+{
+    return detail::eventQueue.pop(event);
+}
+
+bool tiny_engine::pushEvent(Event event)
+{
+    if (event.timestamp == 0) event.timestamp = eventClock();
+    return detail::eventQueue.push(event);
+}
+
+// ----------------------------------------------------------------------------
+// Math implementation
+//
+#ifdef TE_MATH
+
+tiny_engine::Vec2 tiny_engine::normalize(Vec2 v)
+{
+    float len = length(v);
+    return len > 0.0f ? v * (1.0f / len) : v;
+}
+
+tiny_engine::Vec3 tiny_engine::normalize(Vec3 v)
+{
+    float len = length(v);
+    return len > 0.0f ? v * (1.0f / len) : v;
+}
+
+tiny_engine::Vec4 tiny_engine::normalize(Vec4 v)
+{
+    float len = length(v);
+    return len > 0.0f ? v * (1.0f / len) : v;
+}
+
+tiny_engine::Mat4 tiny_engine::identityMatrix()
+{
+    return Mat4 {{ {1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1} }};
+}
+
+tiny_engine::Mat4 tiny_engine::translationMatrix(float x, float y, float z)
+{
+    return Mat4 {{ {1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {x, y, z, 1} }};
+}
+
+tiny_engine::Mat4 tiny_engine::scalingMatrix(float x, float y, float z)
+{
+    return Mat4 {{ {x, 0, 0, 0}, {0, y, 0, 0}, {0, 0, z, 0}, {0, 0, 0, 1} }};
+}
+
+tiny_engine::Mat4 tiny_engine::rotationMatrix(Quat q)
+{
+    return composeTransform(Vec3 { 0, 0, 0 }, q, Vec3 { 1, 1, 1 });
+}
+
+tiny_engine::Mat4 tiny_engine::composeTransform(Vec3 t, Quat q, Vec3 s)
+{
+    Mat4 result;
+    detail::math::composeTransformsScalar(&t.x, &t.y, &t.z, &q.x, &q.y, &q.z, &q.w, 
+                                          &s.x, &s.y, &s.z, &result, 1);
+    return result;
+}
+
+tiny_engine::Mat4 tiny_engine::orthographicMatrixLH(float width, float height, float nearZ, float farZ)
+{
+    float range = 1.0f / (farZ - nearZ);
+    return Mat4 {{ {2.0f / width, 0, 0, 0}, 
+                   {0, 2.0f / height, 0, 0}, 
+                   {0, 0, range, 0}, 
+                   {0, 0, -range * nearZ, 1} }};
+}
+
+tiny_engine::Mat4 tiny_engine::perspectiveMatrixLH(float fovY, float aspect, float nearZ, float farZ)
+{
+    float h = 1.0f / std::tan(fovY * 0.5f);
+    float w = h / aspect;
+    float range = farZ / (farZ - nearZ);
+    return Mat4 {{ {w, 0, 0, 0}, 
+                   {0, h, 0, 0}, 
+                   {0, 0, range, 1}, 
+                   {0, 0, -range * nearZ, 0} }};
+}
+
+tiny_engine::Mat4 tiny_engine::lookAtMatrixLH(Vec3 eye, Vec3 target, Vec3 up)
+{
+    Vec3 z = normalize(target - eye);
+    Vec3 x = normalize(cross(up, z));
+    Vec3 y = cross(z, x);
+    return Mat4 {{ {x.x, y.x, z.x, 0}, 
+                   {x.y, y.y, z.y, 0}, 
+                   {x.z, y.z, z.z, 0}, 
+                   {-dot(x, eye), -dot(y, eye), -dot(z, eye), 1} }};
+}
+
+tiny_engine::Mat4 tiny_engine::transpose(const Mat4& m)
+{
+    Mat4 r;
+    for (int i = 0; i < 4; i++) 
+        for (int j = 0; j < 4; j++) 
+            r.m[i][j] = m.m[j][i];
+    return r;
+}
+
+tiny_engine::Mat4 tiny_engine::inverse(const Mat4& matrix)
+{
+    // Cofactor expansion, works the same for row and column major data.
+    const float* m = &matrix.m[0][0];
+    float inv[16];
+    inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + 
+             m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+    inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - 
+             m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+    inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + 
+             m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+    inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - 
+              m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+    inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - 
+             m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+    inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + 
+             m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+    inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - 
+             m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+    inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + 
+              m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+    inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + 
+             m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+    inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - 
+             m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+    inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + 
+              m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+    inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - 
+              m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+    inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - 
+             m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+    inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + 
+             m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+    inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - 
+              m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+    inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + 
+              m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+    float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+    if (det == 0.0f) return identityMatrix();
+
+    Mat4 result;
+    float invDet = 1.0f / det;
+    for (int i = 0; i < 16; i++) (&result.m[0][0])[i] = inv[i] * invDet;
+    return result;
+}
+
+tiny_engine::Mat4 tiny_engine::operator*(const Mat4& a, const Mat4& b)
+{
+    Mat4 r;
+#if defined(TE_SIMD_SSE2)
+    __m128 b0 = _mm_loadu_ps(b.m[0]);
+    __m128 b1 = _mm_loadu_ps(b.m[1]);
+    __m128 b2 = _mm_loadu_ps(b.m[2]);
+    __m128 b3 = _mm_loadu_ps(b.m[3]);
+    for (int i = 0; i < 4; i++) 
+    {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a.m[i][0]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][2]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][3]), b3));
+        _mm_storeu_ps(r.m[i], row);
+    }
+#elif defined(TE_SIMD_NEON)
+    float32x4_t b0 = vld1q_f32(b.m[0]);
+    float32x4_t b1 = vld1q_f32(b.m[1]);
+    float32x4_t b2 = vld1q_f32(b.m[2]);
+    float32x4_t b3 = vld1q_f32(b.m[3]);
+    for (int i = 0; i < 4; i++) 
+    {
+        float32x4_t row = vmulq_n_f32(b0, a.m[i][0]);
+        row = vmlaq_n_f32(row, b1, a.m[i][1]);
+        row = vmlaq_n_f32(row, b2, a.m[i][2]);
+        row = vmlaq_n_f32(row, b3, a.m[i][3]);
+        vst1q_f32(r.m[i], row);
+    }
+#else
+    for (int i = 0; i < 4; i++) 
+        for (int j = 0; j < 4; j++) 
+            r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + 
+                        a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+#endif
+    return r;
+}
+
+tiny_engine::Vec4 tiny_engine::operator*(Vec4 v, const Mat4& m)
+{
+    Vec4 r;
+#if defined(TE_SIMD_SSE2)
+    __m128 row = _mm_mul_ps(_mm_set1_ps(v.x), _mm_loadu_ps(m.m[0]));
+    row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(v.y), _mm_loadu_ps(m.m[1])));
+    row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(v.z), _mm_loadu_ps(m.m[2])));
+    row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(v.w), _mm_loadu_ps(m.m[3])));
+    _mm_storeu_ps(&r.x, row);
+#elif defined(TE_SIMD_NEON)
+    float32x4_t row = vmulq_n_f32(vld1q_f32(m.m[0]), v.x);
+    row = vmlaq_n_f32(row, vld1q_f32(m.m[1]), v.y);
+    row = vmlaq_n_f32(row, vld1q_f32(m.m[2]), v.z);
+    row = vmlaq_n_f32(row, vld1q_f32(m.m[3]), v.w);
+    vst1q_f32(&r.x, row);
+#else
+    const float in[4] = { v.x, v.y, v.z, v.w };
+    float* out = &r.x;
+    for (int j = 0; j < 4; j++) 
+        out[j] = in[0] * m.m[0][j] + in[1] * m.m[1][j] + in[2] * m.m[2][j] + in[3] * m.m[3][j];
+#endif
+    return r;
+}
+
+tiny_engine::Vec3 tiny_engine::transformPoint(Vec3 v, const Mat4& m)
+{
+    Vec4 r = Vec4 { v.x, v.y, v.z, 1.0f } * m;
+    return { r.x, r.y, r.z };
+}
+
+tiny_engine::Vec3 tiny_engine::transformDirection(Vec3 v, const Mat4& m)
+{
+    Vec4 r = Vec4 { v.x, v.y, v.z, 0.0f } * m;
+    return { r.x, r.y, r.z };
+}
+
+tiny_engine::Quat tiny_engine::identityQuat()
+{
+    return Quat { 0, 0, 0, 1 };
+}
+
+tiny_engine::Quat tiny_engine::quatFromAxisAngle(Vec3 axis, float radians)
+{
+    Vec3 a = normalize(axis) * std::sin(radians * 0.5f);
+    return Quat { a.x, a.y, a.z, std::cos(radians * 0.5f) };
+}
+
+tiny_engine::Quat tiny_engine::normalize(Quat q)
+{
+    Vec4 v = normalize(Vec4 { q.x, q.y, q.z, q.w });
+    return Quat { v.x, v.y, v.z, v.w };
+}
+
+tiny_engine::Quat tiny_engine::conjugate(Quat q)
+{
+    return Quat { -q.x, -q.y, -q.z, q.w };
+}
+
+tiny_engine::Quat tiny_engine::operator*(Quat a, Quat b)
+{
+    return Quat {
+        a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+        a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z
+    };
+}
+
+tiny_engine::Vec3 tiny_engine::rotate(Quat q, Vec3 v)
+{
+    Vec3 u { q.x, q.y, q.z };
+    Vec3 t = cross(u, v) * 2.0f;
+    return v + t * q.w + cross(u, t);
+}
+
+tiny_engine::Quat tiny_engine::slerp(Quat a, Quat b, float t)
+{
+    float cosTheta = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    // Take the shorter way around.
+    if (cosTheta < 0.0f) 
+    {
+        b = Quat { -b.x, -b.y, -b.z, -b.w };
+        cosTheta = -cosTheta;
+    }
+
+    float wa = 1.0f - t;
+    float wb = t;
+    // Nearly parallel: plain lerp is accurate enough and avoids dividing by ~0.
+    if (cosTheta < 0.9995f) 
+    {
+        float theta = std::acos(cosTheta);
+        float sinTheta = std::sin(theta);
+        wa = std::sin((1.0f - t) * theta) / sinTheta;
+        wb = std::sin(t * theta) / sinTheta;
+    }
+    return normalize(Quat { a.x * wa + b.x * wb, a.y * wa + b.y * wb, 
+                            a.z * wa + b.z * wb, a.w * wa + b.w * wb });
+}
+
+void tiny_engine::detail::math::transformPointsScalar(const Mat4& m, 
+                        const float* x, const float* y, const float* z, 
+                        float* outX, float* outY, float* outZ, size_t count)
+{
+    for (size_t i = 0; i < count; i++) 
+    {
+        float px = x[i], py = y[i], pz = z[i];
+        outX[i] = px * m.m[0][0] + py * m.m[1][0] + pz * m.m[2][0] + m.m[3][0];
+        outY[i] = px * m.m[0][1] + py * m.m[1][1] + pz * m.m[2][1] + m.m[3][1];
+        outZ[i] = px * m.m[0][2] + py * m.m[1][2] + pz * m.m[2][2] + m.m[3][2];
+    }
+}
+
+void tiny_engine::transformPoints(const Mat4& m, const float* x, const float* y, const float* z, 
+                                  float* outX, float* outY, float* outZ, size_t count)
+{
+    size_t i = 0;
+#if defined(TE_SIMD_AVX2)
+    {
+        __m256 m00 = _mm256_set1_ps(m.m[0][0]), m01 = _mm256_set1_ps(m.m[0][1]), m02 = _mm256_set1_ps(m.m[0][2]);
+        __m256 m10 = _mm256_set1_ps(m.m[1][0]), m11 = _mm256_set1_ps(m.m[1][1]), m12 = _mm256_set1_ps(m.m[1][2]);
+        __m256 m20 = _mm256_set1_ps(m.m[2][0]), m21 = _mm256_set1_ps(m.m[2][1]), m22 = _mm256_set1_ps(m.m[2][2]);
+        __m256 m30 = _mm256_set1_ps(m.m[3][0]), m31 = _mm256_set1_ps(m.m[3][1]), m32 = _mm256_set1_ps(m.m[3][2]);
+        for (; i + 8 <= count; i += 8) 
+        {
+            __m256 px = _mm256_loadu_ps(x + i);
+            __m256 py = _mm256_loadu_ps(y + i);
+            __m256 pz = _mm256_loadu_ps(z + i);
+            __m256 ox = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m00), _mm256_mul_ps(py, m10)), 
+                                      _mm256_add_ps(_mm256_mul_ps(pz, m20), m30));
+            __m256 oy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m01), _mm256_mul_ps(py, m11)), 
+                                      _mm256_add_ps(_mm256_mul_ps(pz, m21), m31));
+            __m256 oz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m02), _mm256_mul_ps(py, m12)), 
+                                      _mm256_add_ps(_mm256_mul_ps(pz, m22), m32));
+            _mm256_storeu_ps(outX + i, ox);
+            _mm256_storeu_ps(outY + i, oy);
+            _mm256_storeu_ps(outZ + i, oz);
+        }
+    }
+#endif
+#if defined(TE_SIMD_SSE2)
+    {
+        __m128 m00 = _mm_set1_ps(m.m[0][0]), m01 = _mm_set1_ps(m.m[0][1]), m02 = _mm_set1_ps(m.m[0][2]);
+        __m128 m10 = _mm_set1_ps(m.m[1][0]), m11 = _mm_set1_ps(m.m[1][1]), m12 = _mm_set1_ps(m.m[1][2]);
+        __m128 m20 = _mm_set1_ps(m.m[2][0]), m21 = _mm_set1_ps(m.m[2][1]), m22 = _mm_set1_ps(m.m[2][2]);
+        __m128 m30 = _mm_set1_ps(m.m[3][0]), m31 = _mm_set1_ps(m.m[3][1]), m32 = _mm_set1_ps(m.m[3][2]);
+        for (; i + 4 <= count; i += 4) 
+        {
+            __m128 px = _mm_loadu_ps(x + i);
+            __m128 py = _mm_loadu_ps(y + i);
+            __m128 pz = _mm_loadu_ps(z + i);
+            __m128 ox = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m00), _mm_mul_ps(py, m10)), 
+                                   _mm_add_ps(_mm_mul_ps(pz, m20), m30));
+            __m128 oy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m01), _mm_mul_ps(py, m11)), 
+                                   _mm_add_ps(_mm_mul_ps(pz, m21), m31));
+            __m128 oz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m02), _mm_mul_ps(py, m12)), 
+                                   _mm_add_ps(_mm_mul_ps(pz, m22), m32));
+            _mm_storeu_ps(outX + i, ox);
+            _mm_storeu_ps(outY + i, oy);
+            _mm_storeu_ps(outZ + i, oz);
+        }
+    }
+#elif defined(TE_SIMD_NEON)
+    for (; i + 4 <= count; i += 4) 
+    {
+        float32x4_t px = vld1q_f32(x + i);
+        float32x4_t py = vld1q_f32(y + i);
+        float32x4_t pz = vld1q_f32(z + i);
+        float32x4_t ox = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(m.m[3][0]), px, m.m[0][0]), 
+                                                 py, m.m[1][0]), pz, m.m[2][0]);
+        float32x4_t oy = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(m.m[3][1]), px, m.m[0][1]), 
+                                                 py, m.m[1][1]), pz, m.m[2][1]);
+        float32x4_t oz = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(m.m[3][2]), px, m.m[0][2]), 
+                                                 py, m.m[1][2]), pz, m.m[2][2]);
+        vst1q_f32(outX + i, ox);
+        vst1q_f32(outY + i, oy);
+        vst1q_f32(outZ + i, oz);
+    }
+#endif
+    detail::math::transformPointsScalar(m, x + i, y + i, z + i, outX + i, outY + i, outZ + i, count - i);
+}
+
+void tiny_engine::detail::math::composeTransformsScalar(const float* tx, const float* ty, const float* tz,
+                                    const float* qx, const float* qy, const float* qz, const float* qw,
+                                    const float* sx, const float* sy, const float* sz,
+                                    Mat4* out, size_t count)
+{
+    for (size_t i = 0; i < count; i++) 
+    {
+        float x2 = qx[i] + qx[i], y2 = qy[i] + qy[i], z2 = qz[i] + qz[i];
+        float xx = qx[i] * x2, yy = qy[i] * y2, zz = qz[i] * z2;
+        float xy = qx[i] * y2, xz = qx[i] * z2, yz = qy[i] * z2;
+        float wx = qw[i] * x2, wy = qw[i] * y2, wz = qw[i] * z2;
+
+        Mat4& m = out[i];
+        m.m[0][0] = (1.0f - (yy + zz)) * sx[i]; m.m[0][1] = (xy + wz) * sx[i]; m.m[0][2] = (xz - wy) * sx[i]; m.m[0][3] = 0;
+        m.m[1][0] = (xy - wz) * sy[i]; m.m[1][1] = (1.0f - (xx + zz)) * sy[i]; m.m[1][2] = (yz + wx) * sy[i]; m.m[1][3] = 0;
+        m.m[2][0] = (xz + wy) * sz[i]; m.m[2][1] = (yz - wx) * sz[i]; m.m[2][2] = (1.0f - (xx + yy)) * sz[i]; m.m[2][3] = 0;
+        m.m[3][0] = tx[i]; m.m[3][1] = ty[i]; m.m[3][2] = tz[i]; m.m[3][3] = 1;
+    }
+}
+
+void tiny_engine::composeTransforms(const float* tx, const float* ty, const float* tz,
+                                    const float* qx, const float* qy, const float* qz, const float* qw,
+                                    const float* sx, const float* sy, const float* sz,
+                                    Mat4* out, size_t count)
+{
+    size_t i = 0;
+#if defined(TE_SIMD_SSE2)
+    // The matrix elements are computed for 4 transforms at once, 
+    // then each row is transposed from SoA into the 4 output matrices.
+    auto storeRow = [](Mat4* m, int row, __m128 c0, __m128 c1, __m128 c2, __m128 c3) {
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        _mm_storeu_ps(m[0].m[row], c0);
+        _mm_storeu_ps(m[1].m[row], c1);
+        _mm_storeu_ps(m[2].m[row], c2);
+        _mm_storeu_ps(m[3].m[row], c3);
+    };
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) 
+    {
+        __m128 x = _mm_loadu_ps(qx + i), y = _mm_loadu_ps(qy + i);
+        __m128 z = _mm_loadu_ps(qz + i), w = _mm_loadu_ps(qw + i);
+        __m128 x2 = _mm_add_ps(x, x), y2 = _mm_add_ps(y, y), z2 = _mm_add_ps(z, z);
+        __m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+        __m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+        __m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+        __m128 scaleX = _mm_loadu_ps(sx + i), scaleY = _mm_loadu_ps(sy + i), scaleZ = _mm_loadu_ps(sz + i);
+
+        storeRow(out + i, 0, _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), scaleX),
+                             _mm_mul_ps(_mm_add_ps(xy, wz), scaleX),
+                             _mm_mul_ps(_mm_sub_ps(xz, wy), scaleX), zero);
+        storeRow(out + i, 1, _mm_mul_ps(_mm_sub_ps(xy, wz), scaleY),
+                             _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), scaleY),
+                             _mm_mul_ps(_mm_add_ps(yz, wx), scaleY), zero);
+        storeRow(out + i, 2, _mm_mul_ps(_mm_add_ps(xz, wy), scaleZ),
+                             _mm_mul_ps(_mm_sub_ps(yz, wx), scaleZ),
+                             _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), scaleZ), zero);
+        storeRow(out + i, 3, _mm_loadu_ps(tx + i), _mm_loadu_ps(ty + i), _mm_loadu_ps(tz + i), one);
+    }
+#elif defined(TE_SIMD_NEON)
+    auto storeRow = [](Mat4* m, int row, float32x4_t c0, float32x4_t c1, float32x4_t c2, float32x4_t c3) {
+        float32x4x4_t columns = { { c0, c1, c2, c3 } };
+        vst4q_lane_f32(m[0].m[row], columns, 0);
+        vst4q_lane_f32(m[1].m[row], columns, 1);
+        vst4q_lane_f32(m[2].m[row], columns, 2);
+        vst4q_lane_f32(m[3].m[row], columns, 3);
+    };
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    for (; i + 4 <= count; i += 4) 
+    {
+        float32x4_t x = vld1q_f32(qx + i), y = vld1q_f32(qy + i);
+        float32x4_t z = vld1q_f32(qz + i), w = vld1q_f32(qw + i);
+        float32x4_t x2 = vaddq_f32(x, x), y2 = vaddq_f32(y, y), z2 = vaddq_f32(z, z);
+        float32x4_t xx = vmulq_f32(x, x2), yy = vmulq_f32(y, y2), zz = vmulq_f32(z, z2);
+        float32x4_t xy = vmulq_f32(x, y2), xz = vmulq_f32(x, z2), yz = vmulq_f32(y, z2);
+        float32x4_t wx = vmulq_f32(w, x2), wy = vmulq_f32(w, y2), wz = vmulq_f32(w, z2);
+        float32x4_t scaleX = vld1q_f32(sx + i), scaleY = vld1q_f32(sy + i), scaleZ = vld1q_f32(sz + i);
+
+        storeRow(out + i, 0, vmulq_f32(vsubq_f32(one, vaddq_f32(yy, zz)), scaleX),
+                             vmulq_f32(vaddq_f32(xy, wz), scaleX),
+                             vmulq_f32(vsubq_f32(xz, wy), scaleX), zero);
+        storeRow(out + i, 1, vmulq_f32(vsubq_f32(xy, wz), scaleY),
+                             vmulq_f32(vsubq_f32(one, vaddq_f32(xx, zz)), scaleY),
+                             vmulq_f32(vaddq_f32(yz, wx), scaleY), zero);
+        storeRow(out + i, 2, vmulq_f32(vaddq_f32(xz, wy), scaleZ),
+                             vmulq_f32(vsubq_f32(yz, wx), scaleZ),
+                             vmulq_f32(vsubq_f32(one, vaddq_f32(xx, yy)), scaleZ), zero);
+        storeRow(out + i, 3, vld1q_f32(tx + i), vld1q_f32(ty + i), vld1q_f32(tz + i), one);
+    }
+#endif
+    detail::math::composeTransformsScalar(tx + i, ty + i, tz + i, qx + i, qy + i, qz + i, qw + i, 
+                                          sx + i, sy + i, sz + i, out + i, count - i);
+}
+
+#endif
+
+#ifdef TE_PHYSICS
+// ----------------------------------------------------------------------------
+// Physics
+//
+
+void tiny_engine::detail::physics::axisSpread(const AabbArrays& boxes, uint32_t count, float spread[3])
+{
+    const float* mins[3] = { boxes.minX, boxes.minY, boxes.minZ };
+    const float* maxs[3] = { boxes.maxX, boxes.maxY, boxes.maxZ };
+    for (int axis = 0; axis < 3; axis++) 
+    {
+        spread[axis] = 0;
+        if (count == 0) continue;
+        const float* lo = mins[axis];
+        const float* hi = maxs[axis];
+        // Relative to the first center, so worlds far from the origin do not lose the precision.
+        float origin = lo[0] + hi[0];
+        float sum = 0, squares = 0;
+        uint32_t i = 0;
+#if defined(TE_SIMD_SSE2)
+        __m128 origin4 = _mm_set1_ps(origin);
+        __m128 sum4 = _mm_setzero_ps();
+        __m128 squares4 = _mm_setzero_ps();
+        for (; i + 4 <= count; i += 4) 
+        {
+            __m128 c = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(lo + i), _mm_loadu_ps(hi + i)), origin4);
+            sum4 = _mm_add_ps(sum4, c);
+            squares4 = _mm_add_ps(squares4, _mm_mul_ps(c, c));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, sum4);
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        _mm_storeu_ps(lanes, squares4);
+        squares = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(TE_SIMD_NEON)
+        float32x4_t origin4 = vdupq_n_f32(origin);
+        float32x4_t sum4 = vdupq_n_f32(0);
+        float32x4_t squares4 = vdupq_n_f32(0);
+        for (; i + 4 <= count; i += 4) 
+        {
+            float32x4_t c = vsubq_f32(vaddq_f32(vld1q_f32(lo + i), vld1q_f32(hi + i)), origin4);
+            sum4 = vaddq_f32(sum4, c);
+            squares4 = vmlaq_f32(squares4, c, c);
+        }
+        float lanes[4];
+        vst1q_f32(lanes, sum4);
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        vst1q_f32(lanes, squares4);
+        squares = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+        for (; i < count; i++) 
+        {
+            float c = lo[i] + hi[i] - origin;
+            sum += c;
+            squares += c * c;
+        }
+        float mean = sum / count;
+        spread[axis] = squares / count - mean * mean;
+    }
+}
+
+bool tiny_engine::detail::physics::resortIncremental(std::vector<SortEntry>& order, uint32_t maxMoves, 
+                                                     uint32_t& moves)
+{
+    moves = 0;
+    SortEntry* entries = order.data();
+    for (size_t i = 1; i < order.size(); i++) 
+    {
+        SortEntry entry = entries[i];
+        size_t j = i;
+        while (j > 0 && (entry.key < entries[j - 1].key || 
+                         (entry.key == entries[j - 1].key && entry.body < entries[j - 1].body))) 
+        {
+            entries[j] = entries[j - 1];
+            j--;
+        }
+        entries[j] = entry;
+        moves += (uint32_t) (i - j);
+        if (moves > maxMoves) return false;
+    }
+    return true;
+}
+
+void tiny_engine::detail::physics::sweepRangeScalar(const BroadphaseData& data, uint32_t begin, uint32_t end, 
+                                                    std::vector<BodyPair>& out)
+{
+    const float* min0 = data.sortedMin[0].data();
+    const float* min1 = data.sortedMin[1].data();
+    const float* min2 = data.sortedMin[2].data();
+    const float* max0 = data.sortedMax[0].data();
+    const float* max1 = data.sortedMax[1].data();
+    const float* max2 = data.sortedMax[2].data();
+    const uint32_t* body = data.sortedBody.data();
+    for (uint32_t i = begin; i < end; i++) 
+    {
+        // Sorted by min along the sweep axis, so the first box starting behind 
+        // the end of box i ends the sweep for it (the padding always does).
+        for (uint32_t j = i + 1; min0[j] <= max0[i]; j++) 
+        {
+            if (min1[j] <= max1[i] && max1[j] >= min1[i] && min2[j] <= max2[i] && max2[j] >= min2[i]) 
+            {
+                out.push_back(BodyPair { std::min(body[i], body[j]), std::max(body[i], body[j]) });
+            }
+        }
+    }
+}
+
+void tiny_engine::detail::physics::sweepRange(const BroadphaseData& data, uint32_t begin, uint32_t end, 
+                                              std::vector<BodyPair>& out)
+{
+#if defined(TE_SIMD_SSE2) || defined(TE_SIMD_NEON)
+    const float* min0 = data.sortedMin[0].data();
+    const float* min1 = data.sortedMin[1].data();
+    const float* min2 = data.sortedMin[2].data();
+    const float* max0 = data.sortedMax[0].data();
+    const float* max1 = data.sortedMax[1].data();
+    const float* max2 = data.sortedMax[2].data();
+    const uint32_t* body = data.sortedBody.data();
+    for (uint32_t i = begin; i < end; i++) 
+    {
+        // 4 following boxes per step. The padding boxes never overlap, 
+        // so the loads may run up to 3 boxes past the last one.
+#if defined(TE_SIMD_SSE2)
+        __m128 end0 = _mm_set1_ps(max0[i]);
+        __m128 start1 = _mm_set1_ps(min1[i]), end1 = _mm_set1_ps(max1[i]);
+        __m128 start2 = _mm_set1_ps(min2[i]), end2 = _mm_set1_ps(max2[i]);
+        for (uint32_t j = i + 1; ; j += 4) 
+        {
+            __m128 onAxis = _mm_cmple_ps(_mm_loadu_ps(min0 + j), end0);
+            int axisMask = _mm_movemask_ps(onAxis);
+            if (axisMask == 0) break;
+            __m128 overlap1 = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(min1 + j), end1), 
+                                         _mm_cmpge_ps(_mm_loadu_ps(max1 + j), start1));
+            __m128 overlap2 = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(min2 + j), end2), 
+                                         _mm_cmpge_ps(_mm_loadu_ps(max2 + j), start2));
+            int mask = _mm_movemask_ps(_mm_and_ps(onAxis, _mm_and_ps(overlap1, overlap2)));
+#else
+        float32x4_t end0 = vdupq_n_f32(max0[i]);
+        float32x4_t start1 = vdupq_n_f32(min1[i]), end1 = vdupq_n_f32(max1[i]);
+        float32x4_t start2 = vdupq_n_f32(min2[i]), end2 = vdupq_n_f32(max2[i]);
+        const uint32x4_t laneBits = { 1, 2, 4, 8 };
+        for (uint32_t j = i + 1; ; j += 4) 
+        {
+            uint32x4_t onAxis = vcleq_f32(vld1q_f32(min0 + j), end0);
+            uint32x4_t axisBits = vandq_u32(onAxis, laneBits);
+            int axisMask = (int) (vgetq_lane_u32(axisBits, 0) | vgetq_lane_u32(axisBits, 1) | 
+                                  vgetq_lane_u32(axisBits, 2) | vgetq_lane_u32(axisBits, 3));
+            if (axisMask == 0) break;
+            uint32x4_t overlap1 = vandq_u32(vcleq_f32(vld1q_f32(min1 + j), end1), 
+                                            vcgeq_f32(vld1q_f32(max1 + j), start1));
+            uint32x4_t overlap2 = vandq_u32(vcleq_f32(vld1q_f32(min2 + j), end2), 
+                                            vcgeq_f32(vld1q_f32(max2 + j), start2));
+            uint32x4_t bits = vandq_u32(vandq_u32(axisBits, overlap1), overlap2);
+            int mask = (int) (vgetq_lane_u32(bits, 0) | vgetq_lane_u32(bits, 1) | 
+                              vgetq_lane_u32(bits, 2) | vgetq_lane_u32(bits, 3));
+#endif
+            for (int lane = 0; mask != 0; lane++, mask >>= 1) 
+            {
+                if (mask & 1) 
+                {
+                    uint32_t other = body[j + lane];
+                    out.push_back(BodyPair { std::min(body[i], other), std::max(body[i], other) });
+                }
+            }
+            // Once a box starts behind box i, all following ones do.
+            if (axisMask != 0xf) break;
+        }
+    }
+#else
+    sweepRangeScalar(data, begin, end, out);
+#endif
+}
+
+// Copies the pairs of the chunks into the pair buffer in chunk order, 
+// so the result does not depend on which thread searched which chunk.
+static void joinChunkPairs(tiny_engine::detail::physics::BroadphaseData& data, uint32_t chunkCount)
+{
+    uint32_t capacity = (uint32_t) data.pairs.size();
+    data.pairCount = 0;
+    data.stats.droppedPairs = 0;
+    for (uint32_t c = 0; c < chunkCount; c++) 
+    {
+        const auto& chunk = data.chunkPairs[c];
+        uint32_t fits = std::min((uint32_t) chunk.size(), capacity - data.pairCount);
+        if (fits > 0) memcpy(data.pairs.data() + data.pairCount, chunk.data(), fits * sizeof(tiny_engine::BodyPair));
+        data.pairCount += fits;
+        data.stats.droppedPairs += (uint32_t) chunk.size() - fits;
+    }
+}
+
+void tiny_engine::detail::physics::sweepAndPrune(BroadphaseData& data, const AabbArrays& boxes, uint32_t count)
+{
+    const float* mins[3] = { boxes.minX, boxes.minY, boxes.minZ };
+    const float* maxs[3] = { boxes.maxX, boxes.maxY, boxes.maxZ };
+
+    // A new sweep axis means sorting from scratch, 
+    // so it only changes once another axis is clearly better.
+    float spread[3];
+    axisSpread(boxes, count, spread);
+    int best = spread[0] >= spread[1] ? (spread[0] >= spread[2] ? 0 : 2) : (spread[1] >= spread[2] ? 1 : 2);
+    bool fullSort = data.axis < 0 || (best != data.axis && spread[best] > 2 * spread[data.axis]);
+    if (fullSort) 
+    {
+        data.axis = best;
+        data.order.clear();
+    }
+    int axis0 = data.axis, axis1 = (axis0 + 1) % 3, axis2 = (axis0 + 2) % 3;
+
+    // Bodies beyond count are gone, new ones join at the end.
+    auto& order = data.order;
+    uint32_t previousCount = (uint32_t) order.size();
+    if (count < previousCount) 
+    {
+        order.erase(std::remove_if(order.begin(), order.end(), 
+                                   [count](const SortEntry& e) { return e.body >= count; }), order.end());
+    }
+    for (uint32_t body = previousCount; body < count; body++) order.push_back(SortEntry { 0, body });
+    for (auto& entry : order) 
+    {
+        // NaN boxes go to the end and overlap nothing.
+        float key = mins[axis0][entry.body];
+        entry.key = key == key ? key : INFINITY;
+    }
+
+    uint32_t moves = 0;
+    if (fullSort || !resortIncremental(order, count * 8, moves)) 
+    {
+        std::sort(order.begin(), order.end(), [](const SortEntry& a, const SortEntry& b) {
+            return a.key < b.key || (a.key == b.key && a.body < b.body);
+        });
+    }
+    data.stats.fullSort = fullSort;
+    data.stats.sortMoves = moves;
+
+    // Gather the boxes in sweep order, so the sweep reads them sequentially.
+    for (int k = 0; k < 3; k++) 
+    {
+        data.sortedMin[k].resize(count + 4);
+        data.sortedMax[k].resize(count + 4);
+    }
+    data.sortedBody.resize(count + 4);
+    float* min0 = data.sortedMin[0].data();
+    float* min1 = data.sortedMin[1].data();
+    float* min2 = data.sortedMin[2].data();
+    float* max0 = data.sortedMax[0].data();
+    float* max1 = data.sortedMax[1].data();
+    float* max2 = data.sortedMax[2].data();
+    for (uint32_t i = 0; i < count; i++) 
+    {
+        uint32_t body = order[i].body;
+        min0[i] = order[i].key;
+        max0[i] = maxs[axis0][body];
+        min1[i] = mins[axis1][body];
+        max1[i] = maxs[axis1][body];
+        min2[i] = mins[axis2][body];
+        max2[i] = maxs[axis2][body];
+        data.sortedBody[i] = body;
+    }
+    // NaN fails every comparison, so the padding ends the sweep even for infinite boxes.
+    for (uint32_t i = count; i < count + 4; i++) 
+    {
+        min0[i] = min1[i] = min2[i] = NAN;
+        max0[i] = max1[i] = max2[i] = NAN;
+        data.sortedBody[i] = 0;
+    }
+
+    uint32_t chunkCount = (count + pairSearchChunkSize - 1) / pairSearchChunkSize;
+    if (data.chunkPairs.size() < chunkCount) data.chunkPairs.resize(chunkCount);
+    parallelFor(chunkCount, 1, [&data, count](uint32_t begin, uint32_t end) {
+        for (uint32_t c = begin; c < end; c++) 
+        {
+            auto& out = data.chunkPairs[c];
+            out.clear();
+            sweepRange(data, c * pairSearchChunkSize, std::min(count, (c + 1) * pairSearchChunkSize), out);
+        }
+    });
+    joinChunkPairs(data, chunkCount);
+}
+
+void tiny_engine::detail::physics::spatialHash(BroadphaseData& data, const AabbArrays& boxes, uint32_t count)
+{
+    float cellSize = data.settings.cellSize;
+    float inverseCellSize = 1.0f / cellSize;
+    // Clamped, so boxes far out still give valid cell coordinates.
+    auto cellOf = [inverseCellSize](float v) {
+        return (int32_t) std::floor(std::clamp(v * inverseCellSize, -1e9f, 1e9f));
+    };
+    auto hashOf = [](int32_t x, int32_t y, int32_t z) {
+        return ((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u) ^ ((uint32_t) z * 83492791u);
+    };
+    // False for NaN boxes, they overlap nothing.
+    auto overlaps = [&boxes](uint32_t a, uint32_t b) {
+        return boxes.minX[a] <= boxes.maxX[b] && boxes.maxX[a] >= boxes.minX[b] && 
+               boxes.minY[a] <= boxes.maxY[b] && boxes.maxY[a] >= boxes.minY[b] && 
+               boxes.minZ[a] <= boxes.maxZ[b] && boxes.maxZ[a] >= boxes.minZ[b];
+    };
+
+    // A body goes into the cell of its min corner. Boxes no bigger than a cell 
+    // can then only overlap boxes in the same or a neighbouring cell, 
+    // bigger ones are tested against all bodies instead.
+    auto& entries = data.hashEntries;
+    entries.clear();
+    data.largeBodies.clear();
+    data.isLarge.assign(count, 0);
+    for (uint32_t body = 0; body < count; body++) 
+    {
+        if (!overlaps(body, body)) continue;
+        if (boxes.maxX[body] - boxes.minX[body] > cellSize || boxes.maxY[body] - boxes.minY[body] > cellSize || 
+            boxes.maxZ[body] - boxes.minZ[body] > cellSize) 
+        {
+            data.largeBodies.push_back(body);
+            data.isLarge[body] = 1;
+            continue;
+        }
+        entries.push_back(HashEntry { cellOf(boxes.minX[body]), cellOf(boxes.minY[body]), 
+                                      cellOf(boxes.minZ[body]), body });
+    }
+
+    // Counting sort of the entries by bucket, stable so they keep the body order.
+    uint32_t bucketCount = 64;
+    while (bucketCount < entries.size()) bucketCount *= 2;
+    uint32_t bucketMask = bucketCount - 1;
+    auto bucketOf = [&](const HashEntry& e) { return hashOf(e.cellX, e.cellY, e.cellZ) & bucketMask; };
+    auto& bucketStart = data.bucketStart;
+    bucketStart.assign(bucketCount + 1, 0);
+    for (const auto& e : entries) bucketStart[bucketOf(e) + 1]++;
+    for (uint32_t i = 0; i < bucketCount; i++) bucketStart[i + 1] += bucketStart[i];
+    data.hashSorted.resize(entries.size());
+    for (const auto& e : entries) data.hashSorted[bucketStart[bucketOf(e)]++] = e;
+    // The scatter moved every start to the end of its bucket, which is the start of the next.
+    memmove(bucketStart.data() + 1, bucketStart.data(), bucketCount * sizeof(uint32_t));
+    bucketStart[0] = 0;
+
+    // The own cell and the 13 neighbours "after" it, so every pair of cells is visited once.
+    static const int32_t neighbours[13][3] = {
+        { 1, 0, 0 }, { -1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, 
+        { -1, -1, 1 }, { 0, -1, 1 }, { 1, -1, 1 }, { -1, 0, 1 }, { 0, 0, 1 }, 
+        { 1, 0, 1 }, { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }
+    };
+    const HashEntry* sorted = data.hashSorted.data();
+    uint32_t chunkCount = (bucketCount + pairSearchChunkSize - 1) / pairSearchChunkSize;
+    if (data.chunkPairs.size() < chunkCount + 1) data.chunkPairs.resize(chunkCount + 1);
+    parallelFor(chunkCount, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t c = begin; c < end; c++) 
+        {
+            auto& out = data.chunkPairs[c];
+            out.clear();
+            uint32_t lastBucket = std::min(bucketCount, (c + 1) * pairSearchChunkSize);
+            for (uint32_t bucket = c * pairSearchChunkSize; bucket < lastBucket; bucket++) 
+            {
+                for (uint32_t i = bucketStart[bucket]; i < bucketStart[bucket + 1]; i++) 
+                {
+                    const HashEntry& e = sorted[i];
+                    // Other cells can share the bucket, only the same cell counts.
+                    for (uint32_t j = i + 1; j < bucketStart[bucket + 1]; j++) 
+                    {
+                        const HashEntry& other = sorted[j];
+                        if (other.cellX != e.cellX || other.cellY != e.cellY || other.cellZ != e.cellZ) continue;
+                        if (overlaps(e.body, other.body)) 
+                        {
+                            out.push_back(BodyPair { std::min(e.body, other.body), std::max(e.body, other.body) });
+                        }
+                    }
+                    for (const auto& offset : neighbours) 
+                    {
+                        int32_t x = e.cellX + offset[0], y = e.cellY + offset[1], z = e.cellZ + offset[2];
+                        uint32_t neighbour = hashOf(x, y, z) & bucketMask;
+                        for (uint32_t j = bucketStart[neighbour]; j < bucketStart[neighbour + 1]; j++) 
+                        {
+                            const HashEntry& other = sorted[j];
+                            if (other.cellX != x || other.cellY != y || other.cellZ != z) continue;
+                            if (overlaps(e.body, other.body)) 
+                            {
+                                out.push_back(BodyPair { std::min(e.body, other.body), 
+                                                         std::max(e.body, other.body) });
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    // The large bodies against everything, as one more chunk behind the others.
+    auto& out = data.chunkPairs[chunkCount];
+    out.clear();
+    for (uint32_t large : data.largeBodies) 
+    {
+        for (uint32_t body = 0; body < count; body++) 
+        {
+            // Pairs of two large bodies only once.
+            if (body == large || (data.isLarge[body] && body < large)) continue;
+            if (overlaps(large, body)) out.push_back(BodyPair { std::min(large, body), std::max(large, body) });
+        }
+    }
+    joinChunkPairs(data, chunkCount + 1);
+}
+
+tiny_engine::Broadphase tiny_engine::createBroadphase(const BroadphaseSettings& settings)
+{
+    auto data = new detail::physics::BroadphaseData();
+    data->settings = settings;
+    if (!(data->settings.cellSize > 0)) data->settings.cellSize = 1;
+    data->pairs.resize(settings.maxPairs);
+    return Broadphase { detail::physics::broadphaseStorage.store(data) };
+}
+
+void tiny_engine::destroyBroadphase(Broadphase broadphase)
+{
+    delete detail::physics::broadphaseStorage.release(broadphase.id);
+}
+
+uint32_t tiny_engine::updateBroadphase(Broadphase broadphase, const AabbArrays& boxes, uint32_t count)
+{
+    TE_PROFILE_SCOPE("updateBroadphase");
+    auto data = detail::physics::broadphaseStorage.get(broadphase.id);
+    if (!data) return 0;
+    auto start = std::chrono::steady_clock::now();
+    data->stats = {};
+    if (data->settings.type == BroadphaseType::SpatialHash) detail::physics::spatialHash(*data, boxes, count);
+    else detail::physics::sweepAndPrune(*data, boxes, count);
+    data->stats.bodyCount = count;
+    data->stats.pairCount = data->pairCount;
+    data->stats.milliseconds = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    return data->pairCount;
+}
+
+const tiny_engine::BodyPair* tiny_engine::getBroadphasePairs(Broadphase broadphase)
+{
+    auto data = detail::physics::broadphaseStorage.get(broadphase.id);
+    return data ? data->pairs.data() : nullptr;
+}
+
+tiny_engine::BroadphaseStats tiny_engine::getBroadphaseStats(Broadphase broadphase)
+{
+    auto data = detail::physics::broadphaseStorage.get(broadphase.id);
+    return data ? data->stats : BroadphaseStats {};
+}
+
+// The contact solver and the scene queries work on 4 lanes at once, one register where there is SIMD.
+// lanesMaskLessEqual returns bit i set where lane i of a <= lane i of b.
+#if defined(TE_SIMD_SSE2)
+typedef __m128 Lanes;
+static inline Lanes lanesLoad(const float* p) { return _mm_load_ps(p); }
+static inline void lanesStore(float* p, Lanes v) { _mm_store_ps(p, v); }
+static inline Lanes lanesSet(float v) { return _mm_set1_ps(v); }
+static inline Lanes lanesAdd(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes lanesSub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes lanesMul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes lanesMin(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+static inline Lanes lanesMax(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+static inline int lanesMaskLessEqual(Lanes a, Lanes b) { return _mm_movemask_ps(_mm_cmple_ps(a, b)); }
+#elif defined(TE_SIMD_NEON)
+typedef float32x4_t Lanes;
+static inline Lanes lanesLoad(const float* p) { return vld1q_f32(p); }
+static inline void lanesStore(float* p, Lanes v) { vst1q_f32(p, v); }
+static inline Lanes lanesSet(float v) { return vdupq_n_f32(v); }
+static inline Lanes lanesAdd(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+static inline Lanes lanesSub(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+static inline Lanes lanesMul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+static inline Lanes lanesMin(Lanes a, Lanes b) { return vminq_f32(a, b); }
+static inline Lanes lanesMax(Lanes a, Lanes b) { return vmaxq_f32(a, b); }
+static inline int lanesMaskLessEqual(Lanes a, Lanes b)
+{
+    const uint32x4_t laneBits = { 1, 2, 4, 8 };
+    uint32x4_t bits = vandq_u32(vcleq_f32(a, b), laneBits);
+    return (int) (vgetq_lane_u32(bits, 0) | vgetq_lane_u32(bits, 1) | vgetq_lane_u32(bits, 2) | vgetq_lane_u32(bits, 3));
+}
+#else
+struct Lanes
+{
+    float v[4];
+};
+static inline Lanes lanesLoad(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+static inline void lanesStore(float* p, Lanes v) { memcpy(p, v.v, sizeof(v.v)); }
+static inline Lanes lanesSet(float v) { return { { v, v, v, v } }; }
+static inline Lanes lanesAdd(Lanes a, Lanes b)
+{
+    return { { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } };
+}
+static inline Lanes lanesSub(Lanes a, Lanes b)
+{
+    return { { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] } };
+}
+static inline Lanes lanesMul(Lanes a, Lanes b)
+{
+    return { { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] } };
+}
+static inline Lanes lanesMin(Lanes a, Lanes b)
+{
+    return { { std::min(a.v[0], b.v[0]), std::min(a.v[1], b.v[1]), std::min(a.v[2], b.v[2]), std::min(a.v[3], b.v[3]) } };
+}
+static inline Lanes lanesMax(Lanes a, Lanes b)
+{
+    return { { std::max(a.v[0], b.v[0]), std::max(a.v[1], b.v[1]), std::max(a.v[2], b.v[2]), std::max(a.v[3], b.v[3]) } };
+}
+static inline int lanesMaskLessEqual(Lanes a, Lanes b)
+{
+    return (a.v[0] <= b.v[0] ? 1 : 0) | (a.v[1] <= b.v[1] ? 2 : 0) | (a.v[2] <= b.v[2] ? 4 : 0) | (a.v[3] <= b.v[3] ? 8 : 0);
+}
+#endif
+
+static tiny_engine::Vec3 multiply(const tiny_engine::detail::physics::Mat3& m, tiny_engine::Vec3 v)
+{
+    return { m.m[0][0] * v.x + m.m[0][1] * v.y + m.m[0][2] * v.z,
+             m.m[1][0] * v.x + m.m[1][1] * v.y + m.m[1][2] * v.z,
+             m.m[2][0] * v.x + m.m[2][1] * v.y + m.m[2][2] * v.z };
+}
+
+// The first friction direction, any unit vector perpendicular to the normal.
+// Only depends on the normal, so the friction impulses of the last step still fit.
+static tiny_engine::Vec3 frictionDirection(tiny_engine::Vec3 normal)
+{
+    if (std::fabs(normal.x) >= 0.57735f) return tiny_engine::normalize(tiny_engine::Vec3 { normal.y, -normal.x, 0 });
+    return tiny_engine::normalize(tiny_engine::Vec3 { 0, normal.z, -normal.y });
+}
+
+tiny_engine::detail::physics::OrientedBox tiny_engine::detail::physics::orientedBox(const WorldData& world,
+                                                                                    uint32_t body)
+{
+    OrientedBox box;
+    Quat rotation = world.rotation[body];
+    Vec3 half = world.halfExtents[body];
+    box.center = world.position[body];
+    box.axis[0] = rotate(rotation, Vec3 { 1, 0, 0 });
+    box.axis[1] = rotate(rotation, Vec3 { 0, 1, 0 });
+    box.axis[2] = rotate(rotation, Vec3 { 0, 0, 1 });
+    box.half[0] = half.x;
+    box.half[1] = half.y;
+    box.half[2] = half.z;
+    return box;
+}
+
+uint32_t tiny_engine::detail::physics::collideSpheres(Vec3 centerA, float radiusA, Vec3 centerB, float radiusB,
+                                                      Vec3& normal, ContactPoint* points)
+{
+    Vec3 offset = centerB - centerA;
+    float distance = length(offset);
+    if (!(distance - radiusA - radiusB <= speculativeDistance)) return 0;
+    // Spheres at the same spot are pushed apart along y.
+    normal = distance > 1e-6f ? offset * (1.0f / distance) : Vec3 { 0, 1, 0 };
+    points[0].position = (centerA + normal * radiusA + centerB - normal * radiusB) * 0.5f;
+    points[0].depth = radiusA + radiusB - distance;
+    return 1;
+}
+
+uint32_t tiny_engine::detail::physics::collideSphereBox(Vec3 center, float radius, const OrientedBox& box,
+                                                        Vec3& normal, ContactPoint* points)
+{
+    Vec3 offset = center - box.center;
+    float local[3], clamped[3];
+    Vec3 closest = box.center;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        local[axis] = dot(offset, box.axis[axis]);
+        clamped[axis] = std::clamp(local[axis], -box.half[axis], box.half[axis]);
+        closest = closest + box.axis[axis] * clamped[axis];
+    }
+    Vec3 delta = center - closest;
+    float distance = length(delta);
+    if (distance > 0)
+    {
+        if (!(distance - radius <= speculativeDistance)) return 0;
+        normal = delta * (-1.0f / distance);
+        points[0].position = (closest + center + normal * radius) * 0.5f;
+        points[0].depth = radius - distance;
+        return 1;
+    }
+
+    // The center is inside the box, it leaves through the nearest face.
+    int face = 0;
+    float nearest = INFINITY;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float gap = box.half[axis] - std::fabs(local[axis]);
+        if (gap < nearest)
+        {
+            nearest = gap;
+            face = axis;
+        }
+    }
+    normal = box.axis[face] * (local[face] < 0 ? 1.0f : -1.0f);
+    points[0].position = center;
+    points[0].depth = radius + nearest;
+    return 1;
+}
+
+uint32_t tiny_engine::detail::physics::reduceContacts(const ContactPoint* candidates, uint32_t count, Vec3 normal,
+                                                      ContactPoint* points)
+{
+    if (count <= 4)
+    {
+        for (uint32_t i = 0; i < count; i++) points[i] = candidates[i];
+        return count;
+    }
+    uint32_t deepest = 0;
+    for (uint32_t i = 1; i < count; i++) if (candidates[i].depth > candidates[deepest].depth) deepest = i;
+    Vec3 origin = candidates[deepest].position;
+    uint32_t farthest = deepest;
+    float farthestDistance = -1;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Vec3 offset = candidates[i].position - origin;
+        if (dot(offset, offset) > farthestDistance)
+        {
+            farthestDistance = dot(offset, offset);
+            farthest = i;
+        }
+    }
+    // The points furthest to either side of the line through the first two.
+    Vec3 line = candidates[farthest].position - origin;
+    uint32_t left = deepest, right = deepest;
+    float leftArea = 0, rightArea = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        float area = dot(cross(line, candidates[i].position - origin), normal);
+        if (area > leftArea)
+        {
+            leftArea = area;
+            left = i;
+        }
+        if (area < rightArea)
+        {
+            rightArea = area;
+            right = i;
+        }
+    }
+    uint32_t pointCount = 0;
+    points[pointCount++] = candidates[deepest];
+    if (farthest != deepest) points[pointCount++] = candidates[farthest];
+    if (left != deepest) points[pointCount++] = candidates[left];
+    if (right != deepest) points[pointCount++] = candidates[right];
+    return pointCount;
+}
+
+uint32_t tiny_engine::detail::physics::collideBoxes(const OrientedBox& a, const OrientedBox& b,
+                                                    Vec3& normal, ContactPoint* points)
+{
+    // The axis with the least overlap is the contact normal. Faces win over edges and
+    // faces of a over faces of b unless the other is clearly better, so the normal does
+    // not flip between nearly equal axes from step to step.
+    Vec3 offset = b.center - a.center;
+    float alignment[3][3];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++) alignment[i][j] = std::fabs(dot(a.axis[i], b.axis[j])) + 1e-6f;
+    }
+    float faceSeparation[2] = { -INFINITY, -INFINITY };
+    int faceAxis[2] = { 0, 0 };
+    for (int i = 0; i < 3; i++)
+    {
+        float extent = a.half[i] + b.half[0] * alignment[i][0] + b.half[1] * alignment[i][1] +
+                       b.half[2] * alignment[i][2];
+        float separation = std::fabs(dot(offset, a.axis[i])) - extent;
+        // Written so NaN boxes never collide.
+        if (!(separation <= speculativeDistance)) return 0;
+        if (separation > faceSeparation[0])
+        {
+            faceSeparation[0] = separation;
+            faceAxis[0] = i;
+        }
+    }
+    for (int j = 0; j < 3; j++)
+    {
+        float extent = b.half[j] + a.half[0] * alignment[0][j] + a.half[1] * alignment[1][j] +
+                       a.half[2] * alignment[2][j];
+        float separation = std::fabs(dot(offset, b.axis[j])) - extent;
+        if (!(separation <= speculativeDistance)) return 0;
+        if (separation > faceSeparation[1])
+        {
+            faceSeparation[1] = separation;
+            faceAxis[1] = j;
+        }
+    }
+    float edgeSeparation = -INFINITY;
+    Vec3 edgeNormal = { 0, 0, 0 };
+    int edgeA = 0, edgeB = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            Vec3 axis = cross(a.axis[i], b.axis[j]);
+            float axisLength = length(axis);
+            // Parallel edges, the face axes cover them.
+            if (axisLength < 1e-4f) continue;
+            axis = axis * (1.0f / axisLength);
+            float extent = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                extent += a.half[k] * std::fabs(dot(a.axis[k], axis)) + b.half[k] * std::fabs(dot(b.axis[k], axis));
+            }
+            float separation = std::fabs(dot(offset, axis)) - extent;
+            if (!(separation <= speculativeDistance)) return 0;
+            if (separation > edgeSeparation)
+            {
+                edgeSeparation = separation;
+                edgeNormal = axis;
+                edgeA = i;
+                edgeB = j;
+            }
+        }
+    }
+    int reference = faceSeparation[1] > faceSeparation[0] + 1e-3f ? 1 : 0;
+
+    if (edgeSeparation > faceSeparation[reference] + 1e-2f)
+    {
+        // Edge against edge: one point between the closest points of the two edges.
+        if (dot(offset, edgeNormal) < 0) edgeNormal = edgeNormal * -1.0f;
+        Vec3 pointA = a.center, pointB = b.center;
+        for (int k = 0; k < 3; k++)
+        {
+            if (k != edgeA) pointA = pointA + a.axis[k] * (dot(a.axis[k], edgeNormal) > 0 ? a.half[k] : -a.half[k]);
+            if (k != edgeB) pointB = pointB + b.axis[k] * (dot(b.axis[k], edgeNormal) > 0 ? -b.half[k] : b.half[k]);
+        }
+        Vec3 directionA = a.axis[edgeA], directionB = b.axis[edgeB];
+        Vec3 between = pointA - pointB;
+        float d = dot(directionA, directionB);
+        float c = dot(directionA, between);
+        float f = dot(directionB, between);
+        float denominator = 1 - d * d;
+        float s = denominator > 1e-6f ? (d * f - c) / denominator : 0;
+        s = std::clamp(s, -a.half[edgeA], a.half[edgeA]);
+        float t = std::clamp(d * s + f, -b.half[edgeB], b.half[edgeB]);
+        normal = edgeNormal;
+        points[0].position = (pointA + directionA * s + pointB + directionB * t) * 0.5f;
+        points[0].depth = -edgeSeparation;
+        return 1;
+    }
+
+    // Face contact: the face of the other box turned most against the reference face,
+    // clipped against the sides of the reference face.
+    const OrientedBox& referenceBox = reference ? b : a;
+    const OrientedBox& incidentBox = reference ? a : b;
+    int face = faceAxis[reference];
+    Vec3 faceNormal = referenceBox.axis[face];
+    if (dot(incidentBox.center - referenceBox.center, faceNormal) < 0) faceNormal = faceNormal * -1.0f;
+    normal = reference ? faceNormal * -1.0f : faceNormal;
+    Vec3 faceCenter = referenceBox.center + faceNormal * referenceBox.half[face];
+
+    int incidentFace = 0;
+    float mostAligned = -1;
+    for (int k = 0; k < 3; k++)
+    {
+        float aligned = std::fabs(dot(incidentBox.axis[k], faceNormal));
+        if (aligned > mostAligned)
+        {
+            mostAligned = aligned;
+            incidentFace = k;
+        }
+    }
+    float side = dot(incidentBox.axis[incidentFace], faceNormal) > 0 ? -1.0f : 1.0f;
+    Vec3 center = incidentBox.center + incidentBox.axis[incidentFace] * (side * incidentBox.half[incidentFace]);
+    int edge1 = (incidentFace + 1) % 3, edge2 = (incidentFace + 2) % 3;
+    Vec3 extent1 = incidentBox.axis[edge1] * incidentBox.half[edge1];
+    Vec3 extent2 = incidentBox.axis[edge2] * incidentBox.half[edge2];
+    // Each of the 4 clip planes adds at most one corner.
+    Vec3 polygon[8] = { center + extent1 + extent2, center - extent1 + extent2,
+                        center - extent1 - extent2, center + extent1 - extent2 };
+    uint32_t corners = 4;
+    for (int plane = 0; plane < 4; plane++)
+    {
+        int axis = (face + 1 + plane / 2) % 3;
+        Vec3 planeNormal = referenceBox.axis[axis] * (plane % 2 ? -1.0f : 1.0f);
+        float limit = dot(referenceBox.center, planeNormal) + referenceBox.half[axis] + clipTolerance;
+        Vec3 clipped[8];
+        uint32_t clippedCorners = 0;
+        for (uint32_t i = 0; i < corners; i++)
+        {
+            Vec3 from = polygon[i], to = polygon[(i + 1) % corners];
+            float distanceFrom = dot(from, planeNormal) - limit;
+            float distanceTo = dot(to, planeNormal) - limit;
+            if (distanceFrom <= 0) clipped[clippedCorners++] = from;
+            if ((distanceFrom <= 0) != (distanceTo <= 0))
+            {
+                clipped[clippedCorners++] = from + (to - from) * (distanceFrom / (distanceFrom - distanceTo));
+            }
+        }
+        corners = clippedCorners;
+        for (uint32_t i = 0; i < corners; i++) polygon[i] = clipped[i];
+        if (corners == 0) return 0;
+    }
+
+    ContactPoint candidates[8];
+    uint32_t candidateCount = 0;
+    for (uint32_t i = 0; i < corners; i++)
+    {
+        float separation = dot(polygon[i] - faceCenter, faceNormal);
+        if (separation > speculativeDistance) continue;
+        candidates[candidateCount].position = polygon[i] - faceNormal * (separation * 0.5f);
+        candidates[candidateCount].depth = -separation;
+        candidateCount++;
+    }
+    return reduceContacts(candidates, candidateCount, normal, points);
+}
+
+bool tiny_engine::detail::physics::collide(const WorldData& world, uint32_t a, uint32_t b, Manifold& manifold)
+{
+    manifold.a = a;
+    manifold.b = b;
+    ShapeType shapeA = world.shape[a], shapeB = world.shape[b];
+    if (shapeA == ShapeType::Sphere && shapeB == ShapeType::Sphere)
+    {
+        manifold.pointCount = collideSpheres(world.position[a], world.halfExtents[a].x,
+                                             world.position[b], world.halfExtents[b].x,
+                                             manifold.normal, manifold.points);
+    }
+    else if (shapeA == ShapeType::Sphere)
+    {
+        manifold.pointCount = collideSphereBox(world.position[a], world.halfExtents[a].x, orientedBox(world, b),
+                                               manifold.normal, manifold.points);
+    }
+    else if (shapeB == ShapeType::Sphere)
+    {
+        manifold.pointCount = collideSphereBox(world.position[b], world.halfExtents[b].x, orientedBox(world, a),
+                                               manifold.normal, manifold.points);
+        manifold.normal = manifold.normal * -1.0f;
+    }
+    else
+    {
+        manifold.pointCount = collideBoxes(orientedBox(world, a), orientedBox(world, b),
+                                           manifold.normal, manifold.points);
+    }
+    return manifold.pointCount > 0;
+}
+
+void tiny_engine::detail::physics::findContacts(WorldData& world, const BodyPair* pairs, uint32_t pairCount)
+{
+    uint32_t chunkCount = (pairCount + narrowphaseChunkSize - 1) / narrowphaseChunkSize;
+    if (world.chunkManifolds.size() < chunkCount) world.chunkManifolds.resize(chunkCount);
+    if (world.chunkWarmStarted.size() < chunkCount) world.chunkWarmStarted.resize(chunkCount);
+    auto cachedLess = [](const Manifold& manifold, const BodyPair& pair) {
+        return manifold.a < pair.a || (manifold.a == pair.a && manifold.b < pair.b);
+    };
+    parallelFor(chunkCount, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t c = begin; c < end; c++)
+        {
+            auto& out = world.chunkManifolds[c];
+            out.clear();
+            uint32_t warmStarted = 0;
+            uint32_t last = std::min(pairCount, (c + 1) * narrowphaseChunkSize);
+            for (uint32_t i = c * narrowphaseChunkSize; i < last; i++)
+            {
+                uint32_t a = pairs[i].a, b = pairs[i].b;
+                if (world.inverseMass[a] == 0 && world.inverseMass[b] == 0) continue;
+                Manifold manifold;
+                if (!collide(world, a, b, manifold)) continue;
+
+                // The same pair last step: each point takes over the impulses of the nearest old point.
+                auto cached = std::lower_bound(world.cachedManifolds.begin(), world.cachedManifolds.end(),
+                                               pairs[i], cachedLess);
+                bool hasCached = cached != world.cachedManifolds.end() && cached->a == a && cached->b == b;
+                Quat toLocal = conjugate(world.rotation[a]);
+                for (uint32_t p = 0; p < manifold.pointCount; p++)
+                {
+                    ContactPoint& point = manifold.points[p];
+                    point.localA = rotate(toLocal, point.position - world.position[a]);
+                    point.normalImpulse = 0;
+                    point.tangentImpulse[0] = 0;
+                    point.tangentImpulse[1] = 0;
+                    if (!hasCached) continue;
+                    const ContactPoint* match = nullptr;
+                    float nearest = warmStartDistance * warmStartDistance;
+                    for (uint32_t q = 0; q < cached->pointCount; q++)
+                    {
+                        Vec3 offset = cached->points[q].localA - point.localA;
+                        if (dot(offset, offset) <= nearest)
+                        {
+                            nearest = dot(offset, offset);
+                            match = &cached->points[q];
+                        }
+                    }
+                    if (match)
+                    {
+                        point.normalImpulse = match->normalImpulse;
+                        point.tangentImpulse[0] = match->tangentImpulse[0];
+                        point.tangentImpulse[1] = match->tangentImpulse[1];
+                        warmStarted++;
+                    }
+                }
+                out.push_back(manifold);
+            }
+            world.chunkWarmStarted[c] = warmStarted;
+        }
+    });
+
+    // Joined in chunk order, the same for any number of threads.
+    world.manifolds.clear();
+    world.stats.warmStartedContacts = 0;
+    for (uint32_t c = 0; c < chunkCount; c++)
+    {
+        world.manifolds.insert(world.manifolds.end(), world.chunkManifolds[c].begin(), world.chunkManifolds[c].end());
+        world.stats.warmStartedContacts += world.chunkWarmStarted[c];
+    }
+}
+
+void tiny_engine::detail::physics::buildIslands(WorldData& world)
+{
+    uint32_t bodyCount = (uint32_t) world.position.size();
+    uint32_t manifoldCount = (uint32_t) world.manifolds.size();
+    auto& parent = world.parent;
+    parent.resize(bodyCount);
+    for (uint32_t body = 0; body < bodyCount; body++) parent[body] = body;
+    auto find = [&parent](uint32_t body) {
+        while (parent[body] != body)
+        {
+            parent[body] = parent[parent[body]];
+            body = parent[body];
+        }
+        return body;
+    };
+    // The lower root wins, so the islands do not depend on the order of the unions.
+    for (const auto& manifold : world.manifolds)
+    {
+        if (world.inverseMass[manifold.a] == 0 || world.inverseMass[manifold.b] == 0) continue;
+        uint32_t rootA = find(manifold.a), rootB = find(manifold.b);
+        if (rootA < rootB) parent[rootB] = rootA;
+        else if (rootB < rootA) parent[rootA] = rootB;
+    }
+
+    // Islands are numbered in the order of their first manifold.
+    world.islandOf.assign(bodyCount, noIndex);
+    world.islands.clear();
+    world.manifoldIsland.resize(manifoldCount);
+    for (uint32_t m = 0; m < manifoldCount; m++)
+    {
+        const Manifold& manifold = world.manifolds[m];
+        uint32_t root = find(world.inverseMass[manifold.a] > 0 ? manifold.a : manifold.b);
+        if (world.islandOf[root] == noIndex)
+        {
+            world.islandOf[root] = (uint32_t) world.islands.size();
+            world.islands.push_back(Island {});
+        }
+        Island& island = world.islands[world.islandOf[root]];
+        island.manifoldCount++;
+        island.contactCount += manifold.pointCount;
+        world.manifoldIsland[m] = world.islandOf[root];
+    }
+    uint32_t firstManifold = 0, firstContact = 0;
+    for (auto& island : world.islands)
+    {
+        island.firstManifold = firstManifold;
+        island.firstContact = firstContact;
+        firstManifold += island.manifoldCount;
+        firstContact += island.contactCount;
+        island.manifoldCount = 0;
+    }
+    world.islandManifolds.resize(manifoldCount);
+    for (uint32_t m = 0; m < manifoldCount; m++)
+    {
+        Island& island = world.islands[world.manifoldIsland[m]];
+        world.islandManifolds[island.firstManifold + island.manifoldCount++] = m;
+    }
+    world.contacts.resize(firstContact);
+    world.contactColor.resize(firstContact);
+    world.bodyColors.resize(bodyCount);
+}
+
+void tiny_engine::detail::physics::colorIsland(WorldData& world, Island& island)
+{
+    // Greedy: each contact takes the lowest color neither of its moving bodies has yet.
+    // Static bodies are never written by the solver, so any number of contacts of a color may share them.
+    const uint32_t* manifolds = world.islandManifolds.data() + island.firstManifold;
+    for (uint32_t i = 0; i < island.manifoldCount; i++)
+    {
+        const Manifold& manifold = world.manifolds[manifolds[i]];
+        if (world.inverseMass[manifold.a] > 0) world.bodyColors[manifold.a] = 0;
+        if (world.inverseMass[manifold.b] > 0) world.bodyColors[manifold.b] = 0;
+    }
+    uint32_t colorContacts[overflowColor + 1] = {};
+    uint32_t contact = island.firstContact;
+    for (uint32_t i = 0; i < island.manifoldCount; i++)
+    {
+        const Manifold& manifold = world.manifolds[manifolds[i]];
+        bool movesA = world.inverseMass[manifold.a] > 0, movesB = world.inverseMass[manifold.b] > 0;
+        for (uint32_t p = 0; p < manifold.pointCount; p++)
+        {
+            uint64_t used = (movesA ? world.bodyColors[manifold.a] : 0) | (movesB ? world.bodyColors[manifold.b] : 0);
+            uint64_t free = ~used & ((1ull << overflowColor) - 1);
+            uint32_t color = free ? (uint32_t) std::countr_zero(free) : overflowColor;
+            if (color != overflowColor)
+            {
+                if (movesA) world.bodyColors[manifold.a] |= 1ull << color;
+                if (movesB) world.bodyColors[manifold.b] |= 1ull << color;
+            }
+            world.contactColor[contact++] = (uint8_t) color;
+            colorContacts[color]++;
+        }
+    }
+    island.batchCount = colorContacts[overflowColor];
+    island.colorCount = 0;
+    for (uint32_t color = 0; color <= overflowColor; color++)
+    {
+        if (color < overflowColor) island.batchCount += (colorContacts[color] + 3) / 4;
+        if (colorContacts[color] > 0) island.colorCount++;
+    }
+}
+
+void tiny_engine::detail::physics::fillBatch(const WorldData& world, ContactBatch& batch, const uint32_t* contacts,
+                                             uint32_t laneCount, uint32_t color, float deltaTime)
+{
+    memset(&batch, 0, sizeof(batch));
+    batch.color = color;
+    for (uint32_t lane = 0; lane < 4; lane++)
+    {
+        if (lane >= laneCount)
+        {
+            batch.bodyA[lane] = noIndex;
+            batch.bodyB[lane] = noIndex;
+            batch.contact[lane] = noIndex;
+            continue;
+        }
+        uint32_t contact = contacts[lane];
+        const Manifold& manifold = world.manifolds[contact / 4];
+        const ContactPoint& point = manifold.points[contact % 4];
+        uint32_t a = manifold.a, b = manifold.b;
+        batch.bodyA[lane] = a;
+        batch.bodyB[lane] = b;
+        batch.contact[lane] = contact;
+        batch.inverseMassA[lane] = world.inverseMass[a];
+        batch.inverseMassB[lane] = world.inverseMass[b];
+
+        Vec3 normal = manifold.normal;
+        Vec3 tangent = frictionDirection(normal);
+        Vec3 directions[3] = { normal, tangent, cross(normal, tangent) };
+        float impulses[3] = { point.normalImpulse, point.tangentImpulse[0], point.tangentImpulse[1] };
+        Vec3 offsetA = point.position - world.position[a];
+        Vec3 offsetB = point.position - world.position[b];
+        for (int row = 0; row < 3; row++)
+        {
+            Vec3 direction = directions[row];
+            Vec3 angularA = cross(offsetA, direction);
+            Vec3 angularB = cross(offsetB, direction);
+            Vec3 inertiaA = multiply(world.inverseInertiaWorld[a], angularA);
+            Vec3 inertiaB = multiply(world.inverseInertiaWorld[b], angularB);
+            float k = batch.inverseMassA[lane] + batch.inverseMassB[lane] + dot(angularA, inertiaA) +
+                      dot(angularB, inertiaB);
+            batch.mass[row][lane] = k > 0 ? 1.0f / k : 0.0f;
+            batch.impulse[row][lane] = impulses[row];
+            float components[5][3] = {
+                { direction.x, direction.y, direction.z },
+                { angularA.x, angularA.y, angularA.z }, { angularB.x, angularB.y, angularB.z },
+                { inertiaA.x, inertiaA.y, inertiaA.z }, { inertiaB.x, inertiaB.y, inertiaB.z }
+            };
+            for (int c = 0; c < 3; c++)
+            {
+                batch.direction[row][c][lane] = components[0][c];
+                batch.angularA[row][c][lane] = components[1][c];
+                batch.angularB[row][c][lane] = components[2][c];
+                batch.inertiaA[row][c][lane] = components[3][c];
+                batch.inertiaB[row][c][lane] = components[4][c];
+            }
+        }
+
+        // Overlapping bodies are pushed apart by a part of the overlap per step,
+        // bodies with a gap may close it within the step but not more.
+        const PhysicsSettings& settings = world.settings;
+        float depth = point.depth;
+        float target = 0;
+        if (depth > settings.allowedPenetration)
+        {
+            target = settings.penetrationCorrection * (depth - settings.allowedPenetration) / deltaTime;
+        }
+        else if (depth < 0)
+        {
+            target = depth / deltaTime;
+        }
+        Vec3 velocityA = world.linearVelocity[a] + cross(world.angularVelocity[a], offsetA);
+        Vec3 velocityB = world.linearVelocity[b] + cross(world.angularVelocity[b], offsetB);
+        float approach = dot(velocityB - velocityA, normal);
+        float restitution = std::max(world.restitution[a], world.restitution[b]);
+        if (approach < -restitutionVelocity) target = std::max(target, -restitution * approach);
+        batch.velocityTarget[lane] = target;
+        batch.friction[lane] = std::sqrt(world.friction[a] * world.friction[b]);
+    }
+}
+
+void tiny_engine::detail::physics::warmStartBatch(WorldData& world, const ContactBatch& batch)
+{
+    for (uint32_t lane = 0; lane < 4; lane++)
+    {
+        if (batch.contact[lane] == noIndex) continue;
+        Vec3 linear = { 0, 0, 0 }, angularA = { 0, 0, 0 }, angularB = { 0, 0, 0 };
+        for (int row = 0; row < 3; row++)
+        {
+            float impulse = batch.impulse[row][lane];
+            linear = linear + Vec3 { batch.direction[row][0][lane], batch.direction[row][1][lane],
+                                     batch.direction[row][2][lane] } * impulse;
+            angularA = angularA + Vec3 { batch.inertiaA[row][0][lane], batch.inertiaA[row][1][lane],
+                                         batch.inertiaA[row][2][lane] } * impulse;
+            angularB = angularB + Vec3 { batch.inertiaB[row][0][lane], batch.inertiaB[row][1][lane],
+                                         batch.inertiaB[row][2][lane] } * impulse;
+        }
+        uint32_t a = batch.bodyA[lane], b = batch.bodyB[lane];
+        if (batch.inverseMassA[lane] > 0)
+        {
+            world.linearVelocity[a] = world.linearVelocity[a] - linear * batch.inverseMassA[lane];
+            world.angularVelocity[a] = world.angularVelocity[a] - angularA;
+        }
+        if (batch.inverseMassB[lane] > 0)
+        {
+            world.linearVelocity[b] = world.linearVelocity[b] + linear * batch.inverseMassB[lane];
+            world.angularVelocity[b] = world.angularVelocity[b] + angularB;
+        }
+    }
+}
+
+void tiny_engine::detail::physics::prepareIsland(WorldData& world, const Island& island, float deltaTime)
+{
+    // The contacts sorted by color, in manifold order within a color.
+    uint32_t colorStart[overflowColor + 2] = {};
+    const uint8_t* colors = world.contactColor.data() + island.firstContact;
+    for (uint32_t i = 0; i < island.contactCount; i++) colorStart[colors[i] + 1]++;
+    for (uint32_t color = 0; color <= overflowColor; color++) colorStart[color + 1] += colorStart[color];
+    uint32_t next[overflowColor + 1];
+    memcpy(next, colorStart, sizeof(next));
+    uint32_t* sorted = world.contacts.data() + island.firstContact;
+    uint32_t contact = 0;
+    for (uint32_t i = 0; i < island.manifoldCount; i++)
+    {
+        uint32_t m = world.islandManifolds[island.firstManifold + i];
+        for (uint32_t p = 0; p < world.manifolds[m].pointCount; p++) sorted[next[colors[contact++]]++] = m * 4 + p;
+    }
+
+    // 4 contacts of a color per batch, the overflow contacts one per batch.
+    ContactBatch* batch = world.batches.data() + island.firstBatch;
+    for (uint32_t color = 0; color <= overflowColor; color++)
+    {
+        uint32_t perBatch = color == overflowColor ? 1 : 4;
+        for (uint32_t first = colorStart[color]; first < colorStart[color + 1]; first += perBatch)
+        {
+            fillBatch(world, *batch++, sorted + first, std::min(perBatch, colorStart[color + 1] - first),
+                      color, deltaTime);
+        }
+    }
+    for (uint32_t i = 0; i < island.batchCount; i++) warmStartBatch(world, world.batches[island.firstBatch + i]);
+}
+
+void tiny_engine::detail::physics::solveBatch(WorldData& world, ContactBatch& batch)
+{
+    // Velocities per lane: linear a, angular a, linear b, angular b.
+    // Empty lanes read 0, static bodies have no velocity.
+    alignas(16) float velocities[4][3][4];
+    for (uint32_t lane = 0; lane < 4; lane++)
+    {
+        uint32_t a = batch.bodyA[lane], b = batch.bodyB[lane];
+        Vec3 lane4[4] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+        if (a != noIndex)
+        {
+            lane4[0] = world.linearVelocity[a];
+            lane4[1] = world.angularVelocity[a];
+            lane4[2] = world.linearVelocity[b];
+            lane4[3] = world.angularVelocity[b];
+        }
+        for (int v = 0; v < 4; v++)
+        {
+            velocities[v][0][lane] = lane4[v].x;
+            velocities[v][1][lane] = lane4[v].y;
+            velocities[v][2][lane] = lane4[v].z;
+        }
+    }
+    Lanes linearA[3], angularA[3], linearB[3], angularB[3];
+    for (int c = 0; c < 3; c++)
+    {
+        linearA[c] = lanesLoad(velocities[0][c]);
+        angularA[c] = lanesLoad(velocities[1][c]);
+        linearB[c] = lanesLoad(velocities[2][c]);
+        angularB[c] = lanesLoad(velocities[3][c]);
+    }
+    Lanes zero = lanesSet(0);
+    Lanes inverseMassA = lanesLoad(batch.inverseMassA);
+    Lanes inverseMassB = lanesLoad(batch.inverseMassB);
+
+    // Friction first, bounded by the normal impulse so far, then the normal.
+    Lanes maxFriction = lanesMul(lanesLoad(batch.friction), lanesLoad(batch.impulse[0]));
+    Lanes minFriction = lanesSub(zero, maxFriction);
+    static const int rows[3] = { 1, 2, 0 };
+    for (int row : rows)
+    {
+        Lanes direction[3], jacobianA[3], jacobianB[3];
+        Lanes relative = zero;
+        for (int c = 0; c < 3; c++)
+        {
+            direction[c] = lanesLoad(batch.direction[row][c]);
+            jacobianA[c] = lanesLoad(batch.angularA[row][c]);
+            jacobianB[c] = lanesLoad(batch.angularB[row][c]);
+            relative = lanesAdd(relative, lanesMul(direction[c], lanesSub(linearB[c], linearA[c])));
+            relative = lanesAdd(relative, lanesSub(lanesMul(jacobianB[c], angularB[c]),
+                                                   lanesMul(jacobianA[c], angularA[c])));
+        }
+        Lanes mass = lanesLoad(batch.mass[row]);
+        Lanes old = lanesLoad(batch.impulse[row]);
+        Lanes total;
+        if (row == 0)
+        {
+            Lanes target = lanesLoad(batch.velocityTarget);
+            total = lanesMax(lanesAdd(old, lanesMul(mass, lanesSub(target, relative))), zero);
+        }
+        else
+        {
+            total = lanesMin(lanesMax(lanesSub(old, lanesMul(mass, relative)), minFriction), maxFriction);
+        }
+        lanesStore(batch.impulse[row], total);
+        Lanes delta = lanesSub(total, old);
+        Lanes deltaA = lanesMul(delta, inverseMassA);
+        Lanes deltaB = lanesMul(delta, inverseMassB);
+        for (int c = 0; c < 3; c++)
+        {
+            linearA[c] = lanesSub(linearA[c], lanesMul(direction[c], deltaA));
+            linearB[c] = lanesAdd(linearB[c], lanesMul(direction[c], deltaB));
+            angularA[c] = lanesSub(angularA[c], lanesMul(lanesLoad(batch.inertiaA[row][c]), delta));
+            angularB[c] = lanesAdd(angularB[c], lanesMul(lanesLoad(batch.inertiaB[row][c]), delta));
+        }
+    }
+
+    // Back to the moving bodies only, the lanes never share one.
+    for (int c = 0; c < 3; c++)
+    {
+        lanesStore(velocities[0][c], linearA[c]);
+        lanesStore(velocities[1][c], angularA[c]);
+        lanesStore(velocities[2][c], linearB[c]);
+        lanesStore(velocities[3][c], angularB[c]);
+    }
+    for (uint32_t lane = 0; lane < 4; lane++)
+    {
+        if (batch.inverseMassA[lane] > 0)
+        {
+            uint32_t a = batch.bodyA[lane];
+            world.linearVelocity[a] = { velocities[0][0][lane], velocities[0][1][lane], velocities[0][2][lane] };
+            world.angularVelocity[a] = { velocities[1][0][lane], velocities[1][1][lane], velocities[1][2][lane] };
+        }
+        if (batch.inverseMassB[lane] > 0)
+        {
+            uint32_t b = batch.bodyB[lane];
+            world.linearVelocity[b] = { velocities[2][0][lane], velocities[2][1][lane], velocities[2][2][lane] };
+            world.angularVelocity[b] = { velocities[3][0][lane], velocities[3][1][lane], velocities[3][2][lane] };
+        }
+    }
+}
+
+void tiny_engine::detail::physics::solveBatchScalar(WorldData& world, ContactBatch& batch)
+{
+    for (uint32_t lane = 0; lane < 4; lane++)
+    {
+        uint32_t a = batch.bodyA[lane], b = batch.bodyB[lane];
+        if (a == noIndex) continue;
+        float velocities[4][3] = {
+            { world.linearVelocity[a].x, world.linearVelocity[a].y, world.linearVelocity[a].z },
+            { world.angularVelocity[a].x, world.angularVelocity[a].y, world.angularVelocity[a].z },
+            { world.linearVelocity[b].x, world.linearVelocity[b].y, world.linearVelocity[b].z },
+            { world.angularVelocity[b].x, world.angularVelocity[b].y, world.angularVelocity[b].z }
+        };
+        float maxFriction = batch.friction[lane] * batch.impulse[0][lane];
+        float minFriction = 0 - maxFriction;
+        static const int rows[3] = { 1, 2, 0 };
+        for (int row : rows)
+        {
+            float relative = 0;
+            for (int c = 0; c < 3; c++)
+            {
+                relative = relative + batch.direction[row][c][lane] * (velocities[2][c] - velocities[0][c]);
+                relative = relative + (batch.angularB[row][c][lane] * velocities[3][c] -
+                                       batch.angularA[row][c][lane] * velocities[1][c]);
+            }
+            float old = batch.impulse[row][lane];
+            float mass = batch.mass[row][lane];
+            float total;
+            if (row == 0) total = std::max(old + mass * (batch.velocityTarget[lane] - relative), 0.0f);
+            else total = std::min(std::max(old - mass * relative, minFriction), maxFriction);
+            batch.impulse[row][lane] = total;
+            float delta = total - old;
+            float deltaA = delta * batch.inverseMassA[lane];
+            float deltaB = delta * batch.inverseMassB[lane];
+            for (int c = 0; c < 3; c++)
+            {
+                velocities[0][c] = velocities[0][c] - batch.direction[row][c][lane] * deltaA;
+                velocities[2][c] = velocities[2][c] + batch.direction[row][c][lane] * deltaB;
+                velocities[1][c] = velocities[1][c] - batch.inertiaA[row][c][lane] * delta;
+                velocities[3][c] = velocities[3][c] + batch.inertiaB[row][c][lane] * delta;
+            }
+        }
+        if (batch.inverseMassA[lane] > 0)
+        {
+            world.linearVelocity[a] = { velocities[0][0], velocities[0][1], velocities[0][2] };
+            world.angularVelocity[a] = { velocities[1][0], velocities[1][1], velocities[1][2] };
+        }
+        if (batch.inverseMassB[lane] > 0)
+        {
+            world.linearVelocity[b] = { velocities[2][0], velocities[2][1], velocities[2][2] };
+            world.angularVelocity[b] = { velocities[3][0], velocities[3][1], velocities[3][2] };
+        }
+    }
+}
+
+void tiny_engine::detail::physics::solveIslands(WorldData& world, float deltaTime)
+{
+    uint32_t islandCount = (uint32_t) world.islands.size();
+    uint32_t iterations = world.settings.velocityIterations;
+    parallelFor(islandCount, 1, [&world](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) colorIsland(world, world.islands[i]);
+    });
+    uint32_t batchCount = 0;
+    world.stats.colorCount = 0;
+    for (auto& island : world.islands)
+    {
+        island.firstBatch = batchCount;
+        batchCount += island.batchCount;
+        world.stats.colorCount = std::max(world.stats.colorCount, island.colorCount);
+    }
+    world.batches.resize(batchCount);
+    world.stats.batchCount = batchCount;
+
+    // Islands do not share moving bodies, each is solved by one thread from start to end.
+    parallelFor(islandCount, 1, [&world, iterations, deltaTime](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const Island& island = world.islands[i];
+            prepareIsland(world, island, deltaTime);
+            if (island.contactCount > parallelIslandContacts) continue;
+            ContactBatch* batches = world.batches.data() + island.firstBatch;
+            for (uint32_t iteration = 0; iteration < iterations; iteration++)
+            {
+                for (uint32_t b = 0; b < island.batchCount; b++) solveBatch(world, batches[b]);
+            }
+        }
+    });
+    // Big islands, e.g. a pile, go color by color instead:
+    // the batches of a color do not share moving bodies either.
+    for (const auto& island : world.islands)
+    {
+        if (island.contactCount <= parallelIslandContacts) continue;
+        ContactBatch* batches = world.batches.data() + island.firstBatch;
+        for (uint32_t iteration = 0; iteration < iterations; iteration++)
+        {
+            for (uint32_t first = 0; first < island.batchCount; )
+            {
+                uint32_t color = batches[first].color, last = first;
+                while (last < island.batchCount && batches[last].color == color) last++;
+                if (color == overflowColor)
+                {
+                    for (uint32_t b = first; b < last; b++) solveBatch(world, batches[b]);
+                }
+                else
+                {
+                    parallelFor(last - first, 16, [&world, batches, first](uint32_t begin, uint32_t end) {
+                        for (uint32_t b = begin; b < end; b++) solveBatch(world, batches[first + b]);
+                    });
+                }
+                first = last;
+            }
+        }
+    }
+
+    // The impulses go back into the manifolds, to warm start the next step.
+    parallelFor(batchCount, 64, [&world](uint32_t begin, uint32_t end) {
+        for (uint32_t b = begin; b < end; b++)
+        {
+            const ContactBatch& batch = world.batches[b];
+            for (uint32_t lane = 0; lane < 4; lane++)
+            {
+                if (batch.contact[lane] == noIndex) continue;
+                ContactPoint& point = world.manifolds[batch.contact[lane] / 4].points[batch.contact[lane] % 4];
+                point.normalImpulse = batch.impulse[0][lane];
+                point.tangentImpulse[0] = batch.impulse[1][lane];
+                point.tangentImpulse[1] = batch.impulse[2][lane];
+            }
+        }
+    });
+}
+
+tiny_engine::PhysicsWorld tiny_engine::createPhysicsWorld(const PhysicsSettings& settings)
+{
+    auto data = new detail::physics::WorldData();
+    data->settings = settings;
+    data->broadphase = createBroadphase(settings.broadphase);
+    return PhysicsWorld { detail::physics::worldStorage.store(data) };
+}
+
+void tiny_engine::destroyPhysicsWorld(PhysicsWorld world)
+{
+    auto data = detail::physics::worldStorage.release(world.id);
+    if (!data) return;
+    destroyBroadphase(data->broadphase);
+    delete data;
+}
+
+uint32_t tiny_engine::addRigidBody(PhysicsWorld world, const RigidBodyDesc& desc)
+{
+    auto data = detail::physics::worldStorage.get(world.id);
+    if (!data) return detail::physics::noIndex;
+    float mass = desc.mass > 0 ? desc.mass : 0;
+    Vec3 half = desc.halfExtents;
+    Vec3 inertia;
+    if (desc.shape == ShapeType::Sphere)
+    {
+        float sphere = 0.4f * mass * half.x * half.x;
+        inertia = { sphere, sphere, sphere };
+    }
+    else
+    {
+        inertia = { mass / 3 * (half.y * half.y + half.z * half.z),
+                    mass / 3 * (half.x * half.x + half.z * half.z),
+                    mass / 3 * (half.x * half.x + half.y * half.y) };
+    }
+    data->position.push_back(desc.position);
+    data->rotation.push_back(normalize(desc.rotation));
+    data->linearVelocity.push_back(mass > 0 ? desc.linearVelocity : Vec3 { 0, 0, 0 });
+    data->angularVelocity.push_back(mass > 0 ? desc.angularVelocity : Vec3 { 0, 0, 0 });
+    data->shape.push_back(desc.shape);
+    data->halfExtents.push_back(half);
+    data->inverseMass.push_back(mass > 0 ? 1 / mass : 0);
+    data->inverseInertia.push_back(mass > 0 ? Vec3 { 1 / inertia.x, 1 / inertia.y, 1 / inertia.z } : Vec3 { 0, 0, 0 });
+    data->inverseInertiaWorld.push_back(detail::physics::Mat3 {});
+    data->friction.push_back(desc.friction);
+    data->restitution.push_back(desc.restitution);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        data->boxMin[axis].push_back(0);
+        data->boxMax[axis].push_back(0);
+    }
+    return (uint32_t) data->position.size() - 1;
+}
+
+void tiny_engine::stepPhysics(PhysicsWorld world, float deltaTime)
+{
+    TE_PROFILE_SCOPE("stepPhysics");
+    auto data = detail::physics::worldStorage.get(world.id);
+    if (!data || !(deltaTime > 0)) return;
+    auto start = std::chrono::steady_clock::now();
+    auto millisecondsSince = [](std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    };
+    uint32_t count = (uint32_t) data->position.size();
+
+    // Gravity, the inertia in world space and the boxes for the broadphase,
+    // grown by the distance at which contacts start.
+    Vec3 gravity = data->settings.gravity * deltaTime;
+    parallelFor(count, 256, [data, gravity](uint32_t begin, uint32_t end) {
+        for (uint32_t body = begin; body < end; body++)
+        {
+            if (data->inverseMass[body] > 0) data->linearVelocity[body] = data->linearVelocity[body] + gravity;
+            Quat rotation = data->rotation[body];
+            Vec3 axes[3] = { rotate(rotation, Vec3 { 1, 0, 0 }), rotate(rotation, Vec3 { 0, 1, 0 }),
+                             rotate(rotation, Vec3 { 0, 0, 1 }) };
+            float inverse[3] = { data->inverseInertia[body].x, data->inverseInertia[body].y, data->inverseInertia[body].z };
+            float columns[3][3] = { { axes[0].x, axes[0].y, axes[0].z }, { axes[1].x, axes[1].y, axes[1].z },
+                                    { axes[2].x, axes[2].y, axes[2].z } };
+            auto& inertia = data->inverseInertiaWorld[body];
+            for (int row = 0; row < 3; row++)
+            {
+                for (int column = 0; column < 3; column++)
+                {
+                    inertia.m[row][column] = inverse[0] * columns[0][row] * columns[0][column] +
+                                             inverse[1] * columns[1][row] * columns[1][column] +
+                                             inverse[2] * columns[2][row] * columns[2][column];
+                }
+            }
+
+            Vec3 half = data->halfExtents[body];
+            float extent[3];
+            if (data->shape[body] == ShapeType::Sphere)
+            {
+                extent[0] = extent[1] = extent[2] = half.x;
+            }
+            else
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    extent[axis] = std::fabs(columns[0][axis]) * half.x + std::fabs(columns[1][axis]) * half.y +
+                                   std::fabs(columns[2][axis]) * half.z;
+                }
+            }
+            float center[3] = { data->position[body].x, data->position[body].y, data->position[body].z };
+            for (int axis = 0; axis < 3; axis++)
+            {
+                data->boxMin[axis][body] = center[axis] - extent[axis] - detail::physics::speculativeDistance;
+                data->boxMax[axis][body] = center[axis] + extent[axis] + detail::physics::speculativeDistance;
+            }
+        }
+    });
+
+    auto phase = std::chrono::steady_clock::now();
+    AabbArrays boxes = { data->boxMin[0].data(), data->boxMin[1].data(), data->boxMin[2].data(),
+                         data->boxMax[0].data(), data->boxMax[1].data(), data->boxMax[2].data() };
+    uint32_t pairCount = updateBroadphase(data->broadphase, boxes, count);
+    data->stats.broadphaseMilliseconds = millisecondsSince(phase);
+
+    phase = std::chrono::steady_clock::now();
+    detail::physics::findContacts(*data, getBroadphasePairs(data->broadphase), pairCount);
+    data->stats.narrowphaseMilliseconds = millisecondsSince(phase);
+
+    phase = std::chrono::steady_clock::now();
+    detail::physics::buildIslands(*data);
+    detail::physics::solveIslands(*data, deltaTime);
+    data->stats.solverMilliseconds = millisecondsSince(phase);
+
+    parallelFor(count, 256, [data, deltaTime](uint32_t begin, uint32_t end) {
+        for (uint32_t body = begin; body < end; body++)
+        {
+            if (data->inverseMass[body] == 0) continue;
+            data->position[body] = data->position[body] + data->linearVelocity[body] * deltaTime;
+            Vec3 spin = data->angularVelocity[body] * (0.5f * deltaTime);
+            Quat q = data->rotation[body];
+            Quat turn = Quat { spin.x, spin.y, spin.z, 0 } * q;
+            data->rotation[body] = normalize(Quat { q.x + turn.x, q.y + turn.y, q.z + turn.z, q.w + turn.w });
+        }
+    });
+
+    // This step's manifolds become the cache of the next one.
+    std::swap(data->manifolds, data->cachedManifolds);
+    std::sort(data->cachedManifolds.begin(), data->cachedManifolds.end(),
+              [](const detail::physics::Manifold& x, const detail::physics::Manifold& y) {
+                  return x.a < y.a || (x.a == y.a && x.b < y.b);
+              });
+
+    data->stats.bodyCount = count;
+    data->stats.manifoldCount = (uint32_t) data->cachedManifolds.size();
+    data->stats.contactCount = (uint32_t) data->contacts.size();
+    data->stats.islandCount = (uint32_t) data->islands.size();
+    data->stats.stepMilliseconds = millisecondsSince(start);
+}
+
+uint32_t tiny_engine::getRigidBodyCount(PhysicsWorld world)
+{
+    auto data = detail::physics::worldStorage.get(world.id);
+    return data ? (uint32_t) data->position.size() : 0;
+}
+
+const tiny_engine::Vec3* tiny_engine::getRigidBodyPositions(PhysicsWorld world)
+{
+    auto data = detail::physics::worldStorage.get(world.id);
+    return data ? data->position.data() : nullptr;
+}
+
+const tiny_engine::Quat* tiny_engine::getRigidBodyRotations(PhysicsWorld world)
+{
+    auto data = detail::physics::worldStorage.get(world.id);
+    return data ? data->rotation.data() : nullptr;
+}
+
+void tiny_engine::setRigidBodyTransform(PhysicsWorld world, uint32_t body, Vec3 position, Quat rotation)
+{
+    auto data = detail::physics::worldStorage.get(world.id);
+    if (!data || body >= data->position.size()) return;
+    data->position[body] = position;
+    data->rotation[body] = normalize(rotation);
+}
+
+void tiny_engine::setRigidBodyVelocity(PhysicsWorld world, uint32_t body, Vec3 linear, Vec3 angular)
+{
+    auto data = detail::physics::worldStorage.get(world.id);
+    if (!data || body >= data->position.size() || data->inverseMass[body] == 0) return;
+    data->linearVelocity[body] = linear;
+    data->angularVelocity[body] = angular;
+}
+
+tiny_engine::PhysicsStats tiny_engine::getPhysicsStats(PhysicsWorld world)
+{
+    auto data = detail::physics::worldStorage.get(world.id);
+    return data ? data->stats : PhysicsStats {};
+}
+
+// ----------------------------------------------------------------------------
+// Scene queries
+//
+
+static tiny_engine::Aabb combineBoxes(const tiny_engine::Aabb& a, const tiny_engine::Aabb& b)
+{
+    return { { std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z) },
+             { std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z) } };
+}
+
+static tiny_engine::Aabb growBox(const tiny_engine::Aabb& box, float margin)
+{
+    return { { box.min.x - margin, box.min.y - margin, box.min.z - margin },
+             { box.max.x + margin, box.max.y + margin, box.max.z + margin } };
+}
+
+static bool boxContains(const tiny_engine::Aabb& outer, const tiny_engine::Aabb& inner)
+{
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+           outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+static float surfaceArea(const tiny_engine::Aabb& box)
+{
+    float x = box.max.x - box.min.x, y = box.max.y - box.min.y, z = box.max.z - box.min.z;
+    return 2 * (x * y + y * z + z * x);
+}
+
+uint32_t tiny_engine::detail::physics::allocateSceneNode(SceneTreeData& tree)
+{
+    if (!tree.freeNodes.empty())
+    {
+        uint32_t node = tree.freeNodes.back();
+        tree.freeNodes.pop_back();
+        return node;
+    }
+    tree.nodes.push_back({});
+    tree.nodeMark.push_back(0);
+    return (uint32_t) tree.nodes.size() - 1;
+}
+
+void tiny_engine::detail::physics::refitSceneNode(SceneTreeData& tree, uint32_t node)
+{
+    SceneNode& inner = tree.nodes[node];
+    const SceneNode& first = tree.nodes[inner.children[0]];
+    const SceneNode& second = tree.nodes[inner.children[1]];
+    inner.box = combineBoxes(first.box, second.box);
+    inner.height = 1 + std::max(first.height, second.height);
+}
+
+bool tiny_engine::detail::physics::rotateSceneNode(SceneTreeData& tree, uint32_t node)
+{
+    SceneNode& inner = tree.nodes[node];
+    if (inner.children[0] == noIndex) return false;
+    // Child side goes down into the other child and takes the place of its grandchild,
+    // which comes up. That only changes the box of the other child.
+    float bestGain = 0;
+    int bestSide = -1, bestGrandchild = 0;
+    for (int side = 0; side < 2; side++)
+    {
+        const SceneNode& other = tree.nodes[inner.children[1 - side]];
+        if (other.children[0] == noIndex) continue;
+        const Aabb& down = tree.nodes[inner.children[side]].box;
+        float area = surfaceArea(other.box);
+        for (int grandchild = 0; grandchild < 2; grandchild++)
+        {
+            const Aabb& stays = tree.nodes[other.children[1 - grandchild]].box;
+            float gain = area - surfaceArea(combineBoxes(down, stays));
+            if (gain > bestGain)
+            {
+                bestGain = gain;
+                bestSide = side;
+                bestGrandchild = grandchild;
+            }
+        }
+    }
+    if (bestSide < 0) return false;
+    uint32_t down = inner.children[bestSide];
+    uint32_t other = inner.children[1 - bestSide];
+    uint32_t up = tree.nodes[other].children[bestGrandchild];
+    inner.children[bestSide] = up;
+    tree.nodes[up].parent = node;
+    tree.nodes[other].children[bestGrandchild] = down;
+    tree.nodes[down].parent = other;
+    refitSceneNode(tree, other);
+    refitSceneNode(tree, node);
+    return true;
+}
+
+void tiny_engine::detail::physics::refitSceneAncestors(SceneTreeData& tree, uint32_t node)
+{
+    for (; node != noIndex; node = tree.nodes[node].parent)
+    {
+        refitSceneNode(tree, node);
+        rotateSceneNode(tree, node);
+    }
+}
+
+void tiny_engine::detail::physics::insertSceneLeaf(SceneTreeData& tree, uint32_t leaf)
+{
+    if (tree.root == noIndex)
+    {
+        tree.root = leaf;
+        tree.nodes[leaf].parent = noIndex;
+        return;
+    }
+    // The sibling which grows the tree least (surface area heuristic), found by branch and bound:
+    // pairing with a node grows it and all above it, nothing below a node can cost less than
+    // that growth above it plus the area of the leaf itself.
+    Aabb box = tree.nodes[leaf].box;
+    float leafArea = surfaceArea(box);
+    uint32_t sibling = tree.root;
+    float bestCost = surfaceArea(combineBoxes(tree.nodes[tree.root].box, box));
+    auto later = [](const SiblingCandidate& a, const SiblingCandidate& b) { return a.bound > b.bound; };
+    auto& candidates = tree.siblingCandidates;
+    candidates.clear();
+    if (tree.nodes[tree.root].children[0] != noIndex)
+    {
+        float inheritedCost = bestCost - surfaceArea(tree.nodes[tree.root].box);
+        candidates.push_back(SiblingCandidate { inheritedCost + leafArea, inheritedCost, tree.root });
+    }
+    while (!candidates.empty())
+    {
+        std::pop_heap(candidates.begin(), candidates.end(), later);
+        SiblingCandidate candidate = candidates.back();
+        candidates.pop_back();
+        if (candidate.bound >= bestCost) break;
+        const SceneNode& node = tree.nodes[candidate.node];
+        for (int i = 0; i < 2; i++)
+        {
+            const SceneNode& child = tree.nodes[node.children[i]];
+            float combinedArea = surfaceArea(combineBoxes(child.box, box));
+            if (combinedArea + candidate.inheritedCost < bestCost)
+            {
+                bestCost = combinedArea + candidate.inheritedCost;
+                sibling = node.children[i];
+            }
+            if (child.children[0] == noIndex) continue;
+            float inheritedCost = candidate.inheritedCost + combinedArea - surfaceArea(child.box);
+            if (inheritedCost + leafArea >= bestCost) continue;
+            candidates.push_back(SiblingCandidate { inheritedCost + leafArea, inheritedCost, node.children[i] });
+            std::push_heap(candidates.begin(), candidates.end(), later);
+        }
+    }
+
+    uint32_t oldParent = tree.nodes[sibling].parent;
+    uint32_t parent = allocateSceneNode(tree);
+    SceneNode& inner = tree.nodes[parent];
+    inner.parent = oldParent;
+    inner.children[0] = sibling;
+    inner.children[1] = leaf;
+    inner.object = noSceneObject;
+    tree.nodes[sibling].parent = parent;
+    tree.nodes[leaf].parent = parent;
+    if (oldParent == noIndex) tree.root = parent;
+    else
+    {
+        SceneNode& above = tree.nodes[oldParent];
+        above.children[above.children[0] == sibling ? 0 : 1] = parent;
+    }
+    refitSceneAncestors(tree, parent);
+}
+
+void tiny_engine::detail::physics::removeSceneLeaf(SceneTreeData& tree, uint32_t leaf)
+{
+    if (leaf == tree.root)
+    {
+        tree.root = noIndex;
+        return;
+    }
+    // The sibling takes the place of the parent.
+    uint32_t parent = tree.nodes[leaf].parent;
+    const SceneNode& inner = tree.nodes[parent];
+    uint32_t sibling = inner.children[inner.children[0] == leaf ? 1 : 0];
+    uint32_t grandparent = inner.parent;
+    tree.freeNodes.push_back(parent);
+    tree.nodes[sibling].parent = grandparent;
+    if (grandparent == noIndex)
+    {
+        tree.root = sibling;
+        return;
+    }
+    SceneNode& above = tree.nodes[grandparent];
+    above.children[above.children[0] == parent ? 0 : 1] = sibling;
+    refitSceneAncestors(tree, grandparent);
+}
+
+// 4 casts in lanes, sweeps carry the half size of their box in extent.
+struct ScenePacket
+{
+    Lanes origin[3];
+    Lanes inverseDirection[3];
+    Lanes extent[3];
+};
+
+// Slab test of the packet against a box grown by the extents, for distances [0, best].
+// Returns the mask of the lanes which hit it and where they enter it.
+static inline int castPacketBox(const ScenePacket& packet, const tiny_engine::Aabb& box, Lanes best, Lanes& enter)
+{
+    const float boxMin[3] = { box.min.x, box.min.y, box.min.z };
+    const float boxMax[3] = { box.max.x, box.max.y, box.max.z };
+    enter = lanesSet(0);
+    Lanes leave = best;
+    for (int c = 0; c < 3; c++)
+    {
+        Lanes low = lanesMul(lanesSub(lanesSub(lanesSet(boxMin[c]), packet.extent[c]), packet.origin[c]),
+                             packet.inverseDirection[c]);
+        Lanes high = lanesMul(lanesSub(lanesAdd(lanesSet(boxMax[c]), packet.extent[c]), packet.origin[c]),
+                              packet.inverseDirection[c]);
+        enter = lanesMax(enter, lanesMin(low, high));
+        leave = lanesMin(leave, lanesMax(low, high));
+    }
+    return lanesMaskLessEqual(enter, leave);
+}
+
+void tiny_engine::detail::physics::castScenePacket(const SceneTreeData& tree, const Vec3* centers, const Vec3* extents,
+                                                   const Vec3* directions, const float* maxDistances, uint32_t laneCount,
+                                                   SceneHit* hits, std::vector<uint32_t>& stack)
+{
+    alignas(16) float lanes[3][3][4];
+    alignas(16) float best[4];
+    uint32_t object[4] = { noSceneObject, noSceneObject, noSceneObject, noSceneObject };
+    Vec3 packetDirection = { 0, 0, 0 };
+    for (uint32_t lane = 0; lane < 4; lane++)
+    {
+        bool used = lane < laneCount;
+        Vec3 center = used ? centers[lane] : Vec3 { 0, 0, 0 };
+        Vec3 extent = used ? extents[lane] : Vec3 { 0, 0, 0 };
+        Vec3 direction = used ? directions[lane] : Vec3 { 1, 1, 1 };
+        const float c[3] = { center.x, center.y, center.z };
+        const float e[3] = { extent.x, extent.y, extent.z };
+        const float d[3] = { direction.x, direction.y, direction.z };
+        for (int axis = 0; axis < 3; axis++)
+        {
+            // Tiny instead of 0, so the slab distances stay finite instead of 0 * infinity.
+            float component = std::fabs(d[axis]) < 1e-20f ? (d[axis] < 0 ? -1e-20f : 1e-20f) : d[axis];
+            lanes[0][axis][lane] = c[axis];
+            lanes[1][axis][lane] = 1 / component;
+            lanes[2][axis][lane] = e[axis];
+        }
+        // Empty lanes end before they start and never hit anything.
+        best[lane] = used ? maxDistances[lane] : -1;
+        packetDirection = packetDirection + direction;
+    }
+    ScenePacket packet;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        packet.origin[axis] = lanesLoad(lanes[0][axis]);
+        packet.inverseDirection[axis] = lanesLoad(lanes[1][axis]);
+        packet.extent[axis] = lanesLoad(lanes[2][axis]);
+    }
+
+    stack.clear();
+    if (tree.root != noIndex) stack.push_back(tree.root);
+    while (!stack.empty())
+    {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        const SceneNode& node = tree.nodes[index];
+        Lanes enter;
+        if (node.children[0] == noIndex)
+        {
+            int mask = castPacketBox(packet, tree.objectBox[node.object], lanesLoad(best), enter);
+            if (mask == 0) continue;
+            alignas(16) float distance[4];
+            lanesStore(distance, enter);
+            for (int lane = 0; mask != 0; lane++, mask >>= 1)
+            {
+                // Equally close objects go to the lower id, whatever the order of the tree.
+                if ((mask & 1) && (distance[lane] < best[lane] ||
+                                   (distance[lane] == best[lane] && node.object < object[lane])))
+                {
+                    best[lane] = distance[lane];
+                    object[lane] = node.object;
+                }
+            }
+            continue;
+        }
+        if (castPacketBox(packet, node.box, lanesLoad(best), enter) == 0) continue;
+        // The child further along the casts goes first onto the stack, so the nearer is searched first
+        // and the hits found there cut off more of the rest.
+        const Aabb& first = tree.nodes[node.children[0]].box;
+        const Aabb& second = tree.nodes[node.children[1]].box;
+        Vec3 between = (second.min + second.max) - (first.min + first.max);
+        bool secondNearer = dot(between, packetDirection) < 0;
+        stack.push_back(node.children[secondNearer ? 0 : 1]);
+        stack.push_back(node.children[secondNearer ? 1 : 0]);
+    }
+
+    for (uint32_t lane = 0; lane < laneCount; lane++)
+    {
+        hits[lane].object = object[lane];
+        hits[lane].distance = best[lane];
+    }
+}
+
+void tiny_engine::detail::physics::overlapScenePacket(const SceneTreeData& tree, const Aabb* boxes, uint32_t firstQuery,
+                                                      uint32_t laneCount, std::vector<SceneOverlap>& out,
+                                                      std::vector<uint32_t>& stack)
+{
+    // Empty lanes are inside out boxes which overlap nothing.
+    alignas(16) float bounds[2][3][4];
+    for (uint32_t lane = 0; lane < 4; lane++)
+    {
+        Aabb box = lane < laneCount ? boxes[lane] : Aabb { { INFINITY, INFINITY, INFINITY },
+                                                           { -INFINITY, -INFINITY, -INFINITY } };
+        bounds[0][0][lane] = box.min.x;
+        bounds[0][1][lane] = box.min.y;
+        bounds[0][2][lane] = box.min.z;
+        bounds[1][0][lane] = box.max.x;
+        bounds[1][1][lane] = box.max.y;
+        bounds[1][2][lane] = box.max.z;
+    }
+    Lanes queryMin[3], queryMax[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        queryMin[axis] = lanesLoad(bounds[0][axis]);
+        queryMax[axis] = lanesLoad(bounds[1][axis]);
+    }
+    auto overlapMask = [&queryMin, &queryMax](const Aabb& box) {
+        return lanesMaskLessEqual(queryMin[0], lanesSet(box.max.x)) & lanesMaskLessEqual(lanesSet(box.min.x), queryMax[0]) &
+               lanesMaskLessEqual(queryMin[1], lanesSet(box.max.y)) & lanesMaskLessEqual(lanesSet(box.min.y), queryMax[1]) &
+               lanesMaskLessEqual(queryMin[2], lanesSet(box.max.z)) & lanesMaskLessEqual(lanesSet(box.min.z), queryMax[2]);
+    };
+
+    stack.clear();
+    if (tree.root != noIndex) stack.push_back(tree.root);
+    while (!stack.empty())
+    {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        const SceneNode& node = tree.nodes[index];
+        if (node.children[0] == noIndex)
+        {
+            int mask = overlapMask(tree.objectBox[node.object]);
+            for (uint32_t lane = 0; mask != 0; lane++, mask >>= 1)
+            {
+                if (mask & 1) out.push_back(SceneOverlap { firstQuery + lane, node.object });
+            }
+            continue;
+        }
+        if (overlapMask(node.box) == 0) continue;
+        stack.push_back(node.children[1]);
+        stack.push_back(node.children[0]);
+    }
+}
+
+tiny_engine::SceneTree tiny_engine::createSceneTree(const SceneTreeSettings& settings)
+{
+    auto data = new detail::physics::SceneTreeData();
+    data->settings = settings;
+    return SceneTree { detail::physics::sceneTreeStorage.store(data) };
+}
+
+void tiny_engine::destroySceneTree(SceneTree tree)
+{
+    delete detail::physics::sceneTreeStorage.release(tree.id);
+}
+
+uint32_t tiny_engine::addSceneObject(SceneTree tree, const Aabb& box)
+{
+    using namespace detail::physics;
+    auto data = sceneTreeStorage.get(tree.id);
+    if (!data) return noSceneObject;
+    uint32_t object;
+    if (!data->freeObjects.empty())
+    {
+        object = data->freeObjects.back();
+        data->freeObjects.pop_back();
+    }
+    else
+    {
+        object = (uint32_t) data->objectBox.size();
+        data->objectBox.push_back({});
+        data->objectNode.push_back(noIndex);
+        data->objectMoved.push_back(0);
+    }
+    uint32_t leaf = allocateSceneNode(*data);
+    SceneNode& node = data->nodes[leaf];
+    node.box = growBox(box, data->settings.margin);
+    node.children[0] = noIndex;
+    node.children[1] = noIndex;
+    node.object = object;
+    node.height = 0;
+    data->objectBox[object] = box;
+    data->objectNode[object] = leaf;
+    insertSceneLeaf(*data, leaf);
+    data->objectCount++;
+    return object;
+}
+
+void tiny_engine::removeSceneObject(SceneTree tree, uint32_t object)
+{
+    using namespace detail::physics;
+    auto data = sceneTreeStorage.get(tree.id);
+    if (!data || object >= data->objectNode.size() || data->objectNode[object] == noIndex) return;
+    uint32_t leaf = data->objectNode[object];
+    removeSceneLeaf(*data, leaf);
+    data->freeNodes.push_back(leaf);
+    data->objectNode[object] = noIndex;
+    data->freeObjects.push_back(object);
+    data->objectCount--;
+}
+
+void tiny_engine::moveSceneObject(SceneTree tree, uint32_t object, const Aabb& box)
+{
+    using namespace detail::physics;
+    auto data = sceneTreeStorage.get(tree.id);
+    if (!data || object >= data->objectNode.size() || data->objectNode[object] == noIndex) return;
+    data->objectBox[object] = box;
+    if (data->objectMoved[object]) return;
+    data->objectMoved[object] = 1;
+    data->movedObjects.push_back(object);
+}
+
+void tiny_engine::updateSceneTree(SceneTree tree)
+{
+    TE_PROFILE_SCOPE("updateSceneTree");
+    using namespace detail::physics;
+    auto data = sceneTreeStorage.get(tree.id);
+    if (!data) return;
+    auto start = std::chrono::steady_clock::now();
+    uint32_t mark = ++data->updateCount;
+    uint32_t moved = 0;
+    data->refitNodes.clear();
+    for (uint32_t object : data->movedObjects)
+    {
+        data->objectMoved[object] = 0;
+        uint32_t leaf = data->objectNode[object];
+        // Removed since, or still inside its grown box.
+        if (leaf == noIndex || boxContains(data->nodes[leaf].box, data->objectBox[object])) continue;
+        moved++;
+        data->nodes[leaf].box = growBox(data->objectBox[object], data->settings.margin);
+        for (uint32_t node = data->nodes[leaf].parent; node != noIndex && data->nodeMark[node] != mark;
+             node = data->nodes[node].parent)
+        {
+            data->nodeMark[node] = mark;
+            data->refitNodes.push_back(node);
+            uint32_t height = data->nodes[node].height;
+            if (data->heightStart.size() <= height + 1) data->heightStart.resize(height + 2, 0);
+            data->heightStart[height + 1]++;
+        }
+    }
+    data->movedObjects.clear();
+
+    // Every node is higher than the nodes below it, so in order of height children are refit
+    // before their parents. Rotations only rearrange the nodes below, which are done by then.
+    auto& first = data->heightStart;
+    for (size_t height = 1; height < first.size(); height++) first[height] += first[height - 1];
+    data->refitOrder.resize(data->refitNodes.size());
+    for (uint32_t node : data->refitNodes) data->refitOrder[first[data->nodes[node].height]++] = node;
+    std::fill(first.begin(), first.end(), 0);
+    uint32_t rotations = 0;
+    for (uint32_t node : data->refitOrder)
+    {
+        refitSceneNode(*data, node);
+        if (rotateSceneNode(*data, node)) rotations++;
+    }
+    data->stats.movedObjects = moved;
+    data->stats.refitNodes = (uint32_t) data->refitNodes.size();
+    data->stats.rotations = rotations;
+    data->stats.milliseconds = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+void tiny_engine::raycastScene(SceneTree tree, const Ray* rays, SceneHit* hits, uint32_t count)
+{
+    TE_PROFILE_SCOPE("raycastScene");
+    using namespace detail::physics;
+    auto data = sceneTreeStorage.get(tree.id);
+    if (!data) return;
+    uint32_t chunkCount = (count + sceneQueryChunkSize - 1) / sceneQueryChunkSize;
+    parallelFor(chunkCount, 1, [data, rays, hits, count](uint32_t begin, uint32_t end) {
+        thread_local std::vector<uint32_t> stack;
+        Vec3 origins[4], extents[4] = {}, directions[4];
+        float maxDistances[4];
+        for (uint32_t first = begin * sceneQueryChunkSize; first < std::min(count, end * sceneQueryChunkSize); first += 4)
+        {
+            uint32_t laneCount = std::min(4u, count - first);
+            for (uint32_t lane = 0; lane < laneCount; lane++)
+            {
+                origins[lane] = rays[first + lane].origin;
+                directions[lane] = rays[first + lane].direction;
+                maxDistances[lane] = rays[first + lane].maxDistance;
+            }
+            castScenePacket(*data, origins, extents, directions, maxDistances, laneCount, hits + first, stack);
+        }
+    });
+}
+
+void tiny_engine::sweepScene(SceneTree tree, const BoxSweep* sweeps, SceneHit* hits, uint32_t count)
+{
+    TE_PROFILE_SCOPE("sweepScene");
+    using namespace detail::physics;
+    auto data = sceneTreeStorage.get(tree.id);
+    if (!data) return;
+    uint32_t chunkCount = (count + sceneQueryChunkSize - 1) / sceneQueryChunkSize;
+    parallelFor(chunkCount, 1, [data, sweeps, hits, count](uint32_t begin, uint32_t end) {
+        thread_local std::vector<uint32_t> stack;
+        Vec3 centers[4], extents[4], directions[4];
+        const float maxDistances[4] = { 1, 1, 1, 1 };
+        for (uint32_t first = begin * sceneQueryChunkSize; first < std::min(count, end * sceneQueryChunkSize); first += 4)
+        {
+            uint32_t laneCount = std::min(4u, count - first);
+            for (uint32_t lane = 0; lane < laneCount; lane++)
+            {
+                // The box against every object is its center against the object grown by its half size.
+                const Aabb& box = sweeps[first + lane].box;
+                centers[lane] = (box.min + box.max) * 0.5f;
+                extents[lane] = (box.max - box.min) * 0.5f;
+                directions[lane] = sweeps[first + lane].translation;
+            }
+            castScenePacket(*data, centers, extents, directions, maxDistances, laneCount, hits + first, stack);
+        }
+    });
+}
+
+uint32_t tiny_engine::overlapScene(SceneTree tree, const Aabb* boxes, uint32_t count,
+                                   SceneOverlap* overlaps, uint32_t maxOverlaps)
+{
+    TE_PROFILE_SCOPE("overlapScene");
+    using namespace detail::physics;
+    auto data = sceneTreeStorage.get(tree.id);
+    if (!data) return 0;
+    uint32_t chunkCount = (count + sceneQueryChunkSize - 1) / sceneQueryChunkSize;
+    if (data->chunkOverlaps.size() < chunkCount) data->chunkOverlaps.resize(chunkCount);
+    parallelFor(chunkCount, 1, [data, boxes, count](uint32_t begin, uint32_t end) {
+        thread_local std::vector<uint32_t> stack;
+        for (uint32_t c = begin; c < end; c++)
+        {
+            auto& out = data->chunkOverlaps[c];
+            out.clear();
+            uint32_t last = std::min(count, (c + 1) * sceneQueryChunkSize);
+            for (uint32_t first = c * sceneQueryChunkSize; first < last; first += 4)
+            {
+                overlapScenePacket(*data, boxes + first, first, std::min(4u, last - first), out, stack);
+            }
+            std::sort(out.begin(), out.end(), [](const SceneOverlap& a, const SceneOverlap& b) {
+                return a.query != b.query ? a.query < b.query : a.object < b.object;
+            });
+        }
+    });
+    // Joined in chunk order, so the result does not depend on which thread ran which chunk.
+    uint32_t total = 0;
+    for (uint32_t c = 0; c < chunkCount; c++)
+    {
+        const auto& chunk = data->chunkOverlaps[c];
+        uint32_t fits = total < maxOverlaps ? std::min((uint32_t) chunk.size(), maxOverlaps - total) : 0;
+        if (fits > 0) memcpy(overlaps + total, chunk.data(), fits * sizeof(SceneOverlap));
+        total += (uint32_t) chunk.size();
+    }
+    return total;
+}
+
+tiny_engine::SceneTreeStats tiny_engine::getSceneTreeStats(SceneTree tree)
+{
+    using namespace detail::physics;
+    auto data = sceneTreeStorage.get(tree.id);
+    if (!data) return SceneTreeStats {};
+    SceneTreeStats stats = data->stats;
+    stats.objectCount = data->objectCount;
+    stats.nodeCount = (uint32_t) (data->nodes.size() - data->freeNodes.size());
+    stats.height = data->root != noIndex ? data->nodes[data->root].height : 0;
+    stats.cost = 0;
+    if (data->root != noIndex && data->nodes[data->root].children[0] != noIndex)
+    {
+        float innerArea = 0;
+        std::vector<uint32_t> stack = { data->root };
+        while (!stack.empty())
+        {
+            const SceneNode& node = data->nodes[stack.back()];
+            stack.pop_back();
+            if (node.children[0] == noIndex) continue;
+            innerArea += surfaceArea(node.box);
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+        stats.cost = innerArea / surfaceArea(data->nodes[data->root].box);
+    }
+    return stats;
+}
+
+#endif
+
+#ifdef TE_GAMEPLAY
+// ----------------------------------------------------------------------------
+// Gameplay
+//
+
+static uint8_t* allocateChunk(tiny_engine::detail::gameplay::GameWorldData& world, uint32_t size)
+{
+    if (size == tiny_engine::detail::gameplay::chunkBytes && !world.spareChunks.empty())
+    {
+        uint8_t* memory = world.spareChunks.back();
+        world.spareChunks.pop_back();
+        return memory;
+    }
+    return static_cast<uint8_t*>(operator new(size, std::align_val_t(64)));
+}
+
+// Chunks of the usual size are kept for the next archetype which needs one.
+static void freeChunk(tiny_engine::detail::gameplay::GameWorldData& world, uint8_t* memory, uint32_t size)
+{
+    if (size == tiny_engine::detail::gameplay::chunkBytes) world.spareChunks.push_back(memory);
+    else operator delete(memory, std::align_val_t(64));
+}
+
+uint32_t tiny_engine::detail::gameplay::findArchetype(GameWorldData& world, ComponentMask components)
+{
+    auto found = world.archetypeOf.find(components);
+    if (found != world.archetypeOf.end()) return found->second;
+
+    auto archetype = std::make_unique<Archetype>();
+    archetype->components = components;
+    // The entities, then the arrays in the order of the component ids, each padded to columnAlignment.
+    uint32_t bytesPerEntity = sizeof(Entity);
+    uint32_t padding = 0;
+    for (ComponentMask rest = components; rest != 0; rest &= rest - 1)
+    {
+        bytesPerEntity += world.components[std::countr_zero(rest)].size;
+        padding += columnAlignment;
+    }
+    archetype->capacity = chunkBytes > padding + bytesPerEntity ? (chunkBytes - padding) / bytesPerEntity : 1;
+    archetype->chunkSize = std::max(chunkBytes, padding + bytesPerEntity);
+    for (uint32_t& offset : archetype->columnOffsets) offset = noColumn;
+    uint32_t offset = archetype->capacity * (uint32_t) sizeof(Entity);
+    for (ComponentMask rest = components; rest != 0; rest &= rest - 1)
+    {
+        ComponentId component = std::countr_zero(rest);
+        offset = (offset + columnAlignment - 1) & ~(columnAlignment - 1);
+        archetype->columnOffsets[component] = offset;
+        offset += archetype->capacity * world.components[component].size;
+    }
+
+    uint32_t index = (uint32_t) world.archetypes.size();
+    world.archetypes.push_back(std::move(archetype));
+    world.archetypeOf[components] = index;
+    for (QueryData& query : world.queries)
+    {
+        if ((components & query.required) == query.required && (components & query.exclude) == 0)
+        {
+            query.archetypes.push_back(index);
+        }
+    }
+    return index;
+}
+
+tiny_engine::Entity tiny_engine::detail::gameplay::reserveEntity(GameWorldData& world)
+{
+    std::lock_guard<std::mutex> lock(world.entityMutex);
+    if (!world.freeEntities.empty())
+    {
+        uint32_t index = world.freeEntities.back();
+        world.freeEntities.pop_back();
+        return Entity { index, world.entities[index].generation };
+    }
+    return Entity { world.nextEntity++, 0 };
+}
+
+void tiny_engine::detail::gameplay::placeEntity(GameWorldData& world, uint32_t index, uint32_t archetypeIndex)
+{
+    Archetype& archetype = *world.archetypes[archetypeIndex];
+    if (archetype.chunks.empty() || archetype.chunks.back().count == archetype.capacity)
+    {
+        archetype.chunks.push_back(Chunk { allocateChunk(world, archetype.chunkSize), 0 });
+    }
+    Chunk& chunk = archetype.chunks.back();
+    uint32_t row = chunk.count++;
+    EntitySlot& slot = world.entities[index];
+    reinterpret_cast<Entity*>(chunk.memory)[row] = Entity { index, slot.generation };
+    for (ComponentMask rest = archetype.components; rest != 0; rest &= rest - 1)
+    {
+        ComponentId component = std::countr_zero(rest);
+        uint32_t size = world.components[component].size;
+        memset(chunk.memory + archetype.columnOffsets[component] + row * size, 0, size);
+    }
+    archetype.entityCount++;
+    slot.archetype = archetypeIndex;
+    slot.chunk = (uint32_t) archetype.chunks.size() - 1;
+    slot.row = row;
+}
+
+void tiny_engine::detail::gameplay::unplaceEntity(GameWorldData& world, uint32_t index)
+{
+    EntitySlot& slot = world.entities[index];
+    Archetype& archetype = *world.archetypes[slot.archetype];
+    Chunk& chunk = archetype.chunks[slot.chunk];
+    Chunk& last = archetype.chunks.back();
+    uint32_t lastRow = last.count - 1;
+    if (slot.chunk != archetype.chunks.size() - 1 || slot.row != lastRow)
+    {
+        Entity moved = reinterpret_cast<Entity*>(last.memory)[lastRow];
+        reinterpret_cast<Entity*>(chunk.memory)[slot.row] = moved;
+        for (ComponentMask rest = archetype.components; rest != 0; rest &= rest - 1)
+        {
+            ComponentId component = std::countr_zero(rest);
+            uint32_t size = world.components[component].size;
+            uint32_t column = archetype.columnOffsets[component];
+            memcpy(chunk.memory + column + slot.row * size, last.memory + column + lastRow * size, size);
+        }
+        world.entities[moved.index].chunk = slot.chunk;
+        world.entities[moved.index].row = slot.row;
+    }
+    last.count--;
+    archetype.entityCount--;
+    if (last.count == 0)
+    {
+        freeChunk(world, last.memory, archetype.chunkSize);
+        archetype.chunks.pop_back();
+    }
+    slot.archetype = noIndex;
+}
+
+void tiny_engine::detail::gameplay::moveEntity(GameWorldData& world, uint32_t index, uint32_t archetypeIndex)
+{
+    EntitySlot from = world.entities[index];
+    if (from.archetype == archetypeIndex) return;
+    placeEntity(world, index, archetypeIndex);
+    EntitySlot to = world.entities[index];
+    const Archetype& source = *world.archetypes[from.archetype];
+    const Archetype& target = *world.archetypes[archetypeIndex];
+    const uint8_t* sourceMemory = source.chunks[from.chunk].memory;
+    uint8_t* targetMemory = target.chunks[to.chunk].memory;
+    for (ComponentMask rest = source.components & target.components; rest != 0; rest &= rest - 1)
+    {
+        ComponentId component = std::countr_zero(rest);
+        uint32_t size = world.components[component].size;
+        memcpy(targetMemory + target.columnOffsets[component] + to.row * size,
+               sourceMemory + source.columnOffsets[component] + from.row * size, size);
+    }
+    // Out of the old archetype, as seen from its old place.
+    world.entities[index] = from;
+    unplaceEntity(world, index);
+    world.entities[index] = to;
+}
+
+bool tiny_engine::detail::gameplay::isAlive(const GameWorldData& world, Entity entity)
+{
+    if (entity.index >= world.entities.size()) return false;
+    const EntitySlot& slot = world.entities[entity.index];
+    return slot.archetype != noIndex && slot.generation == entity.generation;
+}
+
+void tiny_engine::detail::gameplay::freeEntity(GameWorldData& world, Entity entity)
+{
+    unplaceEntity(world, entity.index);
+    std::lock_guard<std::mutex> lock(world.entityMutex);
+    world.entities[entity.index].generation++;
+    world.freeEntities.push_back(entity.index);
+    world.entityCount--;
+}
+
+// Creates a reserved entity.
+static void createReserved(tiny_engine::detail::gameplay::GameWorldData& world, tiny_engine::Entity entity,
+                           tiny_engine::ComponentMask components)
+{
+    using namespace tiny_engine::detail::gameplay;
+    if (world.entities.size() <= entity.index)
+    {
+        world.entities.resize(entity.index + 1, EntitySlot { 0, noIndex, 0, 0 });
+    }
+    placeEntity(world, entity.index, findArchetype(world, components & world.registered));
+    world.entityCount++;
+}
+
+void tiny_engine::detail::gameplay::playback(GameWorldData& world, CommandsData& commands)
+{
+    for (const Command& command : commands.commands)
+    {
+        Entity entity = command.entity;
+        if (command.type == CommandType::Create)
+        {
+            createReserved(world, entity, command.components);
+            continue;
+        }
+        if (!isAlive(world, entity)) continue;
+        ComponentMask components = world.archetypes[world.entities[entity.index].archetype]->components;
+        switch (command.type)
+        {
+            case CommandType::Destroy:
+                freeEntity(world, entity);
+                break;
+            case CommandType::Add:
+                moveEntity(world, entity.index, findArchetype(world, components | (command.components & world.registered)));
+                break;
+            case CommandType::Remove:
+                moveEntity(world, entity.index, findArchetype(world, components & ~command.components));
+                break;
+            case CommandType::Set:
+            {
+                void* component = getComponent(GameWorld { commands.world }, entity, command.component);
+                if (component)
+                {
+                    memcpy(component, commands.values.data() + command.valueOffset, world.components[command.component].size);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    commands.commands.clear();
+    commands.values.clear();
+}
+
+tiny_engine::GameWorld tiny_engine::createGameWorld()
+{
+    return GameWorld { detail::gameplay::gameWorldStorage.store(new detail::gameplay::GameWorldData()) };
+}
+
+void tiny_engine::destroyGameWorld(GameWorld world)
+{
+    using namespace detail::gameplay;
+    auto data = gameWorldStorage.release(world.id);
+    if (!data) return;
+    for (auto& archetype : data->archetypes)
+    {
+        for (Chunk& chunk : archetype->chunks) operator delete(chunk.memory, std::align_val_t(64));
+    }
+    for (uint8_t* memory : data->spareChunks) operator delete(memory, std::align_val_t(64));
+    for (SystemData& system : data->systems) destroyEntityCommands(system.commands);
+    delete data;
+}
+
+tiny_engine::ComponentId tiny_engine::registerComponent(GameWorld world, uint32_t size, uint32_t alignment)
+{
+    using namespace detail::gameplay;
+    auto data = gameWorldStorage.get(world.id);
+    if (!data || data->componentCount == maxComponents) return maxComponents;
+    if (size > maxComponentSize || alignment > columnAlignment)
+    {
+        std::cerr << "registerComponent: components are at most " << maxComponentSize << " bytes, aligned to at most "
+                  << columnAlignment << std::endl;
+        return maxComponents;
+    }
+    ComponentId component = data->componentCount++;
+    data->components[component] = ComponentInfo { size, alignment };
+    data->registered |= ComponentMask(1) << component;
+    return component;
+}
+
+tiny_engine::Entity tiny_engine::createEntity(GameWorld world, ComponentMask components)
+{
+    using namespace detail::gameplay;
+    auto data = gameWorldStorage.get(world.id);
+    if (!data) return Entity { noIndex, 0 };
+    Entity entity = reserveEntity(*data);
+    createReserved(*data, entity, components);
+    return entity;
+}
+
+void tiny_engine::destroyEntity(GameWorld world, Entity entity)
+{
+    auto data = detail::gameplay::gameWorldStorage.get(world.id);
+    if (data && detail::gameplay::isAlive(*data, entity)) detail::gameplay::freeEntity(*data, entity);
+}
+
+void tiny_engine::addComponents(GameWorld world, Entity entity, ComponentMask components)
+{
+    using namespace detail::gameplay;
+    auto data = gameWorldStorage.get(world.id);
+    if (!data || !isAlive(*data, entity)) return;
+    ComponentMask current = data->archetypes[data->entities[entity.index].archetype]->components;
+    moveEntity(*data, entity.index, findArchetype(*data, current | (components & data->registered)));
+}
+
+void tiny_engine::removeComponents(GameWorld world, Entity entity, ComponentMask components)
+{
+    using namespace detail::gameplay;
+    auto data = gameWorldStorage.get(world.id);
+    if (!data || !isAlive(*data, entity)) return;
+    ComponentMask current = data->archetypes[data->entities[entity.index].archetype]->components;
+    moveEntity(*data, entity.index, findArchetype(*data, current & ~components));
+}
+
+bool tiny_engine::isEntityAlive(GameWorld world, Entity entity)
+{
+    auto data = detail::gameplay::gameWorldStorage.get(world.id);
+    return data && detail::gameplay::isAlive(*data, entity);
+}
+
+void* tiny_engine::getComponent(GameWorld world, Entity entity, ComponentId component)
+{
+    using namespace detail::gameplay;
+    auto data = gameWorldStorage.get(world.id);
+    if (!data || component >= maxComponents || !isAlive(*data, entity)) return nullptr;
+    const EntitySlot& slot = data->entities[entity.index];
+    const Archetype& archetype = *data->archetypes[slot.archetype];
+    if (archetype.columnOffsets[component] == noColumn) return nullptr;
+    return archetype.chunks[slot.chunk].memory + archetype.columnOffsets[component] +
+           slot.row * data->components[component].size;
+}
+
+tiny_engine::Query tiny_engine::createQuery(GameWorld world, ComponentMask read, ComponentMask write, ComponentMask exclude)
+{
+    using namespace detail::gameplay;
+    auto data = gameWorldStorage.get(world.id);
+    if (!data) return Query { noIndex };
+    QueryData query;
+    query.required = read | write;
+    query.exclude = exclude;
+    for (uint32_t i = 0; i < (uint32_t) data->archetypes.size(); i++)
+    {
+        ComponentMask components = data->archetypes[i]->components;
+        if ((components & query.required) == query.required && (components & exclude) == 0)
+        {
+            query.archetypes.push_back(i);
+        }
+    }
+    data->queries.push_back(std::move(query));
+    return Query { (uint32_t) data->queries.size() - 1 };
+}
+
+uint32_t tiny_engine::getQueryEntityCount(GameWorld world, Query query)
+{
+    auto data = detail::gameplay::gameWorldStorage.get(world.id);
+    if (!data || query.id >= data->queries.size()) return 0;
+    uint32_t count = 0;
+    for (uint32_t archetype : data->queries[query.id].archetypes) count += data->archetypes[archetype]->entityCount;
+    return count;
+}
+
+const tiny_engine::QueryChunk* tiny_engine::getQueryChunks(GameWorld world, Query query, uint32_t& count)
+{
+    using namespace detail::gameplay;
+    count = 0;
+    auto data = gameWorldStorage.get(world.id);
+    if (!data || query.id >= data->queries.size()) return nullptr;
+    QueryData& queryData = data->queries[query.id];
+    queryData.chunks.clear();
+    for (uint32_t index : queryData.archetypes)
+    {
+        const Archetype& archetype = *data->archetypes[index];
+        for (const Chunk& chunk : archetype.chunks)
+        {
+            queryData.chunks.push_back(QueryChunk { chunk.count, reinterpret_cast<const Entity*>(chunk.memory),
+                                                    chunk.memory, archetype.columnOffsets });
+        }
+    }
+    count = (uint32_t) queryData.chunks.size();
+    return queryData.chunks.data();
+}
+
+tiny_engine::EntityCommands tiny_engine::createEntityCommands(GameWorld world)
+{
+    auto data = new detail::gameplay::CommandsData();
+    data->world = world.id;
+    return EntityCommands { detail::gameplay::commandsStorage.store(data) };
+}
+
+void tiny_engine::destroyEntityCommands(EntityCommands commands)
+{
+    delete detail::gameplay::commandsStorage.release(commands.id);
+}
+
+tiny_engine::Entity tiny_engine::deferCreateEntity(EntityCommands commands, ComponentMask components)
+{
+    using namespace detail::gameplay;
+    auto data = commandsStorage.get(commands.id);
+    auto world = data ? gameWorldStorage.get(data->world) : nullptr;
+    if (!world) return Entity { noIndex, 0 };
+    Entity entity = reserveEntity(*world);
+    data->commands.push_back(Command { CommandType::Create, entity, components, 0, 0 });
+    return entity;
+}
+
+void tiny_engine::deferDestroyEntity(EntityCommands commands, Entity entity)
+{
+    using namespace detail::gameplay;
+    auto data = commandsStorage.get(commands.id);
+    if (data) data->commands.push_back(Command { CommandType::Destroy, entity, 0, 0, 0 });
+}
+
+void tiny_engine::deferAddComponents(EntityCommands commands, Entity entity, ComponentMask components)
+{
+    using namespace detail::gameplay;
+    auto data = commandsStorage.get(commands.id);
+    if (data) data->commands.push_back(Command { CommandType::Add, entity, components, 0, 0 });
+}
+
+void tiny_engine::deferRemoveComponents(EntityCommands commands, Entity entity, ComponentMask components)
+{
+    using namespace detail::gameplay;
+    auto data = commandsStorage.get(commands.id);
+    if (data) data->commands.push_back(Command { CommandType::Remove, entity, components, 0, 0 });
+}
+
+void tiny_engine::deferSetComponent(EntityCommands commands, Entity entity, ComponentId component, const void* value)
+{
+    using namespace detail::gameplay;
+    auto data = commandsStorage.get(commands.id);
+    auto world = data ? gameWorldStorage.get(data->world) : nullptr;
+    if (!world || component >= world->componentCount) return;
+    uint32_t size = world->components[component].size;
+    uint32_t offset = (uint32_t) data->values.size();
+    data->values.resize(offset + size);
+    memcpy(data->values.data() + offset, value, size);
+    data->commands.push_back(Command { CommandType::Set, entity, 0, component, offset });
+}
+
+void tiny_engine::playbackEntityCommands(EntityCommands commands)
+{
+    using namespace detail::gameplay;
+    auto data = commandsStorage.get(commands.id);
+    auto world = data ? gameWorldStorage.get(data->world) : nullptr;
+    if (world) playback(*world, *data);
+}
+
+void tiny_engine::addSystem(GameWorld world, const SystemDesc& desc)
+{
+    using namespace detail::gameplay;
+    auto data = gameWorldStorage.get(world.id);
+    if (!data) return;
+    SystemData system;
+    system.desc = desc;
+    system.commands = createEntityCommands(world);
+    system.world = world;
+    // One stage after the last system it conflicts with.
+    system.stage = 0;
+    for (const SystemData& earlier : data->systems)
+    {
+        bool conflict = (earlier.desc.write & (desc.read | desc.write)) != 0 || (earlier.desc.read & desc.write) != 0;
+        if (conflict) system.stage = std::max(system.stage, earlier.stage + 1);
+    }
+    data->stageCount = std::max(data->stageCount, system.stage + 1);
+    data->systems.push_back(system);
+}
+
+void tiny_engine::runSystems(GameWorld world)
+{
+    TE_PROFILE_SCOPE("runSystems");
+    using namespace detail::gameplay;
+    auto data = gameWorldStorage.get(world.id);
+    if (!data) return;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t stage = 0; stage < data->stageCount; stage++)
+    {
+        JobCounter counter;
+        for (SystemData& system : data->systems)
+        {
+            if (system.stage != stage) continue;
+            runJob([](void* context) {
+                auto system = static_cast<SystemData*>(context);
+                system->desc.function(system->world, system->commands, system->desc.context);
+            }, &system, &counter);
+        }
+        waitForCounter(counter);
+    }
+    auto ran = std::chrono::steady_clock::now();
+    {
+        TE_PROFILE_SCOPE("playbackEntityCommands");
+        for (SystemData& system : data->systems) playback(*data, *commandsStorage.get(system.commands.id));
+    }
+    data->stats.systemStages = data->stageCount;
+    data->stats.systemMilliseconds = std::chrono::duration<double, std::milli>(ran - start).count();
+    data->stats.playbackMilliseconds = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - ran).count();
+}
+
+tiny_engine::GameWorldStats tiny_engine::getGameWorldStats(GameWorld world)
+{
+    using namespace detail::gameplay;
+    auto data = gameWorldStorage.get(world.id);
+    if (!data) return GameWorldStats {};
+    GameWorldStats stats = data->stats;
+    stats.entityCount = data->entityCount;
+    stats.archetypeCount = (uint32_t) data->archetypes.size();
+    stats.chunkCount = 0;
+    for (auto& archetype : data->archetypes) stats.chunkCount += (uint32_t) archetype->chunks.size();
+    return stats;
+}
+#endif
+
+#ifdef TE_NETWORK
+// ----------------------------------------------------------------------------
+// Network
+//
+
+// Packets are little endian whatever the machine.
+static void writeU16(uint8_t* p, uint16_t value)
+{
+    p[0] = (uint8_t) value;
+    p[1] = (uint8_t) (value >> 8);
+}
+
+static void writeU32(uint8_t* p, uint32_t value)
+{
+    writeU16(p, (uint16_t) value);
+    writeU16(p + 2, (uint16_t) (value >> 16));
+}
+
+static uint16_t readU16(const uint8_t* p)
+{
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t readU32(const uint8_t* p)
+{
+    return readU16(p) | ((uint32_t) readU16(p + 2) << 16);
+}
+
+/// a is newer than b, with the sequences wrapping around.
+static bool sequenceGreater(uint16_t a, uint16_t b)
+{
+    return a != b && (uint16_t) (a - b) < 0x8000;
+}
+
+static uint64_t addressKey(tiny_engine::NetAddress address)
+{
+    return ((uint64_t) address.ip << 16) | address.port;
+}
+
+static double networkSeconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void closeSocket(tiny_engine::detail::network::NativeSocket socket)
+{
+#ifdef _WIN32
+    closesocket(socket);
+#else
+    close(socket);
+#endif
+}
+
+uint8_t* tiny_engine::detail::network::packetData(TransportData& transport, uint32_t packet)
+{
+    return transport.packetMemory.data() + (size_t) packet * packetBytes;
+}
+
+uint32_t tiny_engine::detail::network::takePacket(TransportData& transport)
+{
+    if (transport.freePackets.empty())
+    {
+        transport.stats.poolExhausted++;
+        return noPacket;
+    }
+    uint32_t packet = transport.freePackets.back();
+    transport.freePackets.pop_back();
+    return packet;
+}
+
+void tiny_engine::detail::network::releasePacket(TransportData& transport, uint32_t packet)
+{
+    transport.freePackets.push_back(packet);
+}
+
+uint32_t tiny_engine::detail::network::receiveBatch(TransportData& transport)
+{
+    uint32_t count = (uint32_t) transport.batchPackets.size();
+    transport.batchSizes.resize(count);
+    transport.batchAddresses.resize(count);
+    transport.stats.receiveCalls++;
+#ifdef _WIN32
+    // Winsock has no recvmmsg, the batch is drained with one call per datagram
+    // until the socket would block.
+    uint32_t received = 0;
+    while (received < count)
+    {
+        sockaddr_in from;
+        int fromSize = sizeof(from);
+        int size = recvfrom(transport.socket, (char*) packetData(transport, transport.batchPackets[received]), 
+                packetBytes, 0, (sockaddr*) &from, &fromSize);
+        if (size < 0)
+        {
+            // Too large for a packet buffer, so not ours.
+            if (WSAGetLastError() == WSAEMSGSIZE) 
+            {
+                transport.stats.packetsIgnored++;
+                continue;
+            }
+            break;
+        }
+        transport.batchSizes[received] = (uint32_t) size;
+        transport.batchAddresses[received] = NetAddress { ntohl(from.sin_addr.s_addr), ntohs(from.sin_port) };
+        received++;
+    }
+    return received;
+#else
+    for (uint32_t i = 0; i < count; i++)
+    {
+        transport.vectors[i].iov_base = packetData(transport, transport.batchPackets[i]);
+        transport.vectors[i].iov_len = packetBytes;
+        mmsghdr& header = transport.headers[i];
+        header = {};
+        header.msg_hdr.msg_name = &transport.socketAddresses[i];
+        header.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        header.msg_hdr.msg_iov = &transport.vectors[i];
+        header.msg_hdr.msg_iovlen = 1;
+    }
+    int received = recvmmsg(transport.socket, transport.headers.data(), count, MSG_DONTWAIT, nullptr);
+    if (received <= 0) return 0;
+    for (int i = 0; i < received; i++)
+    {
+        const sockaddr_in& from = transport.socketAddresses[i];
+        // Truncated datagrams were larger than a packet buffer, so not ours. 
+        bool truncated = (transport.headers[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+        transport.batchSizes[i] = truncated ? 0 : transport.headers[i].msg_len;
+        transport.batchAddresses[i] = NetAddress { ntohl(from.sin_addr.s_addr), ntohs(from.sin_port) };
+    }
+    return (uint32_t) received;
+#endif
+}
+
+void tiny_engine::detail::network::sendBatch(TransportData& transport)
+{
+    // The simulated loss drops packets here, after they got their sequences and records.
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < transport.batchPackets.size(); i++)
+    {
+        if (transport.settings.simulatedPacketLoss > 0)
+        {
+            transport.random ^= transport.random << 13;
+            transport.random ^= transport.random >> 17;
+            transport.random ^= transport.random << 5;
+            if ((transport.random >> 8) * (1.0f / 16777216.0f) < transport.settings.simulatedPacketLoss)
+            {
+                transport.stats.packetsDropped++;
+                releasePacket(transport, transport.batchPackets[i]);
+                continue;
+            }
+        }
+        transport.batchPackets[count] = transport.batchPackets[i];
+        transport.batchSizes[count] = transport.batchSizes[i];
+        transport.batchAddresses[count] = transport.batchAddresses[i];
+        count++;
+    }
+
+    uint32_t sent = 0;
+#ifdef _WIN32
+    // One call per datagram, Winsock has no sendmmsg for datagrams to different addresses.
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sockaddr_in to = {};
+        to.sin_family = AF_INET;
+        to.sin_addr.s_addr = htonl(transport.batchAddresses[i].ip);
+        to.sin_port = htons(transport.batchAddresses[i].port);
+        transport.stats.sendCalls++;
+        int size = sendto(transport.socket, (const char*) packetData(transport, transport.batchPackets[i]), 
+                (int) transport.batchSizes[i], 0, (const sockaddr*) &to, sizeof(to));
+        if (size < 0) continue;
+        transport.stats.bytesSent += transport.batchSizes[i];
+        sent++;
+    }
+#else
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sockaddr_in& to = transport.socketAddresses[i];
+        to = {};
+        to.sin_family = AF_INET;
+        to.sin_addr.s_addr = htonl(transport.batchAddresses[i].ip);
+        to.sin_port = htons(transport.batchAddresses[i].port);
+        transport.vectors[i].iov_base = packetData(transport, transport.batchPackets[i]);
+        transport.vectors[i].iov_len = transport.batchSizes[i];
+        mmsghdr& header = transport.headers[i];
+        header = {};
+        header.msg_hdr.msg_name = &to;
+        header.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        header.msg_hdr.msg_iov = &transport.vectors[i];
+        header.msg_hdr.msg_iovlen = 1;
+    }
+    // sendmmsg stops at the first datagram which fails, that one is skipped and the rest sent on.
+    uint32_t next = 0;
+    while (next < count)
+    {
+        transport.stats.sendCalls++;
+        int result = sendmmsg(transport.socket, transport.headers.data() + next, count - next, 0);
+        if (result < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            next++;
+            continue;
+        }
+        for (int i = 0; i < result; i++) transport.stats.bytesSent += transport.batchSizes[next + i];
+        sent += (uint32_t) result;
+        next += (uint32_t) result;
+    }
+#endif
+    transport.stats.packetsSent += sent;
+    transport.stats.packetsDropped += count - sent;
+    for (uint32_t i = 0; i < count; i++) releasePacket(transport, transport.batchPackets[i]);
+    transport.batchPackets.clear();
+    transport.batchSizes.clear();
+    transport.batchAddresses.clear();
+}
+
+void tiny_engine::detail::network::resetConnection(TransportData& transport, uint32_t connection)
+{
+    ConnectionData& data = *transport.connections[connection];
+    for (ChannelState& channel : data.channels)
+    {
+        for (QueuedMessage& message : channel.window)
+        {
+            if (message.packet != noPacket) releasePacket(transport, message.packet);
+            message.packet = noPacket;
+        }
+        for (QueuedMessage& message : channel.received)
+        {
+            if (message.packet != noPacket) releasePacket(transport, message.packet);
+            message.packet = noPacket;
+        }
+        for (QueuedMessage& message : channel.queue) releasePacket(transport, message.packet);
+        channel.queue.clear();
+        channel.nextSequence = 0;
+        channel.oldestUnacked = 0;
+        channel.nextDelivery = 0;
+        channel.assembling = false;
+    }
+    transport.connectionOf.erase(addressKey(data.address));
+    data.active = false;
+}
+
+static void pushNetEvent(tiny_engine::detail::network::TransportData& transport, tiny_engine::NetEventType type, 
+        uint32_t connection, uint32_t channel, const uint8_t* data, uint32_t size)
+{
+    using namespace tiny_engine::detail::network;
+    transport.events.push_back(PendingEvent { tiny_engine::NetEvent { type, connection, channel, data, size }, noOffset });
+}
+
+// Copies the joined message out of the assembly buffer, the next one may start before the event is taken.
+static void pushAssembledEvent(tiny_engine::detail::network::TransportData& transport, 
+        uint32_t connection, uint32_t channel, const uint8_t* data, uint32_t size)
+{
+    using namespace tiny_engine::detail::network;
+    uint32_t offset = (uint32_t) transport.eventBytes.size();
+    transport.eventBytes.insert(transport.eventBytes.end(), data, data + size);
+    transport.events.push_back(PendingEvent { 
+            tiny_engine::NetEvent { tiny_engine::NetEventType::Message, connection, channel, nullptr, size }, offset });
+}
+
+// Delivers a reliable message in order. Fragments arrive one after another, so they are appended.
+// Returns true if the event points at the payload.
+static bool deliverReliable(tiny_engine::detail::network::TransportData& transport, uint32_t connection, 
+        uint32_t channelIndex, const uint8_t* payload, uint32_t size, uint32_t fragment, uint32_t lastFragment)
+{
+    using namespace tiny_engine::detail::network;
+    if (lastFragment == 0)
+    {
+        pushNetEvent(transport, tiny_engine::NetEventType::Message, connection, channelIndex, payload, size);
+        return true;
+    }
+    ChannelState& channel = transport.connections[connection]->channels[channelIndex];
+    if (fragment == 0)
+    {
+        channel.assembling = true;
+        channel.assemblySize = 0;
+    }
+    if (!channel.assembling) return false;
+    if ((fragment < lastFragment && size != fragmentBytes) || 
+        channel.assemblySize + size > transport.settings.maxMessageSize)
+    {
+        channel.assembling = false;
+        return false;
+    }
+    if (channel.assembly.empty()) channel.assembly.resize(transport.settings.maxMessageSize);
+    memcpy(channel.assembly.data() + channel.assemblySize, payload, size);
+    channel.assemblySize += size;
+    if (fragment == lastFragment)
+    {
+        pushAssembledEvent(transport, connection, channelIndex, channel.assembly.data(), channel.assemblySize);
+        channel.assembling = false;
+    }
+    return false;
+}
+
+// Delivers the message if it is the next one, then those which came in before it, or keeps a copy
+// of it until the messages before it are there. Early messages are only kept while more than a batch
+// of buffers is free, so receiving never runs dry. Otherwise refused is set and the packet goes unacked.
+static bool receiveReliable(tiny_engine::detail::network::TransportData& transport, uint32_t connection, 
+        uint32_t channelIndex, uint16_t sequence, const uint8_t* payload, uint32_t size, 
+        uint32_t fragment, uint32_t lastFragment, bool& refused)
+{
+    using namespace tiny_engine::detail::network;
+    ChannelState& channel = transport.connections[connection]->channels[channelIndex];
+    if (sequence != channel.nextDelivery)
+    {
+        // Behind the next delivery it was delivered already, and the sender never gets a window ahead.
+        if ((uint16_t) (sequence - channel.nextDelivery) >= reliableWindow) return false;
+        QueuedMessage& stored = channel.received[sequence % reliableWindow];
+        if (stored.packet != noPacket) return false;
+        if (transport.freePackets.size() <= transport.settings.batchSize)
+        {
+            transport.stats.poolExhausted++;
+            refused = true;
+            return false;
+        }
+        uint32_t packet = takePacket(transport);
+        memcpy(packetData(transport, packet), payload, size);
+        stored = QueuedMessage { packet, (uint16_t) size, sequence, (uint8_t) fragment, (uint8_t) lastFragment, false, 0 };
+        return false;
+    }
+
+    bool held = deliverReliable(transport, connection, channelIndex, payload, size, fragment, lastFragment);
+    channel.nextDelivery++;
+    while (true)
+    {
+        QueuedMessage& stored = channel.received[channel.nextDelivery % reliableWindow];
+        if (stored.packet == noPacket) break;
+        if (deliverReliable(transport, connection, channelIndex, packetData(transport, stored.packet), 
+                stored.size, stored.fragment, stored.lastFragment))
+        {
+            transport.heldPackets.push_back(stored.packet);
+        }
+        else
+        {
+            releasePacket(transport, stored.packet);
+        }
+        stored.packet = noPacket;
+        channel.nextDelivery++;
+    }
+    return held;
+}
+
+// Unreliable fragments may come in any order or not at all. A fragment of a newer message
+// drops the one being joined.
+static bool receiveUnreliable(tiny_engine::detail::network::TransportData& transport, uint32_t connection, 
+        uint32_t channelIndex, uint16_t id, const uint8_t* payload, uint32_t size, 
+        uint32_t fragment, uint32_t lastFragment)
+{
+    using namespace tiny_engine::detail::network;
+    if (lastFragment == 0)
+    {
+        pushNetEvent(transport, tiny_engine::NetEventType::Message, connection, channelIndex, payload, size);
+        return true;
+    }
+    ChannelState& channel = transport.connections[connection]->channels[channelIndex];
+    if (channel.assembling && sequenceGreater(channel.assemblyId, id)) return false;
+    if (!channel.assembling || channel.assemblyId != id)
+    {
+        channel.assembling = true;
+        channel.assemblyId = id;
+        channel.assemblyLast = (uint8_t) lastFragment;
+        channel.assemblySize = 0;
+        channel.fragmentsReceived = 0;
+        memset(channel.fragmentReceived, 0, lastFragment + 1);
+    }
+    uint32_t offset = fragment * fragmentBytes;
+    if (lastFragment != channel.assemblyLast || channel.fragmentReceived[fragment] ||
+        (fragment < lastFragment && size != fragmentBytes) || offset + size > transport.settings.maxMessageSize)
+    {
+        return false;
+    }
+    if (channel.assembly.empty()) channel.assembly.resize(transport.settings.maxMessageSize);
+    memcpy(channel.assembly.data() + offset, payload, size);
+    channel.fragmentReceived[fragment] = true;
+    channel.fragmentsReceived++;
+    if (fragment == lastFragment) channel.assemblySize = offset + size;
+    if (channel.fragmentsReceived == lastFragment + 1)
+    {
+        pushAssembledEvent(transport, connection, channelIndex, channel.assembly.data(), channel.assemblySize);
+        channel.assembling = false;
+    }
+    return false;
+}
+
+bool tiny_engine::detail::network::processPacket(TransportData& transport, uint32_t connection, 
+        const uint8_t* data, uint32_t size, double now)
+{
+    ConnectionData& state = *transport.connections[connection];
+    uint8_t flags = data[2];
+    uint16_t sequence = readU16(data + 3);
+
+    // Duplicates and packets too old for the ack bits are ignored, their reliable messages come again.
+    if (state.receivedAny && !sequenceGreater(sequence, state.remoteSequence))
+    {
+        uint32_t behind = (uint16_t) (state.remoteSequence - sequence);
+        if (behind == 0 || behind > 32 || (state.remoteAcks >> (behind - 1)) & 1)
+        {
+            transport.stats.packetsIgnored++;
+            return false;
+        }
+    }
+    state.lastReceived = now;
+
+    if (flags & hasAcks)
+    {
+        uint16_t ack = readU16(data + 5);
+        uint32_t ackBits = readU32(data + 7);
+        for (uint32_t bit = 0; bit <= 32; bit++)
+        {
+            if (bit > 0 && ((ackBits >> (bit - 1)) & 1) == 0) continue;
+            uint16_t acked = (uint16_t) (ack - bit);
+            SentPacket& sent = state.sent[acked % sentPacketHistory];
+            if (!sent.pending || sent.sequence != acked) continue;
+            sent.pending = false;
+            double roundTrip = now - sent.time;
+            state.roundTrip = state.roundTrip == 0 ? roundTrip : state.roundTrip + (roundTrip - state.roundTrip) * 0.1;
+            for (uint32_t i = 0; i < sent.reliableCount; i++)
+            {
+                QueuedMessage& message = state.channels[sent.channels[i]].window[sent.messages[i] % reliableWindow];
+                if (message.packet == noPacket || message.sequence != sent.messages[i]) continue;
+                releasePacket(transport, message.packet);
+                message.packet = noPacket;
+            }
+        }
+        for (ChannelState& channel : state.channels)
+        {
+            while (channel.oldestUnacked != channel.nextSequence && 
+                   channel.window[channel.oldestUnacked % reliableWindow].packet == noPacket)
+            {
+                channel.oldestUnacked++;
+            }
+        }
+    }
+
+    // A malformed message ends the packet, the messages before it are kept.
+    bool held = false;
+    bool refused = false;
+    uint32_t offset = packetHeaderBytes;
+    while (size - offset >= 3)
+    {
+        uint8_t kind = data[offset];
+        uint32_t channelIndex = kind & (maxChannels - 1);
+        uint32_t messageSize = readU16(data + offset + 1);
+        offset += 3;
+        if (channelIndex >= state.channels.size()) break;
+        bool reliable = state.channels[channelIndex].type == ChannelType::Reliable;
+        uint16_t messageSequence = 0;
+        uint32_t fragment = 0;
+        uint32_t lastFragment = 0;
+        if (reliable || (kind & fragmented))
+        {
+            if (size - offset < 2) break;
+            messageSequence = readU16(data + offset);
+            offset += 2;
+        }
+        if (kind & fragmented)
+        {
+            if (size - offset < 2) break;
+            fragment = data[offset];
+            lastFragment = data[offset + 1];
+            offset += 2;
+            if (fragment > lastFragment || lastFragment == 0) break;
+        }
+        if (messageSize > fragmentBytes || messageSize > size - offset) break;
+        const uint8_t* payload = data + offset;
+        offset += messageSize;
+        state.ackPending = true;
+        if (reliable)
+        {
+            held |= receiveReliable(transport, connection, channelIndex, messageSequence, payload, messageSize, 
+                    fragment, lastFragment, refused);
+        }
+        else
+        {
+            held |= receiveUnreliable(transport, connection, channelIndex, messageSequence, payload, messageSize, 
+                    fragment, lastFragment);
+        }
+    }
+
+    // Acked only now, a packet with a refused message must be sent again. Its other reliable
+    // messages are delivered or kept already, they are dropped as duplicates then.
+    if (refused) return held;
+    if (!state.receivedAny)
+    {
+        state.receivedAny = true;
+        state.remoteSequence = sequence;
+        state.remoteAcks = 0;
+    }
+    else if (sequenceGreater(sequence, state.remoteSequence))
+    {
+        uint32_t shift = (uint16_t) (sequence - state.remoteSequence);
+        if (shift < 32) state.remoteAcks = (state.remoteAcks << shift) | (1u << (shift - 1));
+        else state.remoteAcks = shift == 32 ? 1u << 31 : 0;
+        state.remoteSequence = sequence;
+    }
+    else
+    {
+        state.remoteAcks |= 1u << ((uint16_t) (state.remoteSequence - sequence) - 1);
+    }
+    return held;
+}
+
+void tiny_engine::detail::network::writePackets(TransportData& transport, uint32_t connection, double now)
+{
+    ConnectionData& state = *transport.connections[connection];
+    uint32_t packet = noPacket;
+    uint32_t size = 0;
+    SentPacket* record = nullptr;
+
+    auto finish = [&]() {
+        transport.batchPackets.push_back(packet);
+        transport.batchSizes.push_back(size);
+        transport.batchAddresses.push_back(state.address);
+        packet = noPacket;
+        if (transport.batchPackets.size() >= transport.settings.batchSize) sendBatch(transport);
+    };
+    auto begin = [&]() {
+        if (packet != noPacket) finish();
+        packet = takePacket(transport);
+        if (packet == noPacket) return false;
+        uint8_t* data = packetData(transport, packet);
+        uint16_t sequence = state.nextPacket++;
+        writeU16(data, protocolId);
+        data[2] = state.receivedAny ? hasAcks : 0;
+        writeU16(data + 3, sequence);
+        writeU16(data + 5, state.remoteSequence);
+        writeU32(data + 7, state.remoteAcks);
+        size = packetHeaderBytes;
+        record = &state.sent[sequence % sentPacketHistory];
+        record->pending = true;
+        record->sequence = sequence;
+        record->time = now;
+        record->reliableCount = 0;
+        state.ackPending = false;
+        state.lastSent = now;
+        return true;
+    };
+    auto writeMessage = [&](uint32_t channelIndex, const QueuedMessage& message, bool reliable) {
+        uint8_t* data = packetData(transport, packet) + size;
+        data[0] = (uint8_t) (channelIndex | (message.lastFragment ? fragmented : 0));
+        writeU16(data + 1, message.size);
+        size += 3;
+        if (reliable || message.lastFragment)
+        {
+            writeU16(data + 3, message.sequence);
+            size += 2;
+        }
+        if (message.lastFragment)
+        {
+            packetData(transport, packet)[size] = message.fragment;
+            packetData(transport, packet)[size + 1] = message.lastFragment;
+            size += 2;
+        }
+        memcpy(packetData(transport, packet) + size, packetData(transport, message.packet), message.size);
+        size += message.size;
+    };
+
+    double resendSeconds = std::max(transport.settings.resendSeconds, state.roundTrip * 1.5);
+    bool full = false;
+    for (uint32_t channelIndex = 0; channelIndex < state.channels.size() && !full; channelIndex++)
+    {
+        ChannelState& channel = state.channels[channelIndex];
+        if (channel.type == ChannelType::Reliable)
+        {
+            for (uint16_t sequence = channel.oldestUnacked; sequence != channel.nextSequence; sequence++)
+            {
+                QueuedMessage& message = channel.window[sequence % reliableWindow];
+                if (message.packet == noPacket || (message.sent && now - message.sentTime < resendSeconds)) continue;
+                uint32_t bytes = 5 + (message.lastFragment ? 2 : 0) + message.size;
+                if (packet == noPacket || size + bytes > packetBytes || record->reliableCount == maxReliablePerPacket)
+                {
+                    if (!begin())
+                    {
+                        full = true;
+                        break;
+                    }
+                }
+                writeMessage(channelIndex, message, true);
+                record->channels[record->reliableCount] = (uint8_t) channelIndex;
+                record->messages[record->reliableCount] = sequence;
+                record->reliableCount++;
+                if (message.sent) transport.stats.messagesResent++;
+                message.sent = true;
+                message.sentTime = now;
+            }
+        }
+        else
+        {
+            // Unreliable messages which find no packet buffer are dropped.
+            for (QueuedMessage& message : channel.queue)
+            {
+                uint32_t bytes = 3 + (message.lastFragment ? 4 : 0) + message.size;
+                if (!full && (packet == noPacket || size + bytes > packetBytes)) full = !begin();
+                if (!full) writeMessage(channelIndex, message, false);
+                releasePacket(transport, message.packet);
+            }
+            channel.queue.clear();
+        }
+    }
+    if (packet == noPacket && !full && (state.ackPending || now - state.lastSent >= keepAliveSeconds)) begin();
+    if (packet != noPacket) finish();
+}
+
+tiny_engine::NetAddress tiny_engine::netAddress(const char* ip, uint16_t port)
+{
+    uint32_t address = 0;
+    const char* p = ip;
+    for (int part = 0; part < 4; part++)
+    {
+        if (*p < '0' || *p > '9') return NetAddress { 0, port };
+        uint32_t value = 0;
+        while (*p >= '0' && *p <= '9' && value <= 255) value = value * 10 + (*p++ - '0');
+        if (value > 255 || *p != (part < 3 ? '.' : '\0')) return NetAddress { 0, port };
+        if (part < 3) p++;
+        address = (address << 8) | value;
+    }
+    return NetAddress { address, port };
+}
+
+std::optional<tiny_engine::Transport> tiny_engine::createTransport(const TransportSettings& settings)
+{
+    using namespace detail::network;
+#ifdef _WIN32
+    static bool started = [] {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    if (!started)
+    {
+        std::cerr << "createTransport: WSAStartup failed" << std::endl;
+        return std::nullopt;
+    }
+    NativeSocket socket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (socket == INVALID_SOCKET)
+#else
+    NativeSocket socket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (socket < 0)
+#endif
+    {
+        std::cerr << "createTransport: could not create a socket" << std::endl;
+        return std::nullopt;
+    }
+
+    int bufferBytes = socketBufferBytes;
+    setsockopt(socket, SOL_SOCKET, SO_RCVBUF, (const char*) &bufferBytes, sizeof(bufferBytes));
+    setsockopt(socket, SOL_SOCKET, SO_SNDBUF, (const char*) &bufferBytes, sizeof(bufferBytes));
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(socket, FIONBIO, &nonBlocking);
+    // Otherwise a packet to a closed port makes the next receive fail with WSAECONNRESET.
+    BOOL reportReset = FALSE;
+    DWORD returned = 0;
+    WSAIoctl(socket, SIO_UDP_CONNRESET, &reportReset, sizeof(reportReset), nullptr, 0, &returned, nullptr, nullptr);
+#else
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(settings.bind.ip);
+    address.sin_port = htons(settings.bind.port);
+    socklen_t addressSize = sizeof(address);
+    if (bind(socket, (const sockaddr*) &address, sizeof(address)) != 0 || 
+        getsockname(socket, (sockaddr*) &address, &addressSize) != 0)
+    {
+        std::cerr << "createTransport: could not bind to port " << settings.bind.port << std::endl;
+        closeSocket(socket);
+        return std::nullopt;
+    }
+
+    auto data = new TransportData();
+    data->settings = settings;
+    data->settings.channelCount = std::min(std::max(settings.channelCount, 1u), maxChannels);
+    data->settings.batchSize = std::max(settings.batchSize, 1u);
+    data->settings.maxMessageSize = std::min(settings.maxMessageSize, maxFragments * fragmentBytes);
+    data->socket = socket;
+    data->address = NetAddress { ntohl(address.sin_addr.s_addr), ntohs(address.sin_port) };
+    data->packetMemory.resize((size_t) settings.packetCount * packetBytes);
+    data->freePackets.resize(settings.packetCount);
+    // Reversed, so the first buffers are taken first.
+    for (uint32_t i = 0; i < settings.packetCount; i++) data->freePackets[i] = settings.packetCount - 1 - i;
+    data->connections.resize(settings.maxConnections);
+    data->connectionOf.reserve(settings.maxConnections);
+    uint32_t batchSize = data->settings.batchSize;
+    data->batchPackets.reserve(batchSize);
+    data->batchSizes.reserve(batchSize);
+    data->batchAddresses.reserve(batchSize);
+#ifndef _WIN32
+    data->headers.resize(batchSize);
+    data->vectors.resize(batchSize);
+    data->socketAddresses.resize(batchSize);
+#endif
+    return Transport { transportStorage.store(data) };
+}
+
+void tiny_engine::destroyTransport(Transport transport)
+{
+    using namespace detail::network;
+    auto data = transportStorage.release(transport.id);
+    if (!data) return;
+    closeSocket(data->socket);
+    delete data;
+}
+
+tiny_engine::NetAddress tiny_engine::getTransportAddress(Transport transport)
+{
+    using namespace detail::network;
+    auto data = transportStorage.get(transport.id);
+    return data ? data->address : NetAddress { 0, 0 };
+}
+
+uint32_t tiny_engine::openConnection(Transport transport, NetAddress address)
+{
+    using namespace detail::network;
+    auto data = transportStorage.get(transport.id);
+    if (!data) return noConnection;
+    auto found = data->connectionOf.find(addressKey(address));
+    if (found != data->connectionOf.end()) return found->second;
+
+    for (uint32_t i = 0; i < data->connections.size(); i++)
+    {
+        auto& connection = data->connections[i];
+        if (connection && connection->active) continue;
+        if (!connection)
+        {
+            connection = std::make_unique<ConnectionData>();
+            connection->channels.resize(data->settings.channelCount);
+            for (uint32_t c = 0; c < data->settings.channelCount; c++) 
+            {
+                connection->channels[c].type = data->settings.channels[c];
+            }
+        }
+        double now = networkSeconds();
+        connection->active = true;
+        connection->address = address;
+        connection->lastReceived = now;
+        connection->lastSent = now;
+        connection->roundTrip = 0;
+        connection->nextPacket = 0;
+        connection->receivedAny = false;
+        connection->ackPending = false;
+        for (SentPacket& sent : connection->sent) sent.pending = false;
+        data->connectionOf[addressKey(address)] = i;
+        return i;
+    }
+    return noConnection;
+}
+
+void tiny_engine::closeConnection(Transport transport, uint32_t connection)
+{
+    using namespace detail::network;
+    auto data = transportStorage.get(transport.id);
+    if (!data || connection >= data->connections.size() || 
+        !data->connections[connection] || !data->connections[connection]->active) return;
+    resetConnection(*data, connection);
+}
+
+tiny_engine::NetAddress tiny_engine::getConnectionAddress(Transport transport, uint32_t connection)
+{
+    using namespace detail::network;
+    auto data = transportStorage.get(transport.id);
+    if (!data || connection >= data->connections.size() || !data->connections[connection]) return NetAddress { 0, 0 };
+    return data->connections[connection]->address;
+}
+
+double tiny_engine::getConnectionRoundTrip(Transport transport, uint32_t connection)
+{
+    using namespace detail::network;
+    auto data = transportStorage.get(transport.id);
+    if (!data || connection >= data->connections.size() || !data->connections[connection]) return 0;
+    return data->connections[connection]->roundTrip;
+}
+
+bool tiny_engine::sendMessage(Transport transport, uint32_t connection, uint32_t channel, const void* message, uint32_t size)
+{
+    using namespace detail::network;
+    auto data = transportStorage.get(transport.id);
+    if (!data || connection >= data->connections.size() || !data->connections[connection] || 
+        !data->connections[connection]->active || channel >= data->settings.channelCount || 
+        size > data->settings.maxMessageSize) return false;
+
+    ChannelState& state = data->connections[connection]->channels[channel];
+    // Two batches of buffers are kept for sending and receiving, or queued messages could leave
+    // none to send them or to receive their acks.
+    uint32_t fragments = size <= fragmentBytes ? 1 : (size + fragmentBytes - 1) / fragmentBytes;
+    if (fragments + 2 * data->settings.batchSize > data->freePackets.size())
+    {
+        data->stats.poolExhausted++;
+        return false;
+    }
+    bool reliable = state.type == ChannelType::Reliable;
+    if (reliable && (uint16_t) (state.nextSequence - state.oldestUnacked) + fragments > reliableWindow) return false;
+
+    // Unreliable fragments share the id of their message.
+    uint16_t id = state.nextSequence;
+    if (!reliable) state.nextSequence++;
+    for (uint32_t fragment = 0; fragment < fragments; fragment++)
+    {
+        uint32_t offset = fragment * fragmentBytes;
+        uint32_t pieceSize = std::min(size - offset, fragmentBytes);
+        uint32_t packet = takePacket(*data);
+        memcpy(packetData(*data, packet), (const uint8_t*) message + offset, pieceSize);
+        QueuedMessage queued = { packet, (uint16_t) pieceSize, id, (uint8_t) fragment, (uint8_t) (fragments - 1), false, 0 };
+        if (reliable)
+        {
+            queued.sequence = state.nextSequence++;
+            state.window[queued.sequence % reliableWindow] = queued;
+        }
+        else
+        {
+            state.queue.push_back(queued);
+        }
+    }
+    return true;
+}
+
+void tiny_engine::sendPackets(Transport transport)
+{
+    TE_PROFILE_SCOPE("sendPackets");
+    using namespace detail::network;
+    auto data = transportStorage.get(transport.id);
+    if (!data) return;
+    double now = networkSeconds();
+    for (uint32_t i = 0; i < data->connections.size(); i++)
+    {
+        if (data->connections[i] && data->connections[i]->active) writePackets(*data, i, now);
+    }
+    if (!data->batchPackets.empty()) sendBatch(*data);
+}
+
+void tiny_engine::receivePackets(Transport transport)
+{
+    TE_PROFILE_SCOPE("receivePackets");
+    using namespace detail::network;
+    auto data = transportStorage.get(transport.id);
+    if (!data) return;
+    data->events.clear();
+    data->nextEvent = 0;
+    data->eventBytes.clear();
+    for (uint32_t packet : data->heldPackets) releasePacket(*data, packet);
+    data->heldPackets.clear();
+
+    double now = networkSeconds();
+    while (true)
+    {
+        uint32_t count = std::min(data->settings.batchSize, (uint32_t) data->freePackets.size());
+        if (count == 0)
+        {
+            data->stats.poolExhausted++;
+            break;
+        }
+        for (uint32_t i = 0; i < count; i++) data->batchPackets.push_back(takePacket(*data));
+        uint32_t received = receiveBatch(*data);
+        for (uint32_t i = 0; i < received; i++)
+        {
+            uint32_t packet = data->batchPackets[i];
+            uint32_t size = data->batchSizes[i];
+            const uint8_t* bytes = packetData(*data, packet);
+            data->stats.packetsReceived++;
+            data->stats.bytesReceived += size;
+            bool held = false;
+            if (size >= packetHeaderBytes && readU16(bytes) == protocolId)
+            {
+                NetAddress from = data->batchAddresses[i];
+                auto found = data->connectionOf.find(addressKey(from));
+                uint32_t connection = noConnection;
+                if (found != data->connectionOf.end())
+                {
+                    connection = found->second;
+                }
+                else if (data->settings.acceptConnections)
+                {
+                    connection = openConnection(transport, from);
+                    if (connection != noConnection) pushNetEvent(*data, NetEventType::Connected, connection, 0, nullptr, 0);
+                }
+                if (connection != noConnection) held = processPacket(*data, connection, bytes, size, now);
+                else data->stats.packetsIgnored++;
+            }
+            else
+            {
+                data->stats.packetsIgnored++;
+            }
+            if (held) data->heldPackets.push_back(packet);
+            else releasePacket(*data, packet);
+        }
+        for (uint32_t i = received; i < count; i++) releasePacket(*data, data->batchPackets[i]);
+        data->batchPackets.clear();
+        data->batchSizes.clear();
+        data->batchAddresses.clear();
+        if (received < count) break;
+    }
+
+    for (uint32_t i = 0; i < data->connections.size(); i++)
+    {
+        auto& connection = data->connections[i];
+        if (!connection || !connection->active || now - connection->lastReceived <= data->settings.timeoutSeconds) continue;
+        resetConnection(*data, i);
+        pushNetEvent(*data, NetEventType::Disconnected, i, 0, nullptr, 0);
+    }
+}
+
+bool tiny_engine::nextNetEvent(Transport transport, NetEvent& event)
+{
+    using namespace detail::network;
+    auto data = transportStorage.get(transport.id);
+    if (!data || data->nextEvent == data->events.size()) return false;
+    const PendingEvent& pending = data->events[data->nextEvent++];
+    event = pending.event;
+    if (pending.assembledOffset != noOffset) event.data = data->eventBytes.data() + pending.assembledOffset;
+    return true;
+}
+
+tiny_engine::TransportStats tiny_engine::getTransportStats(Transport transport)
+{
+    using namespace detail::network;
+    auto data = transportStorage.get(transport.id);
+    if (!data) return TransportStats {};
+    TransportStats stats = data->stats;
+    stats.freePackets = (uint32_t) data->freePackets.size();
+    stats.connectionCount = (uint32_t) data->connectionOf.size();
+    return stats;
+}
+#endif
+
+// ----------------------------------------------------------------------------
+// Texture loading
+//
+
+bool tiny_engine::detail::readFile(const std::string& fileName, std::vector<uint8_t>& contents)
+{
+    FILE* file = fopen(fileName.c_str(), "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    bool ok = size >= 0;
+    if (ok) 
+    {
+        contents.resize(size);
+        ok = fread(contents.data(), 1, size, file) == (size_t) size;
+    }
+    fclose(file);
+    return ok;
+}
+
+bool tiny_engine::detail::decodeImage(const uint8_t* data, size_t size, DecodedImage& image)
+{
+    uint32_t width = 0, height = 0;
+    if (png::readSize(data, size, width, height)) 
+    {
+        image.width = width;
+        image.height = height;
+        image.pixels.resize((size_t) width * height * 4);
+        return png::decode(data, size, image.pixels.data(), width * 4);
+    }
+    if (qoi::readSize(data, size, width, height)) 
+    {
+        image.width = width;
+        image.height = height;
+        image.pixels.resize((size_t) width * height * 4);
+        return qoi::decode(data, size, image.pixels.data(), width * 4);
+    }
+    return false;
+}
+
+bool tiny_engine::detail::decodeImageFile(const std::string& fileName, DecodedImage& image)
+{
+    // The file buffer is reused by every decode on this thread, unless it got big.
+    thread_local std::vector<uint8_t> contents;
+    ScratchTrim<uint8_t> trimContents { contents };
+    if (!readFile(fileName, contents)) return false;
+
+    if (png::isPNG(contents.data(), contents.size()) || qoi::isQOI(contents.data(), contents.size())) 
+    {
+        return decodeImage(contents.data(), contents.size(), image);
+    }
+#ifdef _WIN32
+    return wic::decodeImageFile(fileName, image);
+#else
+    return false;
+#endif
+}
+
+tiny_engine::detail::TextureLoader::TextureLoader(DecodeFunction decode, UploadSink upload, 
+                                                  uint32_t threadCount)
+    : decode(std::move(decode)), upload(std::move(upload)), workers(threadCount)
+{
+}
+
+uint32_t tiny_engine::detail::TextureLoader::request(const std::string& fileName)
+{
+    uint32_t handle = requests.insert(Request { TextureLoadState::Pending, 0, Clock::now() });
+    loadStats.requested++;
+
+    workers.submit([this, handle, fileName]() {
+        TE_PROFILE_SCOPE("TextureLoader decode");
+        auto start = Clock::now();
+        Decoded result { handle, false, 0, {} };
+        // Running out of memory on one file is just a failed load, 
+        // an exception escaping a worker would terminate the game.
+        try 
+        {
+            result.succeeded = decode(fileName, result.image);
+        }
+        catch (const std::exception& e) 
+        {
+            std::cerr << "Failed to decode " << fileName << ": " << e.what() << std::endl;
+            result.succeeded = false;
+            result.image = {};
+        }
+        result.decodeMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(decodedMutex);
+        decoded.push_back(std::move(result));
+    });
+    return handle;
+}
+
+uint32_t tiny_engine::detail::TextureLoader::processUploads()
+{
+    uint32_t finalized = 0;
+    size_t bytes = 0;
+    while (finalized < uploadBudget.maxTexturesPerFrame) 
+    {
+        Decoded next;
+        {
+            std::lock_guard<std::mutex> lock(decodedMutex);
+            if (decoded.empty()) break;
+            // The first texture is always taken, so big ones cannot starve.
+            size_t size = decoded.front().image.pixels.size();
+            if (finalized > 0 && bytes + size > uploadBudget.maxBytesPerFrame) break;
+            next = std::move(decoded.front());
+            decoded.pop_front();
+            bytes += size;
+        }
+
+        totalDecodeTime += next.decodeMilliseconds;
+        uint32_t textureId = 0;
+        if (next.succeeded) 
+        {
+            auto start = Clock::now();
+            textureId = upload(next.image);
+            totalUploadTime += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            uploads++;
+        }
+        finish(next.requestHandle, textureId != 0, textureId);
+        finalized++;
+    }
+    return finalized;
+}
+
+void tiny_engine::detail::TextureLoader::finish(uint32_t requestHandle, bool succeeded, uint32_t textureId)
+{
+    Request* request = requests.get(requestHandle);
+    if (!request) return;
+    request->state = succeeded ? TextureLoadState::Ready : TextureLoadState::Failed;
+    request->textureId = textureId;
+
+    double latency = std::chrono::duration<double, std::milli>(Clock::now() - request->start).count();
+    if (succeeded) loadStats.completed++; else loadStats.failed++;
+    uint32_t finished = loadStats.completed + loadStats.failed;
+    totalLatency += latency;
+    loadStats.lastLatency = latency;
+    loadStats.maxLatency = std::max(loadStats.maxLatency, latency);
+    loadStats.averageLatency = totalLatency / finished;
+    loadStats.averageDecodeTime = totalDecodeTime / finished;
+    loadStats.averageUploadTime = uploads > 0 ? totalUploadTime / uploads : 0;
+}
+
+tiny_engine::TextureLoadState tiny_engine::detail::TextureLoader::state(uint32_t requestHandle) const
+{
+    const Request* request = requests.get(requestHandle);
+    return request ? request->state : TextureLoadState::Failed;
+}
+
+uint32_t tiny_engine::detail::TextureLoader::textureId(uint32_t requestHandle) const
+{
+    const Request* request = requests.get(requestHandle);
+    return request && request->state == TextureLoadState::Ready ? request->textureId : 0;
+}
+
+bool tiny_engine::detail::TextureLoader::release(uint32_t requestHandle)
+{
+    const Request* request = requests.get(requestHandle);
+    if (!request || request->state == TextureLoadState::Pending) return false;
+    return requests.erase(requestHandle);
+}
+
+// ----------------------------------------------------------------------------
+// zlib inflate
+//
+
+namespace tiny_engine::detail::zlib {
+
+    // Canonical huffman decoding table. Codes up to fastBits long are 
+    // resolved with one lookup, longer ones with a search over the code lengths.
+    constexpr int fastBits = 9;
+
+    struct Huffman 
+    {
+        uint16_t fast[1 << fastBits];   // (length << 9) | symbol, 0 = not in the fast table
+        uint16_t firstCode[16];
+        uint16_t firstSymbol[16];
+        uint32_t maxCode[17];           // first code past each length, shifted to 16 bits
+        uint8_t lengths[288];
+        uint16_t symbols[288];
+    };
+
+    struct BitReader 
+    {
+        const uint8_t* data;
+        const uint8_t* end;
+        uint64_t bits = 0;
+        int count = 0;
+        bool overrun = false;
+
+        void refill() 
+        {
+            while (count <= 56) 
+            {
+                if (data < end) bits |= (uint64_t) *data++ << count;
+                else if (count == 0) { overrun = true; return; }
+                else return;
+                count += 8;
+            }
+        }
+
+        uint32_t read(int n) 
+        {
+            if (count < n) refill();
+            if (count < n) { overrun = true; return 0; }
+            uint32_t value = (uint32_t) (bits & ((1ull << n) - 1));
+            bits >>= n;
+            count -= n;
+            return value;
+        }
+    };
+
+    inline uint32_t reverseBits(uint32_t v, int n)
+    {
+        v = ((v & 0xAAAA) >> 1) | ((v & 0x5555) << 1);
+        v = ((v & 0xCCCC) >> 2) | ((v & 0x3333) << 2);
+        v = ((v & 0xF0F0) >> 4) | ((v & 0x0F0F) << 4);
+        v = ((v & 0xFF00) >> 8) | ((v & 0x00FF) << 8);
+        return v >> (16 - n);
+    }
+
+    inline bool buildHuffman(Huffman& h, const uint8_t* codeLengths, int count)
+    {
+        int lengthCounts[17] = {};
+        memset(h.fast, 0, sizeof(h.fast));
+        for (int i = 0; i < count; i++) lengthCounts[codeLengths[i]]++;
+        lengthCounts[0] = 0;
+
+        int nextCode[16];
+        int code = 0, symbol = 0;
+        for (int len = 1; len < 16; len++) 
+        {
+            nextCode[len] = code;
+            h.firstCode[len] = (uint16_t) code;
+            h.firstSymbol[len] = (uint16_t) symbol;
+            code += lengthCounts[len];
+            if (lengthCounts[len] && code - 1 >= (1 << len)) return false;
+            h.maxCode[len] = code << (16 - len);
+            code <<= 1;
+            symbol += lengthCounts[len];
+        }
+        h.maxCode[16] = 0x10000;
+
+        for (int i = 0; i < count; i++) 
+        {
+            int len = codeLengths[i];
+            if (!len) continue;
+            int slot = nextCode[len] - h.firstCode[len] + h.firstSymbol[len];
+            h.lengths[slot] = (uint8_t) len;
+            h.symbols[slot] = (uint16_t) i;
+            if (len <= fastBits) 
+            {
+                for (int j = reverseBits(nextCode[len], len); j < (1 << fastBits); j += (1 << len)) 
+                {
+                    h.fast[j] = (uint16_t) ((len << fastBits) | i);
+                }
+            }
+            nextCode[len]++;
+        }
+        return true;
+    }
+
+    inline int decodeSymbol(BitReader& in, const Huffman& h)
+    {
+        if (in.count < 16) in.refill();
+        uint32_t entry = h.fast[in.bits & ((1 << fastBits) - 1)];
+        if (entry) 
+        {
+            int len = entry >> fastBits;
+            if (len > in.count) { in.overrun = true; return -1; }
+            in.bits >>= len;
+            in.count -= len;
+            return entry & ((1 << fastBits) - 1);
+        }
+
+        uint32_t k = reverseBits((uint32_t) (in.bits & 0xffff), 16);
+        int len = fastBits + 1;
+        while (len < 16 && k >= h.maxCode[len]) len++;
+        if (len >= 16 || len > in.count) return -1;
+        int slot = (k >> (16 - len)) - h.firstCode[len] + h.firstSymbol[len];
+        if (slot >= 288 || h.lengths[slot] != len) return -1;
+        in.bits >>= len;
+        in.count -= len;
+        return h.symbols[slot];
+    }
+
+    constexpr uint16_t lengthBase[31] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 
+                                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0 };
+    constexpr uint8_t lengthExtra[31] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 
+                                          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0, 0, 0 };
+    constexpr uint16_t distanceBase[32] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 
+                                            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 
+                                            8193, 12289, 16385, 24577, 0, 0 };
+    constexpr uint8_t distanceExtra[32] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 
+                                            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 0, 0 };
+}
+
+bool tiny_engine::detail::zlib::inflate(const uint8_t* data, size_t size, uint8_t* out, size_t outSize)
+{
+    if (size < 2) return false;
+    // Deflate compression, no preset dictionary.
+    if ((data[0] & 0x0f) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 0x20)) return false;
+
+    BitReader in { data + 2, data + size };
+    size_t written = 0;
+    // Both tables are big-ish, keep them off the (worker) stacks.
+    thread_local Huffman literals;
+    thread_local Huffman distances;
+
+    bool finalBlock = false;
+    while (!finalBlock) 
+    {
+        finalBlock = in.read(1);
+        uint32_t type = in.read(2);
+        if (in.overrun) return false;
+
+        if (type == 0) 
+        {
+            // Stored block: byte aligned LEN, NLEN, then raw bytes.
+            in.read(in.count & 7);
+            uint32_t len = in.read(16);
+            uint32_t nlen = in.read(16);
+            if (in.overrun || (len ^ 0xffff) != nlen || written + len > outSize) return false;
+            // Whatever is still buffered comes first.
+            while (len > 0 && in.count >= 8) 
+            {
+                out[written++] = (uint8_t) in.read(8);
+                len--;
+            }
+            if ((size_t) (in.end - in.data) < len) return false;
+            memcpy(out + written, in.data, len);
+            in.data += len;
+            written += len;
+            continue;
+        }
+
+        if (type == 1) 
+        {
+            uint8_t codeLengths[288 + 32];
+            memset(codeLengths, 8, 144);
+            memset(codeLengths + 144, 9, 112);
+            memset(codeLengths + 256, 7, 24);
+            memset(codeLengths + 280, 8, 8);
+            memset(codeLengths + 288, 5, 32);
+            buildHuffman(literals, codeLengths, 288);
+            buildHuffman(distances, codeLengths + 288, 32);
+        }
+        else if (type == 2) 
+        {
+            static constexpr uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+            uint32_t literalCount = in.read(5) + 257;
+            uint32_t distanceCount = in.read(5) + 1;
+            uint32_t codeLengthCount = in.read(4) + 4;
+
+            uint8_t codeLengthLengths[19] = {};
+            for (uint32_t i = 0; i < codeLengthCount; i++) codeLengthLengths[order[i]] = (uint8_t) in.read(3);
+            Huffman codeLengthCodes;
+            if (in.overrun || !buildHuffman(codeLengthCodes, codeLengthLengths, 19)) return false;
+
+            uint8_t codeLengths[288 + 32];
+            uint32_t n = 0;
+            while (n < literalCount + distanceCount) 
+            {
+                int symbol = decodeSymbol(in, codeLengthCodes);
+                if (symbol < 0) return false;
+                if (symbol < 16) 
+                {
+                    codeLengths[n++] = (uint8_t) symbol;
+                    continue;
+                }
+                uint8_t fill = 0;
+                uint32_t repeat;
+                if (symbol == 16) 
+                {
+                    if (n == 0) return false;
+                    fill = codeLengths[n - 1];
+                    repeat = in.read(2) + 3;
+                }
+                else if (symbol == 17) repeat = in.read(3) + 3;
+                else repeat = in.read(7) + 11;
+                if (n + repeat > literalCount + distanceCount) return false;
+                memset(codeLengths + n, fill, repeat);
+                n += repeat;
+            }
+            if (in.overrun || codeLengths[256] == 0) return false;
+            if (!buildHuffman(literals, codeLengths, literalCount)) return false;
+            if (!buildHuffman(distances, codeLengths + literalCount, distanceCount)) return false;
+        }
+        else 
+        {
+            return false;
+        }
+
+        while (true) 
+        {
+            int symbol = decodeSymbol(in, literals);
+            if (symbol < 0) return false;
+            if (symbol < 256) 
+            {
+                if (written >= outSize) return false;
+                out[written++] = (uint8_t) symbol;
+                continue;
+            }
+            if (symbol == 256) break;
+
+            symbol -= 257;
+            if (symbol >= 29) return false;
+            uint32_t length = lengthBase[symbol] + in.read(lengthExtra[symbol]);
+            int distanceSymbol = decodeSymbol(in, distances);
+            if (distanceSymbol < 0 || distanceSymbol >= 30) return false;
+            uint32_t distance = distanceBase[distanceSymbol] + in.read(distanceExtra[distanceSymbol]);
+            if (in.overrun || distance > written || written + length > outSize) return false;
+
+            uint8_t* dst = out + written;
+            const uint8_t* src = dst - distance;
+            if (distance >= length) memcpy(dst, src, length);
+            else for (uint32_t i = 0; i < length; i++) dst[i] = src[i];   // overlapping run
+            written += length;
+        }
+    }
+    return written == outSize;
+}
+
+// ----------------------------------------------------------------------------
+// PNG decoding
+//
 
-            std::string getSpriteVertexShaderSource();
-            std::string getSpritePixelShaderSource();
+namespace tiny_engine::detail::png {
 
-            ComPtr<ID3D11Device> dx11Device;
-            ComPtr<ID3D11DeviceContext> dx11Context;
-            ComPtr<ID3D11Debug> dx11Debug;
-            ComPtr<IDXGISwapChain> dx11SwapChain;
-            ComPtr<ID3D11Texture2D> dx11BackBuffer;
-            ComPtr<ID3D11Texture2D> dx11DepthStencilBuffer;
-            ComPtr<ID3D11DepthStencilView> dx11DepthStencilView;
-            ComPtr<ID3D11RenderTargetView> dx11rtv;
-            ComPtr<ID3D11DepthStencilState> dx11DepthStencilState;
-            ComPtr<ID3D11RasterizerState> dx11RasterState;
-            ComPtr<ID3D11SamplerState> dx11SamplerState;
-            ComPtr<ID3D11BlendState> dx11BlendState;
+    inline uint32_t readBigEndian32(const uint8_t* p)
+    {
+        return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+    }
 
-            ComPtr<IDWriteFactory> dwriteFactory;
-            ComPtr<IDWriteTextFormat> textFormat;
-            ComPtr<ID2D1Factory> d2dFactory;
-            ComPtr<ID2D1RenderTarget> d2dRenderTarget;
-            ComPtr<ID2D1SolidColorBrush> blackBrush;
+    inline uint8_t paethPredictor(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a);
+        int pb = std::abs(p - b);
+        int pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) return (uint8_t) a;
+        if (pb <= pc) return (uint8_t) b;
+        return (uint8_t) c;
+    }
 
-            ResourceStorage<DX11Texture> textureStorage;
-            ResourceStorage<ShaderProgram> shaderProgramStorage;
-            ResourceStorage<VertexShader> vertexShaderStorage;
-            ResourceStorage<PixelShader> pixelShaderStorage;
-            ResourceStorage<Sampler> samplerStorage;
-            ResourceStorage<Model> modelStorage;
-            ResourceStorage<ConstantBuffer> constantBufferStorage;
-            ResourceStorage<InputLayout> inputLayoutStorage;
+#if defined(TE_SIMD_SSE2)
+    // Pixel at a time SSE2 reconstruction for 3 and 4 byte pixels.
+    // Only the previous pixel of the same row is a true dependency, 
+    // all channels of a pixel are handled at once.
+    inline __m128i loadPixel(const uint8_t* p, uint32_t bytesPerPixel)
+    {
+        if (bytesPerPixel == 4) 
+        {
+            int32_t v;
+            memcpy(&v, p, 4);
+            return _mm_cvtsi32_si128(v);
+        }
+        uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+        return _mm_cvtsi32_si128((int) v);
+    }
+
+    inline void storePixel(uint8_t* p, __m128i v, uint32_t bytesPerPixel)
+    {
+        int32_t bits = _mm_cvtsi128_si32(v);
+        memcpy(p, &bits, bytesPerPixel);
+    }
+
+    inline void unfilterSubSSE2(uint8_t* row, size_t rowBytes, uint32_t bpp)
+    {
+        __m128i a = _mm_setzero_si128();
+        for (size_t i = 0; i < rowBytes; i += bpp) 
+        {
+            a = _mm_add_epi8(a, loadPixel(row + i, bpp));
+            storePixel(row + i, a, bpp);
+        }
+    }
+
+    inline void unfilterAverageSSE2(uint8_t* row, const uint8_t* prior, size_t rowBytes, uint32_t bpp)
+    {
+        const __m128i one = _mm_set1_epi8(1);
+        __m128i a = _mm_setzero_si128();
+        for (size_t i = 0; i < rowBytes; i += bpp) 
+        {
+            __m128i b = loadPixel(prior + i, bpp);
+            // floor((a + b) / 2): avg_epu8 rounds up, undo that where a + b is odd.
+            __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            a = _mm_add_epi8(loadPixel(row + i, bpp), average);
+            storePixel(row + i, a, bpp);
+        }
+    }
+
+    inline void unfilterPaethSSE2(uint8_t* row, const uint8_t* prior, size_t rowBytes, uint32_t bpp)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        auto absolute = [&](__m128i x) { return _mm_max_epi16(x, _mm_sub_epi16(zero, x)); };
+        auto select = [](__m128i mask, __m128i a, __m128i b) { 
+            return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); 
+        };
+
+        __m128i a = zero, c = zero;
+        for (size_t i = 0; i < rowBytes; i += bpp) 
+        {
+            __m128i b = _mm_unpacklo_epi8(loadPixel(prior + i, bpp), zero);
+            __m128i x = _mm_unpacklo_epi8(loadPixel(row + i, bpp), zero);
+
+            // pa = |p - a| = |b - c|, pb = |p - b| = |a - c|, pc = |p - c| = |a + b - 2c|
+            __m128i pa = _mm_sub_epi16(b, c);
+            __m128i pb = _mm_sub_epi16(a, c);
+            __m128i pc = absolute(_mm_add_epi16(pa, pb));
+            pa = absolute(pa);
+            pb = absolute(pb);
+            __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+            // Ties favor a over b over c.
+            __m128i nearest = select(_mm_cmpeq_epi16(smallest, pa), a, 
+                                     select(_mm_cmpeq_epi16(smallest, pb), b, c));
+            x = _mm_add_epi8(x, nearest);
+            x = _mm_and_si128(x, _mm_set1_epi16(0xff));
+            storePixel(row + i, _mm_packus_epi16(x, x), bpp);
+            a = x;
+            c = b;
+        }
+    }
+#endif
+
+    struct Header 
+    {
+        uint32_t width;
+        uint32_t height;
+        uint8_t bitDepth;
+        uint8_t colorType;
+        uint8_t interlace;
+    };
+
+    inline bool readHeader(const uint8_t* data, size_t size, Header& header)
+    {
+        if (!isPNG(data, size) || size < 33) return false;
+        if (readBigEndian32(data + 8) != 13 || memcmp(data + 12, "IHDR", 4) != 0) return false;
+        header.width = readBigEndian32(data + 16);
+        header.height = readBigEndian32(data + 20);
+        header.bitDepth = data[24];
+        header.colorType = data[25];
+        header.interlace = data[28];
+        if (header.width == 0 || header.height == 0 || 
+            header.width > (1u << 24) || header.height > (1u << 24) || 
+            (uint64_t) header.width * header.height > maxImagePixels) return false;
+        if (data[26] != 0 || data[27] != 0 || header.interlace > 1) return false;
+
+        switch (header.colorType) 
+        {
+            case 0: return header.bitDepth == 1 || header.bitDepth == 2 || header.bitDepth == 4 || 
+                           header.bitDepth == 8 || header.bitDepth == 16;
+            case 3: return header.bitDepth == 1 || header.bitDepth == 2 || header.bitDepth == 4 || 
+                           header.bitDepth == 8;
+            case 2: case 4: case 6: return header.bitDepth == 8 || header.bitDepth == 16;
+            default: return false;
+        }
+    }
+
+    inline uint32_t channelCount(uint8_t colorType)
+    {
+        switch (colorType) 
+        {
+            case 2: return 3;
+            case 4: return 2;
+            case 6: return 4;
+            default: return 1;
+        }
+    }
+
+    // Adam7 passes as x/y start and step, a single full pass if not interlaced.
+    struct Pass { uint32_t x, y, dx, dy; };
+    constexpr Pass adam7[7] = { {0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4}, 
+                                {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2} };
+    constexpr Pass progressive[1] = { {0, 0, 1, 1} };
+
+    // The best case of deflate, a 258 byte match in under 2 bits.
+    constexpr uint64_t maxDeflateRatio = 1032;
+
+    // Size of the filtered scanlines of all passes, as inflated from the IDAT chunks.
+    inline size_t rawSize(const Header& header)
+    {
+        const Pass* passes = header.interlace ? adam7 : progressive;
+        int passCount = header.interlace ? 7 : 1;
+        uint32_t bitsPerPixel = channelCount(header.colorType) * header.bitDepth;
+
+        size_t size = 0;
+        for (int p = 0; p < passCount; p++) 
+        {
+            if (header.width <= passes[p].x || header.height <= passes[p].y) continue;
+            size_t w = (header.width - passes[p].x + passes[p].dx - 1) / passes[p].dx;
+            size_t h = (header.height - passes[p].y + passes[p].dy - 1) / passes[p].dy;
+            size += h * (1 + (w * bitsPerPixel + 7) / 8);
+        }
+        return size;
+    }
+}
+
+bool tiny_engine::detail::png::isPNG(const uint8_t* data, size_t size)
+{
+    static constexpr uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    return size >= 8 && memcmp(data, signature, 8) == 0;
+}
+
+bool tiny_engine::detail::png::readSize(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height)
+{
+    Header header;
+    if (!readHeader(data, size, header)) return false;
+
+    // Deflate cannot do better than about 1032:1, so a header promising far 
+    // more pixels than the IDAT chunks could possibly hold is bogus. 
+    uint64_t compressedSize = 0;
+    size_t pos = 8;
+    while (pos + 12 <= size) 
+    {
+        uint32_t length = readBigEndian32(data + pos);
+        if (length > size - pos - 12) return false;
+        if (memcmp(data + pos + 4, "IDAT", 4) == 0) compressedSize += length;
+        else if (memcmp(data + pos + 4, "IEND", 4) == 0) break;
+        pos += length + 12;
+    }
+    if (rawSize(header) > compressedSize * maxDeflateRatio) return false;
+
+    width = header.width;
+    height = header.height;
+    return true;
+}
+
+void tiny_engine::detail::png::unfilterRow(uint8_t filter, uint8_t* row, const uint8_t* prior, 
+                                           size_t rowBytes, uint32_t bpp)
+{
+    switch (filter) 
+    {
+        case 0: 
+            return;
+
+        case 1: 
+#if defined(TE_SIMD_SSE2)
+            if (bpp == 3 || bpp == 4) { unfilterSubSSE2(row, rowBytes, bpp); return; }
+#endif
+            for (size_t i = bpp; i < rowBytes; i++) row[i] += row[i - bpp];
+            return;
+
+        case 2: 
+        {
+            // No dependency between the bytes, 16 at a time.
+            size_t i = 0;
+#if defined(TE_SIMD_SSE2)
+            for (; i + 16 <= rowBytes; i += 16) 
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*) (row + i));
+                __m128i b = _mm_loadu_si128((const __m128i*) (prior + i));
+                _mm_storeu_si128((__m128i*) (row + i), _mm_add_epi8(x, b));
+            }
+#elif defined(TE_SIMD_NEON)
+            for (; i + 16 <= rowBytes; i += 16) 
+            {
+                vst1q_u8(row + i, vaddq_u8(vld1q_u8(row + i), vld1q_u8(prior + i)));
+            }
+#endif
+            for (; i < rowBytes; i++) row[i] += prior[i];
+            return;
+        }
+
+        case 3: 
+#if defined(TE_SIMD_SSE2)
+            if (bpp == 3 || bpp == 4) { unfilterAverageSSE2(row, prior, rowBytes, bpp); return; }
+#endif
+            for (size_t i = 0; i < bpp; i++) row[i] += prior[i] >> 1;
+            for (size_t i = bpp; i < rowBytes; i++) row[i] += (row[i - bpp] + prior[i]) >> 1;
+            return;
+
+        case 4: 
+#if defined(TE_SIMD_SSE2)
+            if (bpp == 3 || bpp == 4) { unfilterPaethSSE2(row, prior, rowBytes, bpp); return; }
+#endif
+            for (size_t i = 0; i < bpp; i++) row[i] += prior[i];
+            for (size_t i = bpp; i < rowBytes; i++) row[i] += paethPredictor(row[i - bpp], prior[i], prior[i - bpp]);
+            return;
+    }
+}
+
+bool tiny_engine::detail::png::decode(const uint8_t* data, size_t size, uint8_t* out, size_t rowPitch)
+{
+    Header header;
+    if (!readHeader(data, size, header)) return false;
+
+    // Gather the palette, transparency and the compressed data.
+    uint32_t palette[256];
+    for (int i = 0; i < 256; i++) palette[i] = 0xff000000;
+    bool hasColorKey = false;
+    uint16_t colorKey[3] = {};
+
+    thread_local std::vector<uint8_t> compressed;
+    ScratchTrim<uint8_t> trimCompressed { compressed };
+    compressed.clear();
+
+    size_t pos = 8;
+    while (pos + 12 <= size) 
+    {
+        uint32_t length = readBigEndian32(data + pos);
+        const uint8_t* type = data + pos + 4;
+        const uint8_t* chunk = data + pos + 8;
+        if (length > size - pos - 12) return false;
+
+        if (memcmp(type, "PLTE", 4) == 0) 
+        {
+            for (uint32_t i = 0; i < length / 3 && i < 256; i++) 
+            {
+                palette[i] = chunk[i * 3] | (chunk[i * 3 + 1] << 8) | (chunk[i * 3 + 2] << 16) | 0xff000000;
+            }
+        }
+        else if (memcmp(type, "tRNS", 4) == 0) 
+        {
+            if (header.colorType == 3) 
+            {
+                for (uint32_t i = 0; i < length && i < 256; i++) 
+                {
+                    palette[i] = (palette[i] & 0x00ffffff) | ((uint32_t) chunk[i] << 24);
+                }
+            }
+            else if ((header.colorType == 0 && length >= 2) || (header.colorType == 2 && length >= 6)) 
+            {
+                hasColorKey = true;
+                for (uint32_t i = 0; i < length / 2 && i < 3; i++) colorKey[i] = (chunk[i * 2] << 8) | chunk[i * 2 + 1];
+            }
+        }
+        else if (memcmp(type, "IDAT", 4) == 0) 
+        {
+            compressed.insert(compressed.end(), chunk, chunk + length);
+        }
+        else if (memcmp(type, "IEND", 4) == 0) 
+        {
+            break;
+        }
+        pos += length + 12;
+    }
+
+    size_t inflatedSize = rawSize(header);
+    if (inflatedSize > compressed.size() * maxDeflateRatio) return false;
+
+    const Pass* passes = header.interlace ? adam7 : progressive;
+    int passCount = header.interlace ? 7 : 1;
+
+    uint32_t channels = channelCount(header.colorType);
+    uint32_t bitsPerPixel = channels * header.bitDepth;
+    uint32_t bytesPerPixel = std::max(1u, bitsPerPixel / 8);
+
+    thread_local std::vector<uint8_t> raw;
+    ScratchTrim<uint8_t> trimRaw { raw };
+    raw.resize(inflatedSize);
+    if (!zlib::inflate(compressed.data(), compressed.size(), raw.data(), inflatedSize)) return false;
+
+    thread_local std::vector<uint8_t> zeroRow;
+    thread_local std::vector<uint8_t> samples;
+    thread_local std::vector<uint32_t> rgbaRow;
+    ScratchTrim<uint8_t> trimZeroRow { zeroRow };
+    ScratchTrim<uint8_t> trimSamples { samples };
+    ScratchTrim<uint32_t> trimRgbaRow { rgbaRow };
+    size_t maxRowBytes = ((size_t) header.width * bitsPerPixel + 7) / 8;
+    zeroRow.assign(maxRowBytes, 0);
+    samples.resize((size_t) header.width * channels);
+    rgbaRow.resize(header.width);
+
+    // Gray values of low bit depths are scaled up to 0..255.
+    static constexpr uint8_t grayScale[9] = { 0, 255, 85, 0, 17, 0, 0, 0, 1 };
+
+    uint8_t* row = raw.data();
+    for (int p = 0; p < passCount; p++) 
+    {
+        const Pass& pass = passes[p];
+        if (header.width <= pass.x || header.height <= pass.y) continue;
+        uint32_t passWidth = (header.width - pass.x + pass.dx - 1) / pass.dx;
+        uint32_t passHeight = (header.height - pass.y + pass.dy - 1) / pass.dy;
+        size_t rowBytes = ((size_t) passWidth * bitsPerPixel + 7) / 8;
+
+        const uint8_t* prior = zeroRow.data();
+        for (uint32_t y = 0; y < passHeight; y++) 
+        {
+            uint8_t filter = row[0];
+            uint8_t* line = row + 1;
+            if (filter > 4) return false;
+            unfilterRow(filter, line, prior, rowBytes, bytesPerPixel);
+
+            // Reduce the row to 8 bit samples.
+            const uint8_t* sample = line;
+            if (header.bitDepth < 8) 
+            {
+                uint32_t mask = (1u << header.bitDepth) - 1;
+                uint8_t scale = header.colorType == 3 ? 1 : grayScale[header.bitDepth];
+                for (uint32_t x = 0; x < passWidth; x++) 
+                {
+                    uint32_t bit = x * header.bitDepth;
+                    uint32_t value = (line[bit >> 3] >> (8 - header.bitDepth - (bit & 7))) & mask;
+                    samples[x] = (uint8_t) (value * scale);
+                }
+                sample = samples.data();
+            }
+            else if (header.bitDepth == 16) 
+            {
+                for (uint32_t i = 0; i < passWidth * channels; i++) samples[i] = line[i * 2];
+                sample = samples.data();
+            }
+
+            // Convert to RGBA, straight into the flipped output row if it is contiguous.
+            uint32_t outY = header.height - 1 - (pass.y + y * pass.dy);
+            uint32_t* target = pass.dx == 1 ? (uint32_t*) (out + outY * rowPitch) : rgbaRow.data();
+            switch (header.colorType) 
+            {
+                case 6: 
+                    memcpy(target, sample, (size_t) passWidth * 4);
+                    break;
+                case 2: 
+                    for (uint32_t x = 0; x < passWidth; x++) 
+                    {
+                        const uint8_t* s = sample + x * 3;
+                        target[x] = s[0] | (s[1] << 8) | (s[2] << 16) | 0xff000000;
+                    }
+                    break;
+                case 3: 
+                    for (uint32_t x = 0; x < passWidth; x++) target[x] = palette[sample[x]];
+                    break;
+                case 0: 
+                    for (uint32_t x = 0; x < passWidth; x++) target[x] = sample[x] * 0x010101u | 0xff000000;
+                    break;
+                case 4: 
+                    for (uint32_t x = 0; x < passWidth; x++) 
+                    {
+                        target[x] = sample[x * 2] * 0x010101u | ((uint32_t) sample[x * 2 + 1] << 24);
+                    }
+                    break;
+            }
+
+            // Color keyed transparency compares the original sample values.
+            if (hasColorKey) 
+            {
+                for (uint32_t x = 0; x < passWidth; x++) 
+                {
+                    bool keyed;
+                    if (header.bitDepth == 16) 
+                    {
+                        const uint8_t* s = line + x * channels * 2;
+                        keyed = ((s[0] << 8) | s[1]) == colorKey[0] && 
+                                (channels == 1 || (((s[2] << 8) | s[3]) == colorKey[1] && 
+                                                   ((s[4] << 8) | s[5]) == colorKey[2]));
+                    }
+                    else if (header.bitDepth == 8) 
+                    {
+                        const uint8_t* s = line + x * channels;
+                        keyed = s[0] == colorKey[0] && 
+                                (channels == 1 || (s[1] == colorKey[1] && s[2] == colorKey[2]));
+                    }
+                    else 
+                    {
+                        keyed = samples[x] / grayScale[header.bitDepth] == colorKey[0];
+                    }
+                    if (keyed) target[x] &= 0x00ffffff;
+                }
+            }
+
+            if (pass.dx != 1) 
+            {
+                uint32_t* outRow = (uint32_t*) (out + outY * rowPitch);
+                for (uint32_t x = 0; x < passWidth; x++) outRow[pass.x + x * pass.dx] = rgbaRow[x];
+            }
+
+            prior = line;
+            row += rowBytes + 1;
+        }
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// QOI decoding
+//
+
+bool tiny_engine::detail::qoi::isQOI(const uint8_t* data, size_t size)
+{
+    return size >= 14 && memcmp(data, "qoif", 4) == 0;
+}
+
+bool tiny_engine::detail::qoi::readSize(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height)
+{
+    if (!isQOI(data, size)) return false;
+    width = png::readBigEndian32(data + 4);
+    height = png::readBigEndian32(data + 8);
+    // A single byte covers at most 62 pixels (a run), so the data has to be 
+    // at least that long for the size in the header to be plausible.
+    uint64_t pixels = (uint64_t) width * height;
+    return width > 0 && height > 0 && width <= (1u << 24) && height <= (1u << 24) && 
+           pixels <= maxImagePixels && pixels <= (uint64_t) (size - 14) * 62;
+}
+
+bool tiny_engine::detail::qoi::decode(const uint8_t* data, size_t size, uint8_t* out, size_t rowPitch)
+{
+    uint32_t width, height;
+    if (!readSize(data, size, width, height)) return false;
+
+    uint32_t index[64] = {};
+    uint32_t px = 0xff000000;   // r, g, b = 0, a = 255
+    size_t pos = 14;
+    // The stream ends with 7 zero bytes and a 1.
+    size_t end = size >= 8 ? size - 8 : 0;
+    uint32_t run = 0;
+
+    for (uint32_t y = 0; y < height; y++) 
+    {
+        uint32_t* outRow = (uint32_t*) (out + (size_t) (height - 1 - y) * rowPitch);
+        for (uint32_t x = 0; x < width; x++) 
+        {
+            if (run > 0) 
+            {
+                run--;
+            }
+            else if (pos < end) 
+            {
+                uint8_t op = data[pos++];
+                if (op == 0xfe) 
+                {
+                    px = (px & 0xff000000) | data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16);
+                    pos += 3;
+                }
+                else if (op == 0xff) 
+                {
+                    px = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16) | ((uint32_t) data[pos + 3] << 24);
+                    pos += 4;
+                }
+                else 
+                {
+                    switch (op >> 6) 
+                    {
+                        case 0: 
+                            px = index[op];
+                            break;
+                        case 1: 
+                        {
+                            uint8_t r = (uint8_t) ((px & 0xff) + ((op >> 4) & 3) - 2);
+                            uint8_t g = (uint8_t) (((px >> 8) & 0xff) + ((op >> 2) & 3) - 2);
+                            uint8_t b = (uint8_t) (((px >> 16) & 0xff) + (op & 3) - 2);
+                            px = (px & 0xff000000) | r | (g << 8) | (b << 16);
+                            break;
+                        }
+                        case 2: 
+                        {
+                            int dg = (op & 0x3f) - 32;
+                            uint8_t next = data[pos++];
+                            uint8_t r = (uint8_t) ((px & 0xff) + dg - 8 + (next >> 4));
+                            uint8_t g = (uint8_t) (((px >> 8) & 0xff) + dg);
+                            uint8_t b = (uint8_t) (((px >> 16) & 0xff) + dg - 8 + (next & 0x0f));
+                            px = (px & 0xff000000) | r | (g << 8) | (b << 16);
+                            break;
+                        }
+                        case 3: 
+                            run = op & 0x3f;
+                            break;
+                    }
+                }
+                uint32_t r = px & 0xff, g = (px >> 8) & 0xff, b = (px >> 16) & 0xff, a = px >> 24;
+                index[(r * 3 + g * 5 + b * 7 + a * 11) % 64] = px;
+            }
+            else 
+            {
+                return false;
+            }
+            outRow[x] = px;
+        }
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Asset packs
+//
+
+std::string tiny_engine::detail::pack::normalizeName(const std::string& name)
+{
+    std::string normalized = name;
+    for (char& c : normalized) 
+    {
+        if (c == '\\') c = '/';
+        else if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+    }
+    return normalized;
+}
+
+uint64_t tiny_engine::detail::pack::hashName(const std::string& name)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : normalizeName(name)) 
+    {
+        hash ^= (uint8_t) c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint32_t tiny_engine::detail::pack::mipCount(uint32_t width, uint32_t height)
+{
+    uint32_t count = 1;
+    while ((width | height) >> count) count++;
+    return count;
+}
+
+uint64_t tiny_engine::detail::pack::mipOffset(uint32_t width, uint32_t height, uint32_t level)
+{
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < level; i++) 
+    {
+        uint64_t size = (uint64_t) std::max(1u, width >> i) * std::max(1u, height >> i) * 4;
+        offset += (size + payloadAlignment - 1) & ~(uint64_t) (payloadAlignment - 1);
+    }
+    return offset;
+}
+
+void tiny_engine::detail::pack::buildMipChain(const DecodedImage& image, std::vector<uint8_t>& payload)
+{
+    size_t base = payload.size();
+    uint32_t levels = mipCount(image.width, image.height);
+    payload.resize(base + mipOffset(image.width, image.height, levels));
+    memcpy(payload.data() + base, image.pixels.data(), image.pixels.size());
+
+    // Each level is filtered from the previous one. 
+    // Odd sizes clamp the 2x2 footprint at the last row/column.
+    for (uint32_t level = 1; level < levels; level++) 
+    {
+        uint32_t srcWidth = std::max(1u, image.width >> (level - 1));
+        uint32_t srcHeight = std::max(1u, image.height >> (level - 1));
+        uint32_t width = std::max(1u, image.width >> level);
+        uint32_t height = std::max(1u, image.height >> level);
+        const uint8_t* src = payload.data() + base + mipOffset(image.width, image.height, level - 1);
+        uint8_t* dst = payload.data() + base + mipOffset(image.width, image.height, level);
+
+        for (uint32_t y = 0; y < height; y++) 
+        {
+            const uint8_t* row0 = src + (size_t) std::min(y * 2, srcHeight - 1) * srcWidth * 4;
+            const uint8_t* row1 = src + (size_t) std::min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+            for (uint32_t x = 0; x < width; x++) 
+            {
+                uint32_t x0 = std::min(x * 2, srcWidth - 1) * 4;
+                uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1) * 4;
+                for (int c = 0; c < 4; c++) 
+                {
+                    dst[(y * width + x) * 4 + c] = (uint8_t) ((row0[x0 + c] + row0[x1 + c] + 
+                                                               row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+                }
+            }
+        }
+    }
+}
+
+tiny_engine::detail::pack::MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool tiny_engine::detail::pack::MappedFile::open(const std::string& fileName)
+{
+    close();
+#ifdef _WIN32
+    file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 
+                       FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) 
+    {
+        close();
+        return false;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) 
+    {
+        close();
+        return false;
+    }
+    view = (const uint8_t*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    length = (size_t) fileSize.QuadPart;
+#else
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) 
+    {
+        ::close(fd);
+        return false;
+    }
+    void* address = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive.
+    ::close(fd);
+    if (address == MAP_FAILED) return false;
+    view = (const uint8_t*) address;
+    length = (size_t) info.st_size;
+#endif
+    if (!view) 
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void tiny_engine::detail::pack::MappedFile::close()
+{
+#ifdef _WIN32
+    if (view) UnmapViewOfFile(view);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (view) munmap((void*) view, length);
+#endif
+    view = nullptr;
+    length = 0;
+}
+
+// The dimensions come from the file, so they are checked before any size is computed from them: 
+// bounded like decoded images, and no more mip levels than the full chain has, 
+// which also keeps the sums of mipOffset far from overflowing.
+static bool validDimensions(const tiny_engine::detail::pack::TocEntry& entry)
+{
+    using namespace tiny_engine::detail;
+    return entry.width > 0 && entry.height > 0 && 
+           (uint64_t) entry.width * entry.height <= maxImagePixels && 
+           entry.mipCount > 0 && entry.mipCount <= pack::mipCount(entry.width, entry.height);
+}
+
+bool tiny_engine::detail::pack::Archive::open(const std::string& fileName)
+{
+    if (!file.open(fileName)) return false;
+
+    // Validate the header and table once, lookups trust them afterwards.
+    FileHeader header;
+    if (file.size() < sizeof(header)) return false;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, magic, 4) != 0 || header.version != version) return false;
+    if (header.tocOffset % alignof(TocEntry) != 0 || header.tocOffset > file.size() || 
+        (file.size() - header.tocOffset) / sizeof(TocEntry) < header.entryCount || 
+        header.namesOffset > file.size()) return false;
+
+    toc = (const TocEntry*) (file.data() + header.tocOffset);
+    names = (const char*) (file.data() + header.namesOffset);
+    count = header.entryCount;
+    for (uint32_t i = 0; i < count; i++) 
+    {
+        const TocEntry& entry = toc[i];
+        if (entry.dataOffset % payloadAlignment != 0 || entry.dataOffset > file.size() || 
+            entry.dataSize > file.size() - entry.dataOffset || 
+            (uint64_t) entry.nameOffset + entry.nameLength > file.size() - header.namesOffset || 
+            entry.format != PixelFormat::RGBA8 || !validDimensions(entry) || 
+            entry.dataSize < mipOffset(entry.width, entry.height, entry.mipCount) || 
+            (i > 0 && toc[i - 1].nameHash > entry.nameHash)) 
+        {
+            file.close();
+            toc = nullptr;
+            count = 0;
+            return false;
+        }
+    }
+    return true;
+}
 
+const tiny_engine::detail::pack::TocEntry* tiny_engine::detail::pack::Archive::find(const std::string& name) const
+{
+    std::string normalized = normalizeName(name);
+    uint64_t hash = hashName(normalized);
+    auto first = std::lower_bound(toc, toc + count, hash, 
+                                  [](const TocEntry& entry, uint64_t h) { return entry.nameHash < h; });
+    // Hash collisions are resolved with the stored names.
+    for (auto entry = first; entry != toc + count && entry->nameHash == hash; entry++) 
+    {
+        if (normalized.size() == entry->nameLength && 
+            memcmp(names + entry->nameOffset, normalized.data(), entry->nameLength) == 0) return entry;
+    }
+    return nullptr;
+}
 
+bool tiny_engine::detail::pack::writeArchive(const std::string& fileName, const std::vector<CookedTexture>& textures)
+{
+    std::vector<uint8_t> data(sizeof(FileHeader));
+    std::vector<TocEntry> entries;
+    std::string nameTable;
 
-        }
+    for (const auto& texture : textures) 
+    {
+        data.resize((data.size() + payloadAlignment - 1) & ~(size_t) (payloadAlignment - 1));
+        std::string name = normalizeName(texture.name);
+        TocEntry entry = {};
+        entry.nameHash = hashName(name);
+        entry.dataOffset = data.size();
+        entry.nameOffset = (uint32_t) nameTable.size();
+        entry.nameLength = (uint32_t) name.size();
+        entry.width = texture.image.width;
+        entry.height = texture.image.height;
+        entry.mipCount = mipCount(texture.image.width, texture.image.height);
+        entry.format = PixelFormat::RGBA8;
+        buildMipChain(texture.image, data);
+        entry.dataSize = data.size() - entry.dataOffset;
+        entries.push_back(entry);
+        nameTable += name;
+    }
+    std::stable_sort(entries.begin(), entries.end(), 
+                     [](const TocEntry& a, const TocEntry& b) { return a.nameHash < b.nameHash; });
+
+    FileHeader header = {};
+    memcpy(header.magic, magic, 4);
+    header.version = version;
+    header.entryCount = (uint32_t) entries.size();
+    header.tocOffset = (data.size() + payloadAlignment - 1) & ~(size_t) (payloadAlignment - 1);
+    header.namesOffset = header.tocOffset + entries.size() * sizeof(TocEntry);
+    data.resize(header.tocOffset);
+    memcpy(data.data(), &header, sizeof(header));
+
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = ok && fwrite(entries.data(), sizeof(TocEntry), entries.size(), file) == entries.size();
+    ok = ok && fwrite(nameTable.data(), 1, nameTable.size(), file) == nameTable.size();
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
 
-        
+// ----------------------------------------------------------------------------
+// Shader cache
+//
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    for (size_t i = 0; i < size; i++) 
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
     }
+    return hash;
+}
 
+uint64_t tiny_engine::detail::shadercache::shaderKey(const std::string& source, const std::vector<Define>& defines, 
+                                                     const std::string& profile, uint32_t flags, 
+                                                     uint32_t compilerVersion)
+{
+    // The strings are hashed with their terminating zero, 
+    // so moving characters from one into the next gives a different key.
+    uint64_t hash = hashBytes(14695981039346656037ull, &version, sizeof(version));
+    hash = hashBytes(hash, source.c_str(), source.size() + 1);
+    for (const auto& define : defines) 
+    {
+        hash = hashBytes(hash, define.name.c_str(), define.name.size() + 1);
+        hash = hashBytes(hash, define.value.c_str(), define.value.size() + 1);
+    }
+    hash = hashBytes(hash, profile.c_str(), profile.size() + 1);
+    hash = hashBytes(hash, &flags, sizeof(flags));
+    return hashBytes(hash, &compilerVersion, sizeof(compilerVersion));
 }
 
+std::string tiny_engine::detail::shadercache::fileName(const std::string& directory, uint64_t key)
+{
+    char name[24];
+    snprintf(name, sizeof(name), "%016llx.cso", (unsigned long long) key);
+    return directory + "/" + name;
+}
 
+bool tiny_engine::detail::shadercache::load(const std::string& directory, uint64_t key, 
+                                            std::vector<uint8_t>& bytecode)
+{
+    std::vector<uint8_t> contents;
+    if (!readFile(fileName(directory, key), contents) || contents.size() < sizeof(FileHeader)) return false;
+    FileHeader header;
+    memcpy(&header, contents.data(), sizeof(header));
+    if (memcmp(header.magic, magic, 4) != 0 || header.version != version || header.key != key || 
+        header.size != contents.size() - sizeof(header)) 
+    {
+        return false;
+    }
+    if (hashBytes(14695981039346656037ull, contents.data() + sizeof(header), header.size) != header.checksum) return false;
+    bytecode.assign(contents.begin() + sizeof(header), contents.end());
+    return true;
+}
 
-// ----------------------------------------------------------------------------
-// Public API implementation
+bool tiny_engine::detail::shadercache::store(const std::string& directory, uint64_t key, 
+                                             const void* bytecode, size_t size)
+{
+    // Fails harmlessly if the directory already exists.
+#ifdef _WIN32
+    CreateDirectoryA(directory.c_str(), nullptr);
+    std::string temporary = fileName(directory, key) + "." + std::to_string(GetCurrentProcessId()) + ".tmp";
+#else
+    mkdir(directory.c_str(), 0755);
+    std::string temporary = fileName(directory, key) + "." + std::to_string(getpid()) + ".tmp";
+#endif
 
-namespace dx11 = tiny_engine::detail::dx11;
+    FileHeader header = {};
+    memcpy(header.magic, magic, 4);
+    header.version = version;
+    header.key = key;
+    header.size = size;
+    header.checksum = hashBytes(14695981039346656037ull, bytecode, size);
+
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(bytecode, 1, size, file) == size;
+    ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(temporary.c_str(), fileName(directory, key).c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(temporary.c_str(), fileName(directory, key).c_str()) == 0;
+#endif
+    if (!ok) remove(temporary.c_str());
+    return ok;
+}
 
-// Singleton of our dx11 internal context, holding resource ids etc.
-static dx11::InternalContext dx11InternalContext =  {};
+// ----------------------------------------------------------------------------
+// WIC image decoding
+//
+#ifdef _WIN32
 
-tiny_engine::GraphicsContext* tiny_engine::initGraphics(const std::string& api, 
-                                            tiny_engine::Window window) 
+bool tiny_engine::detail::wic::decodeImageFile(const std::string& fileName, DecodedImage& image)
 {
 
-    namespace ted = tiny_engine::detail;
-    if (api != "dx11") return nullptr;
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
 
-    if (tiny_engine::detail::dx11::init(window)) 
-    {
+    Microsoft::WRL::ComPtr<IWICImagingFactory> wic;
+    CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER,
+                     IID_PPV_ARGS(&wic));
 
-        dx11InternalContext.hwnd = (HWND) window.nativeWindowHandle;
+    ComPtr<IWICBitmapFlipRotator> flip;
+    wic->CreateBitmapFlipRotator(&flip);
 
-        auto dx11Context = new tiny_engine::GraphicsContext();
-        dx11Context->api = api;
+    Microsoft::WRL::ComPtr<IWICBitmapDecoder> dec;
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> convWide;
+    if (FAILED(wic->CreateDecoderFromFilename(convWide.from_bytes(fileName).c_str(), nullptr, GENERIC_READ,
+                                              WICDecodeMetadataCacheOnDemand, &dec)))
+    return false; 
 
-        // Next we create all secondary default resources we
-        // need to implement all api functions. 
-        // In particular we need:
-        // Shaders to render sprites and 3d models.
-        // 3d models may be animated and have light and shadow. 
-        // Sprites currently are unlit. 
-        // We need default input layouts for both sprites and 3d models,
-        // VertexBuffers for sprites etc.
-        auto spriteVertexShader = dx11::createVertexShaderFromSource(
-                dx11::getSpriteVertexShaderSource());
-        auto spritePixelShader = dx11::createPixelShaderFromSource(
-                dx11::getSpritePixelShaderSource());
-        auto spriteShaderProgram = new dx11::ShaderProgram {spriteVertexShader, spritePixelShader};
-        auto spriteVertexShaderId = dx11::vertexShaderStorage.store(spriteVertexShader);
-        auto spritePixelShaderId = dx11::pixelShaderStorage.store(spritePixelShader);
-        auto spriteShaderProgramId = dx11::shaderProgramStorage.store(spriteShaderProgram);
-        dx11InternalContext.spriteVertexShaderId = spriteVertexShaderId;
-        dx11InternalContext.spritePixelShaderId = spritePixelShaderId;
-        dx11InternalContext.spriteShaderId = spriteShaderProgramId;
+    ComPtr<IWICBitmapFrameDecode> frame;
+    dec->GetFrame(0, &frame);
 
-        auto defaultSampler = dx11::createSampler(D3D11_TEXTURE_ADDRESS_WRAP, DirectX::XMVECTOR{1, 1,1,1}, 
-                                                        D3D11_FILTER_MIN_MAG_MIP_LINEAR );
-        auto defaultSamplerId = dx11::samplerStorage.store(defaultSampler);
-        dx11InternalContext.spriteSamplerId = defaultSamplerId;
+    // Convert to straight RGBA (not pre-multiplied)
+    Microsoft::WRL::ComPtr<IWICFormatConverter> conv;
+    wic->CreateFormatConverter(&conv);
+    conv->Initialize(frame.Get(), GUID_WICPixelFormat32bppRGBA,
+                     WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeCustom);
 
-        std::vector<dx11::VertexAttributeDescription> positionUVAttributes =  {
-                            {"POSITION", 0, 3, DXGI_FORMAT_R32G32B32_FLOAT, sizeof(float) * 5, 0}, 
-                            {"TEXCOORD", 0, 2, DXGI_FORMAT_R32G32_FLOAT, sizeof(float) * 5, sizeof(float) * 3}
-                        };
-        auto spriteInputLayout = dx11::createInputLayout(positionUVAttributes, spriteShaderProgram);
-        auto spriteInputLayoutId = dx11::inputLayoutStorage.store(spriteInputLayout);
-        dx11InternalContext.spriteShaderInputLayoutId = spriteInputLayoutId;
+    flip->Initialize(conv.Get(), WICBitmapTransformFlipVertical);
 
-        // Creating the quad model for all sprites:
-        std::vector<float> quadVertices = {
-            -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,
-            0.5f, -0.5f, 0.0f, 1.0f, 0.0f,
-            -0.5f,  0.5f, 0.0f, 0.0f, 1.0f,
-            0.5, 0.5, 0.0f, 1.0f, 1.0f
+    UINT w = 0, h = 0;
+    flip->GetSize(&w, &h);
+    if ((uint64_t) w * h > maxImagePixels) return false;
+    image.width = w;
+    image.height = h;
+    image.pixels.resize(w * h * 4);
+    flip->CopyPixels(nullptr, w * 4, (UINT)image.pixels.size(), image.pixels.data());
+    return true;
+}
 
-        };
+#endif
 
+// ----------------------------------------------------------------------------
+// Null backend
+//
+#ifdef TE_NULL_GRAPHICS
 
-        std::vector<uint32_t> quadIndices = {
-            // 0,1, 2,
-            // 2, 1, 3
+void tiny_engine::detail::null::flushSpriteBatch()
+{
+    if (spriteBatch.empty()) return;
+    spriteBatch.build();
+    for (const auto& range : spriteBatch.ranges()) 
+    {
+        if (!textureStorage.get(range.textureId)) continue;
+        stateCache.change(StateCache::Shader, range.shaderId);
+        stateCache.change(StateCache::Texture, range.textureId);
+        frameRenderStats.drawCalls++;
+    }
+    spriteBatch.clear();
+}
+#endif
 
-                2,1,0, 
-                3,1,2
+// ----------------------------------------------------------------------------
+// Software rasterizer implementation
+//
+#ifdef TE_SOFTWARE
 
-        };
-        auto quadModel = dx11::createModelFromGeometry(quadVertices, 
-                                                        quadIndices, 
-                                                        D3D11_USAGE_DEFAULT, 5  * sizeof(float));
-        dx11InternalContext.quadModelId = dx11::modelStorage.store(quadModel);
+bool tiny_engine::detail::software::init(Window window)
+{
+    if (window.width <= 0 || window.height <= 0) return false;
 
-        // Create a constant buffer to hold the worldmatrix for object transformations:
-        auto objectTransformBuffer = dx11::createConstantBuffer(sizeof(DirectX::XMMATRIX));
-        dx11InternalContext.objectTransformBufferId = dx11::constantBufferStorage.store(objectTransformBuffer);
+    framebuffer.width = window.width;
+    framebuffer.height = window.height;
+    framebuffer.pixels.assign((size_t) window.width * window.height, 0);
 
-        // Default camera buffer setup, 
-        // this will hold the view/projection matrices in every shader.
-        auto cameraBuffer = dx11::createConstantBuffer(sizeof(DirectX::XMMATRIX) * 2);
-        dx11InternalContext.cameraBufferId = dx11::constantBufferStorage.store(cameraBuffer);
+    internalContext.viewWidth = (float) window.width;
+    internalContext.viewHeight = (float) window.height;
+    bindBackBuffer(0, 0, window.width, window.height);
 
-        // Setup a default projection and viewmatrix for our 2D rendering:
-        float viewWidth  = window.width;
-        float viewHeight = window.height;
-        float nearZ = 0.1f;
-        float farZ  = 100.0f;
+    tilesX = (framebuffer.width + tileSize - 1) / tileSize;
+    tilesY = (framebuffer.height + tileSize - 1) / tileSize;
+    tileQuads.resize(tilesX * tilesY);
 
-        auto ortho = DirectX::XMMatrixOrthographicLH(viewWidth, viewHeight, nearZ, farZ);
-        dx11InternalContext.orthoProjectionMatrix = ortho;
-        
-        DirectX::XMFLOAT4X4 orthoData;
-        DirectX::XMStoreFloat4x4(&orthoData, ortho);
-        DirectX::XMFLOAT4X4 viewData;
-        DirectX::XMStoreFloat4x4(&viewData, DirectX::XMMatrixIdentity());
-        dx11::Camera cam = { viewData, orthoData };
-        dx11::uploadConstantBufferDataForVertexShader(cameraBuffer->buffer, &cam, sizeof(dx11::Camera), 1);
-        
-        return dx11Context;
-    }
-    else 
-    {
+    // The tiles are rasterized with parallelFor, on the job threads if the game started them 
+    // with initJobs, inline otherwise.
+    return true;
+}
 
-        return nullptr;
-    }
+void tiny_engine::detail::software::bindBackBuffer(int x, int y, int width, int height)
+{
+    internalContext.viewportX = x;
+    internalContext.viewportY = y;
+    internalContext.viewportWidth = width;
+    internalContext.viewportHeight = height;
+}
+
+void tiny_engine::detail::software::clearBackBuffer(float r, float g, float b, float a)
+{
+    auto toByte = [](float c) -> uint32_t {
+        return (uint32_t) (std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+    };
+    uint32_t color = toByte(r) | (toByte(g) << 8) | (toByte(b) << 16) | (toByte(a) << 24);
+    std::fill(framebuffer.pixels.begin(), framebuffer.pixels.end(), color);
+}
 
+void tiny_engine::detail::software::presentBackBuffer()
+{
+    // Headless: the image just stays in the framebuffer.
+    frameStats = currentFrameStats;
+    currentFrameStats = {};
+}
 
+const tiny_engine::detail::software::Framebuffer& tiny_engine::detail::software::getFramebuffer()
+{
+    return framebuffer;
 }
 
+const tiny_engine::detail::software::FrameStats& tiny_engine::detail::software::getFrameStats()
+{
+    return frameStats;
+}
 
-void tiny_engine::drawTexture(GraphicsContext* dx11Context, Texture t, int x, int y)
+tiny_engine::detail::software::SoftwareTexture* 
+tiny_engine::detail::software::createTextureFromPixels(uint32_t width, uint32_t height, 
+                                                        const uint8_t* rgbaPixels)
 {
-    if (dx11Context->api == "dx11") 
-    {
-        auto sampler = dx11::samplerStorage.get(dx11InternalContext.spriteSamplerId);
-        auto inputLayout = dx11::inputLayoutStorage.get(dx11InternalContext.spriteShaderInputLayoutId);
-        auto shader = dx11::shaderProgramStorage.get(dx11InternalContext.spriteShaderId);
-        auto texture = dx11::textureStorage.get(t.id);
-        auto model = dx11::modelStorage.get(dx11InternalContext.quadModelId);
-        dx11::drawTexture(texture, sampler, shader, inputLayout,  model, x, y);
-    }
+    auto texture = new SoftwareTexture { width, height, nullptr, {} };
+    texture->pixels.resize((size_t) width * height);
+    memcpy(texture->pixels.data(), rgbaPixels, texture->pixels.size() * 4);
+    texture->texels = texture->pixels.data();
+    return texture;
 }
 
-void tiny_engine::clearBackBuffer(GraphicsContext* context, float r, float g, 
-                                                        float b, float a)
+tiny_engine::detail::software::SoftwareTexture* 
+tiny_engine::detail::software::createTextureView(uint32_t width, uint32_t height, const uint8_t* rgbaPixels)
 {
-   if (context->api == "dx11") {
-       tiny_engine::detail::dx11::clearBackBuffer(r, g, b, a);
-   }
+    return new SoftwareTexture { width, height, (const uint32_t*) rgbaPixels, {} };
 }
 
-void tiny_engine::presentBackBuffer(GraphicsContext* context)
+void tiny_engine::detail::software::blendSpan(uint32_t* dst, const uint32_t* src, int count)
 {
-    if (context->api == "dx11") {
-        tiny_engine::detail::dx11::presentBackBuffer();
+    int i = 0;
+#if defined(TE_SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i alphaMask = _mm_set1_epi32((int) 0xff000000);
+
+    // x / 255 for x <= 255 * 255, rounded: (x + 128 + ((x + 128) >> 8)) >> 8
+    auto blend2 = [&](__m128i s, __m128i d) {
+        __m128i a = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+        __m128i x = _mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, _mm_sub_epi16(full, a)));
+        x = _mm_add_epi16(x, half);
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    };
+
+    for (; i + 4 <= count; i += 4) 
+    {
+        __m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+        __m128i lo = blend2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+        __m128i hi = blend2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+        __m128i result = _mm_packus_epi16(lo, hi);
+        result = _mm_or_si128(_mm_andnot_si128(alphaMask, result), _mm_and_si128(alphaMask, s));
+        _mm_storeu_si128((__m128i*) (dst + i), result);
+    }
+#elif defined(TE_SIMD_NEON)
+    const uint32x4_t alphaMask = vdupq_n_u32(0xff000000);
+    for (; i + 4 <= count; i += 4) 
+    {
+        uint32x4_t s32 = vld1q_u32(src + i);
+        uint8x16_t s = vreinterpretq_u8_u32(s32);
+        uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(dst + i));
+        uint8x16_t a = vreinterpretq_u8_u32(vmulq_n_u32(vshrq_n_u32(s32, 24), 0x01010101));
+        uint8x16_t inv = vmvnq_u8(a);
+
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(s), vget_low_u8(a)), vget_low_u8(d), vget_low_u8(inv));
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(s), vget_high_u8(a)), vget_high_u8(d), vget_high_u8(inv));
+        lo = vaddq_u16(lo, vdupq_n_u16(128));
+        hi = vaddq_u16(hi, vdupq_n_u16(128));
+        uint8x16_t result = vcombine_u8(vshrn_n_u16(vaddq_u16(lo, vshrq_n_u16(lo, 8)), 8),
+                                        vshrn_n_u16(vaddq_u16(hi, vshrq_n_u16(hi, 8)), 8));
+        vst1q_u32(dst + i, vbslq_u32(alphaMask, s32, vreinterpretq_u32_u8(result)));
+    }
+#endif
+    for (; i < count; i++) 
+    {
+        uint32_t s = src[i];
+        uint32_t d = dst[i];
+        uint32_t a = s >> 24;
+        uint32_t result = s & 0xff000000;
+        for (int shift = 0; shift < 24; shift += 8) 
+        {
+            uint32_t x = ((s >> shift) & 0xff) * a + ((d >> shift) & 0xff) * (255 - a) + 128;
+            result |= ((x + (x >> 8)) >> 8) << shift;
+        }
+        dst[i] = result;
     }
 }
 
-void tiny_engine::bindBackBuffer(GraphicsContext* context, int x, int y, 
-                                                int width, int height) 
+void tiny_engine::detail::software::flushSpriteBatch(SpriteBatch& batch)
 {
-    if (context->api == "dx11") {
-        tiny_engine::detail::dx11::bindBackBuffer(x, y, width, height);
+    if (batch.empty()) return;
+    TE_PROFILE_SCOPE("software::flushSpriteBatch");
+    auto start = std::chrono::steady_clock::now();
+
+    batch.build();
+
+    // Transform the quads from the 2D view into pixel coordinates.
+    // The view is centered on 0/0 with y pointing up, pixel rows go down.
+    const auto& ctx = internalContext;
+    float scaleX = ctx.viewportWidth / ctx.viewWidth;
+    float scaleY = ctx.viewportHeight / ctx.viewHeight;
+    float centerX = ctx.viewportX + ctx.viewportWidth * 0.5f;
+    float centerY = ctx.viewportY + ctx.viewportHeight * 0.5f;
+
+    const auto& instances = batch.instances();
+    screenQuads.clear();
+    for (const auto& range : batch.ranges()) 
+    {
+        auto texture = textureStorage.get(range.textureId);
+        if (!texture) continue;
+        // Binding is free here, but counted the same as on the GPU backends.
+        stateCache.change(StateCache::Texture, range.textureId);
+        frameRenderStats.drawCalls++;
+        for (uint32_t i = range.firstInstance; i < range.firstInstance + range.instanceCount; i++) 
+        {
+            // Axis aligned, rotation and tint are not rasterized here.
+            const SpriteInstance& sprite = instances[i];
+            float halfWidth = sprite.width * 0.5f;
+            float halfHeight = sprite.height * 0.5f;
+            screenQuads.push_back(ScreenQuad { 
+                    centerX + (sprite.x - halfWidth) * scaleX, centerY - (sprite.y + halfHeight) * scaleY,
+                    centerX + (sprite.x + halfWidth) * scaleX, centerY - (sprite.y - halfHeight) * scaleY,
+                    sprite.uvLeft, sprite.uvTop, sprite.uvRight, sprite.uvBottom, texture });
+        }
     }
 
-}
+    // Bin the quads into the screen tiles they touch, 
+    // each tile keeps the batch order of its quads.
+    int clipLeft = std::max(ctx.viewportX, 0);
+    int clipTop = std::max(ctx.viewportY, 0);
+    int clipRight = std::min(ctx.viewportX + ctx.viewportWidth, (int) framebuffer.width);
+    int clipBottom = std::min(ctx.viewportY + ctx.viewportHeight, (int) framebuffer.height);
+    for (auto& list : tileQuads) list.clear();
+    for (uint32_t i = 0; i < screenQuads.size(); i++) 
+    {
+        const ScreenQuad& quad = screenQuads[i];
+        int left = std::max(clipLeft, (int) std::ceil(quad.left - 0.5f));
+        int right = std::min(clipRight, (int) std::ceil(quad.right - 0.5f));
+        int top = std::max(clipTop, (int) std::ceil(quad.top - 0.5f));
+        int bottom = std::min(clipBottom, (int) std::ceil(quad.bottom - 0.5f));
+        if (left >= right || top >= bottom) continue;
+
+        for (int ty = top / tileSize; ty <= (bottom - 1) / tileSize; ty++) 
+        {
+            for (int tx = left / tileSize; tx <= (right - 1) / tileSize; tx++) 
+            {
+                tileQuads[ty * tilesX + tx].push_back(i);
+            }
+        }
+    }
 
+    tiny_engine::parallelFor(tilesX * tilesY, 1, [](uint32_t begin, uint32_t end) {
+        for (uint32_t tileIndex = begin; tileIndex < end; tileIndex++) rasterizeTile(tileIndex);
+    });
 
-std::optional<tiny_engine::Texture> tiny_engine::createTextureFromFile(GraphicsContext* context, 
-                                                    const std::string& fileName)
+    currentFrameStats.spriteCount += (uint32_t) batch.size();
+    currentFrameStats.flushCount++;
+    currentFrameStats.rasterMilliseconds += std::chrono::duration<double, std::milli>(
+                                                std::chrono::steady_clock::now() - start).count();
+    batch.clear();
+}
+
+void tiny_engine::detail::software::rasterizeTile(uint32_t tileIndex)
 {
-    if (context->api == "dx11")
+    const auto& quads = tileQuads[tileIndex];
+    if (quads.empty()) return;
+
+    const auto& ctx = internalContext;
+    int tileLeft = std::max<int>((tileIndex % tilesX) * tileSize, std::max(ctx.viewportX, 0));
+    int tileTop = std::max<int>((tileIndex / tilesX) * tileSize, std::max(ctx.viewportY, 0));
+    int tileRight = std::min<int>({ (int) (tileIndex % tilesX) * tileSize + tileSize, 
+                                    (int) framebuffer.width, ctx.viewportX + ctx.viewportWidth });
+    int tileBottom = std::min<int>({ (int) (tileIndex / tilesX) * tileSize + tileSize, 
+                                     (int) framebuffer.height, ctx.viewportY + ctx.viewportHeight });
+
+    uint32_t texels[tileSize];
+    for (uint32_t quadIndex : quads) 
     {
-        auto dx11Texture = dx11::createTextureFromFile(fileName);
-        if (!dx11Texture) {
-            return std::nullopt;
-        }
-        auto id = dx11::textureStorage.store(dx11Texture);
-        return std::make_optional<tiny_engine::Texture>(tiny_engine::Texture { id });
+        const ScreenQuad& quad = screenQuads[quadIndex];
+        const SoftwareTexture* texture = quad.texture;
+
+        // Pixels whose centers lie inside the quad.
+        int left = std::max(tileLeft, (int) std::ceil(quad.left - 0.5f));
+        int right = std::min(tileRight, (int) std::ceil(quad.right - 0.5f));
+        int top = std::max(tileTop, (int) std::ceil(quad.top - 0.5f));
+        int bottom = std::min(tileBottom, (int) std::ceil(quad.bottom - 0.5f));
+        if (left >= right || top >= bottom) continue;
+
+        // Nearest neighbour sampling, uvs interpolated linearly across the quad.
+        float du = (quad.uRight - quad.uLeft) / (quad.right - quad.left);
+        float dv = (quad.vBottom - quad.vTop) / (quad.bottom - quad.top);
+        float uStart = quad.uLeft + (left + 0.5f - quad.left) * du;
+        int maxX = (int) texture->width - 1;
+        int maxY = (int) texture->height - 1;
+
+        for (int y = top; y < bottom; y++) 
+        {
+            float v = quad.vTop + (y + 0.5f - quad.top) * dv;
+            int texY = std::clamp((int) (v * texture->height), 0, maxY);
+            const uint32_t* texRow = texture->texels + (size_t) texY * texture->width;
 
+            int count = right - left;
+            float u = uStart;
+            for (int i = 0; i < count; i++, u += du) 
+            {
+                texels[i] = texRow[std::clamp((int) (u * texture->width), 0, maxX)];
+            }
+            blendSpan(framebuffer.pixels.data() + (size_t) y * framebuffer.width + left, texels, count);
+        }
     }
-    return std::nullopt;
 }
 
+#endif
+
 // ----------------------------------------------------------------------------
 // DirectX11 implementation
 //
@@ -481,8 +12297,9 @@ ComPtr<ID3D11Buffer> dx11::createVertexBuffer(const float* data, size_t size, D3
     D3D11_SUBRESOURCE_DATA initData = {};
     initData.pSysMem = data;
 
+    // Dynamic buffers may be created without initial data.
     ComPtr<ID3D11Buffer> vertexBuffer;
-    auto result = dx11Device->CreateBuffer(&bd, &initData, &vertexBuffer);
+    auto result = dx11Device->CreateBuffer(&bd, data ? &initData : nullptr, &vertexBuffer);
     if (FAILED(result)) {
         std::cerr << "Failed to create vertex buffer: " << std::hex << result << std::endl;
         if (result == DXGI_ERROR_DEVICE_REMOVED && dx11Device) {
@@ -502,7 +12319,7 @@ ComPtr<ID3D11Buffer> tiny_engine::detail::dx11::createIndexBuffer(const uint32_t
     D3D11_BUFFER_DESC bd = {};
     bd.Usage = usage;
     bd.ByteWidth = size;
-    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
     bd.CPUAccessFlags = usage == D3D11_USAGE_DYNAMIC ? D3D11_CPU_ACCESS_WRITE : 0;
 
     D3D11_SUBRESOURCE_DATA initData = {};
@@ -603,7 +12420,9 @@ dx11::InputLayout* dx11::createInputLayout(std::vector<dx11::VertexAttributeDesc
     for (auto& vad : descs) {
         auto desc = D3D11_INPUT_ELEMENT_DESC { savedStrings[counter].c_str(), 0, 
             vad.format,
-            vad.attributeLocation, vad.offset, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+            vad.attributeLocation, vad.offset, 
+            vad.perInstance ? D3D11_INPUT_PER_INSTANCE_DATA : D3D11_INPUT_PER_VERTEX_DATA, 
+            vad.perInstance ? 1u : 0u };
         layoutDescs.push_back(desc);
         counter++;
     }
@@ -630,6 +12449,7 @@ std::string dx11::getSpritePixelShaderSource()
      {
      	float4 pos : SV_POSITION;
         float2 uv : TEXCOORD0;
+        float4 tint : COLOR0;
      };
 
      Texture2D imageTexture;
@@ -638,7 +12458,7 @@ std::string dx11::getSpritePixelShaderSource()
 
     float4 main(VOutput pixelShaderInput) : SV_TARGET
     {
-        return imageTexture.Sample(samplerState, pixelShaderInput.uv);
+        return imageTexture.Sample(samplerState, pixelShaderInput.uv) * pixelShaderInput.tint;
         //return float4(1, 0, 1, 1);
     }
 
@@ -655,10 +12475,7 @@ std::string dx11::getSpriteVertexShaderSource()
         {
             float4 pos : SV_POSITION;
             float2 uv : TEXCOORD0;
-        };
-
-        cbuffer ObjectTransformBuffer : register(b0) {
-            row_major matrix world_matrix;
+            float4 tint : COLOR0;
         };
 
         cbuffer CameraBuffer : register(b1) {
@@ -666,12 +12483,24 @@ std::string dx11::getSpriteVertexShaderSource()
             row_major float4x4 projection_matrix;
         };
 
-        VOutput main(float4 pos : POSITION, float2 uv : TEXCOORD0) {
+        // pos/uv are the corners of the unit quad model, 
+        // the rest comes once per sprite from the instance buffer.
+        VOutput main(float3 pos : POSITION, float2 uv : TEXCOORD0, 
+                     float4 rect : INSTANCE_RECT, float4 uvRect : INSTANCE_UV, 
+                     float2 rotationDepth : INSTANCE_ROTATION_DEPTH, 
+                     float4 tint : INSTANCE_TINT, uint layer : INSTANCE_LAYER) {
+            float2 corner = pos.xy * rect.zw;
+            float s, c;
+            sincos(rotationDepth.x, s, c);
+            float2 world = rect.xy + float2(corner.x * c - corner.y * s, corner.x * s + corner.y * c);
+            // Higher layers move a little to the front, so they pass the depth test over lower ones.
+            float depth = rotationDepth.y - layer * (1.0 / 4096.0);
+
             VOutput output;
-            output.pos =  mul(pos, world_matrix);
-            output.pos = mul(output.pos, view_matrix);
+            output.pos = mul(float4(world, depth, 1), view_matrix);
             output.pos = mul(output.pos, projection_matrix);
-            output.uv = uv;
+            output.uv = lerp(uvRect.xy, uvRect.zw, uv);
+            output.tint = tint;
             return output;
         }
 
@@ -679,38 +12508,83 @@ std::string dx11::getSpriteVertexShaderSource()
 }
 
 
-dx11::PixelShader* dx11::createPixelShaderFromSource(const std::string& source) 
+ComPtr<ID3DBlob> dx11::compileShader(const std::string& source, 
+                                     const std::vector<shadercache::Define>& defines, const char* profile)
 {
     UINT flags = D3DCOMPILE_ENABLE_STRICTNESS;
     #if _DEBUG
     flags |= D3DCOMPILE_DEBUG;
     #endif
 
-
-    auto versionTarget = "ps_5_0";
+    auto start = std::chrono::steady_clock::now();
+    auto elapsedMilliseconds = [&start]() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    const std::string& directory = shadercache::directory;
+    uint64_t key = shadercache::shaderKey(source, defines, profile, flags, D3D_COMPILER_VERSION);
+    char keyText[17];
+    snprintf(keyText, sizeof(keyText), "%016llx", (unsigned long long) key);
 
     ComPtr<ID3DBlob> blob;
+    std::vector<uint8_t> bytecode;
+    if (!directory.empty() && shadercache::load(directory, key, bytecode) && 
+        SUCCEEDED(D3DCreateBlob(bytecode.size(), &blob))) 
+    {
+        memcpy(blob->GetBufferPointer(), bytecode.data(), bytecode.size());
+        double milliseconds = elapsedMilliseconds();
+        shadercache::stats.hits++;
+        shadercache::stats.loadMilliseconds += milliseconds;
+        std::cout << "[shader cache] hit " << profile << " " << keyText << ", loaded in " 
+                  << milliseconds << " ms" << std::endl;
+        return blob;
+    }
+
+    // D3DCompile wants the defines as a null terminated array.
+    std::vector<D3D_SHADER_MACRO> macros;
+    for (const auto& define : defines) macros.push_back({ define.name.c_str(), define.value.c_str() });
+    macros.push_back({ nullptr, nullptr });
+
     ComPtr<ID3DBlob> errorBlob;
-    HRESULT hr = D3DCompile(source.c_str(), source.size(), nullptr, nullptr, nullptr,
-         "main", versionTarget , flags, 0, &blob, &errorBlob);
+    HRESULT hr = D3DCompile(source.c_str(), source.size(), nullptr, macros.data(), nullptr,
+         "main", profile, flags, 0, &blob, &errorBlob);
 
     if (FAILED(hr)) {
         if (errorBlob) {
             std::string errorMsg((char*)errorBlob->GetBufferPointer(), errorBlob->GetBufferSize());
             OutputDebugStringA(errorMsg.c_str());
             std::cerr << "[Shader Compilation Error]: " << errorMsg.c_str() << std::endl;
-            errorBlob->Release();
         } else {
             std::cerr << "[Shader Compilation Error]: Unknown error (no error blob)" << std::endl;
         }
-        return {};
+        return nullptr;
+    }
 
+    double milliseconds = elapsedMilliseconds();
+    shadercache::stats.misses++;
+    shadercache::stats.compileMilliseconds += milliseconds;
+    std::cout << "[shader cache] miss " << profile << " " << keyText << ", compiled in " 
+              << milliseconds << " ms" << std::endl;
+    if (!directory.empty() && 
+        !shadercache::store(directory, key, blob->GetBufferPointer(), blob->GetBufferSize())) 
+    {
+        std::cerr << "Failed to write " << shadercache::fileName(directory, key) << std::endl;
     }
+    return blob;
+}
+
+dx11::PixelShader* dx11::createPixelShaderFromSource(const std::string& source, 
+                                                     const std::vector<shadercache::Define>& defines) 
+{
+    auto blob = compileShader(source, defines, "ps_5_0");
+    if (!blob) return {};
 
     ComPtr<ID3D11PixelShader> pixelShader;
-    hr = dx11Device->CreatePixelShader(blob->GetBufferPointer(),
+    HRESULT hr = dx11Device->CreatePixelShader(blob->GetBufferPointer(),
     blob->GetBufferSize(), nullptr, pixelShader.GetAddressOf());
-    
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create a pixel shader: " << std::hex << hr << std::endl;
+        return {};
+    }
 
     auto ps = new PixelShader();
     ps->blob = blob;
@@ -729,49 +12603,30 @@ dx11::ConstantBuffer* dx11::createConstantBuffer(size_t size)
     desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
     desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
     desc.MiscFlags = 0;
-    desc.StructureByteStride = 0;
-
-    HRESULT hr = dx11Device->CreateBuffer(&desc, nullptr, &buffer);
-    if (FAILED(hr)) {
-        std::cerr << "Failed to create object buffer" << std::endl;
-        exit(1234);
-    }
-    return new ConstantBuffer {buffer};
-}
-
-
-dx11::VertexShader* dx11::createVertexShaderFromSource(const std::string& source) 
-{
-    UINT flags = D3DCOMPILE_ENABLE_STRICTNESS;
-    #if _DEBUG
-    flags |= D3DCOMPILE_DEBUG;
-    #endif
-
-
-    auto versionTarget = "vs_5_0";
-
-    ComPtr<ID3DBlob> blob;
-    ComPtr<ID3DBlob> errorBlob;
-    HRESULT hr = D3DCompile(source.c_str(), source.size(), nullptr, nullptr, nullptr,
-         "main", versionTarget , flags, 0, &blob, &errorBlob);
-
-    if (FAILED(hr)) {
-        if (errorBlob) {
-            std::string errorMsg((char*)errorBlob->GetBufferPointer(), errorBlob->GetBufferSize());
-            OutputDebugStringA(errorMsg.c_str());
-            std::cerr << "[Shader Compilation Error]: " << errorMsg.c_str() << std::endl;
-            errorBlob->Release();
-        } else {
-            std::cerr << "[Shader Compilation Error]: Unknown error (no error blob)" << std::endl;
-        }
-        return {};
+    desc.StructureByteStride = 0;
 
+    HRESULT hr = dx11Device->CreateBuffer(&desc, nullptr, &buffer);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create object buffer" << std::endl;
+        exit(1234);
     }
+    return new ConstantBuffer {buffer};
+}
+
+
+dx11::VertexShader* dx11::createVertexShaderFromSource(const std::string& source, 
+                                                       const std::vector<shadercache::Define>& defines) 
+{
+    auto blob = compileShader(source, defines, "vs_5_0");
+    if (!blob) return {};
 
     ComPtr<ID3D11VertexShader> vertexShader;
-    hr = dx11Device->CreateVertexShader(blob->GetBufferPointer(),
+    HRESULT hr = dx11Device->CreateVertexShader(blob->GetBufferPointer(),
     blob->GetBufferSize(), nullptr, vertexShader.GetAddressOf());
-    
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create a vertex shader: " << std::hex << hr << std::endl;
+        return {};
+    }
 
     auto vs = new VertexShader();
     vs->blob = blob;
@@ -783,7 +12638,11 @@ dx11::VertexShader* dx11::createVertexShaderFromSource(const std::string& source
 
 void dx11::presentBackBuffer()
 {
-    auto result = dx11SwapChain->Present(0, 0);
+    // Tearing is only allowed when not waiting for the blank.
+    UINT syncInterval = std::min(presentSettings.syncInterval, 4u);
+    UINT flags = 0;
+    if (syncInterval == 0 && presentSettings.allowTearing && tearingSupported) flags |= DXGI_PRESENT_ALLOW_TEARING;
+    auto result = dx11SwapChain->Present(syncInterval, flags);
     if (FAILED(result)) {
         _com_error err(result);
         std::wcerr << L"Present failed: " << 
@@ -792,6 +12651,30 @@ void dx11::presentBackBuffer()
         std::cerr << "Device removed reason: " << reason << std::endl;
         // TODO further error handling
     }
+    // The flip model unbinds the back buffer on present, the next frame draws into it again.
+    ID3D11RenderTargetView* const rtvs[] = { dx11rtv.Get() };
+    dx11Context->OMSetRenderTargets(1, rtvs, dx11DepthStencilView.Get());
+}
+
+void dx11::applyPresentSettings(const PresentSettings& settings)
+{
+    uint32_t previousBufferCount = std::clamp(presentSettings.bufferCount, 2u, 16u);
+    presentSettings = settings;
+    // Before init only remembered, the swap chain is created with them.
+    if (!dx11SwapChain2) return;
+
+    dx11SwapChain2->SetMaximumFrameLatency(std::clamp(settings.maxFrameLatency, 1u, 16u));
+    if (std::clamp(settings.bufferCount, 2u, 16u) != previousBufferCount) {
+        D3D11_TEXTURE2D_DESC desc;
+        dx11BackBuffer->GetDesc(&desc);
+        resizeSwapChain(dx11InternalContext.hwnd, (int) desc.Width, (int) desc.Height);
+    }
+}
+
+void dx11::waitForFrameLatency()
+{
+    // With a timeout, so a lost device or a hidden window never hangs the loop.
+    if (frameLatencyWaitable) WaitForSingleObjectEx(frameLatencyWaitable, 1000, TRUE);
 }
 
 void dx11::bindTexture(dx11::DX11Texture* texture, 
@@ -815,91 +12698,244 @@ void dx11::bindInputLayout(dx11::InputLayout* inputLayout)
    dx11Context->IASetInputLayout(inputLayout->inputLayout.Get());
 }
 
-void dx11::drawTexture(dx11::DX11Texture* texture, dx11::Sampler* sampler, 
-        dx11::ShaderProgram* shader, dx11::InputLayout* inputLayout, 
-        dx11::Model* quadModel, int x, int y) 
+static uint32_t spriteInstanceCapacity(dx11::Model* batchModel)
 {
-    
-    // world matrix:
-    // Scale up to actual image size -> TODO
-    // move to xy position
-    auto scale = DirectX::XMMatrixScaling(64, 64, 1);
-    auto trans = DirectX::XMMatrixTranslation(x, y, 0.2);
-    auto world = scale * trans;
-    auto objectTransformBuffer = constantBufferStorage.get(dx11InternalContext.objectTransformBufferId);
-    
-    DirectX::XMFLOAT4X4 worldMatrixData;
-    DirectX::XMStoreFloat4x4(&worldMatrixData, world);
-    dx11::uploadConstantBufferDataForVertexShader(objectTransformBuffer->buffer, &world, sizeof(DirectX::XMFLOAT4X4), 0);
-    
+    if (!batchModel->vertexBuffer) return 0;
+    D3D11_BUFFER_DESC desc;
+    batchModel->vertexBuffer->GetDesc(&desc);
+    return desc.ByteWidth / batchModel->stride;
+}
 
-    bindTexture(texture, 0, sampler, 0); 
-    bindShader(shader);
-    bindInputLayout(inputLayout);
-    bindVertexBuffer(quadModel->vertexBuffer, quadModel->stride, 0);
-    bindIndexBuffer(quadModel->indexBuffer, 0);
-    drawIndexed(quadModel->indexCount, 0);
+bool dx11::reserveSpriteBatchModel(dx11::Model* batchModel, uint32_t instanceCount)
+{
+    uint32_t capacity = spriteInstanceCapacity(batchModel);
+    if (capacity >= instanceCount) return true;
 
+    // Grow geometrically, so a frame with a few more sprites 
+    // does not recreate the buffer every time.
+    uint32_t newCapacity = capacity > 0 ? capacity : 1024;
+    while (newCapacity < instanceCount) newCapacity *= 2;
 
-    // Dummy test for dwrite rendering:
-    RECT rc;
-    GetClientRect(dx11InternalContext.hwnd, &rc);
-    D2D1_RECT_F layoutRect = D2D1::RectF(
-    0, 0, 200, 200
-    );
+    auto vb = createVertexBuffer(nullptr, newCapacity * sizeof(SpriteInstance), D3D11_USAGE_DYNAMIC);
+    if (!vb) return false;
+    batchModel->vertexBuffer = vb;
+    return true;
+}
 
-    d2dRenderTarget->BeginDraw();
+void dx11::flushSpriteBatch(SpriteBatch& batch, ID3D11DeviceContext* context, 
+        StateCache& cache, RenderStats& stats, dx11::Sampler* sampler, 
+        dx11::InputLayout* inputLayout, dx11::Model* batchModel) 
+{
+    if (batch.empty()) return;
+
+    batch.build();
+    const auto& instances = batch.instances();
+    uint32_t capacity = spriteInstanceCapacity(batchModel);
+    if (!reserveSpriteBatchModel(batchModel, (uint32_t) instances.size())) {
+        std::cerr << "Failed to grow the sprite instance buffer" << std::endl;
+        batch.clear();
+        return;
+    }
+    if (spriteInstanceCapacity(batchModel) != capacity) {
+        // A new buffer behind the same model id.
+        cache.invalidate(StateCache::VertexBuffer);
+    }
 
-    d2dRenderTarget->SetTransform(D2D1::Matrix3x2F::Translation(20, 200));
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    auto result = context->Map(batchModel->vertexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+    if (FAILED(result)) {
+        std::cerr << "Failed to map the sprite instance buffer: " << std::hex << result << std::endl;
+        batch.clear();
+        return;
+    }
+    memcpy(mapped.pData, instances.data(), instances.size() * sizeof(SpriteInstance));
+    context->Unmap(batchModel->vertexBuffer.Get(), 0);
 
-    // d2d rendertarget points to the same backbuffer as d3d, 
-    // so we shall not clear again, d3d already did (normally...)
-    //d2dRenderTarget->Clear(D2D1::ColorF(D2D1::ColorF::Blue));
-    static int frame = 0;
-    frame++;
-    std::wstring text = L"fps" + std::to_wstring(frame);
+    // Only what differs from the last bound state goes to the device.
+    if (cache.change(StateCache::InputLayout, dx11InternalContext.spriteShaderInputLayoutId)) {
+        context->IASetInputLayout(inputLayout->inputLayout.Get());
+    }
+    auto quadModel = modelStorage.get(dx11InternalContext.quadModelId);
+    if (cache.change(StateCache::VertexBuffer, dx11InternalContext.spriteBatchModelId)) {
+        // The corners of the quad model per vertex, the sprites per instance.
+        ID3D11Buffer* vertexBuffers[] = { quadModel->vertexBuffer.Get(), batchModel->vertexBuffer.Get() };
+        UINT strides[] = { quadModel->stride, batchModel->stride };
+        UINT offsets[] = { 0, 0 };
+        context->IASetVertexBuffers(0, 2, vertexBuffers, strides, offsets);
+    }
+    if (cache.change(StateCache::IndexBuffer, dx11InternalContext.quadModelId)) {
+        context->IASetIndexBuffer(quadModel->indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+    }
+    if (cache.change(StateCache::Topology, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST)) {
+        context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    }
+    if (cache.change(StateCache::Sampler, dx11InternalContext.spriteSamplerId)) {
+        context->PSSetSamplers(0, 1, sampler->samplerState.GetAddressOf());
+    }
 
-    d2dRenderTarget->SetAntialiasMode(D2D1_ANTIALIAS_MODE_PER_PRIMITIVE);
-    d2dRenderTarget->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_GRAYSCALE);
-    
-    d2dRenderTarget->DrawText(
-        text.c_str(),        // The string to render.
-        text.length(),    // The string's length.
-        textFormat.Get(),    // The text format.
-        layoutRect,       // The region of the window where the text will be rendered.
-        blackBrush.Get()     // The brush used to draw the text.
-    );
+    // One draw call per run of the same shader and texture.
+    for (const auto& range : batch.ranges()) 
+    {
+        auto texture = textureStorage.get(range.textureId);
+        uint32_t shaderId = range.shaderId ? range.shaderId : dx11InternalContext.spriteShaderId;
+        auto shader = shaderProgramStorage.get(shaderId);
+        if (!texture || !shader) continue;
+        if (cache.change(StateCache::Shader, shaderId)) {
+            context->VSSetShader(shader->vs->shader.Get(), nullptr, 0);
+            context->PSSetShader(shader->ps->shader.Get(), nullptr, 0);
+        }
+        if (cache.change(StateCache::Texture, range.textureId)) {
+            context->PSSetShaderResources(0, 1, texture->srv.GetAddressOf());
+        }
+        context->DrawIndexedInstanced((UINT) quadModel->indexCount, range.instanceCount, 0, 0, range.firstInstance);
+        stats.drawCalls++;
+    }
+
+    batch.clear();
+}
 
-    d2dRenderTarget->SetTransform(D2D1::IdentityMatrix());
-    for (int i = 0; i < 20; i++) {
-        int left = 200 + (i * 12);
-        int right = left + 8;
-        D2D1_RECT_F r = D2D1::RectF(left, 60, right, 80);
-        //d2dRenderTarget->DrawRectangle(r, blackBrush.Get(), 2.0f);
-        d2dRenderTarget->FillRectangle(r, blackBrush.Get());
+bool dx11::recordCommandList(CommandListData& list)
+{
+    TE_PROFILE_SCOPE("dx11::recordCommandList");
+    auto deferred = static_cast<DeferredCommandList*>(list.backendData);
+    deferred->commands.Reset();
+    if (list.batch.empty()) return true;
+
+    if (!deferred->context) {
+        auto result = dx11Device->CreateDeferredContext(0, &deferred->context);
+        if (FAILED(result)) {
+            std::cerr << "Failed to create a deferred context: " << std::hex << result << std::endl;
+            return false;
+        }
     }
-    
-    
-    
-    d2dRenderTarget->EndDraw();
-    // End drawing experiment
-    
-    
-    // We must bind the texture, shader, inputlayout, (later) constant buffers, 
-    // vertex buffer, index buffer, then draw indexed.
+    auto context = deferred->context.Get();
+
+    // A deferred context starts without any state, 
+    // everything the immediate context has bound for sprites is set up again.
+    ID3D11RenderTargetView* const rtvs[] = { dx11rtv.Get() };
+    context->OMSetRenderTargets(1, rtvs, dx11DepthStencilView.Get());
+    context->OMSetDepthStencilState(dx11DepthStencilState.Get(), 0);
+    float blendFactor[4] = { 0, 0, 0, 0 };
+    context->OMSetBlendState(dx11BlendState.Get(), blendFactor, 0xffffffff);
+    context->RSSetState(dx11RasterState.Get());
+    context->RSSetViewports(1, &deferred->viewport);
+    auto cameraBuffer = constantBufferStorage.get(dx11InternalContext.cameraBufferId);
+    ID3D11Buffer* cameraBuffers[] = { cameraBuffer->buffer.Get() };
+    context->VSSetConstantBuffers(1, 1, cameraBuffers);
+
+    list.stateCache.invalidate();
+    auto sampler = samplerStorage.get(dx11InternalContext.spriteSamplerId);
+    auto inputLayout = inputLayoutStorage.get(dx11InternalContext.spriteShaderInputLayoutId);
+    flushSpriteBatch(list.batch, context, list.stateCache, list.stats, sampler, inputLayout, &deferred->batchModel);
+
+    auto result = context->FinishCommandList(FALSE, &deferred->commands);
+    if (FAILED(result)) {
+        std::cerr << "Failed to finish a command list: " << std::hex << result << std::endl;
+        return false;
+    }
+    return true;
+}
+
+#ifdef TE_PROFILE
+dx11::GpuProfileScope::GpuProfileScope(const char* name)
+{
+    GpuTimingFrame& frame = gpuTimingFrames[currentGpuTimingFrame];
+    if (!gpuTimingFrameOpen) 
+    {
+        // A frame which was not read back in time is dropped.
+        frame.pending = false;
+        frame.scopeCount = 0;
+        if (!frame.disjoint) {
+            D3D11_QUERY_DESC desc = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+            dx11Device->CreateQuery(&desc, &frame.disjoint);
+        }
+        dx11Context->Begin(frame.disjoint.Get());
+        frame.cpuStart = eventClock();
+        gpuTimingFrameOpen = true;
+    }
+
+    scope = frame.scopeCount;
+    if (scope == GpuTimingFrame::maxScopes) return;
+    if (!frame.begin[scope]) {
+        D3D11_QUERY_DESC desc = { D3D11_QUERY_TIMESTAMP, 0 };
+        dx11Device->CreateQuery(&desc, &frame.begin[scope]);
+        dx11Device->CreateQuery(&desc, &frame.end[scope]);
+    }
+    frame.names[scope] = name;
+    frame.scopeCount++;
+    dx11Context->End(frame.begin[scope].Get());
+}
+
+dx11::GpuProfileScope::~GpuProfileScope()
+{
+    if (scope == GpuTimingFrame::maxScopes) return;
+    dx11Context->End(gpuTimingFrames[currentGpuTimingFrame].end[scope].Get());
 }
 
+void dx11::endGpuTimingFrame()
+{
+    if (!gpuTimingFrameOpen) return;
+    GpuTimingFrame& frame = gpuTimingFrames[currentGpuTimingFrame];
+    dx11Context->End(frame.disjoint.Get());
+    frame.pending = true;
+    gpuTimingFrameOpen = false;
+    currentGpuTimingFrame = (currentGpuTimingFrame + 1) % gpuTimingLatency;
+    readGpuTimings();
+}
+
+void dx11::readGpuTimings()
+{
+    namespace profiler = tiny_engine::detail::profiler;
+    for (auto& frame : gpuTimingFrames) 
+    {
+        if (!frame.pending) continue;
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+        if (dx11Context->GetData(frame.disjoint.Get(), &disjoint, sizeof(disjoint), 
+                                 D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) continue;
+        frame.pending = false;
+        // The GPU clock changed during the frame, its timestamps are useless.
+        if (disjoint.Disjoint || frame.scopeCount == 0) continue;
+        if (!profiler::capturing || frame.cpuStart < profiler::captureStart) continue;
+
+        uint64_t begin[GpuTimingFrame::maxScopes];
+        uint64_t end[GpuTimingFrame::maxScopes];
+        bool complete = true;
+        for (uint32_t i = 0; i < frame.scopeCount && complete; i++) 
+        {
+            complete = dx11Context->GetData(frame.begin[i].Get(), &begin[i], sizeof(uint64_t), 
+                                            D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
+                       dx11Context->GetData(frame.end[i].Get(), &end[i], sizeof(uint64_t), 
+                                            D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK;
+        }
+        if (!complete) continue;
+
+        // GPU ticks to CPU nanoseconds, aligned at the first scope of the frame.
+        double nanosecondsPerTick = 1e9 / (double) disjoint.Frequency;
+        for (uint32_t i = 0; i < frame.scopeCount; i++) 
+        {
+            profiler::capturedEvents.push_back({ frame.names[i], 
+                frame.cpuStart + (uint64_t) ((begin[i] - begin[0]) * nanosecondsPerTick), 
+                frame.cpuStart + (uint64_t) ((end[i] - begin[0]) * nanosecondsPerTick), 
+                profiler::gpuThreadId });
+        }
+    }
+}
+#endif
+
 void dx11::drawIndexed(uint32_t indexCount, uint32_t startIndex)
 {
-    dx11Context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
     dx11Context->DrawIndexed(indexCount, startIndex, 0);
 }
 
+void dx11::bindTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+    dx11Context->IASetPrimitiveTopology(topology);
+}
+
 void dx11::bindVertexBuffer(ComPtr<ID3D11Buffer> vertexBuffer, uint32_t stride, uint32_t offset)
 {
-    std::vector<ID3D11Buffer*> vertexBuffers = {vertexBuffer.Get()};
-    
-    dx11Context->IASetVertexBuffers(0, 1, vertexBuffers.data(), &stride, &offset);
+    ID3D11Buffer* buffer = vertexBuffer.Get();
+    dx11Context->IASetVertexBuffers(0, 1, &buffer, &stride, &offset);
 }
 
 void dx11::bindIndexBuffer(ComPtr<ID3D11Buffer> indexBuffer, uint32_t offset)
@@ -927,42 +12963,14 @@ void tiny_engine::detail::dx11::printDXGIError(HRESULT hr) {
 }
 
 
-dx11::DX11Texture* dx11::createTextureFromFile(const std::string& fileName)
+dx11::DX11Texture* dx11::createTextureFromPixels(uint32_t w, uint32_t h, const uint8_t* rgbaPixels)
 {
+    return createTextureFromMipChain(w, h, 1, rgbaPixels);
+}
 
-    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
-
-    Microsoft::WRL::ComPtr<IWICImagingFactory> wic;
-    CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER,
-                     IID_PPV_ARGS(&wic));
-
-    ComPtr<IWICBitmapFlipRotator> flip;
-    wic->CreateBitmapFlipRotator(&flip);
-
-    Microsoft::WRL::ComPtr<IWICBitmapDecoder> dec;
-    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> convWide;
-    if (FAILED(wic->CreateDecoderFromFilename(convWide.from_bytes(fileName).c_str(), nullptr, GENERIC_READ,
-                                              WICDecodeMetadataCacheOnDemand, &dec)))
-    return nullptr; 
-
-    ComPtr<IWICBitmapFrameDecode> frame;
-    dec->GetFrame(0, &frame);
-
-    // Convert to straight RGBA (not pre-multiplied)
-    Microsoft::WRL::ComPtr<IWICFormatConverter> conv;
-    wic->CreateFormatConverter(&conv);
-    conv->Initialize(frame.Get(), GUID_WICPixelFormat32bppRGBA,
-                     WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeCustom);
-
-    flip->Initialize(conv.Get(), WICBitmapTransformFlipVertical);
-
-    UINT w = 0, h = 0;
-    flip->GetSize(&w, &h);
-    std::vector<uint8_t> buffer(w * h * 4);
-    flip->CopyPixels(nullptr, w * 4, (UINT)buffer.size(), buffer.data());
-
-
-
+dx11::DX11Texture* dx11::createTextureFromMipChain(uint32_t w, uint32_t h, uint32_t mipCount, 
+                                                   const uint8_t* mipData)
+{
     D3D11_TEXTURE2D_DESC desc;
     ZeroMemory(&desc, sizeof(desc));
     desc.Width = w;
@@ -971,19 +12979,23 @@ dx11::DX11Texture* dx11::createTextureFromFile(const std::string& fileName)
     desc.Usage = D3D11_USAGE_DEFAULT;
     desc.CPUAccessFlags = 0;
     desc.MiscFlags = 0;
-    desc.MipLevels = 1;
+    desc.MipLevels = mipCount;
     desc.ArraySize = 1;
     desc.SampleDesc.Count = 1;
     desc.SampleDesc.Quality = 0;
     desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 
-    D3D11_SUBRESOURCE_DATA initialData ={};
-    initialData.pSysMem = buffer.data();
-    initialData.SysMemPitch = w * 4;
-    initialData.SysMemSlicePitch = 0;
+    // Every level is read straight from the source memory (e.g. the mapped asset pack).
+    auto initialData = tiny_engine::frameArena().allocateArray<D3D11_SUBRESOURCE_DATA>(mipCount);
+    for (uint32_t level = 0; level < mipCount; level++) 
+    {
+        initialData[level].pSysMem = mipData + pack::mipOffset(w, h, level);
+        initialData[level].SysMemPitch = std::max(1u, w >> level) * 4;
+        initialData[level].SysMemSlicePitch = 0;
+    }
 
     ComPtr<ID3D11Texture2D> dxTexture;
-    auto result = dx11Device->CreateTexture2D(&desc, &initialData, &dxTexture);
+    auto result = dx11Device->CreateTexture2D(&desc, initialData, &dxTexture);
     if (FAILED(result)) {
         return nullptr;
     }
@@ -992,7 +13004,7 @@ dx11::DX11Texture* dx11::createTextureFromFile(const std::string& fileName)
     srvDesc.Format = desc.Format;
     srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
     srvDesc.Texture2D.MostDetailedMip = 0;
-    srvDesc.Texture2D.MipLevels = 1;
+    srvDesc.Texture2D.MipLevels = mipCount;
     
     ComPtr<ID3D11ShaderResourceView> srv; 
     result = dx11Device->CreateShaderResourceView(dxTexture.Get(), &srvDesc, srv.GetAddressOf());
@@ -1109,28 +13121,52 @@ bool tiny_engine::detail::dx11::init(Window window)
 
     HWND hwnd = (HWND) window.nativeWindowHandle;
 
-    DXGI_SWAP_CHAIN_DESC sd;
-    sd.BufferDesc.Width  = window.width;
-    sd.BufferDesc.Height = window.height;
-    sd.BufferDesc.RefreshRate.Numerator = 60;
-    sd.BufferDesc.RefreshRate.Denominator = 1;
-    //sd.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
-    sd.BufferDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-    sd.BufferDesc.ScanlineOrdering = DXGI_MODE_SCANLINE_ORDER_UNSPECIFIED;
-    sd.BufferDesc.Scaling = DXGI_MODE_SCALING_UNSPECIFIED;
+    // A flip model swap chain: the compositor takes the back buffers as they are instead of 
+    // copying them, and only this model has the frame latency object and tearing.
+    ComPtr<IDXGIFactory2> factory2;
+    result = factory->QueryInterface(__uuidof(IDXGIFactory2), (void**) factory2.GetAddressOf());
+    if (FAILED(result)) {
+        printDXGIError(result);
+        return false;
+    }
+
+    ComPtr<IDXGIFactory5> factory5;
+    BOOL allowTearing = FALSE;
+    if (SUCCEEDED(factory->QueryInterface(__uuidof(IDXGIFactory5), (void**) factory5.GetAddressOf())) &&
+        SUCCEEDED(factory5->CheckFeatureSupport(DXGI_FEATURE_PRESENT_ALLOW_TEARING, 
+                                                &allowTearing, sizeof(allowTearing)))) {
+        tearingSupported = allowTearing == TRUE;
+    }
+    swapChainFlags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+    if (tearingSupported) swapChainFlags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
+
+    DXGI_SWAP_CHAIN_DESC1 sd = {};
+    sd.Width  = window.width;
+    sd.Height = window.height;
+    sd.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
     sd.SampleDesc.Count   = 1;
     sd.SampleDesc.Quality = 0;
     sd.BufferUsage  = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-    sd.BufferCount  = 1;
-    sd.OutputWindow = hwnd;
-    sd.Windowed     = true;
-    sd.SwapEffect   = DXGI_SWAP_EFFECT_DISCARD;
-    sd.Flags        = 0;
-    result = factory->CreateSwapChain(dx11Device.Get(), &sd, &dx11SwapChain );
+    sd.BufferCount  = std::clamp(presentSettings.bufferCount, 2u, 16u);
+    sd.Scaling      = DXGI_SCALING_STRETCH;
+    sd.SwapEffect   = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+    sd.AlphaMode    = DXGI_ALPHA_MODE_UNSPECIFIED;
+    sd.Flags        = swapChainFlags;
+    ComPtr<IDXGISwapChain1> swapChain1;
+    result = factory2->CreateSwapChainForHwnd(dx11Device.Get(), hwnd, &sd, nullptr, nullptr, 
+                                              swapChain1.GetAddressOf());
+    if (FAILED(result)) {
+        printDXGIError(result);
+        return false;
+    }
+    swapChain1.As(&dx11SwapChain);
+    result = swapChain1.As(&dx11SwapChain2);
     if (FAILED(result)) {
         printDXGIError(result);
         return false;
     }
+    dx11SwapChain2->SetMaximumFrameLatency(std::clamp(presentSettings.maxFrameLatency, 1u, 16u));
+    frameLatencyWaitable = dx11SwapChain2->GetFrameLatencyWaitableObject();
 
     factory->Release();
     dxgiAdapter->Release();
@@ -1179,82 +13215,11 @@ bool tiny_engine::detail::dx11::init(Window window)
     dx11Context->OMSetBlendState(dx11BlendState.Get(), blendFactor, 0xffffffff);
     bindBackBuffer(0, 0, window.width, window.height);
 
-    // ---------------------------------------------------------------------
-    // D2D/DWRITE initialization:
-    result = D2D1CreateFactory(
-    D2D1_FACTORY_TYPE_SINGLE_THREADED, d2dFactory.GetAddressOf());
-    if (FAILED(result)) return false;
-
-    result = DWriteCreateFactory(
-        DWRITE_FACTORY_TYPE_SHARED,
-        __uuidof(IDWriteFactory),
-        reinterpret_cast<IUnknown**>(dwriteFactory.GetAddressOf())
-        );
-    if (FAILED(result)) return false;
-
-    result = dwriteFactory->CreateTextFormat(
-        L"consolas",                // Font family name.
-        NULL,                       // Font collection (NULL sets it to use the system font collection).
-        DWRITE_FONT_WEIGHT_NORMAL,
-        DWRITE_FONT_STYLE_NORMAL,
-        DWRITE_FONT_STRETCH_NORMAL,
-        18.0f,
-        L"en-us",
-        textFormat.GetAddressOf());
-    if (FAILED(result)) return false;
-
-    result = textFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
-    if (FAILED(result)) return false;
-
-    result = textFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
-    if (FAILED(result)) return false;
-
-    
-    ComPtr<IDXGISurface> dxgiSurface;
-    result = dx11BackBuffer.As(&dxgiSurface); 
-    if (FAILED(result)) return false;
-    D2D1_RENDER_TARGET_PROPERTIES props =
-    D2D1::RenderTargetProperties(
-        D2D1_RENDER_TARGET_TYPE_DEFAULT,
-        D2D1::PixelFormat(DXGI_FORMAT_UNKNOWN, D2D1_ALPHA_MODE_PREMULTIPLIED));
-    result = d2dFactory->CreateDxgiSurfaceRenderTarget(dxgiSurface.Get(), props, d2dRenderTarget.GetAddressOf());
-    if (FAILED(result)) return false;
-    
-    result = d2dRenderTarget->CreateSolidColorBrush(
-        D2D1::ColorF(D2D1::ColorF::GreenYellow),
-        blackBrush.GetAddressOf());
-
-    
-
     return true;
 
 }
 
 
-#endif
-
-
-
-
-#ifdef TE_WINDOWING
-#include <Windows.h>
-
-
-static LRESULT CALLBACK engineWindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) 
-{
-    switch (msg) 
-    {
-        case WM_DESTROY:
-            PostQuitMessage(0);
-            return 0;
-        default:
-            return DefWindowProc(hwnd, msg, wParam, lParam);
-    }
-    
-
-}
-
-
 bool tiny_engine::detail::dx11::resizeSwapChain(HWND hwnd, int width, int height) {
     dx11Context->OMSetRenderTargets(0, nullptr, nullptr);
     ID3D11ShaderResourceView* nullsrvs[16] = {nullptr};
@@ -1264,19 +13229,12 @@ bool tiny_engine::detail::dx11::resizeSwapChain(HWND hwnd, int width, int height
     ID3D11UnorderedAccessView* nullUAVs[8] = { nullptr };
     dx11Context->CSSetUnorderedAccessViews(0, 8, nullUAVs, nullptr);
 
-    if (dx11rtv.Get()) {
-        dx11rtv->Release();
-        dx11rtv = nullptr;
-    }
-    if (dx11DepthStencilView.Get()) {
-        dx11DepthStencilView->Release();
-        dx11DepthStencilView = nullptr;
-    }
-
-    if (dx11DepthStencilBuffer.Get()) {
-        dx11DepthStencilBuffer->Release();
-        dx11DepthStencilBuffer = nullptr;
-    }
+    // ResizeBuffers fails while anything still refers to the old buffers. 
+    // Reset releases exactly once (an explicit Release plus assigning nullptr would release twice).
+    dx11rtv.Reset();
+    dx11DepthStencilView.Reset();
+    dx11DepthStencilBuffer.Reset();
+    dx11BackBuffer.Reset();
 
     auto result = dx11SwapChain->Present(0, 0);
     if (FAILED(result)) {
@@ -1303,7 +13261,8 @@ bool tiny_engine::detail::dx11::resizeSwapChain(HWND hwnd, int width, int height
         return false;
     }
 
-    result = dx11SwapChain->ResizeBuffers(0, width, height, DXGI_FORMAT_UNKNOWN, 0);
+    result = dx11SwapChain->ResizeBuffers(std::clamp(presentSettings.bufferCount, 2u, 16u), 
+                                          width, height, DXGI_FORMAT_UNKNOWN, swapChainFlags);
     if (FAILED(result)) {
         std::cout << "backbuffer resizing on swapchain resizing failed" 
                             << std::to_string(result) << std::endl;
@@ -1349,6 +13308,7 @@ void tiny_engine::detail::dx11::setViewport(int originX, int originY, int width,
     vp.MinDepth = 0.0f;
     vp.MaxDepth = 1.0f;
     dx11Context->RSSetViewports(1, &vp);
+    currentViewport = vp;
 }
 
 
@@ -1427,21 +13387,174 @@ void tiny_engine::detail::dx11::bindBackBuffer(int x, int y, int width, int heig
 }
 
 
-std::vector<tiny_engine::Event> tiny_engine::pollWindowMessages(Window window)
+#endif
+
+
+
+
+#ifdef TE_WINDOWING
+#include <Windows.h>
+#include <windowsx.h>
+
+
+// Translates a win32 virtual key code.
+static tiny_engine::Key keyFromVirtualKey(WPARAM virtualKey)
+{
+    using tiny_engine::Key;
+    if ((virtualKey >= '0' && virtualKey <= '9') || (virtualKey >= 'A' && virtualKey <= 'Z')) 
+    {
+        return (Key) virtualKey;
+    }
+    if (virtualKey >= VK_F1 && virtualKey <= VK_F12) 
+    {
+        return (Key) ((uint16_t) Key::F1 + (virtualKey - VK_F1));
+    }
+    switch (virtualKey) 
+    {
+        case VK_BACK: return Key::Backspace;
+        case VK_TAB: return Key::Tab;
+        case VK_RETURN: return Key::Enter;
+        case VK_ESCAPE: return Key::Escape;
+        case VK_SPACE: return Key::Space;
+        case VK_LEFT: return Key::Left;
+        case VK_RIGHT: return Key::Right;
+        case VK_UP: return Key::Up;
+        case VK_DOWN: return Key::Down;
+        case VK_INSERT: return Key::Insert;
+        case VK_DELETE: return Key::Delete;
+        case VK_HOME: return Key::Home;
+        case VK_END: return Key::End;
+        case VK_PRIOR: return Key::PageUp;
+        case VK_NEXT: return Key::PageDown;
+        case VK_SHIFT: return Key::Shift;
+        case VK_CONTROL: return Key::Control;
+        case VK_MENU: return Key::Alt;
+        default: return Key::Unknown;
+    }
+}
+
+static void queueEvent(tiny_engine::EventType type, tiny_engine::Event event = {})
+{
+    event.type = type;
+    event.timestamp = tiny_engine::eventClock();
+    tiny_engine::detail::eventQueue.push(event);
+}
+
+static void queueMouseButton(tiny_engine::EventType type, tiny_engine::MouseButton button, LPARAM lParam)
+{
+    tiny_engine::Event event = {};
+    event.mouseButton = { button, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+    queueEvent(type, event);
+}
+
+static LRESULT CALLBACK engineWindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) 
+{
+    using tiny_engine::EventType;
+    using tiny_engine::MouseButton;
+    tiny_engine::Event event = {};
+
+    switch (msg) 
+    {
+        case WM_DESTROY:
+            PostQuitMessage(0);
+            return 0;
+
+        case WM_KEYDOWN:
+        case WM_SYSKEYDOWN:
+        case WM_KEYUP:
+        case WM_SYSKEYUP:
+        {
+            bool down = msg == WM_KEYDOWN || msg == WM_SYSKEYDOWN;
+            // Bit 30: the key was already down before.
+            event.key = { keyFromVirtualKey(wParam), (uint16_t) ((lParam >> 16) & 0x1ff), 
+                          down && (lParam & (1 << 30)) != 0 };
+            queueEvent(down ? EventType::KeyDown : EventType::KeyUp, event);
+            // System keys still go to the default handling, e.g. for Alt+F4.
+            if (msg == WM_SYSKEYDOWN || msg == WM_SYSKEYUP) return DefWindowProc(hwnd, msg, wParam, lParam);
+            return 0;
+        }
+
+        case WM_CHAR:
+        {
+            // Characters outside the BMP arrive as two UTF-16 surrogates.
+            static uint32_t highSurrogate = 0;
+            uint32_t unit = (uint32_t) wParam;
+            if (unit >= 0xd800 && unit < 0xdc00) 
+            {
+                highSurrogate = unit;
+                return 0;
+            }
+            uint32_t codePoint = unit;
+            if (unit >= 0xdc00 && unit < 0xe000) 
+            {
+                if (!highSurrogate) return 0;
+                codePoint = 0x10000 + ((highSurrogate - 0xd800) << 10) + (unit - 0xdc00);
+            }
+            highSurrogate = 0;
+            event.text = { codePoint };
+            queueEvent(EventType::TextInput, event);
+            return 0;
+        }
+
+        case WM_MOUSEMOVE:
+            event.mouseMove = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+            queueEvent(EventType::MouseMove, event);
+            return 0;
+
+        case WM_LBUTTONDOWN: queueMouseButton(EventType::MouseButtonDown, MouseButton::Left, lParam); return 0;
+        case WM_LBUTTONUP: queueMouseButton(EventType::MouseButtonUp, MouseButton::Left, lParam); return 0;
+        case WM_RBUTTONDOWN: queueMouseButton(EventType::MouseButtonDown, MouseButton::Right, lParam); return 0;
+        case WM_RBUTTONUP: queueMouseButton(EventType::MouseButtonUp, MouseButton::Right, lParam); return 0;
+        case WM_MBUTTONDOWN: queueMouseButton(EventType::MouseButtonDown, MouseButton::Middle, lParam); return 0;
+        case WM_MBUTTONUP: queueMouseButton(EventType::MouseButtonUp, MouseButton::Middle, lParam); return 0;
+        case WM_XBUTTONDOWN:
+        case WM_XBUTTONUP:
+            queueMouseButton(msg == WM_XBUTTONDOWN ? EventType::MouseButtonDown : EventType::MouseButtonUp, 
+                             GET_XBUTTON_WPARAM(wParam) == XBUTTON1 ? MouseButton::X1 : MouseButton::X2, 
+                             lParam);
+            return TRUE;
+
+        case WM_MOUSEWHEEL:
+        {
+            // Wheel positions come in screen coordinates.
+            POINT point = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+            ScreenToClient(hwnd, &point);
+            event.mouseWheel = { (float) GET_WHEEL_DELTA_WPARAM(wParam) / WHEEL_DELTA, point.x, point.y };
+            queueEvent(EventType::MouseWheel, event);
+            return 0;
+        }
+
+        case WM_SIZE:
+            event.resize = { LOWORD(lParam), HIWORD(lParam) };
+            queueEvent(EventType::Resize, event);
+            return 0;
+
+        case WM_SETFOCUS:
+            queueEvent(EventType::FocusGained);
+            return 0;
+
+        case WM_KILLFOCUS:
+            queueEvent(EventType::FocusLost);
+            return 0;
+
+        default:
+            return DefWindowProc(hwnd, msg, wParam, lParam);
+    }
+    
+
+}
+
+
+void tiny_engine::pollWindowMessages(Window window)
 {
-    std::vector<Event> events;
     MSG msg;
     while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
         if (msg.message == WM_QUIT) {
-
-            events.emplace_back(tiny_engine::Event{"quit"});
+            queueEvent(EventType::Quit);
         }
         TranslateMessage(&msg);
         DispatchMessageW(&msg);
     }
-
-
-    return events;
 }
 
 
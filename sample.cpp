@@ -9,7 +9,17 @@ int main(int argc, char** args)
     auto graphics = tiny_engine::initGraphics("dx11", window);
     assert(graphics != nullptr);
 
-    auto heroTexture = tiny_engine::createTextureFromFile(graphics, "sample_assets/hero.png");
+    // Cooked assets (see build.bat) are used as they are, without decoding. 
+    // The image files are the fallback.
+    std::optional<tiny_engine::Texture> heroTexture;
+    auto assets = tiny_engine::openAssetPack("build/sample_assets.tepack");
+    if (!assets.has_value()) assets = tiny_engine::openAssetPack("sample_assets.tepack");
+    if (assets.has_value()) {
+        heroTexture = tiny_engine::createTextureFromPack(graphics, assets.value(), "sample_assets/hero.png");
+    }
+    if (!heroTexture.has_value()) {
+        heroTexture = tiny_engine::createTextureFromFile(graphics, "sample_assets/hero.png");
+    }
     if (!heroTexture.has_value()) {
         heroTexture = tiny_engine::createTextureFromFile(graphics, "../sample_assets/hero.png");
         assert(heroTexture.has_value());
@@ -17,21 +27,51 @@ int main(int argc, char** args)
 
     std::cout << "hero texture loaded" << std::endl;
 
+    // Any TrueType font will do, the frame rate is only shown if it loads.
+    auto font = tiny_engine::createFontFromFile(graphics, "C:/Windows/Fonts/consola.ttf", 18);
+
+    // Vsync with at most one frame queued, for the lowest input latency.
+    tiny_engine::PresentSettings presentSettings;
+    presentSettings.syncInterval = 1;
+    presentSettings.maxFrameLatency = 1;
+    tiny_engine::setPresentSettings(graphics, presentSettings);
+
+    float spinAngle = 0;
     bool runGame = true;
     while (runGame) {
 
         
-        auto events = tiny_engine::pollWindowMessages(window);
-        for (auto& e : events)
+        tiny_engine::pollWindowMessages(window);
+        tiny_engine::Event e;
+        while (tiny_engine::nextEvent(e))
         {
-            if (e.type == "quit") runGame = false;
+            if (e.type == tiny_engine::EventType::Quit) runGame = false;
+            if (e.type == tiny_engine::EventType::KeyDown && e.key.key == tiny_engine::Key::Escape) runGame = false;
         }
 
         tiny_engine::bindBackBuffer(graphics, 0, 0, 800, 600);
         tiny_engine::clearBackBuffer(graphics, 0, 0, 0, 1);
 
         tiny_engine::drawTexture(graphics, heroTexture.value(), 100, 100);
-        
+
+        // A second hero, spinning and tinted red.
+        tiny_engine::Sprite spinner;
+        spinner.texture = heroTexture.value();
+        spinner.x = -100;
+        spinner.y = 100;
+        spinAngle += (float) tiny_engine::getFrameTiming().frameTime * 0.001f;
+        spinner.rotation = spinAngle;
+        spinner.tint = 0xff8080ff;
+        tiny_engine::drawSprite(graphics, spinner);
+
+        if (font.has_value()) {
+            auto timing = tiny_engine::getFrameTiming();
+            char stats[64];
+            snprintf(stats, sizeof(stats), "%.0f fps\ncpu %.2f ms", 
+                     timing.frameTime > 0 ? 1000.0 / timing.frameTime : 0.0, timing.cpuTime);
+            tiny_engine::drawText(graphics, font.value(), stats, -380, 270);
+        }
+
         tiny_engine::presentBackBuffer(graphics);
 
     }
@@ -0,0 +1,156 @@
+// Tests of the sprite batching: the sort keys, the radix sort, the draw ranges of SpriteBatch,
+// and the render counters of whole frames on the null backend, so the batching efficiency
+// (draws submitted against draw calls and state changes issued) is tracked without a GPU.
+// Prints the counters of every frame and returns 0 if all of them are as expected.
+//
+// Usage: batching_test
+
+#include "../engine.h"
+#include <random>
+
+using namespace tiny_engine;
+
+static bool passed = true;
+
+static void check(bool condition, const char* test, const char* what)
+{
+    if (condition) return;
+    std::cout << "  FAILED " << test << ": " << what << std::endl;
+    passed = false;
+}
+
+static void testSortKeys()
+{
+    using detail::makeSortKey;
+    check(makeSortKey(1, 0, 0, 1) > makeSortKey(0, 0xffffff, 0xffffff, 0), "sort keys", "layer is not the most significant part");
+    check(makeSortKey(0, 2, 0, 1) > makeSortKey(0, 1, 0xffffff, 0), "sort keys", "shader does not come before texture");
+    check(makeSortKey(0, 0, 2, 1) > makeSortKey(0, 0, 1, 0), "sort keys", "texture does not come before depth");
+    check(makeSortKey(0, 0, 0, 1) < makeSortKey(0, 0, 0, 0), "sort keys", "far draws do not come first");
+    // Shader slots above 255 used to be cut off and share the key of a lower slot.
+    check(makeSortKey(0, 1, 0, 0) != makeSortKey(0, 257, 0, 0), "sort keys", "shader slots 1 and 257 share a key");
+    check(makeSortKey(0, 0xffff, 0, 0) > makeSortKey(0, 0x100, 0, 0), "sort keys", "high shader slots are not ordered");
+    // Generations (above the slot index) must not matter.
+    check(makeSortKey(0, 0, 5 | (3u << 24), 0) == makeSortKey(0, 0, 5, 0), "sort keys", "texture generation changed the key");
+}
+
+static void testRadixSort()
+{
+    std::mt19937_64 random(3);
+    for (size_t count : { (size_t) 0, (size_t) 1, (size_t) 20, (size_t) 1000, (size_t) 100000 }) 
+    {
+        std::vector<detail::SortPacket> packets(count), scratch(count);
+        for (uint32_t i = 0; i < count; i++) 
+        {
+            // Few distinct values in the low bits, so there are many ties to keep in order.
+            uint64_t r = random();
+            packets[i] = detail::SortPacket { (r & 0xff00ff0000000000ull) | (r & 7), i };
+        }
+        std::vector<detail::SortPacket> expected = packets;
+        std::stable_sort(expected.begin(), expected.end(),
+                         [](const detail::SortPacket& a, const detail::SortPacket& b) { return a.key < b.key; });
+        detail::radixSort(packets.data(), scratch.data(), count);
+        bool same = true;
+        for (size_t i = 0; i < count; i++) same &= packets[i].key == expected[i].key && packets[i].index == expected[i].index;
+        check(same, "radix sort", "differs from std::stable_sort");
+    }
+}
+
+static void testSpriteBatch()
+{
+    // 2 shaders (slots 0 and 256, which used to collide) x 3 textures, interleaved.
+    detail::SpriteBatch batch;
+    const uint32_t shaders[2] = { 0, 256 };
+    for (uint32_t i = 0; i < 600; i++) 
+    {
+        detail::SpriteDraw draw = {};
+        draw.shaderId = shaders[i % 2];
+        draw.textureId = 1 + i % 3;
+        draw.depth = detail::spriteDepth;
+        draw.x = (float) i;
+        batch.add(draw);
+    }
+    batch.build();
+    const auto& ranges = batch.ranges();
+    check(ranges.size() == 6, "sprite batch", "not one range per shader and texture");
+    bool counts = true;
+    for (const auto& range : ranges) counts &= range.instanceCount == 100;
+    check(counts, "sprite batch", "wrong instance counts");
+    check(batch.instances().size() == 600, "sprite batch", "instances lost");
+
+    // Equal keys keep their order.
+    bool inOrder = true;
+    for (const auto& range : ranges) 
+    {
+        for (uint32_t i = 1; i < range.instanceCount; i++) 
+        {
+            inOrder &= batch.instances()[range.firstInstance + i - 1].x < batch.instances()[range.firstInstance + i].x;
+        }
+    }
+    check(inOrder, "sprite batch", "draws with the same key were reordered");
+}
+
+struct ExpectedFrame 
+{
+    const char* name;
+    uint32_t textures;
+    uint32_t spritesPerLayer;
+    uint32_t layers;
+    RenderStats expected;
+};
+
+static void testFrameCounters()
+{
+    GraphicsContext* graphics = initGraphics("null", Window { 1280, 720, nullptr });
+    if (!graphics) 
+    {
+        check(false, "frame counters", "no null backend");
+        return;
+    }
+    namespace null = detail::null;
+    Texture textures[8];
+    for (auto& texture : textures) texture = Texture { null::textureStorage.store(new null::NullTexture { 64, 64 }) };
+
+    // One draw call per texture and layer. Every present forgets the bound state, so each frame binds
+    // the shader once and the texture once per range, the other shader binds are skipped.
+    const ExpectedFrame frames[] = {
+        { "1 texture", 1, 1000, 1, { 1000, 1, 0, 2, 0 } },
+        { "4 textures interleaved", 4, 1000, 1, { 1000, 4, 0, 5, 3 } },
+        { "8 textures, 3 layers", 8, 1000, 3, { 3000, 24, 0, 25, 23 } },
+    };
+    for (const ExpectedFrame& frame : frames) 
+    {
+        bindBackBuffer(graphics, 0, 0, 1280, 720);
+        clearBackBuffer(graphics, 0, 0, 0, 1);
+        for (uint32_t layer = 0; layer < frame.layers; layer++) 
+        {
+            Sprite sprite;
+            sprite.layer = (uint8_t) layer;
+            for (uint32_t i = 0; i < frame.spritesPerLayer; i++) 
+            {
+                sprite.texture = textures[i % frame.textures];
+                sprite.x = (float) (i % 1280);
+                drawSprite(graphics, sprite);
+            }
+        }
+        presentBackBuffer(graphics);
+
+        RenderStats stats = getRenderStats(graphics);
+        std::cout << frame.name << ": " << stats.drawsSubmitted << " draws submitted, "
+                  << stats.drawCalls << " draw calls, " << stats.stateChanges << " state changes, "
+                  << stats.stateChangesSkipped << " skipped" << std::endl;
+        const RenderStats& expected = frame.expected;
+        check(stats.drawsSubmitted == expected.drawsSubmitted && stats.drawCalls == expected.drawCalls &&
+              stats.stateChanges == expected.stateChanges && stats.stateChangesSkipped == expected.stateChangesSkipped,
+              frame.name, "counters differ from the expected batching");
+    }
+}
+
+int main()
+{
+    testSortKeys();
+    testRadixSort();
+    testSpriteBatch();
+    testFrameCounters();
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
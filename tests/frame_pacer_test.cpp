@@ -0,0 +1,174 @@
+// Tests of the frame pacer with a fake clock, so no test waits in real time.
+// The fake clock moves 1 us on every read (the limiter's spin loop reads it) and sleeps
+// exactly as long as asked plus a set oversleep.
+// Covers the average frame period held by the limiter, a hitch restarting the schedule
+// instead of a burst of short frames, the spin margin growing with the oversleep and
+// relaxing again, and a clock which starts at 0.
+// Returns 0 if every test passes.
+//
+// Usage: frame_pacer_test
+
+#include "../engine.h"
+#include <cmath>
+
+using namespace tiny_engine;
+
+static bool passed = true;
+
+static void check(bool condition, const char* test, const char* what)
+{
+    if (condition) return;
+    std::cout << "  FAILED " << test << ": " << what << std::endl;
+    passed = false;
+}
+
+struct FakeClock 
+{
+    uint64_t time = 1000000000;
+    uint64_t oversleep = 0;
+    uint32_t sleeps = 0;
+
+    detail::PacingClock pacingClock() 
+    {
+        return detail::PacingClock { now, sleep, this };
+    }
+
+    static uint64_t now(void* user) 
+    {
+        FakeClock* clock = static_cast<FakeClock*>(user);
+        clock->time += 1000;
+        return clock->time;
+    }
+
+    static void sleep(void* user, uint64_t nanoseconds) 
+    {
+        FakeClock* clock = static_cast<FakeClock*>(user);
+        clock->time += nanoseconds + clock->oversleep;
+        clock->sleeps++;
+    }
+};
+
+static const uint64_t millisecond = 1000000;
+
+// One frame as presentBackBuffer runs it: work milliseconds of game, 0.5 ms of present.
+static FrameTiming runFrame(detail::FramePacer& pacer, FakeClock& clock, double work)
+{
+    clock.time += (uint64_t) (work * millisecond);
+    pacer.beginPresent();
+    clock.time += millisecond / 2;
+    pacer.endPresent();
+    pacer.waitForNextFrame(nullptr);
+    return pacer.lastFrame();
+}
+
+static void testAveragePeriod()
+{
+    FakeClock clock;
+    detail::FramePacer pacer(clock.pacingClock());
+    pacer.setTargetFrameRate(60);
+    runFrame(pacer, clock, 5);
+
+    // 5 ms frames held to 60 fps, 600 frames are 10 seconds.
+    const int frames = 600;
+    uint64_t start = clock.time;
+    double shortest = 1e30, longest = 0;
+    for (int i = 0; i < frames; i++) 
+    {
+        FrameTiming timing = runFrame(pacer, clock, 5);
+        shortest = std::min(shortest, timing.frameTime);
+        longest = std::max(longest, timing.frameTime);
+    }
+    double average = (double) (clock.time - start) / millisecond / frames;
+    check(std::fabs(average - 1000.0 / 60) < 0.01, "average period", "60 fps frames are not 16.67 ms on average");
+    check(shortest > 16.6 && longest < 16.8, "average period", "single frames are off the period");
+    check(clock.sleeps >= frames, "average period", "the limiter spun instead of sleeping");
+
+    FrameTiming timing = pacer.lastFrame();
+    check(std::fabs(timing.cpuTime - 5) < 0.01 && std::fabs(timing.presentTime - 0.5) < 0.01,
+          "average period", "wrong cpu or present time");
+    check(timing.limiterWaitTime > 11 && timing.limiterWaitTime < 11.3, "average period", "wrong limiter wait");
+
+    // Without a target the frames are as long as the work.
+    pacer.setTargetFrameRate(0);
+    timing = runFrame(pacer, clock, 5);
+    timing = runFrame(pacer, clock, 5);
+    check(timing.frameTime < 5.6 && timing.limiterWaitTime < 0.01, "average period", "the limiter ran while off");
+}
+
+static void testHitch()
+{
+    FakeClock clock;
+    detail::FramePacer pacer(clock.pacingClock());
+    pacer.setTargetFrameRate(60);
+    for (int i = 0; i < 10; i++) runFrame(pacer, clock, 5);
+
+    // A 100 ms frame is neither waited for nor caught up afterwards.
+    FrameTiming hitch = runFrame(pacer, clock, 100);
+    check(hitch.limiterWaitTime < 0.01, "hitch", "the limiter waited after a late frame");
+    double shortest = 1e30;
+    for (int i = 0; i < 20; i++) shortest = std::min(shortest, runFrame(pacer, clock, 5).frameTime);
+    check(shortest > 16.6, "hitch", "short frames after the hitch, the schedule was caught up");
+
+    // A frame late by less than a period keeps the schedule, the next one is shorter.
+    FrameTiming late = runFrame(pacer, clock, 20);
+    FrameTiming next = runFrame(pacer, clock, 5);
+    check(late.frameTime > 20 && next.frameTime < 1000.0 / 60 * 2 - late.frameTime + 0.1, "hitch",
+          "a slightly late frame restarted the schedule");
+}
+
+static void testSpinMargin()
+{
+    FakeClock clock;
+    detail::FramePacer pacer(clock.pacingClock());
+    pacer.setTargetFrameRate(60);
+    runFrame(pacer, clock, 5);
+
+    // Sleeps which wake 3 ms late: the margin grows past 3 ms right away, and the frames keep the period.
+    clock.oversleep = 3 * millisecond;
+    runFrame(pacer, clock, 5);
+    runFrame(pacer, clock, 5);
+    check(pacer.spinMargin() >= 3 * millisecond, "spin margin", "the margin did not grow with the oversleep");
+    double longest = 0;
+    for (int i = 0; i < 20; i++) longest = std::max(longest, runFrame(pacer, clock, 5).frameTime);
+    check(longest < 16.8, "spin margin", "oversleeping made the frames late");
+
+    // Exact sleeps again: the margin relaxes, slowly, down to its minimum.
+    clock.oversleep = 0;
+    uint64_t grown = pacer.spinMargin();
+    runFrame(pacer, clock, 5);
+    uint64_t afterOne = pacer.spinMargin();
+    check(afterOne < grown && afterOne > grown / 2, "spin margin", "the margin did not relax slowly");
+    for (int i = 0; i < 300; i++) runFrame(pacer, clock, 5);
+    check(pacer.spinMargin() <= 100000, "spin margin", "the margin did not relax to its minimum");
+}
+
+static void testClockStartingAtZero()
+{
+    FakeClock clock;
+    clock.time = 0;
+    // Reads do not advance this clock, so the first frame starts and ends at 0.
+    detail::PacingClock pacingClock = { [](void* user) { return static_cast<FakeClock*>(user)->time; },
+                                        FakeClock::sleep, &clock };
+    detail::FramePacer pacer(pacingClock);
+    pacer.beginPresent();
+    pacer.endPresent();
+    pacer.waitForNextFrame(nullptr);
+    check(pacer.lastFrame().frameTime == 0, "clock at 0", "wrong first frame");
+
+    // The second frame starts at 0 as well, not at its present.
+    clock.time += 5 * millisecond;
+    pacer.beginPresent();
+    pacer.endPresent();
+    pacer.waitForNextFrame(nullptr);
+    check(std::fabs(pacer.lastFrame().cpuTime - 5) < 0.01, "clock at 0", "the frame starting at 0 lost its time");
+}
+
+int main()
+{
+    testAveragePeriod();
+    testHitch();
+    testSpinMargin();
+    testClockStartingAtZero();
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+// Unit tests of the single producer, single consumer RingBuffer behind the event queue.
+// Covers the order of the items, a full buffer dropping and counting pushes,
+// wrapping around the storage many times, and one producer and one consumer thread
+// running at the same time, which must not lose, repeat or reorder anything.
+// Returns 0 if every test passes.
+//
+// Usage: ring_buffer_test
+
+#include "../engine.h"
+
+using namespace tiny_engine;
+
+static bool passed = true;
+
+static void check(bool condition, const char* test, const char* what)
+{
+    if (condition) return;
+    std::cout << "  FAILED " << test << ": " << what << std::endl;
+    passed = false;
+}
+
+static void testEmpty()
+{
+    detail::RingBuffer<int, 4> buffer;
+    int item = -1;
+    check(buffer.empty(), "empty", "a new buffer is not empty");
+    check(buffer.size() == 0, "empty", "a new buffer has a size");
+    check(!buffer.pop(item), "empty", "pop of an empty buffer succeeded");
+    check(item == -1, "empty", "failed pop wrote the item");
+}
+
+static void testOrder()
+{
+    detail::RingBuffer<int, 8> buffer;
+    for (int i = 0; i < 5; i++) check(buffer.push(i), "order", "push failed below capacity");
+    check(buffer.size() == 5, "order", "wrong size after 5 pushes");
+    for (int i = 0; i < 5; i++) 
+    {
+        int item = -1;
+        check(buffer.pop(item) && item == i, "order", "items did not come out in push order");
+    }
+    check(buffer.empty(), "order", "not empty after popping everything");
+}
+
+static void testFull()
+{
+    detail::RingBuffer<int, 4> buffer;
+    for (int i = 0; i < 4; i++) buffer.push(i);
+    check(buffer.size() == 4, "full", "not full after capacity pushes");
+    check(!buffer.push(100), "full", "push into a full buffer succeeded");
+    check(!buffer.push(101), "full", "push into a full buffer succeeded");
+    check(buffer.droppedCount() == 2, "full", "dropped pushes were not counted");
+
+    // The dropped items must not have overwritten anything.
+    int item = -1;
+    check(buffer.pop(item) && item == 0, "full", "a dropped push overwrote the oldest item");
+    check(buffer.push(4), "full", "push after a pop failed");
+    for (int i = 1; i <= 4; i++) check(buffer.pop(item) && item == i, "full", "wrong item after refilling");
+    check(buffer.droppedCount() == 2, "full", "successful pushes changed the dropped count");
+}
+
+static void testWrapAround()
+{
+    // An uneven number of items per round, so the indices end up everywhere in the storage.
+    detail::RingBuffer<uint32_t, 16> buffer;
+    uint32_t next = 0, expected = 0;
+    bool inOrder = true;
+    for (int round = 0; round < 10000; round++) 
+    {
+        for (int i = 0; i < 11; i++) buffer.push(next++);
+        uint32_t item;
+        for (int i = 0; i < 11; i++) inOrder &= buffer.pop(item) && item == expected++;
+    }
+    check(inOrder, "wrap around", "items lost or reordered while wrapping around");
+    check(buffer.empty() && buffer.droppedCount() == 0, "wrap around", "not empty or items dropped");
+}
+
+static void testTwoThreads()
+{
+    // Events as the payload, the real queue's item type. 
+    // Static, so the producer thread can use it without a capture.
+    static detail::RingBuffer<Event, 64> buffer;
+    const uint64_t count = 2000000;
+
+    std::thread producer([]() {
+        for (uint64_t i = 0; i < count; i++) 
+        {
+            Event event = {};
+            event.type = EventType::MouseMove;
+            event.timestamp = i;
+            event.mouseMove.x = (int32_t) i;
+            while (!buffer.push(event)) std::this_thread::yield();
+        }
+    });
+
+    bool inOrder = true;
+    uint64_t expected = 0;
+    while (expected < count) 
+    {
+        Event event;
+        if (!buffer.pop(event)) 
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        // A torn read would show up as a timestamp which does not match the payload.
+        inOrder &= event.type == EventType::MouseMove && event.timestamp == expected &&
+                   event.mouseMove.x == (int32_t) expected;
+        expected++;
+    }
+    producer.join();
+    check(inOrder, "two threads", "items lost, repeated, reordered or torn");
+    check(buffer.empty(), "two threads", "items left after the producer finished");
+}
+
+int main()
+{
+    testEmpty();
+    testOrder();
+    testFull();
+    testWrapAround();
+    testTwoThreads();
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
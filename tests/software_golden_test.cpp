@@ -0,0 +1,340 @@
+// Golden image test of the software rasterizer backend.
+// Renders a few scenes headless and compares them with the images in tests/golden, 
+// first on the calling thread only, then again with the job threads running, 
+// which must give exactly the same pixels. One scene records command lists in jobs, 
+// which finish in any order with the job threads running and in reverse without them.
+// Returns 0 if every scene matches.
+//
+// Usage (from the repository root): software_golden_test [--update]
+// --update writes the current images as the new golden images instead of comparing.
+
+#include "../engine.h"
+#include <cstring>
+
+using namespace tiny_engine;
+
+static const int width = 256;
+static const int height = 192;
+
+// A channel may differ by this much, e.g. from another compiler rounding a blend differently, 
+// and at most maxDifferentPixels pixels may differ by more.
+static const int channelTolerance = 2;
+static const uint32_t maxDifferentPixels = width * height / 1000;
+
+static Texture createTexture(uint32_t w, uint32_t h, const std::vector<uint8_t>& rgba)
+{
+    namespace software = detail::software;
+    return Texture { software::textureStorage.store(software::createTextureFromPixels(w, h, rgba.data())) };
+}
+
+// Horizontal color stripes, opaque.
+static Texture createStripes()
+{
+    std::vector<uint8_t> rgba(32 * 32 * 4);
+    for (uint32_t y = 0; y < 32; y++) 
+    {
+        for (uint32_t x = 0; x < 32; x++) 
+        {
+            uint8_t* p = &rgba[(y * 32 + x) * 4];
+            uint32_t stripe = y / 8;
+            p[0] = stripe == 0 || stripe == 3 ? 255 : 0;
+            p[1] = stripe == 1 || stripe == 3 ? 255 : 0;
+            p[2] = stripe == 2 || stripe == 3 ? 255 : 0;
+            p[3] = 255;
+        }
+    }
+    return createTexture(32, 32, rgba);
+}
+
+// A white/orange checker whose alpha rises from left to right.
+static Texture createFade()
+{
+    std::vector<uint8_t> rgba(64 * 16 * 4);
+    for (uint32_t y = 0; y < 16; y++) 
+    {
+        for (uint32_t x = 0; x < 64; x++) 
+        {
+            uint8_t* p = &rgba[(y * 64 + x) * 4];
+            bool white = ((x / 4) + (y / 4)) % 2 == 0;
+            p[0] = 255;
+            p[1] = white ? 255 : 128;
+            p[2] = white ? 255 : 0;
+            p[3] = (uint8_t) (x * 4 + 3);
+        }
+    }
+    return createTexture(64, 16, rgba);
+}
+
+struct Scene 
+{
+    const char* name;
+    void (*draw)(GraphicsContext* graphics, Texture hero, Texture stripes, Texture fade);
+    /// Command list draws the scene leaves outside the view.
+    uint32_t drawsCulled = 0;
+};
+
+// One command list of the command_lists scene, recorded by a job.
+struct Recording 
+{
+    GraphicsContext* graphics;
+    CommandList list;
+    Texture texture;
+    int row;
+};
+
+static void record(void* data)
+{
+    Recording& recording = *static_cast<Recording*>(data);
+    CommandList list = recording.list;
+    int row = recording.row;
+    beginCommandList(recording.graphics, list);
+    // A row overlapping the rows of the lists before and after it, so their order shows.
+    for (int i = 0; i < 6; i++) drawTexture(list, recording.texture, -90 + i * 36 + row * 12, -45 + row * 30 + i * 4);
+    // Completely outside the view, left and above.
+    drawTexture(list, recording.texture, -170 - row * 10, 0);
+    drawTexture(list, recording.texture, row * 20, 140);
+    closeCommandList(recording.graphics, list);
+}
+
+static const Scene scenes[] = {
+    { "sprites", [](GraphicsContext* graphics, Texture hero, Texture, Texture) {
+        clearBackBuffer(graphics, 0.1f, 0.1f, 0.3f, 1);
+        drawTexture(graphics, hero, 0, 0);
+        drawTexture(graphics, hero, -100, 50);
+        // Partly outside the screen on every side.
+        drawTexture(graphics, hero, -130, -90);
+        drawTexture(graphics, hero, 125, 95);
+        Sprite big;
+        big.texture = hero;
+        big.x = 70;
+        big.y = -30;
+        big.width = 100;
+        big.height = 40;
+        drawSprite(graphics, big);
+    } },
+    { "blend", [](GraphicsContext* graphics, Texture hero, Texture stripes, Texture fade) {
+        clearBackBuffer(graphics, 0, 0, 0, 1);
+        Sprite background;
+        background.texture = stripes;
+        background.width = 200;
+        background.height = 160;
+        drawSprite(graphics, background);
+        // Layers decide the order, not the order of the calls.
+        Sprite over;
+        over.texture = fade;
+        over.width = 240;
+        over.height = 40;
+        over.layer = 2;
+        over.y = 20;
+        drawSprite(graphics, over);
+        Sprite middle;
+        middle.texture = hero;
+        middle.layer = 1;
+        middle.x = -40;
+        middle.y = 10;
+        drawSprite(graphics, middle);
+    } },
+    { "viewport", [](GraphicsContext* graphics, Texture hero, Texture stripes, Texture) {
+        clearBackBuffer(graphics, 0.5f, 0.5f, 0.5f, 1);
+        bindBackBuffer(graphics, 40, 30, 150, 100);
+        float x[16], y[16];
+        for (int i = 0; i < 16; i++) 
+        {
+            x[i] = -140.0f + i * 18.0f;
+            y[i] = (i % 4) * 30.0f - 50.0f;
+        }
+        SpriteArrays arrays;
+        arrays.x = x;
+        arrays.y = y;
+        drawSprites(graphics, stripes, arrays, 16);
+        // Over the stripes and cut off by the bottom of the viewport.
+        Sprite front;
+        front.texture = hero;
+        front.layer = 1;
+        front.x = 60;
+        front.y = -60;
+        drawSprite(graphics, front);
+        bindBackBuffer(graphics, 0, 0, width, height);
+    } },
+    { "command_lists", [](GraphicsContext* graphics, Texture hero, Texture stripes, Texture fade) {
+        clearBackBuffer(graphics, 0.2f, 0.3f, 0.2f, 1);
+        // Drawn directly before the submit, so under every list.
+        drawTexture(graphics, stripes, 0, 0);
+        const Texture textures[] = { hero, fade, stripes, hero };
+        Recording recordings[std::size(textures)];
+        for (int i = 0; i < (int) std::size(textures); i++) 
+        {
+            recordings[i] = Recording { graphics, createCommandList(graphics), textures[i], i };
+        }
+        // Last list first, so inline they finish in reverse array order.
+        JobCounter counter;
+        for (int i = (int) std::size(textures) - 1; i >= 0; i--) runJob(record, &recordings[i], &counter);
+        waitForCounter(counter);
+
+        CommandList lists[std::size(textures)];
+        for (size_t i = 0; i < std::size(textures); i++) lists[i] = recordings[i].list;
+        submitCommandLists(graphics, lists, (uint32_t) std::size(lists));
+        // Drawn directly after the submit, so over every list.
+        drawTexture(graphics, fade, 60, 70);
+        for (CommandList list : lists) destroyCommandList(graphics, list);
+    }, 8 },
+};
+
+static void render(GraphicsContext* graphics, const Scene& scene, Texture hero, Texture stripes, Texture fade, 
+                   std::vector<uint32_t>& pixels)
+{
+    scene.draw(graphics, hero, stripes, fade);
+    presentBackBuffer(graphics);
+    pixels = detail::software::getFramebuffer().pixels;
+}
+
+// The golden images are QOI files, top row first, so any viewer shows them upright. 
+// The encoder only uses runs, the index and literal pixels.
+static bool writeQoi(const std::string& fileName, const std::vector<uint32_t>& pixels)
+{
+    std::vector<uint8_t> out = { 'q', 'o', 'i', 'f' };
+    auto put32 = [&out](uint32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8) out.push_back((uint8_t) (v >> shift));
+    };
+    put32(width);
+    put32(height);
+    out.push_back(4);
+    out.push_back(0);
+
+    uint32_t index[64] = {};
+    uint32_t previous = 0xff000000;
+    int run = 0;
+    for (size_t i = 0; i < pixels.size(); i++) 
+    {
+        uint32_t pixel = pixels[i];
+        if (pixel == previous) 
+        {
+            run++;
+            if (run == 62 || i + 1 == pixels.size()) 
+            {
+                out.push_back((uint8_t) (0xc0 | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) 
+        {
+            out.push_back((uint8_t) (0xc0 | (run - 1)));
+            run = 0;
+        }
+        uint8_t r = pixel & 0xff, g = (pixel >> 8) & 0xff, b = (pixel >> 16) & 0xff, a = pixel >> 24;
+        int slot = (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+        if (index[slot] == pixel) 
+        {
+            out.push_back((uint8_t) slot);
+        }
+        else 
+        {
+            index[slot] = pixel;
+            out.insert(out.end(), { 0xff, r, g, b, a });
+        }
+        previous = pixel;
+    }
+    out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (!file) return false;
+    bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+    fclose(file);
+    return written;
+}
+
+static bool compareWithGolden(const std::string& fileName, const std::vector<uint32_t>& pixels)
+{
+    detail::DecodedImage golden;
+    if (!detail::decodeImageFile(fileName, golden) || golden.width != width || golden.height != height) 
+    {
+        std::cout << "  could not read " << fileName << std::endl;
+        return false;
+    }
+    uint32_t different = 0;
+    int maxDifference = 0;
+    for (int y = 0; y < height; y++) 
+    {
+        // Decoded images come bottom row first.
+        const uint8_t* expected = &golden.pixels[(size_t) (height - 1 - y) * width * 4];
+        const uint32_t* actual = &pixels[(size_t) y * width];
+        for (int x = 0; x < width; x++) 
+        {
+            int difference = 0;
+            for (int c = 0; c < 4; c++) 
+            {
+                int channel = (actual[x] >> (c * 8)) & 0xff;
+                difference = std::max(difference, std::abs(channel - expected[x * 4 + c]));
+            }
+            maxDifference = std::max(maxDifference, difference);
+            if (difference > channelTolerance) different++;
+        }
+    }
+    std::cout << "  " << different << " pixels differ, by at most " << maxDifference << std::endl;
+    return different <= maxDifferentPixels;
+}
+
+int main(int argc, char** args) 
+{
+    bool update = argc > 1 && strcmp(args[1], "--update") == 0;
+
+    GraphicsContext* graphics = initGraphics("software", Window { width, height, nullptr });
+    if (!graphics) 
+    {
+        std::cout << "no software backend" << std::endl;
+        return 1;
+    }
+    auto hero = createTextureFromFile(graphics, "sample_assets/hero.png");
+    if (!hero) 
+    {
+        std::cout << "sample_assets/hero.png not found, run from the repository root" << std::endl;
+        return 1;
+    }
+    Texture stripes = createStripes();
+    Texture fade = createFade();
+
+    std::vector<std::vector<uint32_t>> inlineImages(std::size(scenes));
+    for (size_t i = 0; i < std::size(scenes); i++) render(graphics, scenes[i], *hero, stripes, fade, inlineImages[i]);
+
+    initJobs(3);
+    bool passed = true;
+    for (size_t i = 0; i < std::size(scenes); i++) 
+    {
+        std::vector<uint32_t> threaded;
+        render(graphics, scenes[i], *hero, stripes, fade, threaded);
+        std::string fileName = std::string("tests/golden/") + scenes[i].name + ".qoi";
+        std::cout << scenes[i].name << std::endl;
+        if (threaded != inlineImages[i]) 
+        {
+            std::cout << "  FAILED: the job threads rendered different pixels" << std::endl;
+            passed = false;
+        }
+        if (getRenderStats(graphics).drawsCulled != scenes[i].drawsCulled) 
+        {
+            std::cout << "  FAILED: " << getRenderStats(graphics).drawsCulled << " draws culled instead of " 
+                      << scenes[i].drawsCulled << std::endl;
+            passed = false;
+        }
+        if (update) 
+        {
+            if (!writeQoi(fileName, threaded)) 
+            {
+                std::cout << "  could not write " << fileName << std::endl;
+                passed = false;
+            }
+            else 
+            {
+                std::cout << "  wrote " << fileName << std::endl;
+            }
+        }
+        else if (!compareWithGolden(fileName, threaded)) 
+        {
+            std::cout << "  FAILED" << std::endl;
+            passed = false;
+        }
+    }
+    shutdownJobs();
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
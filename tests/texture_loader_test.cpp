@@ -0,0 +1,222 @@
+// Tests of the background texture loader without a graphics api: a detail::TextureLoader
+// decodes files with decodeImageFile on its workers and hands them to an upload sink which
+// only records the images. Covers the Pending -> Ready / Failed states and the release of
+// finished requests, the upload budget (textures and bytes per processUploads), and the
+// failed loads: missing and corrupt files, and a sink which refuses an image.
+// The test images are QOI files written to the temp directory.
+// Returns 0 if every test passes.
+//
+// Usage: texture_loader_test
+
+#include "../engine.h"
+#include <filesystem>
+#include <fstream>
+
+using namespace tiny_engine;
+
+static bool passed = true;
+
+static void check(bool condition, const char* test, const char* what)
+{
+    if (condition) return;
+    std::cout << "  FAILED " << test << ": " << what << std::endl;
+    passed = false;
+}
+
+static std::string tempFile(const char* name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+static void writeFile(const std::string& fileName, const std::vector<uint8_t>& bytes)
+{
+    std::ofstream file(fileName, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize) bytes.size());
+}
+
+// A QOI file of width x height pixels of one color, every pixel stored as a QOI_OP_RGBA.
+static std::string writeQOI(const char* name, uint32_t width, uint32_t height, uint8_t red)
+{
+    std::vector<uint8_t> bytes = { 'q', 'o', 'i', 'f' };
+    for (uint32_t value : { width, height }) 
+    {
+        for (int shift = 24; shift >= 0; shift -= 8) bytes.push_back((uint8_t) (value >> shift));
+    }
+    bytes.push_back(4);
+    bytes.push_back(0);
+    for (uint32_t i = 0; i < width * height; i++) 
+    {
+        bytes.insert(bytes.end(), { 0xff, red, 0, 0, 0xff });
+    }
+    bytes.insert(bytes.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+    std::string fileName = tempFile(name);
+    writeFile(fileName, bytes);
+    return fileName;
+}
+
+// The sink: remembers the images and hands out the ids 1, 2, 3 and so on,
+// or 0 (failure) for images of refusedWidth.
+struct RecordingSink 
+{
+    std::vector<detail::DecodedImage> images;
+    uint32_t refusedWidth = 0;
+
+    uint32_t upload(const detail::DecodedImage& image) 
+    {
+        if (image.width == refusedWidth) return 0;
+        images.push_back(image);
+        return (uint32_t) images.size();
+    }
+};
+
+// Calls processUploads until count requests are finished, at most 10 seconds.
+// Returns how many each call finalized.
+static std::vector<uint32_t> finishAll(detail::TextureLoader& loader, uint32_t count)
+{
+    std::vector<uint32_t> perCall;
+    uint32_t finished = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (finished < count && std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) 
+    {
+        uint32_t finalized = loader.processUploads();
+        if (finalized > 0) perCall.push_back(finalized);
+        finished += finalized;
+        if (finalized == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return perCall;
+}
+
+static void testStates()
+{
+    std::string fileName = writeQOI("texture_loader_test_states.qoi", 16, 8, 200);
+    RecordingSink sink;
+    detail::TextureLoader loader(detail::decodeImageFile, 
+                                 [&](const detail::DecodedImage& image) { return sink.upload(image); }, 2);
+
+    uint32_t handle = loader.request(fileName);
+    // Nothing is finished before processUploads, however fast the workers are.
+    check(loader.state(handle) == TextureLoadState::Pending, "states", "a new request is not pending");
+    check(loader.textureId(handle) == 0, "states", "a pending request has a texture");
+    check(!loader.release(handle), "states", "a pending request was released");
+
+    finishAll(loader, 1);
+    check(loader.state(handle) == TextureLoadState::Ready, "states", "the request is not ready");
+    check(loader.textureId(handle) == 1, "states", "wrong texture id");
+    check(sink.images.size() == 1 && sink.images[0].width == 16 && sink.images[0].height == 8,
+          "states", "the sink did not get the image");
+    check(!sink.images.empty() && sink.images[0].pixels.size() == 16 * 8 * 4 && sink.images[0].pixels[0] == 200,
+          "states", "wrong pixels");
+    check(loader.stats().requested == 1 && loader.stats().completed == 1 && loader.stats().failed == 0,
+          "states", "wrong stats");
+
+    // Released requests are gone, so streaming does not grow the loader.
+    check(loader.release(handle), "states", "a ready request was not released");
+    check(loader.state(handle) == TextureLoadState::Failed, "states", "a released handle still has a state");
+    check(loader.textureId(handle) == 0, "states", "a released handle still has a texture");
+    check(!loader.release(handle), "states", "a request was released twice");
+
+    // Its slot is reused, with a new handle.
+    uint32_t next = loader.request(fileName);
+    check(next != handle, "states", "a stale handle was handed out again");
+    finishAll(loader, 1);
+    check(loader.state(next) == TextureLoadState::Ready && loader.state(handle) == TextureLoadState::Failed,
+          "states", "the reused slot mixed up the handles");
+    std::filesystem::remove(fileName);
+}
+
+static void testBudget()
+{
+    const uint32_t count = 10;
+    std::string fileName = writeQOI("texture_loader_test_budget.qoi", 64, 64, 10);
+    const size_t imageBytes = 64 * 64 * 4;
+    RecordingSink sink;
+    detail::TextureLoader loader(detail::decodeImageFile, 
+                                 [&](const detail::DecodedImage& image) { return sink.upload(image); }, 2);
+
+    // At most 3 textures per call.
+    TextureUploadBudget budget;
+    budget.maxTexturesPerFrame = 3;
+    loader.setUploadBudget(budget);
+    for (uint32_t i = 0; i < count; i++) loader.request(fileName);
+    std::vector<uint32_t> perCall = finishAll(loader, count);
+    bool withinBudget = true;
+    uint32_t total = 0;
+    for (uint32_t finalized : perCall) 
+    {
+        withinBudget &= finalized <= 3;
+        total += finalized;
+    }
+    check(withinBudget, "budget", "a call finalized more than maxTexturesPerFrame");
+    check(total == count && perCall.size() >= 4, "budget", "10 textures did not take at least 4 calls");
+
+    // At most 2.5 images worth of bytes per call, so 2.
+    budget.maxTexturesPerFrame = 100;
+    budget.maxBytesPerFrame = imageBytes * 5 / 2;
+    loader.setUploadBudget(budget);
+    for (uint32_t i = 0; i < count; i++) loader.request(fileName);
+    perCall = finishAll(loader, count);
+    withinBudget = true;
+    total = 0;
+    for (uint32_t finalized : perCall) 
+    {
+        withinBudget &= finalized <= 2;
+        total += finalized;
+    }
+    check(withinBudget, "budget", "a call uploaded more than maxBytesPerFrame");
+    check(total == count, "budget", "not every texture was finalized under the byte budget");
+
+    // An image bigger than the whole budget still goes through, one per call.
+    budget.maxBytesPerFrame = imageBytes / 2;
+    loader.setUploadBudget(budget);
+    for (uint32_t i = 0; i < 3; i++) loader.request(fileName);
+    perCall = finishAll(loader, 3);
+    check(perCall.size() == 3, "budget", "images over the byte budget were not finalized one per call");
+    check(sink.images.size() == 2 * count + 3, "budget", "the sink missed images");
+    std::filesystem::remove(fileName);
+}
+
+static void testFailures()
+{
+    std::string missing = tempFile("texture_loader_test_missing.qoi");
+    std::filesystem::remove(missing);
+    std::string corrupt = tempFile("texture_loader_test_corrupt.qoi");
+    writeFile(corrupt, { 'q', 'o', 'i', 'f', 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 1 });
+    std::string refused = writeQOI("texture_loader_test_refused.qoi", 3, 3, 0);
+    std::string good = writeQOI("texture_loader_test_good.qoi", 4, 4, 0);
+
+    RecordingSink sink;
+    sink.refusedWidth = 3;
+    detail::TextureLoader loader(detail::decodeImageFile, 
+                                 [&](const detail::DecodedImage& image) { return sink.upload(image); }, 2);
+    uint32_t missingHandle = loader.request(missing);
+    uint32_t corruptHandle = loader.request(corrupt);
+    uint32_t refusedHandle = loader.request(refused);
+    uint32_t goodHandle = loader.request(good);
+    finishAll(loader, 4);
+
+    check(loader.state(missingHandle) == TextureLoadState::Failed, "failures", "a missing file did not fail");
+    check(loader.state(corruptHandle) == TextureLoadState::Failed, "failures", "a corrupt file did not fail");
+    check(loader.state(refusedHandle) == TextureLoadState::Failed, "failures", 
+          "an image the sink refused did not fail");
+    check(loader.textureId(missingHandle) == 0 && loader.textureId(corruptHandle) == 0 && 
+          loader.textureId(refusedHandle) == 0, "failures", "a failed request has a texture");
+    // Failed decodes never reach the sink, and do not stop the other loads.
+    check(loader.state(goodHandle) == TextureLoadState::Ready, "failures", "the good file next to them failed");
+    check(sink.images.size() == 1, "failures", "the sink got a failed image");
+    check(loader.stats().failed == 3 && loader.stats().completed == 1, "failures", "wrong stats");
+    check(loader.release(missingHandle) && loader.release(corruptHandle), "failures", 
+          "failed requests were not released");
+
+    std::filesystem::remove(corrupt);
+    std::filesystem::remove(refused);
+    std::filesystem::remove(good);
+}
+
+int main()
+{
+    testStates();
+    testBudget();
+    testFailures();
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}